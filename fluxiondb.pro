@@ -9,11 +9,32 @@ SOURCES += \
     src/datarecord.cpp \
     src/main.cpp \
     src/messagerequest.cpp \
+    src/responsewriter.cpp \
+    src/cborcodec.cpp \
+    src/subscriptions.cpp \
+    src/subscriptionrequest.cpp \
+    src/aggregaterequest.cpp \
+    src/querydocumentnames.cpp \
+    src/payloadpath.cpp \
+    src/payloadfilter.cpp \
+    src/keypattern.cpp \
+    src/responsecache.cpp \
+    src/shard.cpp \
+    src/documentindex.cpp \
     src/deletecollection.cpp \
     src/querysessions.cpp \
     src/querydocument.cpp \
     src/websocket.cpp \
     src/collection.cpp \
+    src/collectionview.cpp \
+    src/seriesqueries.cpp \
+    src/parallelscan.cpp \
+    src/documentseries.cpp \
+    src/binarycodec.cpp \
+    src/writeaheadlog.cpp \
+    src/segmentstore.cpp \
+    src/persistencewriter.cpp \
+    src/documentloader.cpp \
     src/deletedocument.cpp \
     src/keyvalue.cpp \
     src/deleterecord.cpp \
@@ -26,11 +47,33 @@ HEADERS += \
     src/datarecordheader.h \
     src/message.h \
     src/messagerequest.h \
+    src/responsewriter.h \
+    src/cborcodec.h \
+    src/subscriptions.h \
+    src/subscriptionrequest.h \
+    src/aggregaterequest.h \
+    src/querydocumentnames.h \
+    src/payloadpath.h \
+    src/payloadfilter.h \
+    src/keypattern.h \
+    src/responsecache.h \
+    src/shard.h \
+    src/documentindex.h \
     src/deletecollection.h \
     src/querysessions.h \
     src/querydocument.h \
     src/websocket.h \
     src/collection.h \
+    src/collectionview.h \
+    src/persistentmap.h \
+    src/seriesqueries.h \
+    src/parallelscan.h \
+    src/documentseries.h \
+    src/binarycodec.h \
+    src/writeaheadlog.h \
+    src/segmentstore.h \
+    src/persistencewriter.h \
+    src/documentloader.h \
     src/deletedocument.h \
     src/keyvalue.h \
     src/deleterecord.h \
@@ -0,0 +1,108 @@
+#include "aggregaterequest.h"
+#include <QCborStreamReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonParseError>
+#include <QDebug>
+#include "cborcodec.h"
+
+AggregateRequest AggregateRequest::fromJson(const QString& jsonString, bool* ok)
+{
+    AggregateRequest request;
+    request.from = 0;
+    request.to = 0;
+    request.bucket = 0;
+    request.functions = 0;
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(jsonString.toUtf8(), &error);
+
+    if (error.error != QJsonParseError::NoError) {
+        qWarning() << "JSON parse error:" << error.errorString();
+        if (ok) *ok = false;
+        return request;
+    }
+
+    if (!doc.isObject()) {
+        qWarning() << "JSON is not an object";
+        if (ok) *ok = false;
+        return request;
+    }
+
+    QJsonObject obj = doc.object();
+    request.col = obj["col"].toString();
+    request.doc = obj["doc"].toString();
+    request.field = obj["field"].toString();
+    request.from = obj["from"].toVariant().toLongLong();
+    request.to = obj["to"].toVariant().toLongLong();
+    request.bucket = obj["bucket"].toVariant().toLongLong();
+    for (const QJsonValue& value : obj["fns"].toArray()) {
+        const int function = functionFromName(value.toString());
+        if (function == 0) {
+            qWarning() << "Unknown aggregate function" << value.toString();
+            if (ok) *ok = false;
+            return request;
+        }
+        request.functions |= function;
+    }
+
+    if (ok) *ok = request.isValid();
+    return request;
+}
+
+AggregateRequest AggregateRequest::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    AggregateRequest request;
+    request.from = 0;
+    request.to = 0;
+    request.bucket = 0;
+    request.functions = 0;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&request](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &request.col);
+        if (key == QLatin1String("doc")) return CborCodec::readString(value, &request.doc);
+        if (key == QLatin1String("field")) return CborCodec::readString(value, &request.field);
+        if (key == QLatin1String("from")) return CborCodec::readInteger(value, &request.from);
+        if (key == QLatin1String("to")) return CborCodec::readInteger(value, &request.to);
+        if (key == QLatin1String("bucket")) return CborCodec::readInteger(value, &request.bucket);
+        if (key == QLatin1String("fns")) {
+            return CborCodec::readArray(value, [&request](QCborStreamReader& element) {
+                QString name;
+                if (!CborCodec::readString(element, &name)) {
+                    return false;
+                }
+                const int function = functionFromName(name);
+                request.functions |= function;
+                return function != 0;
+            });
+        }
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+        if (ok) *ok = false;
+        return request;
+    }
+
+    if (ok) *ok = request.isValid();
+    return request;
+}
+
+int AggregateRequest::functionFromName(const QString& name)
+{
+    if (name == QLatin1String("count")) return Count;
+    if (name == QLatin1String("min")) return Min;
+    if (name == QLatin1String("max")) return Max;
+    if (name == QLatin1String("sum")) return Sum;
+    if (name == QLatin1String("avg")) return Avg;
+    if (name == QLatin1String("first")) return First;
+    if (name == QLatin1String("last")) return Last;
+    return 0;
+}
+
+bool AggregateRequest::isValid() const
+{
+    // everything but count needs a field to aggregate
+    return !col.isEmpty() && to > 0 && from <= to && bucket >= 0 && functions != 0 &&
+           (functions == Count || !field.isEmpty());
+}
@@ -0,0 +1,34 @@
+#ifndef AGGREGATEREQUEST_H
+#define AGGREGATEREQUEST_H
+
+#include <QString>
+#include <QByteArray>
+
+struct AggregateRequest {
+    enum Function {
+        Count = 1,
+        Min = 2,
+        Max = 4,
+        Sum = 8,
+        Avg = 16,
+        First = 32,
+        Last = 64
+    };
+
+    QString col;
+    QString doc;
+    // dotted path of a numeric payload field, e.g. "engine.rpm"
+    QString field;
+    qint64 from;
+    qint64 to;
+    // bucket width in ms; 0 aggregates the whole range into one bucket
+    qint64 bucket;
+    int functions;
+
+    static AggregateRequest fromJson(const QString& jsonString, bool* ok = nullptr);
+    static AggregateRequest fromCbor(const QByteArray& cbor, bool* ok = nullptr);
+    static int functionFromName(const QString& name);
+    bool isValid() const;
+};
+
+#endif // AGGREGATEREQUEST_H
@@ -0,0 +1,29 @@
+#include "binarycodec.h"
+#include <array>
+
+namespace {
+
+std::array<quint32, 256> makeCrcTable()
+{
+    std::array<quint32, 256> table{};
+    for (quint32 i = 0; i < 256; ++i) {
+        quint32 value = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            value = (value & 1) ? (0xedb88320u ^ (value >> 1)) : (value >> 1);
+        }
+        table[i] = value;
+    }
+    return table;
+}
+
+} // namespace
+
+quint32 BinaryCodec::crc32(const char* data, qsizetype size)
+{
+    static const std::array<quint32, 256> table = makeCrcTable();
+    quint32 crc = 0xffffffffu;
+    for (qsizetype i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<quint8>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
@@ -0,0 +1,180 @@
+#ifndef BINARYCODEC_H
+#define BINARYCODEC_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+#include <string>
+#include <string_view>
+
+// Little-endian and LEB128 helpers shared by the on-disk binary formats.
+namespace BinaryCodec {
+
+quint32 crc32(const char* data, qsizetype size);
+
+inline void appendFixed32(QByteArray& out, quint32 value)
+{
+    char bytes[4];
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    out.append(bytes, 4);
+}
+
+inline void appendFixed64(QByteArray& out, quint64 value)
+{
+    char bytes[8];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    out.append(bytes, 8);
+}
+
+inline quint32 readFixed32(const char* data)
+{
+    quint32 value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<quint32>(static_cast<quint8>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+inline quint64 readFixed64(const char* data)
+{
+    quint64 value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<quint64>(static_cast<quint8>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+inline void appendVarint(QByteArray& out, quint64 value)
+{
+    char bytes[10];
+    int size = 0;
+    while (value >= 0x80) {
+        bytes[size++] = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = static_cast<char>(value);
+    out.append(bytes, size);
+}
+
+inline void appendSignedVarint(QByteArray& out, qint64 value)
+{
+    // zigzag so small negative deltas stay small
+    appendVarint(out, (static_cast<quint64>(value) << 1) ^ static_cast<quint64>(value >> 63));
+}
+
+inline void appendString(QByteArray& out, std::string_view value)
+{
+    appendVarint(out, value.size());
+    out.append(value.data(), static_cast<qsizetype>(value.size()));
+}
+
+inline void appendString(QByteArray& out, const QString& value)
+{
+    const QByteArray utf8 = value.toUtf8();
+    appendString(out, std::string_view(utf8.constData(), utf8.size()));
+}
+
+// Sequential decoder over a byte range; every read fails once the input is exhausted or malformed.
+class Reader {
+public:
+    Reader(const char* data, qsizetype size) : m_pos(data), m_end(data + size) {}
+
+    bool atEnd() const { return m_pos >= m_end; }
+    qsizetype remaining() const { return m_end - m_pos; }
+    const char* position() const { return m_pos; }
+
+    bool readVarint(quint64* value)
+    {
+        quint64 result = 0;
+        for (int shift = 0; shift < 64 && m_pos < m_end; shift += 7) {
+            const quint8 byte = static_cast<quint8>(*m_pos++);
+            result |= static_cast<quint64>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                *value = result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool readSignedVarint(qint64* value)
+    {
+        quint64 raw = 0;
+        if (!readVarint(&raw)) {
+            return false;
+        }
+        *value = static_cast<qint64>(raw >> 1) ^ -static_cast<qint64>(raw & 1);
+        return true;
+    }
+
+    bool readFixed32(quint32* value)
+    {
+        if (remaining() < 4) {
+            return false;
+        }
+        *value = BinaryCodec::readFixed32(m_pos);
+        m_pos += 4;
+        return true;
+    }
+
+    bool readFixed64(quint64* value)
+    {
+        if (remaining() < 8) {
+            return false;
+        }
+        *value = BinaryCodec::readFixed64(m_pos);
+        m_pos += 8;
+        return true;
+    }
+
+    bool readByte(quint8* value)
+    {
+        if (m_pos >= m_end) {
+            return false;
+        }
+        *value = static_cast<quint8>(*m_pos++);
+        return true;
+    }
+
+    bool readBytes(std::string_view* value)
+    {
+        quint64 size = 0;
+        if (!readVarint(&size) || size > static_cast<quint64>(remaining())) {
+            return false;
+        }
+        *value = std::string_view(m_pos, size);
+        m_pos += size;
+        return true;
+    }
+
+    bool readString(QString* value)
+    {
+        std::string_view bytes;
+        if (!readBytes(&bytes)) {
+            return false;
+        }
+        *value = QString::fromUtf8(bytes.data(), static_cast<qsizetype>(bytes.size()));
+        return true;
+    }
+
+    bool skip(qsizetype size)
+    {
+        if (size > remaining()) {
+            return false;
+        }
+        m_pos += size;
+        return true;
+    }
+
+private:
+    const char* m_pos;
+    const char* m_end;
+};
+
+} // namespace BinaryCodec
+
+#endif // BINARYCODEC_H
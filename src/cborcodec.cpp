@@ -0,0 +1,94 @@
+#include "cborcodec.h"
+#include <QCborValue>
+#include <cmath>
+#include <limits>
+
+bool CborCodec::readString(QCborStreamReader &reader, QString *value)
+{
+    if (!reader.isString())
+    {
+        return false;
+    }
+    value->clear();
+    auto chunk = reader.readString();
+    while (chunk.status == QCborStreamReader::Ok)
+    {
+        value->append(chunk.data);
+        chunk = reader.readString();
+    }
+    return chunk.status == QCborStreamReader::EndOfString;
+}
+
+bool CborCodec::readInteger(QCborStreamReader &reader, qint64 *value)
+{
+    constexpr quint64 maxMagnitude = quint64(std::numeric_limits<qint64>::max());
+    if (reader.isUnsignedInteger())
+    {
+        if (reader.toUnsignedInteger() > maxMagnitude)
+        {
+            return false;
+        }
+        *value = static_cast<qint64>(reader.toUnsignedInteger());
+    }
+    else if (reader.isNegativeInteger())
+    {
+        // the absolute value, where 0 stands for -2^64
+        const quint64 magnitude = quint64(reader.toNegativeInteger());
+        if (magnitude == 0 || magnitude > maxMagnitude + 1)
+        {
+            return false;
+        }
+        *value = reader.toInteger();
+    }
+    else if (reader.isDouble() || reader.isFloat())
+    {
+        const double number = reader.isDouble() ? reader.toDouble() : double(reader.toFloat());
+        // -2^63 <= number < 2^63, which also rules out NaN and the infinities
+        if (!(number >= -9223372036854775808.0 && number < 9223372036854775808.0) || std::trunc(number) != number)
+        {
+            return false;
+        }
+        *value = static_cast<qint64>(number);
+    }
+    else
+    {
+        return false;
+    }
+    return reader.next();
+}
+
+bool CborCodec::readBool(QCborStreamReader &reader, bool *value)
+{
+    if (!reader.isBool())
+    {
+        return false;
+    }
+    *value = reader.toBool();
+    return reader.next();
+}
+
+bool CborCodec::readStringList(QCborStreamReader &reader, QStringList *values)
+{
+    values->clear();
+    return readArray(reader, [values](QCborStreamReader &element)
+                     {
+                         QString value;
+                         if (!readString(element, &value))
+                         {
+                             return false;
+                         }
+                         values->append(value);
+                         return true;
+                     });
+}
+
+bool CborCodec::readJson(QCborStreamReader &reader, QJsonValue *value)
+{
+    *value = QCborValue::fromCbor(reader).toJsonValue();
+    return reader.lastError() == QCborError::NoError;
+}
+
+bool CborCodec::skip(QCborStreamReader &reader)
+{
+    return reader.next();
+}
@@ -0,0 +1,67 @@
+#ifndef CBORCODEC_H
+#define CBORCODEC_H
+
+#include <QCborStreamReader>
+#include <QJsonValue>
+#include <QString>
+#include <QStringList>
+
+// Field readers for the binary (CBOR) protocol. Each one consumes the item at
+// the reader's position and fails on a type mismatch, so request structs are
+// filled straight from the frame without building a QCborValue tree.
+namespace CborCodec {
+
+bool readString(QCborStreamReader& reader, QString* value);
+// Integers, also sent as whole floating point numbers; fractions, NaN,
+// infinities and values outside qint64 are rejected.
+bool readInteger(QCborStreamReader& reader, qint64* value);
+bool readBool(QCborStreamReader& reader, bool* value);
+bool readStringList(QCborStreamReader& reader, QStringList* values);
+// Any item, converted the way QCborValue::toJsonValue() does; for the few
+// fields whose shape is only checked later (filter expressions).
+bool readJson(QCborStreamReader& reader, QJsonValue* value);
+// Skips the current item, containers included.
+bool skip(QCborStreamReader& reader);
+
+// Walks a map with text keys, calling field(key, reader) for every entry.
+// field must consume the value (skip() the ones it does not know) and
+// returns false to reject the map.
+template <typename Field>
+bool readMap(QCborStreamReader& reader, Field field)
+{
+    if (!reader.isMap() || !reader.enterContainer())
+    {
+        return false;
+    }
+    QString key;
+    while (reader.hasNext())
+    {
+        if (!readString(reader, &key) || !reader.hasNext() || !field(key, reader))
+        {
+            return false;
+        }
+    }
+    return reader.lastError() == QCborError::NoError && reader.leaveContainer();
+}
+
+// Walks an array, calling element(reader) for every item.
+template <typename Element>
+bool readArray(QCborStreamReader& reader, Element element)
+{
+    if (!reader.isArray() || !reader.enterContainer())
+    {
+        return false;
+    }
+    while (reader.hasNext())
+    {
+        if (!element(reader))
+        {
+            return false;
+        }
+    }
+    return reader.lastError() == QCborError::NoError && reader.leaveContainer();
+}
+
+} // namespace CborCodec
+
+#endif // CBORCODEC_H
@@ -5,11 +5,16 @@
 #include <QDir>
 #include <QFile>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QThreadPool>
 #include <algorithm>
-#include <iterator>
-#include <utility>
+#include <limits>
+#include <atomic>
 
 #include "json/json.hpp"
+#include "persistencewriter.h"
+#include "documentloader.h"
+#include "parallelscan.h"
 
 #ifdef __linux__ 
 #include <malloc.h>
@@ -17,12 +22,150 @@
 
 using json = nlohmann::json_abi_v3_11_3::json;
 
-Collection::Collection(const QString &name, const QString &dataFolder)
+namespace {
+
+// Source of the change stamps of every collection.
+std::atomic<quint64> lastVersion{0};
+
+quint64 nextVersion()
+{
+    return ++lastVersion;
+}
+
+// Calls fn(partition, key, value) for every entry of an unordered map, its
+// buckets split into partitions that run in parallel.
+template <typename Map, typename Fn>
+void forEachEntryInParallel(const Map &map, int partitions, Fn fn)
+{
+    const size_t buckets = map.bucket_count();
+    runPartitions(partitions, [&](int partition)
+                  {
+                      const size_t last = buckets * (partition + 1) / partitions;
+                      for (size_t bucket = buckets * partition / partitions; bucket < last; ++bucket)
+                      {
+                          for (auto it = map.begin(bucket); it != map.end(bucket); ++it)
+                          {
+                              fn(partition, it->first, it->second);
+                          }
+                      }
+                  });
+}
+
+// Streams the [{"ts": ..., "data": "..."}, ...] array of a legacy flush file
+// into the loader without building a DOM.
+class LegacyRecordsHandler : public nlohmann::json_abi_v3_11_3::json_sax<json> {
+public:
+    LegacyRecordsHandler(DocumentLoader &loader, const QString &doc, quint64 sequence)
+        : m_loader(loader), m_doc(doc), m_sequence(sequence), m_depth(0), m_ts(0), m_hasTs(false), m_hasData(false)
+    {
+    }
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t value) override { return number(value); }
+    bool number_unsigned(number_unsigned_t value) override { return number(static_cast<qint64>(value)); }
+    bool number_float(number_float_t value, const string_t &) override { return number(static_cast<qint64>(value)); }
+    bool binary(binary_t &) override { return true; }
+
+    bool string(string_t &value) override
+    {
+        if (m_depth == 2 && m_key == "data") {
+            m_data = std::move(value);
+            m_hasData = true;
+        }
+        return true;
+    }
+
+    bool key(string_t &value) override
+    {
+        m_key = value;
+        return true;
+    }
+
+    bool start_object(std::size_t) override
+    {
+        if (++m_depth == 2) {
+            m_hasTs = false;
+            m_hasData = false;
+        }
+        return true;
+    }
+
+    bool end_object() override
+    {
+        if (m_depth-- == 2 && m_hasTs && m_hasData) {
+            m_loader.addRecord(m_doc, m_sequence, m_ts, m_loader.keep(std::move(m_data)));
+        }
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        ++m_depth;
+        return true;
+    }
+
+    bool end_array() override
+    {
+        --m_depth;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &, const nlohmann::json_abi_v3_11_3::detail::exception &ex) override
+    {
+        qWarning() << "Legacy record file parse error" << m_doc << ":" << ex.what();
+        return false;
+    }
+
+private:
+    bool number(qint64 value)
+    {
+        if (m_depth == 2 && m_key == "ts") {
+            m_ts = value;
+            m_hasTs = true;
+        }
+        return true;
+    }
+
+    DocumentLoader &m_loader;
+    QString m_doc;
+    quint64 m_sequence;
+    int m_depth;
+    std::string m_key;
+    std::string m_data;
+    qint64 m_ts;
+    bool m_hasTs;
+    bool m_hasData;
+};
+
+} // namespace
+
+struct Collection::FlushJob {
+    QString name;
+    QString folder;
+    std::shared_ptr<SegmentStore> segments;
+    std::vector<Tombstone> tombstones;
+    // dirty documents, from their oldest unflushed record on
+    std::vector<DocumentSnapshot> documents;
+    // every document in full, set when the segments are due for a rewrite
+    bool rewrite;
+    std::vector<DocumentSnapshot> allDocuments;
+    bool writeKeyValues;
+    std::unordered_map<std::string, std::string> keyValues;
+};
+
+Collection::Collection(const QString &name, const QString &dataFolder, PersistenceWriter *writer)
+    : m_segments(std::make_shared<SegmentStore>(dataFolder + "/" + name))
 {
     m_name = name;
     m_dataFolder = dataFolder;
     m_key_vaue_updated = 0;
     m_flushed = 0;
+    m_flushingSince = 0;
+    m_latestHighWater = std::numeric_limits<qint64>::min();
+    m_version = nextVersion();
+    m_valuesVersion = nextVersion();
+    m_writer = writer;
 }
 
 Collection::~Collection() {
@@ -32,9 +175,17 @@ Collection::~Collection() {
     malloc_trim(0);
 #endif
     if (!m_dataFolder.isEmpty()) {
-        QDir dir(m_dataFolder + "/" + m_name);
-        if (dir.exists()) {
-            dir.removeRecursively();
+        // queued behind any flush of this collection that is still being written
+        auto removeFolder = [path = m_dataFolder + "/" + m_name]() {
+            QDir dir(path);
+            if (dir.exists()) {
+                dir.removeRecursively();
+            }
+        };
+        if (m_writer != nullptr) {
+            m_writer->enqueue(removeFolder);
+        } else {
+            removeFolder();
         }
     }
     qInfo() << "Collection deleted from memory" << m_name;    
@@ -42,111 +193,239 @@ Collection::~Collection() {
 
 void Collection::insert(qint64 timestamp, const QString &key, const QString &data)
 {
-    insert(timestamp, key, data, true);
+    const QByteArray payload = data.toUtf8();
+    insert(timestamp, key, std::string_view(payload.constData(), payload.size()));
 }
 
-void Collection::insert(qint64 timestamp, const QString &key, const QString &data, bool isNew)
+void Collection::insert(qint64 timestamp, const QString &key, std::string_view data)
 {
-    // Create new record
-    auto record = std::make_unique<DataRecord>();
-    record->timestamp = timestamp;
-    record->data = data.toStdString();
-    record->isNew = isNew;
-
-    // Get or create vector for this key
-    auto it = m_data.find(key);
-    if (it == m_data.end())
+    auto [it, created] = m_data.try_emplace(key);
+    if (created)
     {
-        std::vector<std::unique_ptr<DataRecord>> newVector;
-        newVector.push_back(std::move(record));
-        m_data.emplace(key, std::move(newVector));
-        return;
+        m_index.insert(key, &it->second);
+    }
+    const qint64 previousLast = it->second.lastTimestamp();
+    it->second.insert(timestamp, data);
+    if (timestamp > previousLast)
+    {
+        moveActivity(key, previousLast, timestamp);
     }
+    m_latestHighWater = std::max(m_latestHighWater, timestamp);
+    refreshLatest(it);
+    markDirty(it, timestamp, timestamp);
+}
 
-    auto &records = it->second;
+void Collection::insert(const QString &key, std::vector<DataRecord> &records)
+{
     if (records.empty())
     {
-        records.push_back(std::move(record));
         return;
     }
+    const auto byTimestamp = [](const DataRecord &a, const DataRecord &b) { return a.timestamp < b.timestamp; };
+    if (!std::is_sorted(records.begin(), records.end(), byTimestamp))
+    {
+        std::stable_sort(records.begin(), records.end(), byTimestamp);
+    }
+    auto kept = records.begin();
+    for (auto it = records.begin(); it != records.end(); ++it)
+    {
+        if (kept != records.begin() && std::prev(kept)->timestamp == it->timestamp)
+        {
+            *std::prev(kept) = *it;
+        }
+        else
+        {
+            *kept++ = *it;
+        }
+    }
+    records.erase(kept, records.end());
 
-    // Find the position to insert using binary search
-    auto vecIt = std::lower_bound(records.begin(), records.end(), timestamp,
-                                  [](const std::unique_ptr<DataRecord> &a, qint64 b)
-                                  {
-                                      return a->timestamp < b;
-                                  });
+    auto [it, created] = m_data.try_emplace(key);
+    if (created)
+    {
+        m_index.insert(key, &it->second);
+    }
+    const qint64 previousLast = it->second.lastTimestamp();
+    it->second.insertSorted(records);
+    if (records.back().timestamp > previousLast)
+    {
+        moveActivity(key, previousLast, records.back().timestamp);
+    }
+    m_latestHighWater = std::max(m_latestHighWater, records.back().timestamp);
+    refreshLatest(it);
+    markDirty(it, records.front().timestamp, records.back().timestamp);
+}
 
-    // Check if we found a record with the same timestamp
-    if (vecIt != records.end() && (*vecIt)->timestamp == timestamp)
+void Collection::markDirty(std::unordered_map<QString, DocumentSeries>::iterator it, qint64 from, qint64 to)
+{
+    const DocumentSeries &series = it->second;
+    const auto nothingBetween = [&series](qint64 end, qint64 start)
     {
-        *vecIt = std::move(record); // Replace existing record
+        if (start <= end || end == std::numeric_limits<qint64>::max())
+        {
+            return true;
+        }
+        const auto pos = series.earliestPosition(end + 1);
+        return !pos.isValid() || series.recordAt(pos).timestamp >= start;
+    };
+
+    DocumentSeries::TimeRanges &ranges = m_dirty[it->first];
+    if (!ranges.empty() && from > ranges.back().second && nothingBetween(ranges.back().second, from))
+    {
+        // appending to the document
+        ranges.back().second = to;
+        return;
     }
-    else
+    const auto after = std::upper_bound(ranges.begin(), ranges.end(), from,
+                                        [](qint64 ts, const std::pair<qint64, qint64> &range) { return ts < range.first; });
+    auto joined = ranges.insert(after, std::make_pair(from, to));
+    if (joined != ranges.begin() && nothingBetween(std::prev(joined)->second, joined->first))
+    {
+        --joined;
+        joined->second = std::max(joined->second, to);
+        ranges.erase(std::next(joined));
+    }
+    while (std::next(joined) != ranges.end() && nothingBetween(joined->second, std::next(joined)->first))
     {
-        records.insert(vecIt, std::move(record)); // Insert at the correct position
+        joined->second = std::max(joined->second, std::next(joined)->second);
+        ranges.erase(std::next(joined));
+    }
+
+    if (ranges.size() > MaxDirtyRanges)
+    {
+        size_t closest = 0;
+        for (size_t i = 1; i + 1 < ranges.size(); ++i)
+        {
+            if (static_cast<quint64>(ranges[i + 1].first) - static_cast<quint64>(ranges[i].second) <
+                static_cast<quint64>(ranges[closest + 1].first) - static_cast<quint64>(ranges[closest].second))
+            {
+                closest = i;
+            }
+        }
+        ranges[closest].second = ranges[closest + 1].second;
+        ranges.erase(ranges.begin() + static_cast<std::ptrdiff_t>(closest) + 1);
     }
 }
 
-DataRecord *Collection::getLatestRecordForDocument(const QString &key, qint64 timestamp)
+bool Collection::getLatestRecordForDocument(const QString &key, qint64 timestamp, DataRecord *recordOut) const
 {
     auto it = m_data.find(key);
     if (it == m_data.end())
     {
-        return nullptr;
+        return false;
     }
 
-    const int index = getLatestRecordIndex(it->second, timestamp);
-    if (index == -1)
+    const auto pos = it->second.latestPosition(timestamp);
+    if (!pos.isValid())
     {
-        return nullptr;
+        return false;
     }
 
-    return it->second[index].get();
+    if (recordOut != nullptr)
+    {
+        *recordOut = it->second.recordAt(pos);
+    }
+    return true;
 }
 
-DataRecord *Collection::getEarliestRecordForDocument(const QString &key, qint64 timestamp)
+bool Collection::getEarliestRecordForDocument(const QString &key, qint64 timestamp, DataRecord *recordOut) const
 {
     auto it = m_data.find(key);
     if (it == m_data.end())
     {
-        return nullptr;
+        return false;
     }
 
-    const int index = getEarliestRecordIndex(it->second, timestamp);
-    if (index == -1)
+    const auto pos = it->second.earliestPosition(timestamp);
+    if (!pos.isValid())
     {
-        return nullptr;
+        return false;
     }
 
-    return it->second[index].get();
+    if (recordOut != nullptr)
+    {
+        *recordOut = it->second.recordAt(pos);
+    }
+    return true;
 }
 
-QHash<QString, DataRecord *> Collection::getAllRecords(qint64 timestamp, const QString &key, qint64 from, const QRegularExpression *keyRegex)
+bool Collection::scansEveryDocument(const KeyPattern *pattern, qint64 activeSince) const
 {
-    QHash<QString, DataRecord *> result;
-    const bool hasRegex = keyRegex != nullptr && keyRegex->isValid();
-    if (hasRegex || key.isEmpty())
+    if (pattern != nullptr && !pattern->prefix().isEmpty() && pattern->caseSensitivity() == Qt::CaseSensitive)
+    {
+        return false;
+    }
+    // every document was written to at or after activeSince
+    return activeSince == std::numeric_limits<qint64>::min() || m_activity.empty() ||
+           m_activity.begin()->first >= activityBucket(activeSince);
+}
+
+template <typename Value, typename Fn>
+QHash<QString, Value> Collection::collectDocuments(const KeyPattern *pattern, qint64 activeSince, Fn fn) const
+{
+    const int partitions = scanPartitions(m_data.size());
+    if (partitions == 1 || !scansEveryDocument(pattern, activeSince))
+    {
+        QHash<QString, Value> result;
+        forEachDocument(pattern, activeSince, [&](const QString &name, const DocumentSeries &series) { fn(result, name, series); });
+        return result;
+    }
+    std::vector<QHash<QString, Value>> partial(partitions);
+    forEachEntryInParallel(m_data, partitions, [&](int partition, const QString &name, const DocumentSeries &series)
+                           {
+                               if (series.lastTimestamp() >= activeSince && (pattern == nullptr || pattern->matches(name)))
+                               {
+                                   fn(partial[partition], name, series);
+                               }
+                           });
+    return mergePartitions(partial);
+}
+
+QHash<QString, DataRecord> Collection::getAllRecords(qint64 timestamp, const QString &key, qint64 from, const KeyPattern *keyPattern,
+                                                     const PayloadFilter *filter) const
+{
+    QHash<QString, DataRecord> result;
+    const bool hasRegex = keyPattern != nullptr;
+    const bool hasFilter = filter != nullptr && !filter->isEmpty();
+    const bool prefixIndexed = hasRegex && !keyPattern->prefix().isEmpty() && keyPattern->caseSensitivity() == Qt::CaseSensitive;
+    if ((hasRegex || key.isEmpty()) && timestamp >= m_latestHighWater && !prefixIndexed)
     {
-        for (const auto &[docKey, records] : m_data)
+        // no document has records past the timestamp, so each one's latest
+        // record is the one in the table
+        const int partitions = scanPartitions(m_latest.size());
+        std::vector<QHash<QString, DataRecord>> partial(partitions);
+        if (partitions == 1)
         {
-            if (hasRegex && !keyRegex->match(docKey).hasMatch())
-            {
-                continue;
-            }
-            if (!key.isEmpty() && docKey != key)
-            {
-                continue;
-            }
-            const int index = getLatestRecordIndex(records, timestamp);
-            if (index != -1)
-            {
-                auto record = records[index].get();
-                if (from == 0 || record->timestamp >= from) {
-                    result.insert(docKey, record);
-                }
-            }
+            partial.front().reserve(static_cast<qsizetype>(m_latest.size()));
         }
+        runPartitions(partitions, [&](int partition)
+                      {
+                          QHash<QString, DataRecord> &out = partial[partition];
+                          const size_t last = m_latest.size() * (partition + 1) / partitions;
+                          for (size_t i = m_latest.size() * partition / partitions; i < last; ++i)
+                          {
+                              const LatestRecord &latest = m_latest[i];
+                              if ((from == 0 || latest.record.timestamp >= from) && (!hasRegex || keyPattern->matches(latest.doc)) &&
+                                  (!hasFilter || filter->matches(latest.record.data)))
+                              {
+                                  out.insert(latest.doc, latest.record);
+                              }
+                          }
+                      });
+        result = mergePartitions(partial);
+    }
+    else if (hasRegex || key.isEmpty())
+    {
+        // a document last written before from has no latest record at or after it
+        result = collectDocuments<DataRecord>(keyPattern, from == 0 ? std::numeric_limits<qint64>::min() : from,
+                                              [&](QHash<QString, DataRecord> &out, const QString &docKey, const DocumentSeries &records)
+                                              {
+                                                  DataRecord record;
+                                                  if (latestRecordOf(records, timestamp, from, filter, &record))
+                                                  {
+                                                      out.insert(docKey, record);
+                                                  }
+                                              });
     }
     else
     {
@@ -155,87 +434,270 @@ QHash<QString, DataRecord *> Collection::getAllRecords(qint64 timestamp, const Q
         {
             return result;
         }
-        const int index = getLatestRecordIndex(it->second, timestamp);
-        if (index != -1)
+        DataRecord record;
+        if (latestRecordOf(it->second, timestamp, from, filter, &record))
         {
-            auto record = it->second[index].get();
-            if (from == 0 || record->timestamp >= from) {
-                result.insert(key, record);
-            }
+            result.insert(key, record);
         }
     }
     return result;
 }
 
-QHash<QString, QList<DataRecord *>> Collection::getSessionData(qint64 from, qint64 to)
+QStringList Collection::getDocumentNames(const QString &prefix, const QString &after, qint64 limit, bool *more) const
 {
-    QHash<QString, QList<DataRecord *>> result;
-    for (const auto &[key, records] : m_data)
+    QStringList result;
+    *more = false;
+    m_index.forEachAfter(after, prefix, [&](const QString &name, const DocumentSeries &)
+                         {
+                             if (limit > 0 && result.size() >= limit)
+                             {
+                                 *more = true;
+                                 return false;
+                             }
+                             result.append(name);
+                             return true;
+                         });
+    return result;
+}
+
+QHash<QString, QList<DataRecord>> Collection::getSessionData(qint64 from, qint64 to) const
+{
+    QHash<QString, QList<DataRecord>> result;
+    if (from > to)
     {
-        if (from > to)
-        {
-            continue;
-        }
-        const int startIndex = getEarliestRecordIndex(records, from);
-        if (startIndex == -1)
-        {
-            continue;
-        }
-        const int endIndex = getLatestRecordIndex(records, to);
-            if (endIndex == -1)
-        {
-            continue;
-        }
-        for (int i = startIndex; i <= endIndex; ++i)
-        {
-            result[key].append(records[i].get());
-        }
+        return result;
     }
-    return result;
+    return collectDocuments<QList<DataRecord>>(nullptr, from,
+                                               [&](QHash<QString, QList<DataRecord>> &out, const QString &key, const DocumentSeries &records)
+                                               {
+                                                   if (!records.overlaps(from, to))
+                                                   {
+                                                       return;
+                                                   }
+                                                   QList<DataRecord> &sessionRecords = out[key];
+                                                   records.forEachInRange(from, to, false, [&sessionRecords](const DataRecord &record)
+                                                                          {
+                                                                              sessionRecords.append(record);
+                                                                              return true;
+                                                                          });
+                                               });
 }
 
-QList<DataRecord *> Collection::getAllRecordsForDocument(const QString &key, qint64 from, qint64 to, bool reverse, qint64 limit)
+QList<DataRecord> Collection::getAllRecordsForDocument(const QString &key, qint64 from, qint64 to, bool reverse, qint64 limit,
+                                                       const PayloadFilter *filter) const
 {
-    QList<DataRecord *> result;
     auto it = m_data.find(key);
     if (it == m_data.end())
     {
-        return result;
+        return QList<DataRecord>();
     }
+    return recordsInRange(it->second, from, to, reverse, limit, filter);
+}
 
+QList<DataRecord> Collection::downsampleDocument(const QString &key, qint64 from, qint64 to, qint64 points, DownsampleMethod method,
+                                                 const PayloadPath &field, bool reverse, qint64 limit, const PayloadFilter *filter) const
+{
+    auto it = m_data.find(key);
+    if (it == m_data.end())
+    {
+        return QList<DataRecord>();
+    }
+    return downsampleSeries(it->second, from, to, points, method, field, reverse, limit, filter);
+}
+
+QHash<QString, std::vector<AggregateBucket>> Collection::aggregate(const QString &key, const KeyPattern *keyPattern, qint64 from, qint64 to,
+                                                                   qint64 bucketWidth, const PayloadPath &field) const
+{
+    QHash<QString, std::vector<AggregateBucket>> result;
     if (from > to)
     {
         return result;
     }
 
-    const int startIndex = getEarliestRecordIndex(it->second, from);
-    if (startIndex == -1)
+    const bool hasRegex = keyPattern != nullptr;
+    if (hasRegex || key.isEmpty())
     {
-        return result;
+        result = collectDocuments<std::vector<AggregateBucket>>(
+            keyPattern, from, [&](QHash<QString, std::vector<AggregateBucket>> &out, const QString &docKey, const DocumentSeries &records)
+            {
+                if (!records.overlaps(from, to))
+                {
+                    return;
+                }
+                std::vector<AggregateBucket> buckets = aggregateSeries(records, from, to, bucketWidth, field);
+                if (!buckets.empty())
+                {
+                    out.insert(docKey, std::move(buckets));
+                }
+            });
+    }
+    else
+    {
+        auto it = m_data.find(key);
+        if (it != m_data.end())
+        {
+            std::vector<AggregateBucket> buckets = aggregateSeries(it->second, from, to, bucketWidth, field);
+            if (!buckets.empty())
+            {
+                result.insert(key, std::move(buckets));
+            }
+        }
     }
+    return result;
+}
 
-    const int endIndex = getLatestRecordIndex(it->second, to);
-    if (endIndex == -1)
+void Collection::eraseDocument(std::unordered_map<QString, DocumentSeries>::iterator it)
+{
+    const qint64 previousLast = it->second.lastTimestamp();
+    moveActivity(it->first, previousLast, std::numeric_limits<qint64>::min());
+    dropLatest(it->first);
+    m_index.remove(it->first);
+    m_data.erase(it);
+    m_data.rehash(0);
+    lowerLatestHighWater(previousLast);
+}
+
+void Collection::refreshLatest(std::unordered_map<QString, DocumentSeries>::iterator it)
+{
+    const DataRecord record = it->second.recordAt(it->second.latestPosition(it->second.lastTimestamp()));
+    m_version = nextVersion();
+    m_unpublishedDocuments.insert(it->first);
+    auto [slot, created] = m_latestSlots.try_emplace(it->first, m_latest.size());
+    if (created)
     {
-        return result;
+        m_latest.push_back(LatestRecord{it->first, record, m_version});
     }
+    else
+    {
+        m_latest[slot->second].record = record;
+        m_latest[slot->second].version = m_version;
+    }
+}
 
-    for (int i = startIndex; i <= endIndex; ++i)
+void Collection::dropLatest(const QString &key)
+{
+    auto slot = m_latestSlots.find(key);
+    if (slot == m_latestSlots.end())
+    {
+        return;
+    }
+    m_version = nextVersion();
+    m_unpublishedDocuments.insert(key);
+    // the last entry fills the gap so the table stays dense
+    const size_t index = slot->second;
+    m_latestSlots.erase(slot);
+    if (index + 1 != m_latest.size())
     {
-        result.append(it->second[i].get());
+        m_latest[index] = std::move(m_latest.back());
+        m_latestSlots[m_latest[index].doc] = index;
     }
+    m_latest.pop_back();
+}
 
-    if (reverse)
+void Collection::lowerLatestHighWater(qint64 previousLast)
+{
+    if (previousLast < m_latestHighWater)
     {
-        std::reverse(result.begin(), result.end());
+        return;
     }
+    m_latestHighWater = std::numeric_limits<qint64>::min();
+    if (m_activity.empty())
+    {
+        return;
+    }
+    for (const QString &key : m_activity.rbegin()->second)
+    {
+        m_latestHighWater = std::max(m_latestHighWater, m_data.find(key)->second.lastTimestamp());
+    }
+}
 
-    if (limit > 0 && result.size() > limit)
+quint64 Collection::documentVersion(const QString &key) const
+{
+    auto slot = m_latestSlots.find(key);
+    return slot != m_latestSlots.end() ? m_latest[slot->second].version : 0;
+}
+
+void Collection::rebuildLatest()
+{
+    m_version = nextVersion();
+    m_latestHighWater = std::numeric_limits<qint64>::min();
+    m_latest.clear();
+    m_latestSlots.clear();
+    m_latest.reserve(m_data.size());
+    for (auto it = m_data.begin(); it != m_data.end(); ++it)
     {
-        result.resize(limit);
+        m_latestHighWater = std::max(m_latestHighWater, it->second.lastTimestamp());
+        refreshLatest(it);
     }
+}
 
-    return result;
+qint64 Collection::activityBucket(qint64 timestamp)
+{
+    return timestamp / ActivityBucketMs - (timestamp % ActivityBucketMs < 0 ? 1 : 0);
+}
+
+// previousLast and last are the newest timestamps of the document before and
+// after a change, std::numeric_limits<qint64>::min() when it had or has none
+void Collection::moveActivity(const QString &key, qint64 previousLast, qint64 last)
+{
+    const qint64 none = std::numeric_limits<qint64>::min();
+    const qint64 previousBucket = previousLast == none ? none : activityBucket(previousLast);
+    const qint64 bucket = last == none ? none : activityBucket(last);
+    if (previousBucket == bucket)
+    {
+        return;
+    }
+    if (previousBucket != none)
+    {
+        auto it = m_activity.find(previousBucket);
+        if (it != m_activity.end())
+        {
+            it->second.erase(key);
+            if (it->second.empty())
+            {
+                m_activity.erase(it);
+            }
+        }
+    }
+    if (bucket != none)
+    {
+        m_activity[bucket].insert(key);
+    }
+}
+
+std::shared_ptr<const CollectionView> Collection::publish()
+{
+    for (const QString &key : m_unpublishedDocuments)
+    {
+        if (const CollectionView::Document *published = m_publishedDocuments.find(key))
+        {
+            m_publishedActivity.erase(std::make_pair(published->series->lastTimestamp(), key));
+        }
+        auto it = m_data.find(key);
+        if (it == m_data.end())
+        {
+            m_publishedDocuments.erase(key);
+            continue;
+        }
+        const CollectionView::Document document =
+            CollectionView::document(std::make_shared<const DocumentSeries>(it->second), documentVersion(key));
+        m_publishedDocuments.insert(key, document);
+        m_publishedActivity.insert(std::make_pair(document.series->lastTimestamp(), key), document);
+    }
+    m_unpublishedDocuments.clear();
+    for (const QString &key : m_unpublishedValues)
+    {
+        auto it = m_key_vaue.find(key);
+        if (it == m_key_vaue.end())
+        {
+            m_publishedValues.erase(key);
+            continue;
+        }
+        m_publishedValues.insert(key, it->second);
+    }
+    m_unpublishedValues.clear();
+    return std::make_shared<const CollectionView>(m_publishedDocuments, m_publishedActivity, m_publishedValues, m_latestHighWater, m_version,
+                                                  m_valuesVersion);
 }
 
 void Collection::clearDocument(const QString &key)
@@ -243,18 +705,14 @@ void Collection::clearDocument(const QString &key)
     auto it = m_data.find(key);
     if (it != m_data.end())
     {
-        std::vector<std::unique_ptr<DataRecord>>{}.swap(it->second);
-        m_data.erase(it);
-        m_data.rehash(0);
+        eraseDocument(it);
+        m_dirty.erase(key);
 #ifdef __linux__
         malloc_trim(0);
 #endif
-        // delete from disc if persistence is enabled
+        // tombstone on disc if persistence is enabled
         if (!m_dataFolder.isEmpty()) {
-            QDir dir(m_dataFolder + "/" + m_name + "/" + key);
-            if (dir.exists()) {
-                dir.removeRecursively();
-            }
+            m_tombstones.push_back(Tombstone{key, 0, 0, true});
         }
 
         qInfo() << "Document deleted from memory" << m_name << ":" << key;
@@ -267,38 +725,23 @@ void Collection::deleteRecord(const QString &key, qint64 ts)
     if (it == m_data.end()) {
         return;
     }
-    auto &records = it->second;
-    auto vecIt = std::lower_bound(records.begin(), records.end(), ts,
-                                  [](const std::unique_ptr<DataRecord> &a, qint64 b)
-                                  {
-                                      return a->timestamp < b;
-                                  });   
-    if (vecIt == records.end() || (*vecIt)->timestamp != ts) {
+    const qint64 previousLast = it->second.lastTimestamp();
+    if (!it->second.remove(ts)) {
         return;
     }
-    records.erase(vecIt);
-    if (records.empty()) {
-        std::vector<std::unique_ptr<DataRecord>>{}.swap(records);
-        m_data.erase(it);
-        m_data.rehash(0);
-#ifdef __linux__
-        malloc_trim(0);
-#endif
-        return;
-    }    
-
-    const auto capacity = records.capacity();
-    const auto size = records.size();
-    if (capacity > 0 && size * 2 < capacity)
-    {
-        std::vector<std::unique_ptr<DataRecord>> compacted;
-        compacted.reserve(size);
-        std::move(records.begin(), records.end(), std::back_inserter(compacted));
-        records.swap(compacted);
+    moveActivity(key, previousLast, it->second.lastTimestamp());
+    if (!m_dataFolder.isEmpty()) {
+        m_tombstones.push_back(Tombstone{key, ts, ts, false});
+    }
+    if (!it->second.isEmpty()) {
+        refreshLatest(it);
+    } else {
+        eraseDocument(it);
 #ifdef __linux__
         malloc_trim(0);
 #endif
     }
+    lowerLatestHighWater(previousLast);
 }
 
 void Collection::deleteRecordsInRange(const QString &key, qint64 fromTs, qint64 toTs)
@@ -307,99 +750,23 @@ void Collection::deleteRecordsInRange(const QString &key, qint64 fromTs, qint64
     if (it == m_data.end()) {
         return;
     }
-    auto &records = it->second;
-    
-    // Find the first record >= fromTs
-    auto beginIt = std::lower_bound(records.begin(), records.end(), fromTs,
-                                    [](const std::unique_ptr<DataRecord> &a, qint64 b)
-                                    {
-                                        return a->timestamp < b;
-                                    });
-    
-    // Find the first record > toTs
-    auto endIt = std::upper_bound(records.begin(), records.end(), toTs,
-                                  [](qint64 b, const std::unique_ptr<DataRecord> &a)
-                                  {
-                                      return b < a->timestamp;
-                                  });
-    
-    if (beginIt == records.end() || beginIt >= endIt) {
+    const qint64 previousLast = it->second.lastTimestamp();
+    if (it->second.removeRange(fromTs, toTs) == 0) {
         return;
     }
-    
-    records.erase(beginIt, endIt);
-    
-    if (records.empty()) {
-        std::vector<std::unique_ptr<DataRecord>>{}.swap(records);
-        m_data.erase(it);
-        m_data.rehash(0);
-#ifdef __linux__
-        malloc_trim(0);
-#endif
-        return;
+    moveActivity(key, previousLast, it->second.lastTimestamp());
+    if (!m_dataFolder.isEmpty()) {
+        m_tombstones.push_back(Tombstone{key, fromTs, toTs, false});
     }
-    
-    const auto capacity = records.capacity();
-    const auto size = records.size();
-    if (capacity > 0 && size * 2 < capacity)
-    {
-        std::vector<std::unique_ptr<DataRecord>> compacted;
-        compacted.reserve(size);
-        std::move(records.begin(), records.end(), std::back_inserter(compacted));
-        records.swap(compacted);
+    if (!it->second.isEmpty()) {
+        refreshLatest(it);
+    } else {
+        eraseDocument(it);
 #ifdef __linux__
         malloc_trim(0);
 #endif
     }
-}
-
-int Collection::getLatestRecordIndex(const std::vector<std::unique_ptr<DataRecord>> &records, qint64 timestamp)
-{
-    if (records.empty())
-    {
-        return -1;
-    }
-
-    auto vecIt = std::upper_bound(records.begin(), records.end(), timestamp,
-                                  [](qint64 b, const std::unique_ptr<DataRecord> &a)
-                                  {
-                                      return b < a->timestamp;
-                                  });
-
-    if (vecIt == records.begin())
-    {
-        if (records.front()->timestamp > timestamp)
-        {
-            return -1;
-        }
-    }
-    else
-    {
-        --vecIt;
-    }
-
-    return vecIt - records.begin();
-}
-
-int Collection::getEarliestRecordIndex(const std::vector<std::unique_ptr<DataRecord>> &records, qint64 timestamp)
-{
-    if (records.empty())
-    {
-        return -1;
-    }
-
-    auto vecIt = std::lower_bound(records.begin(), records.end(), timestamp,
-                                  [](const std::unique_ptr<DataRecord> &a, qint64 b)
-                                  {
-                                      return a->timestamp < b;
-                                  });
-
-    if (vecIt == records.end())
-    {
-        return -1;
-    }
-
-    return vecIt - records.begin();
+    lowerLatestHighWater(previousLast);
 }
 
 // key value methods
@@ -408,9 +775,11 @@ void Collection::setValueForKey(const QString &key, const QString &value)
 {
     m_key_vaue[key] = value.toStdString();
     m_key_vaue_updated = QDateTime::currentMSecsSinceEpoch();
+    m_valuesVersion = nextVersion();
+    m_unpublishedValues.insert(key);
 }
 
-QString Collection::getValueForKey(const QString &key)
+QString Collection::getValueForKey(const QString &key) const
 {
     auto it = m_key_vaue.find(key);
     if (it == m_key_vaue.end())
@@ -428,107 +797,193 @@ void Collection::removeValueForKey(const QString &key)
     malloc_trim(0);
 #endif
     m_key_vaue_updated = QDateTime::currentMSecsSinceEpoch();
+    m_valuesVersion = nextVersion();
+    m_unpublishedValues.insert(key);
 }
 
-QHash<QString, QString> Collection::getAllValues(const QRegularExpression *keyRegex)
+QHash<QString, QString> Collection::getAllValues(const KeyPattern *keyPattern) const
 {
-    QHash<QString, QString> result;
-    const bool hasRegex = keyRegex != nullptr && keyRegex->isValid();
-    for (auto &[key, value] : m_key_vaue)
-    {
-        if (hasRegex && !keyRegex->match(key).hasMatch())
-        {
-            continue;
-        }
-        result.insert(key, QString::fromStdString(value));
-    }
-    return result;
+    const bool hasRegex = keyPattern != nullptr;
+    const int partitions = scanPartitions(m_key_vaue.size());
+    std::vector<QHash<QString, QString>> partial(partitions);
+    forEachEntryInParallel(m_key_vaue, partitions, [&](int partition, const QString &key, const std::string &value)
+                           {
+                               if (!hasRegex || keyPattern->matches(key))
+                               {
+                                   partial[partition].insert(key, QString::fromStdString(value));
+                               }
+                           });
+    return mergePartitions(partial);
 }
 
-QList<QString> Collection::getAllKeys()
+QList<QString> Collection::getAllKeys() const
 {
     QList<QString> result;
-    for (auto &[key, value] : m_key_vaue)
+    for (const auto &[key, value] : m_key_vaue)
     {
         result.append(key);
     }
     return result;
 }
 
-void Collection::flushToDisk()
+std::function<bool()> Collection::takeFlushJob()
 {
     if (m_dataFolder.isEmpty()) {
-        return; // Skip if persistence is disabled
+        return nullptr; // Skip if persistence is disabled
     }
-    
-    qDebug() << "Flushing collection to disk" << m_name;
-    // fluxiondb data
-    QDir dir;
-    dir.mkpath(m_dataFolder + "/" + m_name);
-    for(auto & each : m_data) {
-        auto key = each.first;
-        auto &records = each.second;
-
-        auto arr = json::array();
-        for(auto & record : records) {
-            if (!record->isNew) {
-                continue;
+
+    FlushJob job;
+    job.name = m_name;
+    job.folder = m_dataFolder + "/" + m_name;
+    job.segments = m_segments;
+    job.tombstones = m_tombstones;
+    m_flushingTombstones.swap(m_tombstones);
+    m_tombstones.clear();
+    // only dirty documents are captured, and of those only the ranges changed
+    job.documents.reserve(m_dirty.size());
+    for (const auto &[key, ranges] : m_dirty) {
+        auto it = m_data.find(key);
+        if (it != m_data.end()) {
+            job.documents.push_back(DocumentSnapshot{key, it->second.snapshot(ranges)});
+        }
+    }
+    m_flushingDirty.swap(m_dirty);
+    m_dirty.clear();
+
+    // tombstones and superseded records only go away when the segments are rewritten
+    const qint64 segmentSize = m_segments->totalSize();
+    job.rewrite = segmentSize > SegmentStore::TargetSegmentSize && segmentSize > 2 * m_segments->rewrittenSize();
+    if (job.rewrite) {
+        job.allDocuments = snapshotAll();
+    }
+
+    // if no key value update, skip it
+    job.writeKeyValues = m_key_vaue_updated > m_flushed;
+    if (job.writeKeyValues) {
+        for(auto &[key, value] : m_key_vaue) {
+            job.keyValues[key.toStdString()] = value;
+        }
+    }
+    m_flushingSince = m_flushed;
+    m_flushed = QDateTime::currentMSecsSinceEpoch();
+
+    return [job = std::move(job)]() { return writeFlush(job); };
+}
+
+void Collection::finishFlush(bool flushed)
+{
+    if (!flushed) {
+        // the captured deletions go first, they happened before the ones since
+        m_flushingTombstones.insert(m_flushingTombstones.end(), m_tombstones.begin(), m_tombstones.end());
+        m_tombstones.swap(m_flushingTombstones);
+        for (const auto &[key, ranges] : m_flushingDirty) {
+            auto it = m_data.find(key);
+            if (it != m_data.end()) {
+                for (const auto &[from, to] : ranges) {
+                    markDirty(it, from, to);
+                }
             }
-            auto obj = json::object();
-            obj["ts"] = record->timestamp;
-            obj["data"] = record->data;
-            arr.push_back(obj);
-            record->isNew = false;
         }
-        if (arr.empty()) {
+        m_flushed = std::min(m_flushed, m_flushingSince);
+    }
+    m_flushingDirty.clear();
+    m_flushingTombstones.clear();
+}
+
+std::vector<Collection::DocumentSnapshot> Collection::snapshotAll() const
+{
+    std::vector<DocumentSnapshot> documents;
+    documents.reserve(m_data.size());
+    for (const auto &[key, series] : m_data) {
+        documents.push_back(DocumentSnapshot{key, series.snapshot()});
+    }
+    return documents;
+}
+
+bool Collection::writeFlush(const FlushJob &job)
+{
+    qDebug() << "Flushing collection to disk" << job.name;
+    // fluxiondb data: tombstones queued by deletes go first, then the new records
+    QDir dir;
+    dir.mkpath(job.folder);
+    SegmentStore &segments = *job.segments;
+    for (const Tombstone &tombstone : job.tombstones) {
+        if (tombstone.clearsDocument) {
+            segments.appendClearDocument(tombstone.doc);
+        } else {
+            segments.appendDeleteRange(tombstone.doc, tombstone.fromTs, tombstone.toTs);
+        }
+    }
+
+    bool ok = true;
+    std::vector<DataRecord> pending;
+    for (const DocumentSnapshot &document : job.documents) {
+        pending.clear();
+        document.records.forEach([&pending](const DataRecord &record) {
+            pending.push_back(record);
+        });
+        if (pending.empty()) {
             continue;
         }
-        dir.mkpath(m_dataFolder + "/" + m_name + "/" + key);
-        auto now = QString::number(QDateTime::currentMSecsSinceEpoch());
-        QFile file(m_dataFolder + "/" + m_name + "/" + key + "/"+ now + ".json");
-        if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            file.write(json(arr).dump().c_str());
-            file.close();
+        segments.appendRecords(document.key, pending);
+        // keep the write buffer bounded on large flushes
+        if (segments.pendingSize() >= SegmentStore::TargetSegmentSize / 8) {
+            ok = segments.commit() && ok;
         }
     }
+    ok = segments.commit() && ok;
 
-    // if no key value update, skip next code:
-    if (m_key_vaue_updated > m_flushed) {    
+    if (job.writeKeyValues) {    
         // store key_value in data folder
-        QFile file(m_dataFolder + "/" + m_name + "/key_value.json");
-        qDebug() << "Flushing key_value to disk" << m_dataFolder + "/" + m_name + "/key_value.json";
+        QFile file(job.folder + "/key_value.json");
+        qDebug() << "Flushing key_value to disk" << job.folder + "/key_value.json";
         if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            std::unordered_map<std::string, std::string> kv;
-            for(auto &[key, value] : m_key_vaue) {
-                kv[key.toStdString()] = value;
-            }
-            file.write(json(kv).dump().c_str());
+            file.write(json(job.keyValues).dump().c_str());
             file.close();
+        } else {
+            ok = false;
         }
-        qDebug() << "Done flushing collection to disk" << m_name;
     }
-    m_flushed = QDateTime::currentMSecsSinceEpoch();
+
+    if (ok && job.rewrite) {
+        ok = rewriteSegments(segments, job.name, job.allDocuments);
+    }
+    qDebug() << "Done flushing collection to disk" << job.name;
+    return ok;
 }
 
-void Collection::loadFromDisk()
+bool Collection::rewriteSegments(SegmentStore &segments, const QString &name, const std::vector<DocumentSnapshot> &documents)
 {
-    if (m_dataFolder.isEmpty()) {
-        return; // Skip if persistence is disabled
+    qInfo() << "Compacting collection" << name << segments.totalSize() << "bytes";
+    segments.beginRewrite();
+    std::vector<DataRecord> records;
+    for (const DocumentSnapshot &document : documents) {
+        records.clear();
+        document.records.forEach([&records](const DataRecord &record) {
+            records.push_back(record);
+        });
+        segments.appendRecords(document.key, records);
+        if (segments.pendingSize() >= SegmentStore::TargetSegmentSize / 8 && !segments.commit()) {
+            break;
+        }
     }
-    
-    qDebug() << "Loading collection from disk" << m_name;
-    QDir dir(m_dataFolder + "/" + m_name);
-    if (!dir.exists()) {
-        qDebug() << "Collection does not exist" << m_name;
-        return;
+    segments.commit();
+    if (!segments.finishRewrite()) {
+        qWarning() << "Compaction failed, keeping old segments" << name;
+        return false;
     }
+    qInfo() << "Done compacting collection" << name << segments.totalSize() << "bytes";
+    return true;
+}
+
+bool Collection::loadLegacyJson(DocumentLoader &loader, quint64 &sequence)
+{
+    // per-flush <doc>/<timestamp>.json files written before the segment format
+    bool found = false;
+    QDir dir(m_dataFolder + "/" + m_name);
     for (const QFileInfo &info : dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
         auto key = info.fileName();
         QDir dir(m_dataFolder + "/" + m_name + "/" + key);
-        if (!dir.exists()) {
-            qDebug() << "Collection does not exist" << m_name << key;
-            continue;
-        }
         for (const QFileInfo &info : dir.entryInfoList(QDir::Files | QDir::NoDotAndDotDot, QDir::Time | QDir::Reversed)) {
             auto fileName = info.fileName();
             QFile file(m_dataFolder + "/" + m_name + "/" + key + "/" + fileName);
@@ -537,23 +992,86 @@ void Collection::loadFromDisk()
                 continue;
             }
             auto data = file.readAll();
-            auto arr = json::parse(data.toStdString());
-            for(auto & record : arr) {
-                std::string data = record["data"];
-                qint64 ts = record["ts"];
-                insert(ts, key, QString(data.c_str()), false);
+            LegacyRecordsHandler handler(loader, key, ++sequence);
+            if (!json::sax_parse(data.constData(), data.constData() + data.size(), &handler)) {
+                qWarning() << "Failed to parse file" << file.fileName();
             }
             file.close();
+            found = true;
         }
     }
+    return found;
+}
+
+qsizetype Collection::loadFromDisk()
+{
+    if (m_dataFolder.isEmpty()) {
+        return 0; // Skip if persistence is disabled
+    }
+    
+    qDebug() << "Loading collection from disk" << m_name;
+    QDir dir(m_dataFolder + "/" + m_name);
+    if (!dir.exists()) {
+        qDebug() << "Collection does not exist" << m_name;
+        return 0;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    DocumentLoader loader;
+    quint64 sequence = 0;
+    qsizetype records = 0;
+    const bool hasLegacyData = loadLegacyJson(loader, sequence);
+    m_segments->load([this, &loader, &sequence](const SegmentStore::Block &block) {
+        ++sequence;
+        switch (block.type) {
+        case SegmentStore::BlockType::Records:
+            if (!block.forEachRecord([&loader, &block, &sequence](qint64 ts, std::string_view data) {
+                    loader.addRecord(block.doc, sequence, ts, data);
+                })) {
+                qWarning() << "Malformed records block" << m_name << block.doc;
+            }
+            break;
+        case SegmentStore::BlockType::DeleteRange:
+            loader.addDeletion(block.doc, sequence, block.fromTs, block.toTs);
+            break;
+        case SegmentStore::BlockType::ClearDocument:
+            loader.addClear(block.doc, sequence);
+            break;
+        }
+    }, [this, &loader, &records]() {
+        // payloads point into the mapped segments, build before they are unmapped
+        records = loader.build(m_data, QThreadPool::globalInstance());
+    });
+    m_index.rebuild(m_data);
+    m_activity.clear();
+    for (const auto &[key, series] : m_data) {
+        moveActivity(key, std::numeric_limits<qint64>::min(), series.lastTimestamp());
+    }
+    rebuildLatest();
+    const qint64 scanned = timer.elapsed();
+
+    if (hasLegacyData) {
+        qInfo() << "Migrating collection to segment files" << m_name;
+        if (rewriteSegments(*m_segments, m_name, snapshotAll())) {
+            for (const QFileInfo &info : dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+                QDir(info.absoluteFilePath()).removeRecursively();
+            }
+        }
+    }
+
     QFile file(m_dataFolder + "/" + m_name + "/key_value.json");
     if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
         auto data = file.readAll();
         auto kv = json::parse(data.toStdString());
         for(auto &[key, value] : kv.items()) {
             m_key_vaue[QString(key.c_str())] = value;
+            m_unpublishedValues.insert(QString(key.c_str()));
         }
         file.close();
+        m_valuesVersion = nextVersion();
     }    
-    qDebug() << "Done loading collection from disk" << m_name;
+    qInfo() << "Loaded collection" << m_name << ":" << m_data.size() << "documents," << records << "records,"
+            << m_segments->totalSize() << "segment bytes in" << scanned << "ms (" << timer.elapsed() << "ms total)";
+    return records;
 }
@@ -3,51 +3,237 @@
 
 #include <QString>
 #include <QHash>
-#include <QRegularExpression>
-#include <vector>
-#include <unordered_map>
+#include <functional>
 #include <memory>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "datarecord.h"
+#include "documentseries.h"
+#include "segmentstore.h"
+#include "payloadpath.h"
+#include "payloadfilter.h"
+#include "keypattern.h"
+#include "documentindex.h"
+#include "seriesqueries.h"
+#include "collectionview.h"
+
+class PersistenceWriter;
+class DocumentLoader;
 
 class Collection {
 public:
-    explicit Collection(const QString& name, const QString& dataFolder);
+    // Disk writes go through the writer when one is given, otherwise they run inline.
+    explicit Collection(const QString& name, const QString& dataFolder, PersistenceWriter* writer = nullptr);
     ~Collection();
 
     void insert(qint64 timestamp, const QString& key, const QString& data);
-    DataRecord* getLatestRecordForDocument(const QString& key, qint64 timestamp);
-    DataRecord* getEarliestRecordForDocument(const QString& key, qint64 timestamp);
-    QHash<QString, DataRecord*> getAllRecords(qint64 timestamp, const QString& key, qint64 from = 0, const QRegularExpression* keyRegex = nullptr);
-    QList<DataRecord*> getAllRecordsForDocument(const QString& key, qint64 from, qint64 to, bool reverse = false, qint64 limit = 0);
-    QHash<QString, QList<DataRecord*>> getSessionData(qint64 from, qint64 to);
+    void insert(qint64 timestamp, const QString& key, std::string_view data);
+    // Inserts records of one document in any order, as one insert() per
+    // record would: of records with the same timestamp the last one wins.
+    // They are sorted in place and merged into the series in one pass.
+    void insert(const QString& key, std::vector<DataRecord>& records);
+    bool getLatestRecordForDocument(const QString& key, qint64 timestamp, DataRecord* recordOut) const;
+    bool getEarliestRecordForDocument(const QString& key, qint64 timestamp, DataRecord* recordOut) const;
+    // A filter applies to the latest record: documents whose latest record
+    // does not match are left out rather than falling back to older ones.
+    QHash<QString, DataRecord> getAllRecords(qint64 timestamp, const QString& key, qint64 from = 0, const KeyPattern* keyPattern = nullptr,
+                                             const PayloadFilter* filter = nullptr) const;
+    // Records failing the filter are skipped during the scan, before limit.
+    QList<DataRecord> getAllRecordsForDocument(const QString& key, qint64 from, qint64 to, bool reverse = false, qint64 limit = 0,
+                                               const PayloadFilter* filter = nullptr) const;
+    // At most points records of the document in [from, to], picked by method.
+    // With a field only records holding a number there are considered; Lttb,
+    // Min and Max need one. reverse and limit apply to the picked records.
+    QList<DataRecord> downsampleDocument(const QString& key, qint64 from, qint64 to, qint64 points, DownsampleMethod method,
+                                         const PayloadPath& field, bool reverse = false, qint64 limit = 0,
+                                         const PayloadFilter* filter = nullptr) const;
+    QHash<QString, QList<DataRecord>> getSessionData(qint64 from, qint64 to) const;
+    // Document names starting with prefix in lexicographic order, after the
+    // name `after` when it is set; more tells whether the limit cut them short.
+    QStringList getDocumentNames(const QString& prefix, const QString& after, qint64 limit, bool* more) const;
+    // Buckets the records of the matching documents in [from, to] by
+    // bucketWidth ms, or into one bucket for 0. With a field only records
+    // holding a number there count; empty buckets are left out.
+    QHash<QString, std::vector<AggregateBucket>> aggregate(const QString& key, const KeyPattern* keyPattern, qint64 from, qint64 to,
+                                                           qint64 bucketWidth, const PayloadPath& field) const;
     
     void setValueForKey(const QString& key, const QString& value);
-    QString getValueForKey(const QString& key);
+    QString getValueForKey(const QString& key) const;
     void removeValueForKey(const QString& key);
-    QHash<QString, QString> getAllValues(const QRegularExpression* keyRegex = nullptr);
-    QList<QString> getAllKeys();
+    QHash<QString, QString> getAllValues(const KeyPattern* keyPattern = nullptr) const;
+    QList<QString> getAllKeys() const;
+
+    // Change stamps for caching what was read: version() changes with every
+    // record change of the collection, documentVersion() with the records of
+    // one document (0 while it has none) and valuesVersion() with the
+    // key-values. Stamps are unique across collections, so a stamp seen on a
+    // dropped and recreated collection never matches again.
+    quint64 version() const { return m_version; }
+    quint64 documentVersion(const QString& key) const;
+    quint64 valuesVersion() const { return m_valuesVersion; }
+    // newest timestamp of any record; queries at or after it read the latest records
+    qint64 latestHighWater() const { return m_latestHighWater; }
 
+    // The collection as it is now, for readers on other threads. Only the
+    // documents and keys changed since the last call are copied into it,
+    // each series as a pointer per chunk; everything else is shared with the
+    // previous view. Chunks shared with a view are copied once written to.
+    std::shared_ptr<const CollectionView> publish();
 
     void clearDocument(const QString& key);
     void deleteRecord(const QString& key, qint64 ts);
     void deleteRecordsInRange(const QString& key, qint64 fromTs, qint64 toTs);
-    void flushToDisk();
-    void loadFromDisk();
+    // Captures everything changed since the last flush and returns a job that
+    // writes it out. Only the capture runs here; the job may run on the
+    // persistence thread while this collection keeps changing.
+    std::function<bool()> takeFlushJob();
+    // Settles the last job taken once it ran. When it failed, what it
+    // captured is marked changed again so the next flush writes it, since
+    // the log generations holding it are only dropped after a good flush.
+    void finishFlush(bool flushed);
+    // Loads the persisted state; safe to call from a worker thread before the
+    // collection is shared. Returns the number of records loaded.
+    qsizetype loadFromDisk();
     bool isEmpty() const {
         return m_data.empty();
     }
 
 private:
-    void insert(qint64 timestamp, const QString& key, const QString& data, bool isNew);
-    int getLatestRecordIndex(const std::vector<std::unique_ptr<DataRecord>>& records, qint64 timestamp);
-    int getEarliestRecordIndex(const std::vector<std::unique_ptr<DataRecord>>& records, qint64 timestamp);
-    
+    struct Tombstone {
+        QString doc;
+        qint64 fromTs;
+        qint64 toTs;
+        bool clearsDocument;
+    };
+    struct DocumentSnapshot {
+        QString key;
+        DocumentSeries::Snapshot records;
+    };
+    struct FlushJob;
+
+    // Adds [from, to] to the ranges of the document the next flush writes.
+    // Ranges with no record between them are joined, so appends stay one
+    // range; past MaxDirtyRanges the two closest in time are joined.
+    void markDirty(std::unordered_map<QString, DocumentSeries>::iterator it, qint64 from, qint64 to);
+    static constexpr size_t MaxDirtyRanges = 32;
+    void eraseDocument(std::unordered_map<QString, DocumentSeries>::iterator it);
+    // Keeps the latest-record table in step with a changed document. It runs
+    // after every change, since a change may move the chunk the view points into.
+    void refreshLatest(std::unordered_map<QString, DocumentSeries>::iterator it);
+    void dropLatest(const QString& key);
+    // Recomputes m_latestHighWater from the newest activity bucket once a
+    // removal took away a document's last record at previousLast, if that
+    // may have been the newest one.
+    void lowerLatestHighWater(qint64 previousLast);
+    void rebuildLatest();
+
+    // documents are bucketed by the minute of their newest record
+    static constexpr qint64 ActivityBucketMs = 60 * 1000;
+    static qint64 activityBucket(qint64 timestamp);
+    void moveActivity(const QString& key, qint64 previousLast, qint64 last);
+
+    // Calls fn(name, series) for the documents matching the pattern (every
+    // document without one) that have records at or after activeSince. A
+    // pattern with a case-sensitive literal prefix only visits the names under
+    // it in m_index; otherwise a bound on activity only visits the documents
+    // written to since, through m_activity.
+    template <typename Fn>
+    void forEachDocument(const KeyPattern* pattern, qint64 activeSince, Fn fn) const
+    {
+        const auto visit = [&](const QString& name, const DocumentSeries& series)
+        {
+            if (series.lastTimestamp() >= activeSince && (pattern == nullptr || pattern->matches(name)))
+            {
+                fn(name, series);
+            }
+        };
+        if (pattern != nullptr && !pattern->prefix().isEmpty() && pattern->caseSensitivity() == Qt::CaseSensitive)
+        {
+            m_index.forEachWithPrefix(pattern->prefix(), [&](const QString& name, const DocumentSeries& series)
+                                      {
+                                          visit(name, series);
+                                          return true;
+                                      });
+            return;
+        }
+        if (activeSince != std::numeric_limits<qint64>::min())
+        {
+            for (auto bucket = m_activity.lower_bound(activityBucket(activeSince)); bucket != m_activity.end(); ++bucket)
+            {
+                for (const QString& name : bucket->second)
+                {
+                    const auto it = m_data.find(name);
+                    if (it != m_data.end())
+                    {
+                        visit(name, it->second);
+                    }
+                }
+            }
+            return;
+        }
+        for (const auto& [name, series] : m_data)
+        {
+            visit(name, series);
+        }
+    }
+    // Whether forEachDocument() would visit every document anyway.
+    bool scansEveryDocument(const KeyPattern* pattern, qint64 activeSince) const;
+    // forEachDocument() for scans that build a result by document: fn(out,
+    // name, series) adds to out. A scan of every document of a large
+    // collection is split into partitions of m_data's buckets that run in
+    // parallel, each into its own out, merged afterwards.
+    template <typename Value, typename Fn>
+    QHash<QString, Value> collectDocuments(const KeyPattern* pattern, qint64 activeSince, Fn fn) const;
+    std::vector<DocumentSnapshot> snapshotAll() const;
+    bool loadLegacyJson(DocumentLoader& loader, quint64& sequence);
+    static bool writeFlush(const FlushJob& job);
+    static bool rewriteSegments(SegmentStore& segments, const QString& name, const std::vector<DocumentSnapshot>& documents);
+
     QString m_name;
-    std::unordered_map<QString, std::vector<std::unique_ptr<DataRecord>>> m_data;
+    std::unordered_map<QString, DocumentSeries> m_data;
+    // the names of m_data in order, for prefix and range lookups
+    DocumentIndex m_index;
+    // the names of m_data by activityBucket() of their newest record
+    std::map<qint64, std::unordered_set<QString>> m_activity;
+    // Latest record of every document, packed so "latest of everything" is a
+    // linear copy. It answers timestamps at or after m_latestHighWater, the
+    // newest timestamp of any record, which no document can be past.
+    struct LatestRecord {
+        QString doc;
+        DataRecord record;
+        // documentVersion()
+        quint64 version;
+    };
+    std::vector<LatestRecord> m_latest;
+    std::unordered_map<QString, size_t> m_latestSlots;
+    qint64 m_latestHighWater;
+    quint64 m_version;
+    quint64 m_valuesVersion;
+    // documents changed since the last flush, mapped to the time ranges changed
+    std::unordered_map<QString, DocumentSeries::TimeRanges> m_dirty;
     std::unordered_map<QString, std::string> m_key_vaue;
     qint64 m_key_vaue_updated;
     qint64 m_flushed;
     QString m_dataFolder;
+    // deletions since the last flush, written as segment tombstones before its records
+    std::vector<Tombstone> m_tombstones;
+    // what the flush being written captured, restored by finishFlush() if it fails
+    std::unordered_map<QString, DocumentSeries::TimeRanges> m_flushingDirty;
+    std::vector<Tombstone> m_flushingTombstones;
+    qint64 m_flushingSince;
+    std::shared_ptr<SegmentStore> m_segments;
+    PersistenceWriter* m_writer;
+    // what publish() shares with the views, and the names changed since
+    CollectionView::Documents m_publishedDocuments;
+    CollectionView::Activity m_publishedActivity;
+    CollectionView::Values m_publishedValues;
+    std::unordered_set<QString> m_unpublishedDocuments;
+    std::unordered_set<QString> m_unpublishedValues;
 };
 
 #endif // COLLECTION_H 
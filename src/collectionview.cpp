@@ -0,0 +1,269 @@
+#include "collectionview.h"
+#include "parallelscan.h"
+#include <limits>
+
+namespace {
+
+// Calls fn(partition, key, value) for every entry of the map, its leaves
+// split into partitions that run in parallel.
+template <typename Map, typename Fn>
+void forEachEntryInParallel(const Map &map, int partitions, Fn fn)
+{
+    if (partitions == 1)
+    {
+        map.forEach([&](const auto &key, const auto &value)
+                    {
+                        fn(0, key, value);
+                        return true;
+                    });
+        return;
+    }
+    const auto leaves = map.leaves();
+    runPartitions(partitions, [&](int partition)
+                  {
+                      const size_t last = leaves.size() * (partition + 1) / partitions;
+                      for (size_t leaf = leaves.size() * partition / partitions; leaf < last; ++leaf)
+                      {
+                          const auto &keys = *leaves[leaf].keys;
+                          const auto &values = *leaves[leaf].values;
+                          for (size_t i = 0; i < keys.size(); ++i)
+                          {
+                              fn(partition, keys[i], values[i]);
+                          }
+                      }
+                  });
+}
+
+} // namespace
+
+CollectionView::CollectionView(const Documents &documents, const Activity &activity, const Values &values, qint64 latestHighWater,
+                               quint64 version, quint64 valuesVersion)
+    : m_documents(documents), m_activity(activity), m_values(values), m_latestHighWater(latestHighWater), m_version(version),
+      m_valuesVersion(valuesVersion)
+{
+}
+
+CollectionView::Document CollectionView::document(std::shared_ptr<const DocumentSeries> series, quint64 version)
+{
+    DataRecord latest{std::numeric_limits<qint64>::min(), std::string_view()};
+    if (!series->isEmpty())
+    {
+        latest = series->recordAt(series->latestPosition(std::numeric_limits<qint64>::max()));
+    }
+    return Document{std::move(series), version, latest};
+}
+
+quint64 CollectionView::documentVersion(const QString &key) const
+{
+    const Document *document = m_documents.find(key);
+    return document != nullptr ? document->version : 0;
+}
+
+template <typename Value, typename Fn>
+QHash<QString, Value> CollectionView::collectDocuments(const KeyPattern *pattern, qint64 activeSince, Fn fn) const
+{
+    QHash<QString, Value> result;
+    if (pattern != nullptr && !pattern->prefix().isEmpty() && pattern->caseSensitivity() == Qt::CaseSensitive)
+    {
+        m_documents.forEachFrom(pattern->prefix(), [&](const QString &name, const Document &document)
+                                {
+                                    if (!name.startsWith(pattern->prefix()))
+                                    {
+                                        return false;
+                                    }
+                                    if (document.series->lastTimestamp() >= activeSince && pattern->matches(name))
+                                    {
+                                        fn(result, name, document);
+                                    }
+                                    return true;
+                                });
+        return result;
+    }
+    // unless some document was last written before activeSince, the scan
+    // visits every document anyway
+    qint64 oldest = std::numeric_limits<qint64>::max();
+    m_activity.forEach([&oldest](const std::pair<qint64, QString> &key, const Document &)
+                       {
+                           oldest = key.first;
+                           return false;
+                       });
+    if (activeSince != std::numeric_limits<qint64>::min() && oldest < activeSince)
+    {
+        m_activity.forEachFrom(std::make_pair(activeSince, QString()),
+                               [&](const std::pair<qint64, QString> &key, const Document &document)
+                               {
+                                   if (pattern == nullptr || pattern->matches(key.second))
+                                   {
+                                       fn(result, key.second, document);
+                                   }
+                                   return true;
+                               });
+        return result;
+    }
+    const int partitions = scanPartitions(m_documents.size());
+    std::vector<QHash<QString, Value>> partial(partitions);
+    forEachEntryInParallel(m_documents, partitions, [&](int partition, const QString &name, const Document &document)
+                           {
+                               if (pattern == nullptr || pattern->matches(name))
+                               {
+                                   fn(partial[partition], name, document);
+                               }
+                           });
+    return mergePartitions(partial);
+}
+
+QHash<QString, DataRecord> CollectionView::getAllRecords(qint64 timestamp, const QString &key, qint64 from, const KeyPattern *keyPattern,
+                                                         const PayloadFilter *filter) const
+{
+    const bool hasFilter = filter != nullptr && !filter->isEmpty();
+    const auto latestOf = [&](const Document &document, DataRecord *record)
+    {
+        if (timestamp < m_latestHighWater)
+        {
+            return latestRecordOf(*document.series, timestamp, from, filter, record);
+        }
+        // no document has records past the timestamp, so its latest record
+        // is the one published with it
+        *record = document.latest;
+        return !document.series->isEmpty() && (from == 0 || record->timestamp >= from) && (!hasFilter || filter->matches(record->data));
+    };
+
+    if (keyPattern == nullptr && !key.isEmpty())
+    {
+        QHash<QString, DataRecord> result;
+        DataRecord record;
+        const Document *document = m_documents.find(key);
+        if (document != nullptr && latestOf(*document, &record))
+        {
+            result.insert(key, record);
+        }
+        return result;
+    }
+    // a document last written before from has no latest record at or after it
+    return collectDocuments<DataRecord>(keyPattern, from == 0 ? std::numeric_limits<qint64>::min() : from,
+                                        [&](QHash<QString, DataRecord> &out, const QString &name, const Document &document)
+                                        {
+                                            DataRecord record;
+                                            if (latestOf(document, &record))
+                                            {
+                                                out.insert(name, record);
+                                            }
+                                        });
+}
+
+QList<DataRecord> CollectionView::getAllRecordsForDocument(const QString &key, qint64 from, qint64 to, bool reverse, qint64 limit,
+                                                           const PayloadFilter *filter) const
+{
+    const Document *document = m_documents.find(key);
+    if (document == nullptr)
+    {
+        return QList<DataRecord>();
+    }
+    return recordsInRange(*document->series, from, to, reverse, limit, filter);
+}
+
+QList<DataRecord> CollectionView::downsampleDocument(const QString &key, qint64 from, qint64 to, qint64 points, DownsampleMethod method,
+                                                     const PayloadPath &field, bool reverse, qint64 limit, const PayloadFilter *filter) const
+{
+    const Document *document = m_documents.find(key);
+    if (document == nullptr)
+    {
+        return QList<DataRecord>();
+    }
+    return downsampleSeries(*document->series, from, to, points, method, field, reverse, limit, filter);
+}
+
+QStringList CollectionView::getDocumentNames(const QString &prefix, const QString &after, qint64 limit, bool *more) const
+{
+    QStringList result;
+    *more = false;
+    const QString &start = after.isEmpty() || after < prefix ? prefix : after;
+    m_documents.forEachFrom(start, [&](const QString &name, const Document &)
+                            {
+                                if (!name.startsWith(prefix))
+                                {
+                                    return false;
+                                }
+                                if (name == after)
+                                {
+                                    return true;
+                                }
+                                if (limit > 0 && result.size() >= limit)
+                                {
+                                    *more = true;
+                                    return false;
+                                }
+                                result.append(name);
+                                return true;
+                            });
+    return result;
+}
+
+QHash<QString, std::vector<AggregateBucket>> CollectionView::aggregate(const QString &key, const KeyPattern *keyPattern, qint64 from,
+                                                                       qint64 to, qint64 bucketWidth, const PayloadPath &field) const
+{
+    QHash<QString, std::vector<AggregateBucket>> result;
+    if (from > to)
+    {
+        return result;
+    }
+
+    if (keyPattern == nullptr && !key.isEmpty())
+    {
+        const Document *document = m_documents.find(key);
+        if (document != nullptr)
+        {
+            std::vector<AggregateBucket> buckets = aggregateSeries(*document->series, from, to, bucketWidth, field);
+            if (!buckets.empty())
+            {
+                result.insert(key, std::move(buckets));
+            }
+        }
+        return result;
+    }
+    return collectDocuments<std::vector<AggregateBucket>>(
+        keyPattern, from, [&](QHash<QString, std::vector<AggregateBucket>> &out, const QString &name, const Document &document)
+        {
+            if (!document.series->overlaps(from, to))
+            {
+                return;
+            }
+            std::vector<AggregateBucket> buckets = aggregateSeries(*document.series, from, to, bucketWidth, field);
+            if (!buckets.empty())
+            {
+                out.insert(name, std::move(buckets));
+            }
+        });
+}
+
+QString CollectionView::getValueForKey(const QString &key) const
+{
+    const std::string *value = m_values.find(key);
+    return value != nullptr ? QString::fromStdString(*value) : QString("");
+}
+
+QHash<QString, QString> CollectionView::getAllValues(const KeyPattern *keyPattern) const
+{
+    const int partitions = scanPartitions(m_values.size());
+    std::vector<QHash<QString, QString>> partial(partitions);
+    forEachEntryInParallel(m_values, partitions, [&](int partition, const QString &key, const std::string &value)
+                           {
+                               if (keyPattern == nullptr || keyPattern->matches(key))
+                               {
+                                   partial[partition].insert(key, QString::fromStdString(value));
+                               }
+                           });
+    return mergePartitions(partial);
+}
+
+QList<QString> CollectionView::getAllKeys() const
+{
+    QList<QString> result;
+    result.reserve(static_cast<qsizetype>(m_values.size()));
+    m_values.forEach([&result](const QString &key, const std::string &)
+                     {
+                         result.append(key);
+                         return true;
+                     });
+    return result;
+}
@@ -0,0 +1,89 @@
+#ifndef COLLECTIONVIEW_H
+#define COLLECTIONVIEW_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "documentseries.h"
+#include "keypattern.h"
+#include "persistentmap.h"
+#include "seriesqueries.h"
+
+// Immutable state of a collection as of one Collection::publish(), read on
+// other threads while the collection keeps changing (see Shard::readView()).
+// Documents and key-values sit in persistent maps that share their nodes with
+// the collection's next views, and each document is a series sharing its
+// chunks with the live one, so publishing costs the documents and keys
+// changed since the last view rather than a copy of the collection.
+//
+// Like the collection, a view keeps each document's latest record next to it,
+// read instead of the series for timestamps at or after the high-water mark,
+// and the documents ordered by their newest record, so scans bounded by
+// activity only visit the documents written to since.
+//
+// The read methods answer as the Collection methods of the same name do.
+class CollectionView
+{
+public:
+    struct Document {
+        std::shared_ptr<const DocumentSeries> series;
+        // Collection::documentVersion() when it was published
+        quint64 version;
+        // the newest record of series, a view into its chunks
+        DataRecord latest;
+    };
+    using Documents = PersistentMap<QString, Document>;
+    // the documents again, by the timestamp of their newest record
+    using Activity = PersistentMap<std::pair<qint64, QString>, Document>;
+    using Values = PersistentMap<QString, std::string>;
+
+    CollectionView(const Documents& documents, const Activity& activity, const Values& values, qint64 latestHighWater, quint64 version,
+                   quint64 valuesVersion);
+
+    // The entry for the series: its latest record looked up once, here,
+    // rather than by every read at the high-water mark.
+    static Document document(std::shared_ptr<const DocumentSeries> series, quint64 version);
+
+    quint64 version() const { return m_version; }
+    quint64 documentVersion(const QString& key) const;
+    quint64 valuesVersion() const { return m_valuesVersion; }
+    qint64 latestHighWater() const { return m_latestHighWater; }
+
+    QHash<QString, DataRecord> getAllRecords(qint64 timestamp, const QString& key, qint64 from = 0, const KeyPattern* keyPattern = nullptr,
+                                             const PayloadFilter* filter = nullptr) const;
+    QList<DataRecord> getAllRecordsForDocument(const QString& key, qint64 from, qint64 to, bool reverse = false, qint64 limit = 0,
+                                               const PayloadFilter* filter = nullptr) const;
+    QList<DataRecord> downsampleDocument(const QString& key, qint64 from, qint64 to, qint64 points, DownsampleMethod method,
+                                         const PayloadPath& field, bool reverse = false, qint64 limit = 0,
+                                         const PayloadFilter* filter = nullptr) const;
+    QStringList getDocumentNames(const QString& prefix, const QString& after, qint64 limit, bool* more) const;
+    QHash<QString, std::vector<AggregateBucket>> aggregate(const QString& key, const KeyPattern* keyPattern, qint64 from, qint64 to,
+                                                           qint64 bucketWidth, const PayloadPath& field) const;
+
+    QString getValueForKey(const QString& key) const;
+    QHash<QString, QString> getAllValues(const KeyPattern* keyPattern = nullptr) const;
+    QList<QString> getAllKeys() const;
+
+private:
+    // Calls fn(out, name, document) for the documents matching the pattern
+    // (every document without one) that have records at or after
+    // activeSince. A case-sensitive literal prefix only visits the names under
+    // it; otherwise a bound on activity only visits the documents written to
+    // since, through m_activity. A scan of every document of a large view is
+    // split into runs of leaves that run in parallel, each into its own out.
+    template <typename Value, typename Fn>
+    QHash<QString, Value> collectDocuments(const KeyPattern* pattern, qint64 activeSince, Fn fn) const;
+
+    Documents m_documents;
+    Activity m_activity;
+    Values m_values;
+    qint64 m_latestHighWater;
+    quint64 m_version;
+    quint64 m_valuesVersion;
+};
+
+#endif // COLLECTIONVIEW_H
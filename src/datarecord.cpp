@@ -6,7 +6,7 @@ QJsonObject DataRecord::toJson() const
 {
     QJsonObject obj;
     obj["ts"] = timestamp;
-    obj["data"] = QString::fromStdString(data);
+    obj["data"] = QString::fromUtf8(data.data(), static_cast<qsizetype>(data.size()));
     
     return obj;
 } 
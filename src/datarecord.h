@@ -3,17 +3,16 @@
 
 #include <QString>
 #include <QJsonObject>
-#include <string>
+#include <string_view>
 
 struct DataRecord {
     qint64 timestamp;
-    // using std::string for data since it's half the size of QString
-    std::string data;
-    bool isNew;
+    // view into the owning DocumentSeries chunk, valid until the series is modified
+    std::string_view data;
     
     QJsonObject toJson() const;
     QString toString() const;
 
 };
 
-#endif // DATARECORD_H 
\ No newline at end of file
+#endif // DATARECORD_H 
@@ -1,8 +1,10 @@
 #include "deletecollection.h"
+#include <QCborStreamReader>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonParseError>
 #include <QDebug>
+#include "cborcodec.h"
 
 DeleteCollection DeleteCollection::fromJson(const QString& jsonString, bool* ok)
 {
@@ -28,6 +30,24 @@ DeleteCollection DeleteCollection::fromJson(const QString& jsonString, bool* ok)
     return query;
 }
 
+DeleteCollection DeleteCollection::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    DeleteCollection query;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&query](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &query.col);
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+        if (ok) *ok = false;
+        return query;
+    }
+
+    if (ok) *ok = query.isValid();
+    return query;
+}
+
 bool DeleteCollection::isValid() const
 {
     return !col.isEmpty();
@@ -2,11 +2,13 @@
 #define QUERYDELETECOLLECTION_H
 
 #include <QString>
+#include <QByteArray>
 
 struct DeleteCollection {
     QString col;
     
     static DeleteCollection fromJson(const QString& jsonString, bool* ok = nullptr);
+    static DeleteCollection fromCbor(const QByteArray& cbor, bool* ok = nullptr);
     bool isValid() const;
 };
 
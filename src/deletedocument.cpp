@@ -1,8 +1,10 @@
 #include "deletedocument.h"
+#include <QCborStreamReader>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonParseError>
 #include <QDebug>
+#include "cborcodec.h"
 
 DeleteDocument DeleteDocument::fromJson(const QString& jsonString, bool* ok)
 {
@@ -32,6 +34,25 @@ DeleteDocument DeleteDocument::fromJson(const QString& jsonString, bool* ok)
     return query;
 }
 
+DeleteDocument DeleteDocument::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    DeleteDocument query;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&query](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("doc")) return CborCodec::readString(value, &query.doc);
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &query.col);
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+        if (ok) *ok = false;
+        return query;
+    }
+
+    if (ok) *ok = query.isValid();
+    return query;
+}
+
 bool DeleteDocument::isValid() const
 {
     return !doc.isEmpty();
@@ -2,12 +2,14 @@
 #define DELETE_DOCUMENT_H
 
 #include <QString>
+#include <QByteArray>
 
 struct DeleteDocument {
     QString doc;
     QString col;
     
     static DeleteDocument fromJson(const QString& jsonString, bool* ok = nullptr);
+    static DeleteDocument fromCbor(const QByteArray& cbor, bool* ok = nullptr);
     bool isValid() const;
 };
 
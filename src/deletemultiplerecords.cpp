@@ -2,6 +2,8 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QCborStreamReader>
+#include "cborcodec.h"
 
 
 DeleteMultipleRecords DeleteMultipleRecords::fromJson(const QString& jsonString, bool* ok) {
@@ -41,6 +43,23 @@ DeleteMultipleRecords DeleteMultipleRecords::fromJson(const QString& jsonString,
     return query;
 }
 
+DeleteMultipleRecords DeleteMultipleRecords::fromCbor(const QByteArray& cbor, bool* ok) {
+    DeleteMultipleRecords query;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readArray(reader, [&query](QCborStreamReader& element) {
+        bool recordOk = false;
+        DeleteRecord record = DeleteRecord::fromCborMap(element, &recordOk);
+        if (!recordOk || !record.isValid()) {
+            qWarning() << "Invalid delete record map";
+            return false;
+        }
+        query.records.append(record);
+        return true;
+    });
+    if (ok) *ok = parsed;
+    return query;
+}
+
 bool DeleteMultipleRecords::isValid() const {
     return !records.isEmpty();
 }
@@ -3,11 +3,13 @@
 
 #include <QString>
 #include <QList>
+#include <QByteArray>
 #include "deleterecord.h"
 
 struct DeleteMultipleRecords {
     QList<DeleteRecord> records;
     static DeleteMultipleRecords fromJson(const QString& jsonString, bool* ok);
+    static DeleteMultipleRecords fromCbor(const QByteArray& cbor, bool* ok);
     bool isValid() const;
 };
 
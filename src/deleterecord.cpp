@@ -2,6 +2,8 @@
 #include "deleterecord.h"
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QCborStreamReader>
+#include "cborcodec.h"
 
 
 
@@ -35,6 +37,30 @@ DeleteRecord DeleteRecord::fromJson(const QString& jsonString, bool* ok) {
     return fromJsonObject(doc.object(), ok);
 
 }
+DeleteRecord DeleteRecord::fromCborMap(QCborStreamReader& reader, bool* ok) {
+    DeleteRecord query;
+    query.ts = 0;
+    const bool parsed = CborCodec::readMap(reader, [&query](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("doc")) return CborCodec::readString(value, &query.doc);
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &query.col);
+        if (key == QLatin1String("ts")) return CborCodec::readInteger(value, &query.ts);
+        return CborCodec::skip(value);
+    });
+    if (ok) *ok = parsed;
+    return query;
+}
+
+DeleteRecord DeleteRecord::fromCbor(const QByteArray& cbor, bool* ok) {
+    QCborStreamReader reader(cbor);
+    bool parsed = false;
+    DeleteRecord query = fromCborMap(reader, &parsed);
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+    }
+    if (ok) *ok = parsed;
+    return query;
+}
+
 bool DeleteRecord::isValid() const {
     if (doc.isEmpty()) {
         qWarning() << "doc is empty";
@@ -3,6 +3,10 @@
 
 #include <QString>
 #include <QJsonObject>
+#include <QByteArray>
+
+class QCborStreamReader;
+
 struct DeleteRecord {
     QString doc;
     QString col;
@@ -10,6 +14,9 @@ struct DeleteRecord {
     
     static DeleteRecord fromJson(const QString& jsonString, bool* ok = nullptr);
     static DeleteRecord fromJsonObject(const QJsonObject& jsonObject, bool* ok = nullptr);
+    static DeleteRecord fromCbor(const QByteArray& cbor, bool* ok = nullptr);
+    // Reads the map at the reader's position and advances past it.
+    static DeleteRecord fromCborMap(QCborStreamReader& reader, bool* ok = nullptr);
     bool isValid() const;
 };
 
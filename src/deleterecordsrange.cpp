@@ -1,6 +1,8 @@
 #include "deleterecordsrange.h"
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QCborStreamReader>
+#include "cborcodec.h"
 
 DeleteRecordsRange DeleteRecordsRange::fromJsonObject(const QJsonObject& jsonObject, bool* ok) {
     DeleteRecordsRange query;
@@ -31,6 +33,25 @@ DeleteRecordsRange DeleteRecordsRange::fromJson(const QString& jsonString, bool*
     return fromJsonObject(doc.object(), ok);
 }
 
+DeleteRecordsRange DeleteRecordsRange::fromCbor(const QByteArray& cbor, bool* ok) {
+    DeleteRecordsRange query;
+    query.fromTs = 0;
+    query.toTs = 0;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&query](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("doc")) return CborCodec::readString(value, &query.doc);
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &query.col);
+        if (key == QLatin1String("fromTs")) return CborCodec::readInteger(value, &query.fromTs);
+        if (key == QLatin1String("toTs")) return CborCodec::readInteger(value, &query.toTs);
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+    }
+    if (ok) *ok = parsed;
+    return query;
+}
+
 bool DeleteRecordsRange::isValid() const {
     if (doc.isEmpty()) {
         qWarning() << "doc is empty";
@@ -3,6 +3,7 @@
 
 #include <QString>
 #include <QJsonObject>
+#include <QByteArray>
 
 struct DeleteRecordsRange {
     QString doc;
@@ -12,6 +13,7 @@ struct DeleteRecordsRange {
     
     static DeleteRecordsRange fromJson(const QString& jsonString, bool* ok = nullptr);
     static DeleteRecordsRange fromJsonObject(const QJsonObject& jsonObject, bool* ok = nullptr);
+    static DeleteRecordsRange fromCbor(const QByteArray& cbor, bool* ok = nullptr);
     bool isValid() const;
 };
 
@@ -0,0 +1,20 @@
+#include "documentindex.h"
+
+void DocumentIndex::insert(const QString &name, const DocumentSeries *series)
+{
+    m_documents[name] = series;
+}
+
+void DocumentIndex::remove(const QString &name)
+{
+    m_documents.erase(name);
+}
+
+void DocumentIndex::rebuild(const std::unordered_map<QString, DocumentSeries> &documents)
+{
+    m_documents.clear();
+    for (const auto &[name, series] : documents)
+    {
+        m_documents.emplace(name, &series);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef DOCUMENTINDEX_H
+#define DOCUMENTINDEX_H
+
+#include <QString>
+#include <map>
+#include <unordered_map>
+#include "documentseries.h"
+
+// Document names of a collection in lexicographic order, next to the hash map
+// that owns the series. Hierarchical names ("region/site/device-7") sharing a
+// prefix are adjacent, so prefix and range enumeration cost the documents
+// visited instead of the whole collection.
+class DocumentIndex
+{
+public:
+    // Series pointers stay valid until the document is removed, since the
+    // owning unordered_map does not move its elements when it rehashes.
+    void insert(const QString& name, const DocumentSeries* series);
+    void remove(const QString& name);
+    void rebuild(const std::unordered_map<QString, DocumentSeries>& documents);
+
+    qsizetype size() const { return static_cast<qsizetype>(m_documents.size()); }
+
+    // Calls fn(name, series) for the documents starting with prefix, in
+    // order, until fn returns false.
+    template <typename Fn>
+    void forEachWithPrefix(const QString& prefix, Fn fn) const
+    {
+        for (auto it = m_documents.lower_bound(prefix); it != m_documents.end() && it->first.startsWith(prefix); ++it)
+        {
+            if (!fn(it->first, *it->second))
+            {
+                return;
+            }
+        }
+    }
+
+    // Same for the documents after the name `after` (all for an empty one).
+    template <typename Fn>
+    void forEachAfter(const QString& after, const QString& prefix, Fn fn) const
+    {
+        auto it = after.isEmpty() || after < prefix ? m_documents.lower_bound(prefix) : m_documents.upper_bound(after);
+        for (; it != m_documents.end() && it->first.startsWith(prefix); ++it)
+        {
+            if (!fn(it->first, *it->second))
+            {
+                return;
+            }
+        }
+    }
+
+private:
+    std::map<QString, const DocumentSeries*> m_documents;
+};
+
+#endif // DOCUMENTINDEX_H
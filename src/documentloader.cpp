@@ -0,0 +1,131 @@
+#include "documentloader.h"
+#include <QSemaphore>
+#include <QThreadPool>
+#include <algorithm>
+
+void DocumentLoader::addRecord(const QString &doc, quint64 sequence, qint64 timestamp, std::string_view data)
+{
+    m_documents[doc].records.push_back(Record{timestamp, sequence, data, false});
+}
+
+void DocumentLoader::addDeletion(const QString &doc, quint64 sequence, qint64 fromTs, qint64 toTs)
+{
+    m_documents[doc].deletions.push_back(Deletion{fromTs, toTs, sequence});
+}
+
+void DocumentLoader::addClear(const QString &doc, quint64 sequence)
+{
+    Document &document = m_documents[doc];
+    document.clearedAt = std::max(document.clearedAt, sequence);
+}
+
+std::string_view DocumentLoader::keep(std::string data)
+{
+    m_ownedPayloads.push_back(std::move(data));
+    return m_ownedPayloads.back();
+}
+
+qsizetype DocumentLoader::build(std::unordered_map<QString, DocumentSeries> &out, QThreadPool *pool)
+{
+    // create every series up front so the builders only touch their own entry
+    std::vector<std::pair<Document *, DocumentSeries *>> work;
+    work.reserve(m_documents.size());
+    out.reserve(out.size() + m_documents.size());
+    for (auto &[key, document] : m_documents)
+    {
+        work.emplace_back(&document, &out[key]);
+    }
+
+    const int batches = static_cast<int>(std::min<size_t>(work.size(), static_cast<size_t>(pool->maxThreadCount()) * 4));
+    QSemaphore done;
+    for (int batch = 0; batch < batches; ++batch)
+    {
+        pool->start([&work, &done, batch, batches]()
+                    {
+                        for (size_t i = batch; i < work.size(); i += batches)
+                        {
+                            buildDocument(*work[i].first, *work[i].second);
+                        }
+                        done.release();
+                    });
+    }
+    done.acquire(batches);
+
+    qsizetype records = 0;
+    for (const auto &entry : m_documents)
+    {
+        auto it = out.find(entry.first);
+        if (it->second.isEmpty())
+        {
+            // every record was deleted
+            out.erase(it);
+            continue;
+        }
+        records += it->second.size();
+    }
+    m_documents.clear();
+    m_ownedPayloads.clear();
+    return records;
+}
+
+void DocumentLoader::buildDocument(Document &document, DocumentSeries &series)
+{
+    auto &records = document.records;
+    const quint64 clearedAt = document.clearedAt;
+    if (clearedAt > 0)
+    {
+        records.erase(std::remove_if(records.begin(), records.end(),
+                                     [clearedAt](const Record &record)
+                                     {
+                                         return record.sequence < clearedAt;
+                                     }),
+                      records.end());
+    }
+
+    // by timestamp, later writes of the same timestamp last
+    const auto byTime = [](const Record &a, const Record &b)
+    {
+        return a.timestamp < b.timestamp || (a.timestamp == b.timestamp && a.sequence < b.sequence);
+    };
+    if (!std::is_sorted(records.begin(), records.end(), byTime))
+    {
+        std::sort(records.begin(), records.end(), byTime);
+    }
+
+    for (const Deletion &deletion : document.deletions)
+    {
+        auto it = std::lower_bound(records.begin(), records.end(), deletion.fromTs,
+                                   [](const Record &record, qint64 ts)
+                                   {
+                                       return record.timestamp < ts;
+                                   });
+        for (; it != records.end() && it->timestamp <= deletion.toTs; ++it)
+        {
+            if (it->sequence < deletion.sequence)
+            {
+                it->deleted = true;
+            }
+        }
+    }
+
+    std::vector<DataRecord> resolved;
+    resolved.reserve(records.size());
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        // the latest write of each timestamp wins
+        if (i + 1 < records.size() && records[i + 1].timestamp == records[i].timestamp)
+        {
+            continue;
+        }
+        if (!records[i].deleted)
+        {
+            resolved.push_back(DataRecord{records[i].timestamp, records[i].data});
+        }
+    }
+    series.assign(resolved);
+
+    records.clear();
+    records.shrink_to_fit();
+    document.deletions.clear();
+    document.deletions.shrink_to_fit();
+}
@@ -0,0 +1,57 @@
+#ifndef DOCUMENTLOADER_H
+#define DOCUMENTLOADER_H
+
+#include <QString>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "documentseries.h"
+
+class QThreadPool;
+
+// Collects the persisted history of a collection's documents, records and
+// deletions in write order, and resolves it into sorted series in one pass
+// per document instead of inserting record by record. A higher sequence
+// means a later write.
+class DocumentLoader {
+public:
+    void addRecord(const QString& doc, quint64 sequence, qint64 timestamp, std::string_view data);
+    void addDeletion(const QString& doc, quint64 sequence, qint64 fromTs, qint64 toTs);
+    void addClear(const QString& doc, quint64 sequence);
+    // Keeps a payload whose source buffer is released before build().
+    std::string_view keep(std::string data);
+
+    // Builds every collected document into the map, in parallel on the pool,
+    // and returns the number of records loaded.
+    qsizetype build(std::unordered_map<QString, DocumentSeries>& out, QThreadPool* pool);
+
+private:
+    struct Record {
+        qint64 timestamp;
+        quint64 sequence;
+        std::string_view data;
+        bool deleted;
+    };
+
+    struct Deletion {
+        qint64 fromTs;
+        qint64 toTs;
+        quint64 sequence;
+    };
+
+    struct Document {
+        std::vector<Record> records;
+        std::vector<Deletion> deletions;
+        // records written before the last clear are dropped
+        quint64 clearedAt = 0;
+    };
+
+    static void buildDocument(Document& document, DocumentSeries& series);
+
+    std::unordered_map<QString, Document> m_documents;
+    std::deque<std::string> m_ownedPayloads;
+};
+
+#endif // DOCUMENTLOADER_H
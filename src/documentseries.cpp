@@ -0,0 +1,583 @@
+#include "documentseries.h"
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <utility>
+
+quint32 DocumentSeries::Chunk::payloadEnd(int row) const
+{
+    return row + 1 < rows() ? offsets[row + 1] : static_cast<quint32>(arena.size());
+}
+
+std::string_view DocumentSeries::Chunk::payload(int row) const
+{
+    const quint32 start = offsets[row];
+    return std::string_view(arena.data() + start, payloadEnd(row) - start);
+}
+
+void DocumentSeries::Chunk::insertRow(int row, qint64 timestamp, std::string_view data)
+{
+    const quint32 start = row < rows() ? offsets[row] : static_cast<quint32>(arena.size());
+    const quint32 length = static_cast<quint32>(data.size());
+    arena.insert(start, data.data(), data.size());
+    timestamps.insert(timestamps.begin() + row, timestamp);
+    offsets.insert(offsets.begin() + row, start);
+    for (int i = row + 1; i < rows(); ++i)
+    {
+        offsets[i] += length;
+    }
+}
+
+void DocumentSeries::Chunk::replaceRow(int row, std::string_view data)
+{
+    const quint32 start = offsets[row];
+    const quint32 oldLength = payloadEnd(row) - start;
+    arena.replace(start, oldLength, data.data(), data.size());
+    const quint32 newLength = static_cast<quint32>(data.size());
+    for (int i = row + 1; i < rows(); ++i)
+    {
+        // unsigned wrap-around makes this correct for shrinking payloads too
+        offsets[i] = offsets[i] - oldLength + newLength;
+    }
+}
+
+void DocumentSeries::Chunk::eraseRows(int first, int last)
+{
+    const quint32 start = offsets[first];
+    const quint32 end = last < rows() ? offsets[last] : static_cast<quint32>(arena.size());
+    const quint32 length = end - start;
+    arena.erase(start, length);
+    timestamps.erase(timestamps.begin() + first, timestamps.begin() + last);
+    offsets.erase(offsets.begin() + first, offsets.begin() + last);
+    for (int i = first; i < rows(); ++i)
+    {
+        offsets[i] -= length;
+    }
+}
+
+void DocumentSeries::Chunk::append(const Chunk &other)
+{
+    const quint32 base = static_cast<quint32>(arena.size());
+    arena.append(other.arena);
+    timestamps.insert(timestamps.end(), other.timestamps.begin(), other.timestamps.end());
+    offsets.reserve(offsets.size() + other.offsets.size());
+    for (const quint32 offset : other.offsets)
+    {
+        offsets.push_back(base + offset);
+    }
+}
+
+DocumentSeries::Chunk DocumentSeries::Chunk::splitOff(int row)
+{
+    Chunk upper;
+    const quint32 base = offsets[row];
+    upper.arena.assign(arena, base, std::string::npos);
+    upper.timestamps.assign(timestamps.begin() + row, timestamps.end());
+    upper.offsets.reserve(offsets.size() - row);
+    for (auto it = offsets.begin() + row; it != offsets.end(); ++it)
+    {
+        upper.offsets.push_back(*it - base);
+    }
+
+    arena.resize(base);
+    timestamps.resize(row);
+    offsets.resize(row);
+    return upper;
+}
+
+void DocumentSeries::Chunk::shrink()
+{
+    timestamps.shrink_to_fit();
+    offsets.shrink_to_fit();
+    arena.shrink_to_fit();
+}
+
+bool DocumentSeries::ownsChunk(int index) const
+{
+    // use_count() is a relaxed load, so seeing 1 alone does not order this
+    // thread after a reader on another thread that just dropped its copy.
+    // That reader's decrement is a release; the acquire fence after reading
+    // the count it left synchronizes with it, so every read it made of the
+    // chunk happens before the writes that follow. The count cannot rise
+    // again meanwhile: copies are only taken on the thread owning the series.
+    if (m_chunks[index].use_count() != 1)
+    {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+
+DocumentSeries::Chunk &DocumentSeries::mutableChunk(int index)
+{
+    // copy on write: a snapshot still reading this chunk keeps the old version
+    if (!ownsChunk(index))
+    {
+        m_chunks[index] = std::make_shared<Chunk>(*m_chunks[index]);
+    }
+    return *m_chunks[index];
+}
+
+void DocumentSeries::insert(qint64 timestamp, std::string_view data)
+{
+    // an insert or replace only ever widens the bounds
+    m_firstTimestamp = std::min(m_firstTimestamp, timestamp);
+    m_lastTimestamp = std::max(m_lastTimestamp, timestamp);
+
+    // Fast path: appending past the newest record, which is the common case.
+    if (m_chunks.empty() || timestamp > m_chunks.back()->timestamps.back())
+    {
+        if (m_chunks.empty() || m_chunks.back()->rows() >= ChunkCapacity)
+        {
+            if (!m_chunks.empty() && ownsChunk(static_cast<int>(m_chunks.size()) - 1))
+            {
+                m_chunks.back()->shrink();
+            }
+            m_chunks.push_back(std::make_shared<Chunk>());
+        }
+        Chunk &tail = mutableChunk(static_cast<int>(m_chunks.size()) - 1);
+        tail.insertRow(tail.rows(), timestamp, data);
+        ++m_size;
+        return;
+    }
+
+    int index = chunkFor(timestamp);
+    const Chunk &current = *m_chunks[index];
+    auto it = std::lower_bound(current.timestamps.begin(), current.timestamps.end(), timestamp);
+    int row = static_cast<int>(it - current.timestamps.begin());
+    if (it != current.timestamps.end() && *it == timestamp)
+    {
+        mutableChunk(index).replaceRow(row, data); // Replace existing record
+        return;
+    }
+
+    // Falls between two chunks: prefer the tail of the previous one if it has room.
+    if (row == 0 && index > 0 && m_chunks[index - 1]->rows() < ChunkCapacity)
+    {
+        Chunk &previous = mutableChunk(index - 1);
+        previous.insertRow(previous.rows(), timestamp, data);
+        ++m_size;
+        return;
+    }
+
+    if (current.rows() >= ChunkCapacity)
+    {
+        const int half = current.rows() / 2;
+        auto upper = std::make_shared<Chunk>(mutableChunk(index).splitOff(half));
+        m_chunks.insert(m_chunks.begin() + index + 1, std::move(upper));
+        if (row > half)
+        {
+            ++index;
+            row -= half;
+        }
+    }
+
+    mutableChunk(index).insertRow(row, timestamp, data);
+    ++m_size;
+}
+
+void DocumentSeries::insertSorted(const std::vector<DataRecord> &records)
+{
+    if (records.empty())
+    {
+        return;
+    }
+    m_firstTimestamp = std::min(m_firstTimestamp, records.front().timestamp);
+    m_lastTimestamp = std::max(m_lastTimestamp, records.back().timestamp);
+
+    if (m_chunks.empty() || records.front().timestamp > m_chunks.back()->timestamps.back())
+    {
+        appendSorted(records.begin(), records.end());
+        return;
+    }
+
+    // every chunk before the first one reached only holds older records
+    const int first = chunkFor(records.front().timestamp);
+    qsizetype existing = 0;
+    for (auto it = m_chunks.begin() + first; it != m_chunks.end(); ++it)
+    {
+        existing += (*it)->rows();
+    }
+    if (static_cast<qsizetype>(records.size()) * ChunkCapacity < existing)
+    {
+        // a few records deep in a long history: shifting rows within their
+        // chunks is cheaper than rebuilding everything after them
+        for (const DataRecord &record : records)
+        {
+            insert(record.timestamp, record.data);
+        }
+        return;
+    }
+
+    // the merged records point into these until the new chunks are built
+    std::vector<std::shared_ptr<Chunk>> old(std::make_move_iterator(m_chunks.begin() + first),
+                                            std::make_move_iterator(m_chunks.end()));
+    m_chunks.resize(first);
+
+    std::vector<DataRecord> merged;
+    merged.reserve(static_cast<size_t>(existing) + records.size());
+    auto next = records.begin();
+    for (const auto &chunk : old)
+    {
+        for (int row = 0; row < chunk->rows(); ++row)
+        {
+            const qint64 timestamp = chunk->timestamps[row];
+            while (next != records.end() && next->timestamp < timestamp)
+            {
+                merged.push_back(*next++);
+            }
+            if (next != records.end() && next->timestamp == timestamp)
+            {
+                merged.push_back(*next++); // replaces the existing record
+                continue;
+            }
+            merged.push_back(DataRecord{timestamp, chunk->payload(row)});
+        }
+    }
+    merged.insert(merged.end(), next, records.end());
+
+    m_size -= existing;
+    appendSorted(merged.begin(), merged.end());
+}
+
+void DocumentSeries::appendSorted(std::vector<DataRecord>::const_iterator first, std::vector<DataRecord>::const_iterator last)
+{
+    while (first != last)
+    {
+        if (m_chunks.empty() || m_chunks.back()->rows() >= ChunkCapacity)
+        {
+            if (!m_chunks.empty() && ownsChunk(static_cast<int>(m_chunks.size()) - 1))
+            {
+                m_chunks.back()->shrink();
+            }
+            m_chunks.push_back(std::make_shared<Chunk>());
+        }
+        Chunk &tail = mutableChunk(static_cast<int>(m_chunks.size()) - 1);
+        const auto count = std::min<std::ptrdiff_t>(last - first, ChunkCapacity - tail.rows());
+        if (tail.rows() == 0)
+        {
+            // a fresh chunk is sized once; a partly filled one grows as usual
+            size_t bytes = 0;
+            for (auto it = first; it != first + count; ++it)
+            {
+                bytes += it->data.size();
+            }
+            tail.timestamps.reserve(count);
+            tail.offsets.reserve(count);
+            tail.arena.reserve(bytes);
+        }
+        for (auto it = first; it != first + count; ++it)
+        {
+            tail.timestamps.push_back(it->timestamp);
+            tail.offsets.push_back(static_cast<quint32>(tail.arena.size()));
+            tail.arena.append(it->data);
+        }
+        first += count;
+        m_size += count;
+    }
+}
+
+void DocumentSeries::assign(const std::vector<DataRecord> &records)
+{
+    m_chunks.clear();
+    m_chunks.reserve((records.size() + ChunkCapacity - 1) / ChunkCapacity);
+    for (size_t first = 0; first < records.size(); first += ChunkCapacity)
+    {
+        const size_t last = std::min(records.size(), first + static_cast<size_t>(ChunkCapacity));
+        size_t bytes = 0;
+        for (size_t i = first; i < last; ++i)
+        {
+            bytes += records[i].data.size();
+        }
+
+        auto chunk = std::make_shared<Chunk>();
+        chunk->timestamps.reserve(last - first);
+        chunk->offsets.reserve(last - first);
+        chunk->arena.reserve(bytes);
+        for (size_t i = first; i < last; ++i)
+        {
+            chunk->timestamps.push_back(records[i].timestamp);
+            chunk->offsets.push_back(static_cast<quint32>(chunk->arena.size()));
+            chunk->arena.append(records[i].data);
+        }
+        m_chunks.push_back(std::move(chunk));
+    }
+    m_size = static_cast<qsizetype>(records.size());
+    updateBounds();
+}
+
+bool DocumentSeries::remove(qint64 timestamp)
+{
+    if (m_chunks.empty())
+    {
+        return false;
+    }
+
+    const int index = chunkFor(timestamp);
+    const Chunk &current = *m_chunks[index];
+    auto it = std::lower_bound(current.timestamps.begin(), current.timestamps.end(), timestamp);
+    if (it == current.timestamps.end() || *it != timestamp)
+    {
+        return false;
+    }
+
+    const int row = static_cast<int>(it - current.timestamps.begin());
+    --m_size;
+    if (current.rows() == 1)
+    {
+        m_chunks.erase(m_chunks.begin() + index);
+    }
+    else
+    {
+        mutableChunk(index).eraseRows(row, row + 1);
+        mergeIfSparse(index);
+    }
+    updateBounds();
+    return true;
+}
+
+qsizetype DocumentSeries::removeRange(qint64 fromTs, qint64 toTs)
+{
+    if (m_chunks.empty() || fromTs > toTs)
+    {
+        return 0;
+    }
+
+    qsizetype removed = 0;
+    const int firstTouched = chunkFor(fromTs);
+    int index = firstTouched;
+    while (index < static_cast<int>(m_chunks.size()))
+    {
+        const Chunk &current = *m_chunks[index];
+        if (current.timestamps.front() > toTs)
+        {
+            break;
+        }
+
+        const auto first = std::lower_bound(current.timestamps.begin(), current.timestamps.end(), fromTs);
+        const auto last = std::upper_bound(first, current.timestamps.end(), toTs);
+        const int firstRow = static_cast<int>(first - current.timestamps.begin());
+        const int lastRow = static_cast<int>(last - current.timestamps.begin());
+        if (firstRow == 0 && lastRow == current.rows())
+        {
+            removed += lastRow;
+            m_chunks.erase(m_chunks.begin() + index);
+            continue;
+        }
+        if (firstRow < lastRow)
+        {
+            mutableChunk(index).eraseRows(firstRow, lastRow);
+            removed += lastRow - firstRow;
+        }
+        ++index;
+    }
+
+    m_size -= removed;
+    if (removed > 0)
+    {
+        mergeIfSparse(std::min(firstTouched, static_cast<int>(m_chunks.size()) - 1));
+        updateBounds();
+    }
+    return removed;
+}
+
+void DocumentSeries::updateBounds()
+{
+    if (m_chunks.empty())
+    {
+        m_firstTimestamp = std::numeric_limits<qint64>::max();
+        m_lastTimestamp = std::numeric_limits<qint64>::min();
+        return;
+    }
+    m_firstTimestamp = m_chunks.front()->timestamps.front();
+    m_lastTimestamp = m_chunks.back()->timestamps.back();
+}
+
+DocumentSeries::Position DocumentSeries::latestPosition(qint64 timestamp) const
+{
+    // queries at "now" land past the newest record
+    if (m_size > 0 && timestamp >= m_lastTimestamp)
+    {
+        Position pos;
+        pos.chunk = static_cast<int>(m_chunks.size()) - 1;
+        pos.row = m_chunks.back()->rows() - 1;
+        return pos;
+    }
+    if (timestamp < m_firstTimestamp)
+    {
+        return Position();
+    }
+
+    // first chunk starting after the timestamp; the answer lives in the chunk before it
+    auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), timestamp,
+                               [](qint64 ts, const std::shared_ptr<Chunk> &chunk)
+                               {
+                                   return ts < chunk->timestamps.front();
+                               });
+    if (it == m_chunks.begin())
+    {
+        return Position();
+    }
+    --it;
+
+    const auto &timestamps = (*it)->timestamps;
+    const auto rowIt = std::upper_bound(timestamps.begin(), timestamps.end(), timestamp);
+    Position pos;
+    pos.chunk = static_cast<int>(it - m_chunks.begin());
+    pos.row = static_cast<int>(rowIt - timestamps.begin()) - 1;
+    return pos;
+}
+
+DocumentSeries::Position DocumentSeries::earliestPosition(qint64 timestamp) const
+{
+    if (m_size > 0 && timestamp <= m_firstTimestamp)
+    {
+        Position pos;
+        pos.chunk = 0;
+        pos.row = 0;
+        return pos;
+    }
+    if (timestamp > m_lastTimestamp)
+    {
+        return Position();
+    }
+
+    auto it = std::lower_bound(m_chunks.begin(), m_chunks.end(), timestamp,
+                               [](const std::shared_ptr<Chunk> &chunk, qint64 ts)
+                               {
+                                   return chunk->timestamps.back() < ts;
+                               });
+    if (it == m_chunks.end())
+    {
+        return Position();
+    }
+
+    const auto &timestamps = (*it)->timestamps;
+    const auto rowIt = std::lower_bound(timestamps.begin(), timestamps.end(), timestamp);
+    Position pos;
+    pos.chunk = static_cast<int>(it - m_chunks.begin());
+    pos.row = static_cast<int>(rowIt - timestamps.begin());
+    return pos;
+}
+
+DataRecord DocumentSeries::recordAt(const Position &pos) const
+{
+    const Chunk &chunk = *m_chunks[pos.chunk];
+    return DataRecord{chunk.timestamps[pos.row], chunk.payload(pos.row)};
+}
+
+bool DocumentSeries::next(Position &pos) const
+{
+    if (!pos.isValid())
+    {
+        return false;
+    }
+    if (++pos.row < m_chunks[pos.chunk]->rows())
+    {
+        return true;
+    }
+    if (++pos.chunk < static_cast<int>(m_chunks.size()))
+    {
+        pos.row = 0;
+        return true;
+    }
+    pos = Position();
+    return false;
+}
+
+bool DocumentSeries::previous(Position &pos) const
+{
+    if (!pos.isValid())
+    {
+        return false;
+    }
+    if (--pos.row >= 0)
+    {
+        return true;
+    }
+    if (--pos.chunk >= 0)
+    {
+        pos.row = m_chunks[pos.chunk]->rows() - 1;
+        return true;
+    }
+    pos = Position();
+    return false;
+}
+
+DocumentSeries::Snapshot DocumentSeries::snapshot(qint64 fromTs) const
+{
+    return snapshot(TimeRanges{{fromTs, std::numeric_limits<qint64>::max()}});
+}
+
+DocumentSeries::Snapshot DocumentSeries::snapshot(const TimeRanges &ranges) const
+{
+    Snapshot result;
+    int next = 0;
+    for (const auto &[from, to] : ranges)
+    {
+        const Position first = earliestPosition(from);
+        if (!first.isValid())
+        {
+            break;
+        }
+        // a chunk overlapping several ranges is referenced once
+        for (int chunk = std::max(first.chunk, next); chunk < static_cast<int>(m_chunks.size()) && m_chunks[chunk]->timestamps.front() <= to;
+             ++chunk)
+        {
+            result.m_chunks.push_back(m_chunks[chunk]);
+            next = chunk + 1;
+        }
+    }
+    if (!result.m_chunks.empty())
+    {
+        result.m_ranges = ranges;
+    }
+    return result;
+}
+
+int DocumentSeries::chunkFor(qint64 timestamp) const
+{
+    // first chunk whose newest record is not older than the timestamp, else the tail
+    auto it = std::lower_bound(m_chunks.begin(), m_chunks.end(), timestamp,
+                               [](const std::shared_ptr<Chunk> &chunk, qint64 ts)
+                               {
+                                   return chunk->timestamps.back() < ts;
+                               });
+    if (it == m_chunks.end())
+    {
+        return static_cast<int>(m_chunks.size()) - 1;
+    }
+    return static_cast<int>(it - m_chunks.begin());
+}
+
+void DocumentSeries::mergeIfSparse(int chunkIndex)
+{
+    if (chunkIndex < 0 || chunkIndex >= static_cast<int>(m_chunks.size()))
+    {
+        return;
+    }
+
+    const int rows = m_chunks[chunkIndex]->rows();
+    if (rows < ChunkCapacity / 4)
+    {
+        if (chunkIndex + 1 < static_cast<int>(m_chunks.size()) &&
+            rows + m_chunks[chunkIndex + 1]->rows() <= ChunkCapacity)
+        {
+            mutableChunk(chunkIndex).append(*m_chunks[chunkIndex + 1]);
+            m_chunks.erase(m_chunks.begin() + chunkIndex + 1);
+            return;
+        }
+        if (chunkIndex > 0 && m_chunks[chunkIndex - 1]->rows() + rows <= ChunkCapacity)
+        {
+            mutableChunk(chunkIndex - 1).append(*m_chunks[chunkIndex]);
+            m_chunks.erase(m_chunks.begin() + chunkIndex);
+            return;
+        }
+    }
+
+    const auto capacity = m_chunks[chunkIndex]->timestamps.capacity();
+    if (capacity > 0 && static_cast<size_t>(rows) * 2 < capacity && ownsChunk(chunkIndex))
+    {
+        m_chunks[chunkIndex]->shrink();
+    }
+}
@@ -0,0 +1,172 @@
+#ifndef DOCUMENTSERIES_H
+#define DOCUMENTSERIES_H
+
+#include <QtGlobal>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "datarecord.h"
+
+// Time ordered records of a single document. Records are stored column-wise in
+// fixed-size chunks: a contiguous timestamp array and a packed payload arena,
+// so a series costs a handful of allocations per chunk instead of one per record.
+// Chunks are shared copy-on-write with snapshots.
+class DocumentSeries {
+    struct Chunk;
+
+public:
+    static constexpr int ChunkCapacity = 512;
+
+    struct Position {
+        int chunk = -1;
+        int row = -1;
+
+        bool isValid() const { return chunk >= 0; }
+    };
+
+    void insert(qint64 timestamp, std::string_view data);
+    // Inserts records sorted by unique timestamp in one pass, replacing the
+    // ones with a timestamp already present. Records past the newest one are
+    // appended; otherwise the chunks from the first one reached are merged
+    // with the batch and rebuilt, instead of shifting rows once per record.
+    void insertSorted(const std::vector<DataRecord> &records);
+    // Replaces the contents with records already sorted by unique timestamp,
+    // filling each chunk in one pass.
+    void assign(const std::vector<DataRecord> &records);
+    bool remove(qint64 timestamp);
+    qsizetype removeRange(qint64 fromTs, qint64 toTs);
+
+    // last record with timestamp <= the given timestamp
+    Position latestPosition(qint64 timestamp) const;
+    // first record with timestamp >= the given timestamp
+    Position earliestPosition(qint64 timestamp) const;
+    DataRecord recordAt(const Position &pos) const;
+    bool next(Position &pos) const;
+    bool previous(Position &pos) const;
+
+    // Calls fn(record) for the records in [from, to], oldest first or, with
+    // reverse, newest first, until fn returns false. Only the records visited
+    // are touched, so a bounded scan costs its bound rather than the range.
+    template <typename Fn>
+    void forEachInRange(qint64 from, qint64 to, bool reverse, Fn fn) const
+    {
+        if (from > to)
+        {
+            return;
+        }
+        Position pos = reverse ? latestPosition(to) : earliestPosition(from);
+        while (pos.isValid())
+        {
+            const DataRecord record = recordAt(pos);
+            if (reverse ? record.timestamp < from : record.timestamp > to)
+            {
+                return;
+            }
+            if (!fn(record))
+            {
+                return;
+            }
+            if (reverse)
+            {
+                previous(pos);
+            }
+            else
+            {
+                next(pos);
+            }
+        }
+    }
+
+    qsizetype size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    // Oldest and newest timestamps, kept next to the size on every change so
+    // scans across documents can skip one without searching its chunks.
+    // An empty series has first = max and last = min, overlapping nothing.
+    qint64 firstTimestamp() const { return m_firstTimestamp; }
+    qint64 lastTimestamp() const { return m_lastTimestamp; }
+    // whether any record lies in [from, to]
+    bool overlaps(qint64 from, qint64 to) const { return m_firstTimestamp <= to && m_lastTimestamp >= from; }
+
+    // Sorted, disjoint [from, to] timestamp ranges.
+    using TimeRanges = std::vector<std::pair<qint64, qint64>>;
+
+    // Immutable view of the records in some time ranges. It holds its own
+    // references to the chunks, so it stays valid and may be read from another
+    // thread while the series keeps changing.
+    class Snapshot {
+    public:
+        bool isEmpty() const { return m_chunks.empty(); }
+
+        template <typename Fn>
+        void forEach(Fn fn) const
+        {
+            size_t range = 0;
+            for (const auto &chunk : m_chunks)
+            {
+                for (int row = 0; row < chunk->rows(); ++row)
+                {
+                    const qint64 timestamp = chunk->timestamps[row];
+                    while (m_ranges[range].second < timestamp)
+                    {
+                        if (++range == m_ranges.size())
+                        {
+                            return;
+                        }
+                    }
+                    if (timestamp >= m_ranges[range].first)
+                    {
+                        fn(DataRecord{timestamp, chunk->payload(row)});
+                    }
+                }
+            }
+        }
+
+    private:
+        friend class DocumentSeries;
+        std::vector<std::shared_ptr<const Chunk>> m_chunks;
+        TimeRanges m_ranges;
+    };
+
+    // The records from a timestamp on, or those in the given ranges; only the
+    // chunks holding them are referenced.
+    Snapshot snapshot(qint64 fromTs = std::numeric_limits<qint64>::min()) const;
+    Snapshot snapshot(const TimeRanges& ranges) const;
+
+private:
+    struct Chunk {
+        std::vector<qint64> timestamps;
+        // start of each record in the arena; a record ends where the next one starts
+        std::vector<quint32> offsets;
+        std::string arena;
+
+        int rows() const { return static_cast<int>(timestamps.size()); }
+        quint32 payloadEnd(int row) const;
+        std::string_view payload(int row) const;
+        void insertRow(int row, qint64 timestamp, std::string_view data);
+        void replaceRow(int row, std::string_view data);
+        void eraseRows(int first, int last);
+        void append(const Chunk &other);
+        Chunk splitOff(int row);
+        void shrink();
+    };
+
+    // whether no snapshot shares the chunk, so it may change in place
+    bool ownsChunk(int index) const;
+    Chunk &mutableChunk(int index);
+    // appends records sorted past the newest one, filling the tail chunk first
+    void appendSorted(std::vector<DataRecord>::const_iterator first, std::vector<DataRecord>::const_iterator last);
+    int chunkFor(qint64 timestamp) const;
+    void mergeIfSparse(int chunkIndex);
+    void updateBounds();
+
+    std::vector<std::shared_ptr<Chunk>> m_chunks;
+    qsizetype m_size = 0;
+    qint64 m_firstTimestamp = std::numeric_limits<qint64>::max();
+    qint64 m_lastTimestamp = std::numeric_limits<qint64>::min();
+};
+
+#endif // DOCUMENTSERIES_H
@@ -3,7 +3,9 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJsonParseError>
+#include <QCborStreamReader>
 #include <QDebug>
+#include "cborcodec.h"
 
 QList<InsertRequest> InsertRequest::fromJson(const QString& jsonString, bool* ok)
 {       
@@ -44,6 +46,37 @@ QList<InsertRequest> InsertRequest::fromJson(const QString& jsonString, bool* ok
     return payloads;
 }
 
+QList<InsertRequest> InsertRequest::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    QList<InsertRequest> payloads;
+    QCborStreamReader reader(cbor);
+    if (reader.isArray() && reader.isLengthKnown()) {
+        payloads.reserve(static_cast<qsizetype>(reader.length()));
+    }
+    const bool parsed = CborCodec::readArray(reader, [&payloads](QCborStreamReader& element) {
+        InsertRequest payload;
+        payload.ts = 0;
+        const bool fields = CborCodec::readMap(element, [&payload](const QString& key, QCborStreamReader& value) {
+            if (key == QLatin1String("ts")) return CborCodec::readInteger(value, &payload.ts);
+            if (key == QLatin1String("doc")) return CborCodec::readString(value, &payload.doc);
+            if (key == QLatin1String("data")) return CborCodec::readString(value, &payload.data);
+            if (key == QLatin1String("col")) return CborCodec::readString(value, &payload.col);
+            return CborCodec::skip(value);
+        });
+        payloads.append(payload);
+        return fields;
+    });
+
+    if (!parsed) {
+        qWarning() << "CBOR payload is not an array of insert maps";
+        if (ok) *ok = false;
+        return payloads;
+    }
+
+    if (ok) *ok = true;
+    return payloads;
+}
+
 bool InsertRequest::isValid() const
 {
     return ts > 0 && !doc.isEmpty() && !data.isEmpty() && !col.isEmpty();
@@ -3,6 +3,7 @@
 
 #include <QString>
 #include <QList>
+#include <QByteArray>
 struct InsertRequest {
     qint64 ts;
     QString doc;
@@ -10,6 +11,7 @@ struct InsertRequest {
     QString col;
     
     static QList<InsertRequest> fromJson(const QString& jsonString, bool* ok = nullptr);
+    static QList<InsertRequest> fromCbor(const QByteArray& cbor, bool* ok = nullptr);
     bool isValid() const;
 };
 
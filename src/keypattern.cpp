@@ -0,0 +1,402 @@
+#include "keypattern.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <algorithm>
+
+namespace {
+
+// Literal runs checked per key, longest first.
+constexpr int MaxRequiredLiterals = 3;
+
+// End of the character class opening at start, or -1.
+int skipClass(const QString &pattern, int start)
+{
+    int i = start + 1;
+    if (i < pattern.size() && pattern.at(i) == '^')
+    {
+        ++i;
+    }
+    if (i < pattern.size() && pattern.at(i) == ']')
+    {
+        ++i;
+    }
+    while (i < pattern.size())
+    {
+        const QChar ch = pattern.at(i);
+        if (ch == '\\')
+        {
+            i += 2;
+        }
+        else if (ch == '[' && i + 1 < pattern.size() && pattern.at(i + 1) == ':')
+        {
+            const int end = pattern.indexOf(QStringLiteral(":]"), i + 2);
+            if (end < 0)
+            {
+                return -1;
+            }
+            i = end + 2;
+        }
+        else if (ch == ']')
+        {
+            return i + 1;
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    return -1;
+}
+
+// End of the group opening at start, or -1 when it ends the pattern early or
+// uses syntax that changes how the rest of the pattern reads (inline options,
+// verbs).
+int skipGroup(const QString &pattern, int start)
+{
+    int depth = 0;
+    int i = start;
+    while (i < pattern.size())
+    {
+        const QChar ch = pattern.at(i);
+        if (ch == '\\')
+        {
+            i += 2;
+            continue;
+        }
+        if (ch == '[')
+        {
+            i = skipClass(pattern, i);
+            if (i < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        if (ch == '(')
+        {
+            if (i + 1 < pattern.size() && (pattern.at(i + 1) == '*' ||
+                                           (pattern.at(i + 1) == '?' && i + 2 < pattern.size() &&
+                                            !QStringLiteral(":=!<").contains(pattern.at(i + 2)))))
+            {
+                return -1;
+            }
+            ++depth;
+        }
+        else if (ch == ')' && --depth == 0)
+        {
+            return i + 1;
+        }
+        ++i;
+    }
+    return -1;
+}
+
+// 2 for a surrogate pair starting at i, else 1
+int characterLength(const QString &pattern, int i)
+{
+    return pattern.at(i).isHighSurrogate() && i + 1 < pattern.size() && pattern.at(i + 1).isLowSurrogate() ? 2 : 1;
+}
+
+// Whether Qt and PCRE agree on what the character matches case-insensitively:
+// ASCII only, and not k or s, which also match the Kelvin sign and long s.
+bool foldsSafely(QChar ch)
+{
+    return ch.unicode() < 0x80 && ch.toLower() != 'k' && ch.toLower() != 's';
+}
+
+// The runs of text between characters that do not fold safely.
+QStringList foldSafePieces(const QString &text)
+{
+    QStringList pieces;
+    QString piece;
+    for (const QChar ch : text)
+    {
+        if (foldsSafely(ch))
+        {
+            piece.append(ch);
+        }
+        else if (!piece.isEmpty())
+        {
+            pieces.append(piece);
+            piece.clear();
+        }
+    }
+    if (!piece.isEmpty())
+    {
+        pieces.append(piece);
+    }
+    return pieces;
+}
+
+} // namespace
+
+std::shared_ptr<const KeyPattern> KeyPattern::parse(const QString &candidate)
+{
+    if (candidate.size() < 2 || !candidate.startsWith('/'))
+    {
+        return nullptr;
+    }
+
+    int closingSlashIndex = -1;
+    bool escaping = false;
+    for (int i = 1; i < candidate.size(); ++i)
+    {
+        const QChar ch = candidate.at(i);
+        if (!escaping && ch == '/')
+        {
+            closingSlashIndex = i;
+            break;
+        }
+
+        if (!escaping && ch == '\\')
+        {
+            escaping = true;
+            continue;
+        }
+
+        escaping = false;
+    }
+
+    if (closingSlashIndex == -1)
+    {
+        return nullptr;
+    }
+
+    const QString pattern = candidate.mid(1, closingSlashIndex - 1);
+    const QString flags = candidate.mid(closingSlashIndex + 1);
+
+    QRegularExpression::PatternOptions options = QRegularExpression::NoPatternOption;
+    for (const QChar flag : flags)
+    {
+        if (flag == 'i')
+        {
+            options |= QRegularExpression::CaseInsensitiveOption;
+        }
+        else if (flag == 'm')
+        {
+            options |= QRegularExpression::MultilineOption;
+        }
+        else if (flag == 's')
+        {
+            options |= QRegularExpression::DotMatchesEverythingOption;
+        }
+    }
+
+    std::shared_ptr<KeyPattern> keyPattern(new KeyPattern());
+    keyPattern->m_regex = QRegularExpression(pattern, options);
+    if (!keyPattern->m_regex.isValid())
+    {
+        qWarning() << "Invalid regex pattern" << candidate << ":" << keyPattern->m_regex.errorString();
+        return nullptr;
+    }
+    // compiles and JITs now instead of on the first match
+    keyPattern->m_regex.optimize();
+    keyPattern->m_caseSensitivity = options.testFlag(QRegularExpression::CaseInsensitiveOption) ? Qt::CaseInsensitive : Qt::CaseSensitive;
+    keyPattern->extractLiterals(pattern);
+    return keyPattern;
+}
+
+bool KeyPattern::matches(const QString &key) const
+{
+    if (!m_prefix.isEmpty() && !key.startsWith(m_prefix, m_caseSensitivity))
+    {
+        return false;
+    }
+    for (const QString &literal : m_required)
+    {
+        if (!key.contains(literal, m_caseSensitivity))
+        {
+            return false;
+        }
+    }
+    return m_regex.match(key).hasMatch();
+}
+
+// Walks the top-level sequence of the pattern, collecting runs of literal
+// characters that are neither optional nor part of a group, class or
+// alternation. Anything it does not fully understand gives up on literals, so
+// they only ever narrow what the regex would match anyway.
+void KeyPattern::extractLiterals(const QString &pattern)
+{
+    if (pattern.contains(QStringLiteral("\\Q")))
+    {
+        return;
+    }
+
+    // with multiline, ^ also matches after a newline inside the key
+    const bool anchored = pattern.startsWith('^') && !m_regex.patternOptions().testFlag(QRegularExpression::MultilineOption);
+    bool prefixOpen = anchored;
+    QString prefix;
+    QStringList runs;
+    QString run;
+    const auto endRun = [&]()
+    {
+        if (prefixOpen)
+        {
+            prefix = run;
+            prefixOpen = false;
+        }
+        if (!run.isEmpty())
+        {
+            runs.append(run);
+            run.clear();
+        }
+    };
+
+    int i = anchored ? 1 : 0;
+    while (i < pattern.size())
+    {
+        const QChar ch = pattern.at(i);
+        bool literal = false;
+        QString value(ch);
+        int next = i + 1;
+        if (ch == '\\')
+        {
+            if (i + 1 >= pattern.size())
+            {
+                return;
+            }
+            value = pattern.mid(i + 1, characterLength(pattern, i + 1));
+            next = i + 1 + value.size();
+            if (!value.at(0).isLetterOrNumber())
+            {
+                literal = true;
+            }
+            else if (!QStringLiteral("dDwWsSbBhHvVRXAzZGKntrfea").contains(value))
+            {
+                // escapes that read further characters (\x41, \p{L}, \1, ...)
+                return;
+            }
+        }
+        else if (ch == '[')
+        {
+            next = skipClass(pattern, i);
+        }
+        else if (ch == '(')
+        {
+            next = skipGroup(pattern, i);
+        }
+        else if (ch == '|' || ch == '*' || ch == '+' || ch == '?')
+        {
+            // top-level alternation requires no literal at all
+            return;
+        }
+        else if (ch != '.' && ch != '^' && ch != '$')
+        {
+            // a quantifier after a surrogate pair applies to the whole character
+            value = pattern.mid(i, characterLength(pattern, i));
+            next = i + value.size();
+            literal = true;
+        }
+        if (next < 0)
+        {
+            return;
+        }
+
+        // a quantifier makes the atom optional or lets it repeat
+        bool optional = false;
+        bool repeated = false;
+        if (next < pattern.size())
+        {
+            const QChar quantifier = pattern.at(next);
+            if (quantifier == '*' || quantifier == '?' || quantifier == '+')
+            {
+                optional = quantifier != '+';
+                repeated = true;
+                ++next;
+            }
+            else if (quantifier == '{')
+            {
+                // "{" only starts a quantifier when bounds follow; newer PCRE2
+                // also reads "{,n}" and spaces around the counts
+                const int end = pattern.indexOf('}', next);
+                const QString bounds = end < 0 ? QString() : pattern.mid(next + 1, end - next - 1);
+                if (!bounds.isEmpty() && std::all_of(bounds.begin(), bounds.end(), [](QChar c)
+                                                     { return c.isDigit() || c == ',' || c == ' ' || c == '\t'; }))
+                {
+                    const QString minimum = bounds.section(',', 0, 0).trimmed();
+                    bool ok = false;
+                    optional = minimum.toLongLong(&ok) == 0 || !ok;
+                    repeated = true;
+                    next = end + 1;
+                }
+            }
+            // lazy and possessive forms
+            if (repeated && next < pattern.size() && (pattern.at(next) == '?' || pattern.at(next) == '+'))
+            {
+                ++next;
+            }
+        }
+
+        if (literal && !optional)
+        {
+            run.append(value);
+        }
+        if (!literal || repeated)
+        {
+            endRun();
+        }
+        i = next;
+    }
+    endRun();
+
+    if (m_caseSensitivity == Qt::CaseInsensitive)
+    {
+        prefix.truncate(std::find_if_not(prefix.begin(), prefix.end(), foldsSafely) - prefix.begin());
+        QStringList pieces;
+        for (const QString &text : runs)
+        {
+            pieces += foldSafePieces(text);
+        }
+        runs = pieces;
+    }
+    if (!prefix.isEmpty() && !runs.isEmpty() && runs.first() == prefix)
+    {
+        runs.removeFirst();
+    }
+    std::stable_sort(runs.begin(), runs.end(), [](const QString &a, const QString &b) { return a.size() > b.size(); });
+    while (runs.size() > MaxRequiredLiterals)
+    {
+        runs.removeLast();
+    }
+    m_prefix = prefix;
+    m_required = runs;
+}
+
+KeyPatternCache::KeyPatternCache(size_t capacity)
+    : m_capacity(capacity)
+{
+}
+
+std::shared_ptr<const KeyPattern> KeyPatternCache::lookup(const QString &candidate)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_index.find(candidate);
+        if (it != m_index.end())
+        {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return it->second->second;
+        }
+    }
+
+    // compiled outside the lock; a thread racing on the same pattern keeps its own copy
+    std::shared_ptr<const KeyPattern> pattern = KeyPattern::parse(candidate);
+    if (pattern == nullptr)
+    {
+        return nullptr;
+    }
+    QMutexLocker locker(&m_mutex);
+    if (m_index.count(candidate) > 0)
+    {
+        return pattern;
+    }
+    m_entries.emplace_front(candidate, pattern);
+    m_index[candidate] = m_entries.begin();
+    if (m_entries.size() > m_capacity)
+    {
+        m_index.erase(m_entries.back().first);
+        m_entries.pop_back();
+    }
+    return pattern;
+}
@@ -0,0 +1,62 @@
+#ifndef KEYPATTERN_H
+#define KEYPATTERN_H
+
+#include <QString>
+#include <QStringList>
+#include <QRegularExpression>
+#include <QMutex>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+// A "/regex/flags" document or key pattern, compiled once and optimized.
+// Compiling also pulls out literals every match has to contain: the literal
+// prefix of an anchored pattern and the literal runs of its top-level
+// sequence. matches() checks those with plain string compares first and only
+// runs the regex on the keys that pass, e.g. "^site-7/.*/cpu$" only runs the
+// regex on keys starting with "site-7/" that contain "cpu".
+class KeyPattern
+{
+public:
+    // Null when the candidate is not a /pattern/ or does not compile.
+    static std::shared_ptr<const KeyPattern> parse(const QString& candidate);
+
+    bool matches(const QString& key) const;
+
+    // Literal every matching key starts with, empty when there is none.
+    const QString& prefix() const { return m_prefix; }
+    Qt::CaseSensitivity caseSensitivity() const { return m_caseSensitivity; }
+    const QRegularExpression& regex() const { return m_regex; }
+
+private:
+    KeyPattern() = default;
+    void extractLiterals(const QString& pattern);
+
+    QRegularExpression m_regex;
+    QString m_prefix;
+    QStringList m_required;
+    Qt::CaseSensitivity m_caseSensitivity = Qt::CaseSensitive;
+};
+
+// Least recently used cache of compiled patterns, keyed by the full
+// "/pattern/flags" text, so repeated queries skip compiling and planning.
+// Safe to share between threads.
+class KeyPatternCache
+{
+public:
+    explicit KeyPatternCache(size_t capacity = 256);
+
+    // Same contract as KeyPattern::parse().
+    std::shared_ptr<const KeyPattern> lookup(const QString& candidate);
+
+private:
+    using Entry = std::pair<QString, std::shared_ptr<const KeyPattern>>;
+
+    QMutex m_mutex;
+    size_t m_capacity;
+    // most recently used first
+    std::list<Entry> m_entries;
+    std::unordered_map<QString, std::list<Entry>::iterator> m_index;
+};
+
+#endif // KEYPATTERN_H
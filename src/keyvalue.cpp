@@ -1,6 +1,9 @@
 #include "keyvalue.h"
+#include <QCborStreamReader>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QDebug>
+#include "cborcodec.h"
 
 KeyValue KeyValue::fromJson(const QString& jsonString, bool* ok)
 {
@@ -18,6 +21,26 @@ KeyValue KeyValue::fromJson(const QString& jsonString, bool* ok)
     return kv;
 }
 
+KeyValue KeyValue::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    KeyValue kv;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&kv](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("key")) return CborCodec::readString(value, &kv.key);
+        if (key == QLatin1String("value")) return CborCodec::readString(value, &kv.value);
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &kv.col);
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+        if (ok) *ok = false;
+        return kv;
+    }
+
+    if (ok) *ok = kv.isValid();
+    return kv;
+}
+
 bool KeyValue::isValid() const
 {
     return !col.isEmpty();
@@ -2,6 +2,7 @@
 #define KEYVALUE_H
 
 #include <QString>
+#include <QByteArray>
 
 struct KeyValue {
     QString key;
@@ -9,6 +10,7 @@ struct KeyValue {
     QString col;
     
     static KeyValue fromJson(const QString& jsonString, bool* ok = nullptr);
+    static KeyValue fromCbor(const QByteArray& cbor, bool* ok = nullptr);
     bool isValid() const;
     bool hasValue() const;
     bool hasKey() const;
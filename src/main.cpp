@@ -52,10 +52,40 @@ int main(int argc, char *argv[])
         "15"
     );
     
+    QCommandLineOption walSyncOption(
+        QStringList() << "wal-sync",
+        "When the write-ahead log is fsynced: batch (before acknowledging each group commit), interval, or os (default: batch)",
+        "policy",
+        "batch"
+    );
+
+    QCommandLineOption walSyncIntervalOption(
+        QStringList() << "wal-sync-interval",
+        "The interval in milliseconds between write-ahead log fsyncs with --wal-sync=interval (default: 100)",
+        "ms",
+        "100"
+    );
+    
+    QCommandLineOption lazyLoadOption(
+        QStringList() << "lazy-load",
+        "Start serving before the data folder is loaded; collections load in the background and requests wait only for the collections they touch"
+    );
+    
+    QCommandLineOption shardsOption(
+        QStringList() << "shards",
+        "The number of worker threads collections are partitioned across; 0 handles them on the event loop thread (default: 0)",
+        "threads",
+        "0"
+    );
+    
     // Add options to parser
     parser.addOption(secretKeyOption);
     parser.addOption(dataFolderOption);
     parser.addOption(flushIntervalOption);
+    parser.addOption(walSyncOption);
+    parser.addOption(walSyncIntervalOption);
+    parser.addOption(lazyLoadOption);
+    parser.addOption(shardsOption);
 
     // Process the command line arguments
     parser.process(app);
@@ -64,15 +94,30 @@ int main(int argc, char *argv[])
     QString secretKey = parser.value(secretKeyOption);
     QString dataFolder = parser.value(dataFolderOption);
     int flushInterval = parser.value(flushIntervalOption).toInt();
+    int walSyncInterval = parser.value(walSyncIntervalOption).toInt();
+    bool lazyLoad = parser.isSet(lazyLoadOption);
+    bool shardsOk = false;
+    int shards = parser.value(shardsOption).toInt(&shardsOk);
 
     // Validate required options
     if (secretKey.isEmpty()) {
         qFatal("secret-key is not set");
     }
+
+    WriteAheadLog::SyncPolicy walSyncPolicy;
+    if (!WriteAheadLog::parseSyncPolicy(parser.value(walSyncOption), &walSyncPolicy)) {
+        qFatal("wal-sync must be one of: batch, interval, os");
+    }
+    if (walSyncInterval <= 0) {
+        qFatal("wal-sync-interval must be a positive number of milliseconds");
+    }
+    if (!shardsOk || shards < 0) {
+        qFatal("shards must be 0 or a positive number of threads");
+    }
     
     qInfo() << "Server started";
     // Create and start WebSocket server
-    WebSocket server(secretKey, dataFolder, flushInterval);
+    WebSocket server(secretKey, dataFolder, flushInterval, walSyncPolicy, walSyncInterval, lazyLoad, shards);
     server.start(8080);
 
     return app.exec();
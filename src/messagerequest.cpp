@@ -2,7 +2,9 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonParseError>
+#include <QCborStreamReader>
 #include <QDebug>
+#include "cborcodec.h"
 
 MessageRequest MessageRequest::fromJson(const QString& jsonString, bool* ok)
 {
@@ -33,6 +35,44 @@ MessageRequest MessageRequest::fromJson(const QString& jsonString, bool* ok)
     return msg;
 }
 
+MessageRequest MessageRequest::fromCbor(const QByteArray& frame, bool* ok)
+{
+    MessageRequest msg;
+    msg.binary = true;
+    QCborStreamReader reader(frame);
+    if (!reader.isArray() || !reader.enterContainer() || !reader.hasNext() || !reader.isUnsignedInteger()) {
+        qWarning() << "CBOR frame is not an [opcode, id, payload] array";
+        if (ok) *ok = false;
+        return msg;
+    }
+    msg.opcode = reader.toUnsignedInteger();
+    reader.next();
+
+    if (!reader.hasNext() || !CborCodec::readString(reader, &msg.id) || !reader.hasNext()) {
+        qWarning() << "CBOR frame has no id or payload";
+        if (ok) *ok = false;
+        return msg;
+    }
+
+    // keep the payload encoded; the handler decodes it into its request struct
+    const qint64 payloadStart = reader.currentOffset();
+    if (!reader.next()) {
+        qWarning() << "CBOR parse error:" << reader.lastError().toString();
+        if (ok) *ok = false;
+        return msg;
+    }
+    msg.payload = frame.mid(payloadStart, reader.currentOffset() - payloadStart);
+
+    if (reader.hasNext() || !reader.leaveContainer()) {
+        qWarning() << "CBOR frame has trailing items";
+        if (ok) *ok = false;
+        return msg;
+    }
+
+    if (ok) *ok = !msg.id.isEmpty() && !msg.payload.isEmpty();
+    return msg;
+}
+
 bool MessageRequest::isValid() const
 {
     return !id.isEmpty() && !type.isEmpty() && !data.isEmpty();
@@ -2,13 +2,27 @@
 #define MESSAGEREQUEST_H
 
 #include <QString>
+#include <QByteArray>
+#include <any>
 
 struct MessageRequest {
     QString id;
     QString type;
     QString data;
+
+    // binary protocol: the numeric type and the encoded CBOR payload, decoded by the handler
+    bool binary = false;
+    quint64 opcode = 0;
+    QByteArray payload;
+
+    // the payload decoded into its request struct ahead of the handler, off
+    // the event loop thread; empty when the handler decodes it itself
+    std::any decoded;
+    bool decodedOk = false;
     
     static MessageRequest fromJson(const QString& jsonString, bool* ok = nullptr);
+    // Decodes a [opcode, id, payload] frame; type is left for the caller to map from the opcode.
+    static MessageRequest fromCbor(const QByteArray& frame, bool* ok = nullptr);
     bool isValid() const;
 };
 
@@ -0,0 +1,46 @@
+#include "parallelscan.h"
+#include <QThreadPool>
+#include <QSemaphore>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+int scanPartitions(size_t count)
+{
+    if (count < ParallelScanEntries)
+    {
+        return 1;
+    }
+    return std::max(1, QThreadPool::globalInstance()->maxThreadCount()) * 4;
+}
+
+void runPartitions(int count, const std::function<void(int)> &scan)
+{
+    if (count == 1)
+    {
+        scan(0);
+        return;
+    }
+    struct State {
+        std::atomic<int> next{0};
+        QSemaphore done;
+    };
+    auto state = std::make_shared<State>();
+    // a helper starting after every partition was claimed returns without touching scan
+    const auto claim = [state, count, &scan]()
+    {
+        for (int partition = state->next++; partition < count; partition = state->next++)
+        {
+            scan(partition);
+            state->done.release();
+        }
+    };
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int helpers = std::min(count, pool->maxThreadCount()) - 1;
+    for (int i = 0; i < helpers; ++i)
+    {
+        pool->start(claim);
+    }
+    claim();
+    state->done.acquire(count);
+}
@@ -0,0 +1,50 @@
+#ifndef PARALLELSCAN_H
+#define PARALLELSCAN_H
+
+#include <QHash>
+#include <QString>
+#include <functional>
+#include <vector>
+
+// Splitting scans of many documents or keys across the global thread pool.
+
+// Scans of fewer entries than this are not worth splitting across threads.
+constexpr size_t ParallelScanEntries = 64 * 1024;
+
+// Partitions for a scan of count entries: 1 for a small one, otherwise a few
+// per pool thread so that threads finishing early have more to take over.
+int scanPartitions(size_t count);
+
+// Runs scan(partition) for every partition in [0, count), on the calling
+// thread and the global pool at once. Threads claim one partition at a time,
+// so the ones done early take over the rest, and the caller never waits for
+// a pool thread to free up: what nobody claimed yet it runs itself.
+void runPartitions(int count, const std::function<void(int)>& scan);
+
+// Joins the results of the partitions of a scan; their keys are disjoint.
+template <typename Value>
+QHash<QString, Value> mergePartitions(std::vector<QHash<QString, Value>>& partial)
+{
+    if (partial.size() == 1)
+    {
+        return std::move(partial.front());
+    }
+    qsizetype size = 0;
+    for (const auto& part : partial)
+    {
+        size += part.size();
+    }
+    QHash<QString, Value> result;
+    result.reserve(size);
+    for (auto& part : partial)
+    {
+        for (auto it = part.begin(); it != part.end(); ++it)
+        {
+            result.insert(it.key(), std::move(it.value()));
+        }
+        part.clear();
+    }
+    return result;
+}
+
+#endif // PARALLELSCAN_H
@@ -0,0 +1,224 @@
+#include "payloadfilter.h"
+#include <QJsonArray>
+#include <QJsonObject>
+
+bool PayloadFilter::compile(const QJsonValue &expression, PayloadFilter *filter, QString *errorMessage)
+{
+    filter->m_nodes.clear();
+    if (expression.isUndefined() || expression.isNull())
+    {
+        return true;
+    }
+    if (filter->compileNode(expression, errorMessage) < 0)
+    {
+        filter->m_nodes.clear();
+        return false;
+    }
+    return true;
+}
+
+int PayloadFilter::compileNode(const QJsonValue &expression, QString *errorMessage)
+{
+    const QJsonObject obj = expression.toObject();
+    if (!expression.isObject() || obj.size() != 1)
+    {
+        *errorMessage = QStringLiteral("each filter must be an object with one operator");
+        return -1;
+    }
+    const QString name = obj.constBegin().key();
+    const QJsonValue operand = obj.constBegin().value();
+
+    Node node;
+    node.kind = Kind::Null;
+    node.number = 0;
+    node.boolean = false;
+
+    if (name == QLatin1String("and") || name == QLatin1String("or"))
+    {
+        node.op = name == QLatin1String("and") ? Op::And : Op::Or;
+        if (!operand.isArray() || operand.toArray().isEmpty())
+        {
+            *errorMessage = name + QStringLiteral(" takes a non-empty array of filters");
+            return -1;
+        }
+        for (const QJsonValue &child : operand.toArray())
+        {
+            const int index = compileNode(child, errorMessage);
+            if (index < 0)
+            {
+                return -1;
+            }
+            node.children.push_back(index);
+        }
+    }
+    else if (name == QLatin1String("not"))
+    {
+        node.op = Op::Not;
+        const int index = compileNode(operand, errorMessage);
+        if (index < 0)
+        {
+            return -1;
+        }
+        node.children.push_back(index);
+    }
+    else if (name == QLatin1String("exists"))
+    {
+        node.op = Op::Exists;
+        if (!operand.isString() || operand.toString().isEmpty())
+        {
+            *errorMessage = QStringLiteral("exists takes a path");
+            return -1;
+        }
+        node.path = PayloadPath(operand.toString());
+    }
+    else
+    {
+        if (name == QLatin1String("eq")) node.op = Op::Eq;
+        else if (name == QLatin1String("ne")) node.op = Op::Ne;
+        else if (name == QLatin1String("gt")) node.op = Op::Gt;
+        else if (name == QLatin1String("gte")) node.op = Op::Gte;
+        else if (name == QLatin1String("lt")) node.op = Op::Lt;
+        else if (name == QLatin1String("lte")) node.op = Op::Lte;
+        else
+        {
+            *errorMessage = QStringLiteral("unknown filter operator ") + name;
+            return -1;
+        }
+
+        const QJsonArray arguments = operand.toArray();
+        if (!operand.isArray() || arguments.size() != 2 || !arguments.at(0).isString() || arguments.at(0).toString().isEmpty())
+        {
+            *errorMessage = name + QStringLiteral(" takes [path, value]");
+            return -1;
+        }
+        node.path = PayloadPath(arguments.at(0).toString());
+        const QJsonValue value = arguments.at(1);
+        if (value.isDouble())
+        {
+            node.kind = Kind::Number;
+            node.number = value.toDouble();
+        }
+        else if (value.isString())
+        {
+            node.kind = Kind::String;
+            node.text = value.toString().toStdString();
+        }
+        else if (value.isBool())
+        {
+            node.kind = Kind::Bool;
+            node.boolean = value.toBool();
+        }
+        else if (value.isNull())
+        {
+            node.kind = Kind::Null;
+        }
+        else
+        {
+            *errorMessage = name + QStringLiteral(" compares with a number, string, bool or null");
+            return -1;
+        }
+        if ((node.kind == Kind::Bool || node.kind == Kind::Null) && node.op != Op::Eq && node.op != Op::Ne)
+        {
+            *errorMessage = name + QStringLiteral(" needs a number or a string");
+            return -1;
+        }
+    }
+
+    m_nodes.push_back(std::move(node));
+    return static_cast<int>(m_nodes.size()) - 1;
+}
+
+bool PayloadFilter::matches(std::string_view payload) const
+{
+    return m_nodes.empty() || evaluate(static_cast<int>(m_nodes.size()) - 1, payload);
+}
+
+bool PayloadFilter::evaluate(int index, std::string_view payload) const
+{
+    const Node &node = m_nodes[index];
+    switch (node.op)
+    {
+    case Op::And:
+        for (int child : node.children)
+        {
+            if (!evaluate(child, payload))
+            {
+                return false;
+            }
+        }
+        return true;
+    case Op::Or:
+        for (int child : node.children)
+        {
+            if (evaluate(child, payload))
+            {
+                return true;
+            }
+        }
+        return false;
+    case Op::Not:
+        return !evaluate(node.children.front(), payload);
+    case Op::Exists:
+    {
+        std::string_view value;
+        return node.path.find(payload, &value);
+    }
+    default:
+    {
+        std::string_view value;
+        return node.path.find(payload, &value) && compare(node, value);
+    }
+    }
+}
+
+bool PayloadFilter::compare(const Node &node, std::string_view value) const
+{
+    int order = 0;
+    switch (node.kind)
+    {
+    case Kind::Number:
+    {
+        double number = 0;
+        if (!PayloadPath::toNumber(value, &number))
+        {
+            return false;
+        }
+        order = number < node.number ? -1 : (number > node.number ? 1 : 0);
+        break;
+    }
+    case Kind::String:
+    {
+        std::string text;
+        if (!PayloadPath::toString(value, &text))
+        {
+            return false;
+        }
+        order = text.compare(node.text);
+        break;
+    }
+    case Kind::Bool:
+        if (value != "true" && value != "false")
+        {
+            return false;
+        }
+        order = (value == "true") == node.boolean ? 0 : 1;
+        break;
+    case Kind::Null:
+        if (value != "null")
+        {
+            return false;
+        }
+        break;
+    }
+
+    switch (node.op)
+    {
+    case Op::Eq: return order == 0;
+    case Op::Ne: return order != 0;
+    case Op::Gt: return order > 0;
+    case Op::Gte: return order >= 0;
+    case Op::Lt: return order < 0;
+    case Op::Lte: return order <= 0;
+    default: return false;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef PAYLOADFILTER_H
+#define PAYLOADFILTER_H
+
+#include <QJsonValue>
+#include <QString>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "payloadpath.h"
+
+// Predicate over record payloads, compiled once per query from a JSON
+// expression and evaluated on the payload text during the scan:
+//   {"and": [f, ...]}, {"or": [f, ...]}, {"not": f}, {"exists": "path"},
+//   {"eq"|"ne"|"gt"|"gte"|"lt"|"lte": ["path", value]}
+// Numbers compare numerically and strings lexically; bool and null only
+// support eq and ne. A comparison with a missing path or a value of another
+// type is false.
+class PayloadFilter
+{
+public:
+    PayloadFilter() = default;
+
+    // An undefined or null expression compiles to a filter matching everything.
+    static bool compile(const QJsonValue& expression, PayloadFilter* filter, QString* errorMessage);
+
+    bool isEmpty() const { return m_nodes.empty(); }
+    bool matches(std::string_view payload) const;
+
+private:
+    enum class Op { And, Or, Not, Exists, Eq, Ne, Gt, Gte, Lt, Lte };
+    enum class Kind { Number, String, Bool, Null };
+
+    struct Node {
+        Op op;
+        // And, Or and Not: indexes of the operands in m_nodes
+        std::vector<int> children;
+        PayloadPath path;
+        Kind kind;
+        double number;
+        std::string text;
+        bool boolean;
+    };
+
+    int compileNode(const QJsonValue& expression, QString* errorMessage);
+    bool evaluate(int index, std::string_view payload) const;
+    bool compare(const Node& node, std::string_view value) const;
+
+    // the root is the last node
+    std::vector<Node> m_nodes;
+};
+
+#endif // PAYLOADFILTER_H
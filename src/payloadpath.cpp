@@ -0,0 +1,369 @@
+#include "payloadpath.h"
+#include <QByteArray>
+#include <QStringList>
+#include "responsewriter.h"
+
+namespace {
+
+const char *skipWhitespace(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    {
+        ++p;
+    }
+    return p;
+}
+
+// p is on the opening quote; returns the position after the closing one
+const char *skipString(const char *p, const char *end)
+{
+    for (++p; p < end; ++p)
+    {
+        if (*p == '\\')
+        {
+            ++p;
+        }
+        else if (*p == '"')
+        {
+            return p + 1;
+        }
+    }
+    return nullptr;
+}
+
+// Skips one value without validating it; returns the position after it.
+const char *skipValue(const char *p, const char *end)
+{
+    if (p >= end)
+    {
+        return nullptr;
+    }
+    if (*p == '"')
+    {
+        return skipString(p, end);
+    }
+    if (*p == '{' || *p == '[')
+    {
+        int depth = 0;
+        while (p < end)
+        {
+            const char ch = *p;
+            if (ch == '"')
+            {
+                p = skipString(p, end);
+                if (p == nullptr)
+                {
+                    return nullptr;
+                }
+                continue;
+            }
+            if (ch == '{' || ch == '[')
+            {
+                ++depth;
+            }
+            else if ((ch == '}' || ch == ']') && --depth == 0)
+            {
+                return p + 1;
+            }
+            ++p;
+        }
+        return nullptr;
+    }
+    const char *start = p;
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+    {
+        ++p;
+    }
+    return p > start ? p : nullptr;
+}
+
+void appendUtf8(std::string &out, quint32 codePoint)
+{
+    if (codePoint < 0x80)
+    {
+        out += static_cast<char>(codePoint);
+    }
+    else if (codePoint < 0x800)
+    {
+        out += static_cast<char>(0xc0 | (codePoint >> 6));
+        out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    }
+    else if (codePoint < 0x10000)
+    {
+        out += static_cast<char>(0xe0 | (codePoint >> 12));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    }
+    else
+    {
+        out += static_cast<char>(0xf0 | (codePoint >> 18));
+        out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    }
+}
+
+bool readHex4(const char *p, const char *end, quint32 *value)
+{
+    if (end - p < 4)
+    {
+        return false;
+    }
+    quint32 result = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        const char ch = p[i];
+        result <<= 4;
+        if (ch >= '0' && ch <= '9')
+        {
+            result |= static_cast<quint32>(ch - '0');
+        }
+        else if (ch >= 'a' && ch <= 'f')
+        {
+            result |= static_cast<quint32>(ch - 'a' + 10);
+        }
+        else if (ch >= 'A' && ch <= 'F')
+        {
+            result |= static_cast<quint32>(ch - 'A' + 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    *value = result;
+    return true;
+}
+
+// Decodes the text between the quotes of a JSON string.
+bool unescape(std::string_view raw, std::string *out)
+{
+    out->clear();
+    out->reserve(raw.size());
+    const char *p = raw.data();
+    const char *end = p + raw.size();
+    while (p < end)
+    {
+        if (*p != '\\')
+        {
+            *out += *p++;
+            continue;
+        }
+        if (++p == end)
+        {
+            return false;
+        }
+        switch (*p++)
+        {
+        case '"': *out += '"'; break;
+        case '\\': *out += '\\'; break;
+        case '/': *out += '/'; break;
+        case 'b': *out += '\b'; break;
+        case 'f': *out += '\f'; break;
+        case 'n': *out += '\n'; break;
+        case 'r': *out += '\r'; break;
+        case 't': *out += '\t'; break;
+        case 'u':
+        {
+            quint32 codePoint = 0;
+            if (!readHex4(p, end, &codePoint))
+            {
+                return false;
+            }
+            p += 4;
+            quint32 low = 0;
+            if (codePoint >= 0xd800 && codePoint < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                readHex4(p + 2, end, &low) && low >= 0xdc00 && low < 0xe000)
+            {
+                codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                p += 6;
+            }
+            appendUtf8(*out, codePoint);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool keyEquals(std::string_view rawKey, const std::string &key)
+{
+    if (rawKey.find('\\') == std::string_view::npos)
+    {
+        return rawKey == key;
+    }
+    std::string decoded;
+    return unescape(rawKey, &decoded) && decoded == key;
+}
+
+} // namespace
+
+PayloadPath::PayloadPath(const QString &path)
+{
+    const QStringList parts = path.split('.', Qt::SkipEmptyParts);
+    m_segments.reserve(parts.size());
+    for (const QString &part : parts)
+    {
+        bool isIndex = false;
+        const int index = part.toInt(&isIndex);
+        m_segments.push_back(Segment{part.toStdString(), isIndex && index >= 0 ? index : -1});
+    }
+}
+
+bool PayloadPath::find(std::string_view payload, std::string_view *value) const
+{
+    const char *p = payload.data();
+    const char *end = p + payload.size();
+    p = skipWhitespace(p, end);
+
+    for (const Segment &segment : m_segments)
+    {
+        if (p >= end)
+        {
+            return false;
+        }
+        if (*p == '{')
+        {
+            p = skipWhitespace(p + 1, end);
+            for (;;)
+            {
+                if (p >= end || *p != '"')
+                {
+                    return false; // end of the object, or malformed
+                }
+                const char *keyEnd = skipString(p, end);
+                if (keyEnd == nullptr)
+                {
+                    return false;
+                }
+                const std::string_view rawKey(p + 1, static_cast<size_t>(keyEnd - p - 2));
+                p = skipWhitespace(keyEnd, end);
+                if (p >= end || *p != ':')
+                {
+                    return false;
+                }
+                p = skipWhitespace(p + 1, end);
+                if (keyEquals(rawKey, segment.key))
+                {
+                    break;
+                }
+                p = skipValue(p, end);
+                if (p == nullptr)
+                {
+                    return false;
+                }
+                p = skipWhitespace(p, end);
+                if (p >= end || *p != ',')
+                {
+                    return false;
+                }
+                p = skipWhitespace(p + 1, end);
+            }
+        }
+        else if (*p == '[' && segment.index >= 0)
+        {
+            p = skipWhitespace(p + 1, end);
+            for (int i = 0; i < segment.index; ++i)
+            {
+                if (p >= end || *p == ']')
+                {
+                    return false;
+                }
+                p = skipValue(p, end);
+                if (p == nullptr)
+                {
+                    return false;
+                }
+                p = skipWhitespace(p, end);
+                if (p >= end || *p != ',')
+                {
+                    return false;
+                }
+                p = skipWhitespace(p + 1, end);
+            }
+            if (p >= end || *p == ']')
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    const char *valueEnd = skipValue(p, end);
+    if (valueEnd == nullptr)
+    {
+        return false;
+    }
+    *value = std::string_view(p, static_cast<size_t>(valueEnd - p));
+    return true;
+}
+
+bool PayloadPath::findNumber(std::string_view payload, double *value) const
+{
+    std::string_view json;
+    return find(payload, &json) && toNumber(json, value);
+}
+
+bool PayloadPath::toNumber(std::string_view json, double *value)
+{
+    if (json.empty() || !(json[0] == '-' || (json[0] >= '0' && json[0] <= '9')))
+    {
+        return false;
+    }
+    // toDouble() ignores the process locale, unlike strtod
+    bool ok = false;
+    *value = QByteArray::fromRawData(json.data(), static_cast<qsizetype>(json.size())).toDouble(&ok);
+    return ok;
+}
+
+bool PayloadPath::toString(std::string_view json, std::string *value)
+{
+    if (json.size() < 2 || json.front() != '"' || json.back() != '"')
+    {
+        return false;
+    }
+    return unescape(json.substr(1, json.size() - 2), value);
+}
+
+PayloadProjection::PayloadProjection(const QStringList &fields)
+{
+    m_paths.reserve(fields.size());
+    m_keys.reserve(fields.size());
+    for (const QString &field : fields)
+    {
+        m_paths.emplace_back(field);
+        const QByteArray utf8 = field.toUtf8();
+        QByteArray key;
+        ResponseWriter::appendJsonString(key, std::string_view(utf8.constData(), static_cast<size_t>(utf8.size())));
+        key.append(':');
+        m_keys.push_back(key);
+    }
+}
+
+QByteArray PayloadProjection::apply(std::string_view payload) const
+{
+    QByteArray out;
+    out.reserve(64);
+    out.append('{');
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        std::string_view value;
+        if (!m_paths[i].find(payload, &value))
+        {
+            continue;
+        }
+        if (out.size() > 1)
+        {
+            out.append(',');
+        }
+        out.append(m_keys[i]);
+        out.append(value.data(), static_cast<qsizetype>(value.size()));
+    }
+    out.append('}');
+    return out;
+}
@@ -0,0 +1,59 @@
+#ifndef PAYLOADPATH_H
+#define PAYLOADPATH_H
+
+#include <QString>
+#include <QByteArray>
+#include <QStringList>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A dotted path into a JSON record payload, e.g. "pos.lat" or "items.0.v".
+// It is resolved by scanning the payload text: values off the path are
+// skipped without being parsed, and the match is returned as a view of its
+// JSON text.
+class PayloadPath
+{
+public:
+    PayloadPath() = default;
+    explicit PayloadPath(const QString& path);
+
+    bool isEmpty() const { return m_segments.empty(); }
+
+    // JSON text of the value at the path; false when the payload has no such
+    // value or is not JSON.
+    bool find(std::string_view payload, std::string_view* value) const;
+    bool findNumber(std::string_view payload, double* value) const;
+
+    // Converters for the JSON text of a scalar.
+    static bool toNumber(std::string_view json, double* value);
+    static bool toString(std::string_view json, std::string* value);
+
+private:
+    struct Segment {
+        std::string key;
+        // array index the segment stands for, -1 when it is not a number
+        int index;
+    };
+
+    std::vector<Segment> m_segments;
+};
+
+// Picks a list of paths out of payloads into a flat JSON object keyed by
+// path, e.g. {"pos.lat":52.1,"speed":12}. Paths a payload lacks are left out.
+class PayloadProjection
+{
+public:
+    PayloadProjection() = default;
+    explicit PayloadProjection(const QStringList& fields);
+
+    bool isEmpty() const { return m_paths.empty(); }
+    QByteArray apply(std::string_view payload) const;
+
+private:
+    std::vector<PayloadPath> m_paths;
+    // each path as a quoted JSON key followed by a colon
+    std::vector<QByteArray> m_keys;
+};
+
+#endif // PAYLOADPATH_H
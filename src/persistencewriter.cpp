@@ -0,0 +1,47 @@
+#include "persistencewriter.h"
+#include <QMutexLocker>
+
+PersistenceWriter::PersistenceWriter(QObject *parent)
+    : QThread(parent), m_stopping(false)
+{
+    setObjectName(QStringLiteral("PersistenceWriter"));
+}
+
+PersistenceWriter::~PersistenceWriter()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wake.wakeAll();
+    }
+    wait();
+}
+
+void PersistenceWriter::enqueue(std::function<void()> job)
+{
+    QMutexLocker locker(&m_mutex);
+    m_jobs.push_back(std::move(job));
+    m_wake.wakeOne();
+}
+
+void PersistenceWriter::run()
+{
+    for (;;)
+    {
+        std::function<void()> job;
+        {
+            QMutexLocker locker(&m_mutex);
+            while (m_jobs.empty() && !m_stopping)
+            {
+                m_wake.wait(&m_mutex);
+            }
+            if (m_jobs.empty())
+            {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
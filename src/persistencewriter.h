@@ -0,0 +1,31 @@
+#ifndef PERSISTENCEWRITER_H
+#define PERSISTENCEWRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+
+// Dedicated thread that runs persistence jobs (segment writes, compaction,
+// folder removal) one at a time in the order they were enqueued, so file I/O
+// overlaps with request handling on the event loop.
+class PersistenceWriter : public QThread {
+public:
+    explicit PersistenceWriter(QObject* parent = nullptr);
+    // Runs every job still queued, then stops the thread.
+    ~PersistenceWriter();
+
+    void enqueue(std::function<void()> job);
+
+protected:
+    void run() override;
+
+private:
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    std::deque<std::function<void()>> m_jobs;
+    bool m_stopping;
+};
+
+#endif // PERSISTENCEWRITER_H
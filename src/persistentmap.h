@@ -0,0 +1,297 @@
+#ifndef PERSISTENTMAP_H
+#define PERSISTENTMAP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+// Ordered map whose copies share their structure: a B+ tree of copy-on-write
+// nodes. Copying the map costs one pointer. A change to either copy then
+// copies the nodes on the path to the entry that are still shared, at most
+// a node per level, and changes the others in place, so a map can be copied
+// after every batch of changes for the price of the nodes they touched.
+//
+// A copy may be read from any thread while the original keeps changing, as
+// long as both the changes and the copying happen on one thread.
+template <typename Key, typename Value>
+class PersistentMap
+{
+public:
+    // entries of one leaf, in order; see leaves()
+    struct Leaf {
+        const std::vector<Key>* keys;
+        const std::vector<Value>* values;
+    };
+
+    size_t size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    const Value* find(const Key& key) const
+    {
+        const Node* node = m_root.get();
+        while (node != nullptr && !node->leaf)
+        {
+            node = node->children[childFor(*node, key)].get();
+        }
+        if (node == nullptr)
+        {
+            return nullptr;
+        }
+        auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key);
+        return it != node->keys.end() && *it == key ? &node->values[it - node->keys.begin()] : nullptr;
+    }
+
+    // Inserts the entry, or replaces the value of the key.
+    void insert(const Key& key, Value value)
+    {
+        if (m_root == nullptr)
+        {
+            m_root = std::make_shared<Node>();
+            m_root->leaf = true;
+        }
+        std::shared_ptr<Node> split = insertInto(m_root, key, std::move(value));
+        if (split != nullptr)
+        {
+            auto root = std::make_shared<Node>();
+            root->leaf = false;
+            root->keys = {m_root->keys.front(), split->keys.front()};
+            root->children = {std::move(m_root), std::move(split)};
+            m_root = std::move(root);
+        }
+    }
+
+    bool erase(const Key& key)
+    {
+        // a missing key copies nothing
+        if (find(key) == nullptr)
+        {
+            return false;
+        }
+        eraseFrom(m_root, key);
+        if (m_root->keys.empty())
+        {
+            m_root.reset();
+        }
+        else if (!m_root->leaf && m_root->children.size() == 1)
+        {
+            std::shared_ptr<Node> child = m_root->children.front();
+            m_root = std::move(child);
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        m_root.reset();
+        m_size = 0;
+    }
+
+    // Calls fn(key, value) in key order until fn returns false.
+    template <typename Fn>
+    void forEach(Fn fn) const
+    {
+        if (m_root != nullptr)
+        {
+            visit(*m_root, nullptr, fn);
+        }
+    }
+
+    // Same, from the first key not less than from on.
+    template <typename Fn>
+    void forEachFrom(const Key& from, Fn fn) const
+    {
+        if (m_root != nullptr)
+        {
+            visit(*m_root, &from, fn);
+        }
+    }
+
+    // The leaves in key order, for scans split into runs of leaves.
+    std::vector<Leaf> leaves() const
+    {
+        std::vector<Leaf> result;
+        if (m_root != nullptr)
+        {
+            collectLeaves(*m_root, result);
+        }
+        return result;
+    }
+
+private:
+    static constexpr size_t MaxEntries = 64;
+
+    struct Node {
+        bool leaf;
+        // A leaf's keys go with its values; a branch's are the first key
+        // under each of its children.
+        std::vector<Key> keys;
+        std::vector<Value> values;
+        std::vector<std::shared_ptr<Node>> children;
+    };
+
+    // the child of a branch whose keys may hold key
+    static size_t childFor(const Node& node, const Key& key)
+    {
+        const auto it = std::upper_bound(node.keys.begin(), node.keys.end(), key);
+        return it == node.keys.begin() ? 0 : static_cast<size_t>(it - node.keys.begin()) - 1;
+    }
+
+    // Copy on write, see DocumentSeries::ownsChunk() for why the fence
+    // orders the in-place change after readers dropping their copies.
+    static Node& mutableNode(std::shared_ptr<Node>& slot)
+    {
+        if (slot.use_count() != 1)
+        {
+            slot = std::make_shared<Node>(*slot);
+        }
+        else
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *slot;
+    }
+
+    // Returns the upper half of the node when it had to be split.
+    std::shared_ptr<Node> insertInto(std::shared_ptr<Node>& slot, const Key& key, Value&& value)
+    {
+        Node& node = mutableNode(slot);
+        if (node.leaf)
+        {
+            const auto it = std::lower_bound(node.keys.begin(), node.keys.end(), key);
+            const auto at = it - node.keys.begin();
+            if (it != node.keys.end() && *it == key)
+            {
+                node.values[at] = std::move(value);
+                return nullptr;
+            }
+            node.keys.insert(it, key);
+            node.values.insert(node.values.begin() + at, std::move(value));
+            ++m_size;
+        }
+        else
+        {
+            const size_t at = childFor(node, key);
+            std::shared_ptr<Node> split = insertInto(node.children[at], key, std::move(value));
+            node.keys[at] = node.children[at]->keys.front();
+            if (split != nullptr)
+            {
+                node.keys.insert(node.keys.begin() + at + 1, split->keys.front());
+                node.children.insert(node.children.begin() + at + 1, std::move(split));
+            }
+        }
+        return node.keys.size() > MaxEntries ? splitOff(node) : nullptr;
+    }
+
+    static std::shared_ptr<Node> splitOff(Node& node)
+    {
+        const size_t half = node.keys.size() / 2;
+        auto upper = std::make_shared<Node>();
+        upper->leaf = node.leaf;
+        upper->keys.assign(std::make_move_iterator(node.keys.begin() + half), std::make_move_iterator(node.keys.end()));
+        node.keys.resize(half);
+        if (node.leaf)
+        {
+            upper->values.assign(std::make_move_iterator(node.values.begin() + half), std::make_move_iterator(node.values.end()));
+            node.values.resize(half);
+        }
+        else
+        {
+            upper->children.assign(std::make_move_iterator(node.children.begin() + half), std::make_move_iterator(node.children.end()));
+            node.children.resize(half);
+        }
+        return upper;
+    }
+
+    // The key is known to be present.
+    void eraseFrom(std::shared_ptr<Node>& slot, const Key& key)
+    {
+        Node& node = mutableNode(slot);
+        if (node.leaf)
+        {
+            const auto at = std::lower_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+            node.keys.erase(node.keys.begin() + at);
+            node.values.erase(node.values.begin() + at);
+            --m_size;
+            return;
+        }
+        size_t at = childFor(node, key);
+        eraseFrom(node.children[at], key);
+        if (node.children[at]->keys.empty())
+        {
+            node.keys.erase(node.keys.begin() + at);
+            node.children.erase(node.children.begin() + at);
+            return;
+        }
+        node.keys[at] = node.children[at]->keys.front();
+
+        // a child shrunk to a quarter joins a neighbour that has room, so
+        // deletes do not leave the tree sparse
+        if (node.children[at]->keys.size() > MaxEntries / 4)
+        {
+            return;
+        }
+        if (at + 1 == node.children.size() && at > 0)
+        {
+            --at;
+        }
+        if (at + 1 < node.children.size() && node.children[at]->keys.size() + node.children[at + 1]->keys.size() <= MaxEntries)
+        {
+            Node& merged = mutableNode(node.children[at]);
+            const Node& next = *node.children[at + 1];
+            // the next child may be shared, so its entries are copied
+            merged.keys.insert(merged.keys.end(), next.keys.begin(), next.keys.end());
+            merged.values.insert(merged.values.end(), next.values.begin(), next.values.end());
+            merged.children.insert(merged.children.end(), next.children.begin(), next.children.end());
+            node.keys.erase(node.keys.begin() + at + 1);
+            node.children.erase(node.children.begin() + at + 1);
+        }
+    }
+
+    template <typename Fn>
+    static bool visit(const Node& node, const Key* from, Fn& fn)
+    {
+        if (node.leaf)
+        {
+            size_t i = from == nullptr ? 0 : std::lower_bound(node.keys.begin(), node.keys.end(), *from) - node.keys.begin();
+            for (; i < node.keys.size(); ++i)
+            {
+                if (!fn(node.keys[i], node.values[i]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        for (size_t i = from == nullptr ? 0 : childFor(node, *from); i < node.children.size(); ++i)
+        {
+            if (!visit(*node.children[i], from, fn))
+            {
+                return false;
+            }
+            // every later child starts past from
+            from = nullptr;
+        }
+        return true;
+    }
+
+    static void collectLeaves(const Node& node, std::vector<Leaf>& out)
+    {
+        if (node.leaf)
+        {
+            out.push_back(Leaf{&node.keys, &node.values});
+            return;
+        }
+        for (const auto& child : node.children)
+        {
+            collectLeaves(*child, out);
+        }
+    }
+
+    std::shared_ptr<Node> m_root;
+    size_t m_size = 0;
+};
+
+#endif // PERSISTENTMAP_H
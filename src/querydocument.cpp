@@ -1,8 +1,13 @@
 #include "querydocument.h"
+#include <QCborStreamReader>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QJsonArray>
 #include <QJsonParseError>
 #include <QDebug>
+#include <limits>
+#include "cborcodec.h"
+#include "seriesqueries.h"
 
 QueryDocument QueryDocument::fromJson(const QString& jsonString, bool* ok)
 {
@@ -28,8 +33,60 @@ QueryDocument QueryDocument::fromJson(const QString& jsonString, bool* ok)
     query.to = obj["to"].toVariant().toLongLong();
     query.doc = obj["doc"].toString();
     query.col = obj["col"].toString();
+    for (const QJsonValue& field : obj["fields"].toArray()) {
+        query.fields.append(field.toString());
+    }
+    query.filter = obj.value("filter");
+    QJsonObject downsample = obj["downsample"].toObject();
+    query.downsample = downsample["points"].toVariant().toLongLong();
+    query.downsampleMethod = downsample.value("method").toString(QStringLiteral("lttb"));
+    query.downsampleField = downsample["field"].toString();
     query.limit = obj["limit"].toVariant().toLongLong();
     query.reverse = obj["reverse"].toVariant().toBool();
+    query.cursor = obj["cursor"].toString();
+    query.stream = obj["stream"].toBool();
+
+    if (ok) *ok = query.isValid();
+    return query;
+}
+
+QueryDocument QueryDocument::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    QueryDocument query;
+    query.from = 0;
+    query.to = 0;
+    query.limit = 0;
+    query.reverse = false;
+    query.downsample = 0;
+    query.downsampleMethod = QStringLiteral("lttb");
+    query.stream = false;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&query](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("from")) return CborCodec::readInteger(value, &query.from);
+        if (key == QLatin1String("to")) return CborCodec::readInteger(value, &query.to);
+        if (key == QLatin1String("doc")) return CborCodec::readString(value, &query.doc);
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &query.col);
+        if (key == QLatin1String("fields")) return CborCodec::readStringList(value, &query.fields);
+        if (key == QLatin1String("filter")) return CborCodec::readJson(value, &query.filter);
+        if (key == QLatin1String("downsample")) {
+            return CborCodec::readMap(value, [&query](const QString& option, QCborStreamReader& optionValue) {
+                if (option == QLatin1String("points")) return CborCodec::readInteger(optionValue, &query.downsample);
+                if (option == QLatin1String("method")) return CborCodec::readString(optionValue, &query.downsampleMethod);
+                if (option == QLatin1String("field")) return CborCodec::readString(optionValue, &query.downsampleField);
+                return CborCodec::skip(optionValue);
+            });
+        }
+        if (key == QLatin1String("limit")) return CborCodec::readInteger(value, &query.limit);
+        if (key == QLatin1String("reverse")) return CborCodec::readBool(value, &query.reverse);
+        if (key == QLatin1String("cursor")) return CborCodec::readString(value, &query.cursor);
+        if (key == QLatin1String("stream")) return CborCodec::readBool(value, &query.stream);
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+        if (ok) *ok = false;
+        return query;
+    }
 
     if (ok) *ok = query.isValid();
     return query;
@@ -37,5 +94,59 @@ QueryDocument QueryDocument::fromJson(const QString& jsonString, bool* ok)
 
 bool QueryDocument::isValid() const
 {
-    return to > 0 && from <= to && !doc.isEmpty() && !col.isEmpty();
+    if (to <= 0 || from > to || doc.isEmpty() || col.isEmpty() || downsample < 0) {
+        return false;
+    }
+    if (downsample == 0) {
+        return true;
+    }
+    // a downsampled result is a single bounded page already
+    if (!cursor.isEmpty() || stream) {
+        return false;
+    }
+    // only first and last can pick records without a numeric field
+    DownsampleMethod method;
+    return downsampleMethodFromName(downsampleMethod, &method) &&
+           (!downsampleField.isEmpty() || method == DownsampleMethod::First || method == DownsampleMethod::Last);
 } 
+
+QString QueryDocument::encodeCursor(const QString& doc, qint64 ts, bool reverse)
+{
+    QByteArray token(reverse ? "r:" : "f:");
+    token += QByteArray::number(ts);
+    token += ':';
+    token += doc.toUtf8();
+    return QString::fromLatin1(token.toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals));
+}
+
+bool QueryDocument::decodeCursor(qint64* ts) const
+{
+    const QByteArray token = QByteArray::fromBase64(cursor.toLatin1(), QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals);
+    const qsizetype separator = token.indexOf(':', 2);
+    if (separator < 0 || !token.startsWith(reverse ? "r:" : "f:")) {
+        return false;
+    }
+    bool ok = false;
+    *ts = token.mid(2, separator - 2).toLongLong(&ok);
+    // no record can follow the first or last timestamp, so no cursor points there
+    if (!ok || *ts == (reverse ? std::numeric_limits<qint64>::min() : std::numeric_limits<qint64>::max())) {
+        return false;
+    }
+    return QString::fromUtf8(token.mid(separator + 1)) == doc;
+}
+
+bool QueryDocument::resumeAfter(qint64 last)
+{
+    if (reverse) {
+        if (last == std::numeric_limits<qint64>::min()) {
+            return false;
+        }
+        to = last - 1;
+    } else {
+        if (last == std::numeric_limits<qint64>::max()) {
+            return false;
+        }
+        from = last + 1;
+    }
+    return true;
+}
@@ -2,6 +2,9 @@
 #define QUERYDOCUMENT_H
 
 #include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QJsonValue>
 
 struct QueryDocument {
     qint64 from;
@@ -10,10 +13,34 @@ struct QueryDocument {
     bool reverse;
     QString doc;
     QString col;
+    // payload paths to return instead of the whole payload
+    QStringList fields;
+    // payload predicate, see PayloadFilter; undefined when absent
+    QJsonValue filter;
+    // at most downsample records (0 returns all), picked by downsampleMethod
+    // over the numeric payload field downsampleField
+    qint64 downsample;
+    QString downsampleMethod;
+    QString downsampleField;
+    // continuation token of a previous page, see encodeCursor()
+    QString cursor;
+    // send the result as a series of bounded frames
+    bool stream;
 
-    
     static QueryDocument fromJson(const QString& jsonString, bool* ok = nullptr);
+    static QueryDocument fromCbor(const QByteArray& cbor, bool* ok = nullptr);
     bool isValid() const;
+
+    // Opaque token for the page after the record at ts. It records the
+    // document and direction so it cannot resume a different query.
+    static QString encodeCursor(const QString& doc, qint64 ts, bool reverse);
+    // Timestamp of the last record returned before, false when the cursor
+    // is malformed, belongs to another document or direction, or points at
+    // the last timestamp of its direction.
+    bool decodeCursor(qint64* ts) const;
+    // Narrows the range to the records after the one at last, in the query's
+    // direction; false when no timestamp follows last.
+    bool resumeAfter(qint64 last);
 };
 
 #endif // QUERYDOCUMENT_H 
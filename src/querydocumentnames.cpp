@@ -0,0 +1,63 @@
+#include "querydocumentnames.h"
+#include <QCborStreamReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QDebug>
+#include "cborcodec.h"
+
+QueryDocumentNames QueryDocumentNames::fromJson(const QString& jsonString, bool* ok)
+{
+    QueryDocumentNames query;
+    query.limit = 0;
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(jsonString.toUtf8(), &error);
+
+    if (error.error != QJsonParseError::NoError) {
+        qWarning() << "JSON parse error:" << error.errorString();
+        if (ok) *ok = false;
+        return query;
+    }
+
+    if (!doc.isObject()) {
+        qWarning() << "JSON is not an object";
+        if (ok) *ok = false;
+        return query;
+    }
+
+    QJsonObject obj = doc.object();
+    query.col = obj["col"].toString();
+    query.prefix = obj["prefix"].toString();
+    query.after = obj["after"].toString();
+    query.limit = obj["limit"].toVariant().toLongLong();
+
+    if (ok) *ok = query.isValid();
+    return query;
+}
+
+QueryDocumentNames QueryDocumentNames::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    QueryDocumentNames query;
+    query.limit = 0;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&query](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &query.col);
+        if (key == QLatin1String("prefix")) return CborCodec::readString(value, &query.prefix);
+        if (key == QLatin1String("after")) return CborCodec::readString(value, &query.after);
+        if (key == QLatin1String("limit")) return CborCodec::readInteger(value, &query.limit);
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+        if (ok) *ok = false;
+        return query;
+    }
+
+    if (ok) *ok = query.isValid();
+    return query;
+}
+
+bool QueryDocumentNames::isValid() const
+{
+    return !col.isEmpty() && limit >= 0;
+}
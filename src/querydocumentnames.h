@@ -0,0 +1,20 @@
+#ifndef QUERYDOCUMENTNAMES_H
+#define QUERYDOCUMENTNAMES_H
+
+#include <QString>
+#include <QByteArray>
+
+// Payload of docs: the document names of a collection in lexicographic
+// order, optionally under a prefix and after the last name of a previous page.
+struct QueryDocumentNames {
+    QString col;
+    QString prefix;
+    QString after;
+    qint64 limit;
+
+    static QueryDocumentNames fromJson(const QString& jsonString, bool* ok = nullptr);
+    static QueryDocumentNames fromCbor(const QByteArray& cbor, bool* ok = nullptr);
+    bool isValid() const;
+};
+
+#endif // QUERYDOCUMENTNAMES_H
@@ -1,8 +1,11 @@
 #include "querysessions.h"
+#include <QCborStreamReader>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QJsonArray>
 #include <QJsonParseError>
 #include <QDebug>
+#include "cborcodec.h"
 
 QuerySessions QuerySessions::fromJson(const QString& jsonString, bool* ok)
 {
@@ -28,7 +31,36 @@ QuerySessions QuerySessions::fromJson(const QString& jsonString, bool* ok)
     payload.from = obj["from"].toVariant().toLongLong();
     payload.doc = obj["doc"].toString();
     payload.col = obj["col"].toString();
+    for (const QJsonValue& field : obj["fields"].toArray()) {
+        payload.fields.append(field.toString());
+    }
+    payload.filter = obj.value("filter");
+
+
+    if (ok) *ok = payload.isValid();
+    return payload;
+}
 
+QuerySessions QuerySessions::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    QuerySessions payload;
+    payload.ts = 0;
+    payload.from = 0;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&payload](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("ts")) return CborCodec::readInteger(value, &payload.ts);
+        if (key == QLatin1String("from")) return CborCodec::readInteger(value, &payload.from);
+        if (key == QLatin1String("doc")) return CborCodec::readString(value, &payload.doc);
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &payload.col);
+        if (key == QLatin1String("fields")) return CborCodec::readStringList(value, &payload.fields);
+        if (key == QLatin1String("filter")) return CborCodec::readJson(value, &payload.filter);
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+        if (ok) *ok = false;
+        return payload;
+    }
 
     if (ok) *ok = payload.isValid();
     return payload;
@@ -2,14 +2,22 @@
 #define QUERYSESSIONS_H
 
 #include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QJsonValue>
 
 struct QuerySessions {
     qint64 ts;
     qint64 from;
     QString doc;
     QString col;
+    // payload paths to return instead of the whole payload
+    QStringList fields;
+    // payload predicate, see PayloadFilter; undefined when absent
+    QJsonValue filter;
     
     static QuerySessions fromJson(const QString& jsonString, bool* ok = nullptr);
+    static QuerySessions fromCbor(const QByteArray& cbor, bool* ok = nullptr);
     bool isValid() const;
 };
 
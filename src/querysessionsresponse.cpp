@@ -7,7 +7,7 @@ QJsonObject  QuerySessionsResponse::toJson() const
 {
     QJsonObject dataObj;
     foreach (const QString& key, records.keys()) {
-        dataObj[key] = records[key]->toJson();
+        dataObj[key] = records[key].toJson();
     }
     
     QJsonObject obj;
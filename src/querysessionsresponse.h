@@ -8,7 +8,7 @@
 
 struct QuerySessionsResponse {
     QString id;
-    QHash<QString, DataRecord*> records;
+    QHash<QString, DataRecord> records;
 
     QJsonObject toJson() const;
     QString toString() const;
@@ -0,0 +1,90 @@
+#include "responsecache.h"
+#include <QMutexLocker>
+
+ResponseCache::ResponseCache(qsizetype capacityBytes)
+    : m_capacity(capacityBytes), m_size(0)
+{
+}
+
+ResponseCache::Lookup ResponseCache::lookup(const QByteArray &key, quint64 version, QByteArray *response, Waiter waiter)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_index.find(key);
+    if (it != m_index.end() && it->second->version == version)
+    {
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        *response = it->second->response;
+        return Lookup::Hit;
+    }
+    // a reader on an older view must not drop the entry of a newer one
+    if (it != m_index.end() && it->second->version < version)
+    {
+        erase(it->second);
+    }
+
+    auto [flight, created] = m_inFlight.try_emplace(key, Flight{version, {}});
+    if (created)
+    {
+        return Lookup::Miss;
+    }
+    if (flight->second.version != version)
+    {
+        // computed alongside; only the read that started the flight ends it
+        return Lookup::Miss;
+    }
+    flight->second.waiters.push_back(std::move(waiter));
+    return Lookup::Pending;
+}
+
+void ResponseCache::insert(const QByteArray &key, quint64 version, const QByteArray &response)
+{
+    std::vector<Waiter> waiters;
+    {
+        QMutexLocker locker(&m_mutex);
+        auto flight = m_inFlight.find(key);
+        if (flight != m_inFlight.end() && flight->second.version == version)
+        {
+            waiters.swap(flight->second.waiters);
+            m_inFlight.erase(flight);
+        }
+        store(key, version, response);
+    }
+    // outside the lock, a waiter may well look up again
+    for (const Waiter &waiter : waiters)
+    {
+        waiter(response);
+    }
+}
+
+void ResponseCache::store(const QByteArray &key, quint64 version, const QByteArray &response)
+{
+    auto it = m_index.find(key);
+    if (it != m_index.end())
+    {
+        if (it->second->version > version)
+        {
+            return;
+        }
+        erase(it->second);
+    }
+    const qsizetype cost = key.size() + response.size();
+    if (cost > m_capacity / 16)
+    {
+        return;
+    }
+
+    m_entries.push_front(Entry{key, version, response});
+    m_index[key] = m_entries.begin();
+    m_size += cost;
+    while (m_size > m_capacity)
+    {
+        erase(std::prev(m_entries.end()));
+    }
+}
+
+void ResponseCache::erase(std::list<Entry>::iterator it)
+{
+    m_size -= it->key.size() + it->response.size();
+    m_index.erase(it->key);
+    m_entries.erase(it);
+}
@@ -0,0 +1,69 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Least recently used cache of encoded responses, bounded by their total size.
+// Responses are stored with an empty id (see ResponseWriter::withId()) under
+// a key built from the normalized request, together with the change stamp of
+// the data they were read from (see Collection::version()). A lookup with a
+// newer stamp misses and drops the entry, so writes invalidate the responses
+// of the collection or document they touch without tracking them here.
+// Lookups and inserts may come from the reader threads as well as the shard;
+// since stamps only grow, one from a view older than the entry leaves it be.
+//
+// Reads missing the same key and stamp at once are computed once: the
+// first one computes the response, the others wait for it.
+class ResponseCache
+{
+public:
+    // called with the response computed by another read
+    using Waiter = std::function<void(const QByteArray& response)>;
+
+    enum class Lookup {
+        // the response was cached
+        Hit,
+        // the caller computes the response and passes it to insert()
+        Miss,
+        // an identical read is computing it, and calls waiter once it is done
+        Pending
+    };
+
+    explicit ResponseCache(qsizetype capacityBytes = 64 * 1024 * 1024);
+
+    Lookup lookup(const QByteArray& key, quint64 version, QByteArray* response, Waiter waiter);
+    // Responses larger than a sixteenth of the capacity are not kept. The
+    // waiters of the read that computed it get the response either way.
+    void insert(const QByteArray& key, quint64 version, const QByteArray& response);
+
+private:
+    struct Entry {
+        QByteArray key;
+        quint64 version;
+        QByteArray response;
+    };
+
+    // a response being computed after a Miss
+    struct Flight {
+        quint64 version;
+        std::vector<Waiter> waiters;
+    };
+
+    void store(const QByteArray& key, quint64 version, const QByteArray& response);
+    void erase(std::list<Entry>::iterator it);
+
+    QMutex m_mutex;
+    qsizetype m_capacity;
+    qsizetype m_size;
+    // most recently used first
+    std::list<Entry> m_entries;
+    std::unordered_map<QByteArray, std::list<Entry>::iterator> m_index;
+    std::unordered_map<QByteArray, Flight> m_inFlight;
+};
+
+#endif // RESPONSECACHE_H
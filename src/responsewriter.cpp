@@ -0,0 +1,243 @@
+#include "responsewriter.h"
+#include <QCborStreamWriter>
+#include <QLocale>
+#include <cmath>
+#include <cstring>
+
+ResponseWriter::ResponseWriter(bool binary)
+    : m_afterKey(false)
+{
+    m_out.reserve(256);
+    if (binary)
+    {
+        m_cbor = std::make_unique<QCborStreamWriter>(&m_out);
+    }
+}
+
+ResponseWriter::~ResponseWriter() = default;
+
+bool ResponseWriter::isBinary() const
+{
+    return m_cbor != nullptr;
+}
+
+void ResponseWriter::startMap()
+{
+    if (m_cbor)
+    {
+        m_cbor->startMap();
+        return;
+    }
+    beforeValue();
+    m_out.append('{');
+    m_hasElements.push_back(false);
+}
+
+void ResponseWriter::endMap()
+{
+    if (m_cbor)
+    {
+        m_cbor->endMap();
+        return;
+    }
+    m_hasElements.pop_back();
+    m_out.append('}');
+}
+
+void ResponseWriter::startArray()
+{
+    if (m_cbor)
+    {
+        m_cbor->startArray();
+        return;
+    }
+    beforeValue();
+    m_out.append('[');
+    m_hasElements.push_back(false);
+}
+
+void ResponseWriter::endArray()
+{
+    if (m_cbor)
+    {
+        m_cbor->endArray();
+        return;
+    }
+    m_hasElements.pop_back();
+    m_out.append(']');
+}
+
+void ResponseWriter::key(const char *name)
+{
+    string(name);
+    if (!m_cbor)
+    {
+        m_out.append(':');
+        m_afterKey = true;
+    }
+}
+
+void ResponseWriter::key(const QString &name)
+{
+    string(name);
+    if (!m_cbor)
+    {
+        m_out.append(':');
+        m_afterKey = true;
+    }
+}
+
+void ResponseWriter::string(const char *value)
+{
+    string(std::string_view(value, std::strlen(value)));
+}
+
+void ResponseWriter::string(const QString &value)
+{
+    if (m_cbor)
+    {
+        m_cbor->append(value);
+        return;
+    }
+    const QByteArray utf8 = value.toUtf8();
+    string(std::string_view(utf8.constData(), static_cast<size_t>(utf8.size())));
+}
+
+void ResponseWriter::string(std::string_view value)
+{
+    if (m_cbor)
+    {
+        m_cbor->appendTextString(value.data(), static_cast<qsizetype>(value.size()));
+        return;
+    }
+    beforeValue();
+    appendJsonString(m_out, value);
+}
+
+void ResponseWriter::integer(qint64 value)
+{
+    if (m_cbor)
+    {
+        m_cbor->append(value);
+        return;
+    }
+    beforeValue();
+    m_out.append(QByteArray::number(value));
+}
+
+void ResponseWriter::number(double value)
+{
+    if (!std::isfinite(value))
+    {
+        null();
+        return;
+    }
+    if (m_cbor)
+    {
+        m_cbor->append(value);
+        return;
+    }
+    beforeValue();
+    m_out.append(QByteArray::number(value, 'g', QLocale::FloatingPointShortest));
+}
+
+void ResponseWriter::boolean(bool value)
+{
+    if (m_cbor)
+    {
+        m_cbor->append(value);
+        return;
+    }
+    beforeValue();
+    m_out.append(value ? "true" : "false");
+}
+
+void ResponseWriter::null()
+{
+    if (m_cbor)
+    {
+        m_cbor->appendNull();
+        return;
+    }
+    beforeValue();
+    m_out.append("null");
+}
+
+QByteArray ResponseWriter::take()
+{
+    m_cbor.reset();
+    return std::move(m_out);
+}
+
+void ResponseWriter::beforeValue()
+{
+    if (m_afterKey)
+    {
+        m_afterKey = false;
+        return;
+    }
+    if (!m_hasElements.empty())
+    {
+        if (m_hasElements.back())
+        {
+            m_out.append(',');
+        }
+        m_hasElements.back() = true;
+    }
+}
+
+QByteArray ResponseWriter::withId(const QByteArray &response, const QString &id, bool binary)
+{
+    // {"id":"" in JSON; an indefinite map, the text "id" and an empty text in CBOR
+    static const QByteArray jsonHead("{\"id\":\"\"");
+    static const QByteArray cborHead("\xbf\x62id\x60", 5);
+    const QByteArray &head = binary ? cborHead : jsonHead;
+    if (id.isEmpty() || !response.startsWith(head))
+    {
+        return response;
+    }
+
+    ResponseWriter writer(binary);
+    writer.startMap();
+    writer.key("id");
+    writer.string(id);
+    QByteArray out = writer.take();
+    out.reserve(out.size() + response.size() - head.size());
+    out.append(response.constData() + head.size(), response.size() - head.size());
+    return out;
+}
+
+void ResponseWriter::appendJsonString(QByteArray &out, std::string_view value)
+{
+    static const char hex[] = "0123456789abcdef";
+    out.append('"');
+    size_t plain = 0; // start of the run copied verbatim
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        const unsigned char ch = static_cast<unsigned char>(value[i]);
+        if (ch >= 0x20 && ch != '"' && ch != '\\')
+        {
+            continue;
+        }
+        out.append(value.data() + plain, static_cast<qsizetype>(i - plain));
+        plain = i + 1;
+        switch (ch)
+        {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+        {
+            const char escaped[] = {'\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xf]};
+            out.append(escaped, 6);
+            break;
+        }
+        }
+    }
+    out.append(value.data() + plain, static_cast<qsizetype>(value.size() - plain));
+    out.append('"');
+}
@@ -0,0 +1,64 @@
+#ifndef RESPONSEWRITER_H
+#define RESPONSEWRITER_H
+
+#include <QByteArray>
+#include <QString>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+class QCborStreamWriter;
+
+// Streams a response in the encoding of the request it answers: compact JSON
+// text, or CBOR for the binary protocol. Values go straight into the output
+// buffer as they are produced instead of through a QJsonObject tree.
+class ResponseWriter
+{
+public:
+    explicit ResponseWriter(bool binary);
+    ~ResponseWriter();
+
+    bool isBinary() const;
+
+    void startMap();
+    void endMap();
+    void startArray();
+    void endArray();
+
+    void key(const char* name);
+    void key(const QString& name);
+
+    void string(const char* value);
+    void string(const QString& value);
+    // UTF-8 text, e.g. a record payload viewed in its series chunk
+    void string(std::string_view value);
+    void integer(qint64 value);
+    // NaN and infinities are written as null
+    void number(double value);
+    void boolean(bool value);
+    void null();
+
+    // Bytes encoded so far, for bounding the size of a frame.
+    qsizetype size() const { return m_out.size(); }
+
+    // The encoded response; the writer must not be used afterwards.
+    QByteArray take();
+
+    // A response that was written with an empty "id" as its first entry,
+    // with id put in its place, e.g. to answer from a cached response.
+    static QByteArray withId(const QByteArray& response, const QString& id, bool binary);
+
+    // Appends a quoted, escaped JSON string.
+    static void appendJsonString(QByteArray& out, std::string_view value);
+
+private:
+    void beforeValue();
+
+    QByteArray m_out;
+    std::unique_ptr<QCborStreamWriter> m_cbor;
+    // JSON only: per open container, whether an element was written already
+    std::vector<bool> m_hasElements;
+    bool m_afterKey;
+};
+
+#endif // RESPONSEWRITER_H
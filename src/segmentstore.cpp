@@ -0,0 +1,380 @@
+#include "segmentstore.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include "binarycodec.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char SegmentMagic[8] = {'F', 'X', 'D', 'B', 'S', 'E', 'G', '\0'};
+constexpr char FooterMagic[8] = {'F', 'X', 'D', 'B', 'I', 'D', 'X', '\0'};
+constexpr qint64 HeaderSize = 12;      // magic + version
+constexpr qint64 TrailerSize = 20;     // footer offset + footer crc + magic
+constexpr qint64 BlockHeaderSize = 8;  // body length + body crc
+
+bool syncFile(QFileDevice &file)
+{
+#ifdef __linux__
+    return ::fdatasync(file.handle()) == 0;
+#else
+    Q_UNUSED(file);
+    return true;
+#endif
+}
+
+bool decodeBlock(const char *data, qsizetype size, SegmentStore::Block *block)
+{
+    BinaryCodec::Reader reader(data, size);
+    quint8 type = 0;
+    if (!reader.readByte(&type) || !reader.readString(&block->doc))
+    {
+        return false;
+    }
+
+    block->type = static_cast<SegmentStore::BlockType>(type);
+    switch (block->type)
+    {
+    case SegmentStore::BlockType::Records:
+        if (!reader.readVarint(&block->recordCount))
+        {
+            return false;
+        }
+        block->records = std::string_view(reader.position(), reader.remaining());
+        return true;
+    case SegmentStore::BlockType::DeleteRange:
+        return reader.readSignedVarint(&block->fromTs) && reader.readSignedVarint(&block->toTs) && reader.atEnd();
+    case SegmentStore::BlockType::ClearDocument:
+        return reader.atEnd();
+    }
+    return false;
+}
+
+} // namespace
+
+bool SegmentStore::Block::forEachRecord(const std::function<void(qint64, std::string_view)> &fn) const
+{
+    BinaryCodec::Reader reader(records.data(), static_cast<qsizetype>(records.size()));
+    qint64 timestamp = 0;
+    for (quint64 i = 0; i < recordCount; ++i)
+    {
+        qint64 delta = 0;
+        std::string_view payload;
+        if (!reader.readSignedVarint(&delta) || !reader.readBytes(&payload))
+        {
+            return false;
+        }
+        timestamp += delta;
+        fn(timestamp, payload);
+    }
+    return reader.atEnd();
+}
+
+SegmentStore::SegmentStore(const QString &folder)
+    : m_folder(folder), m_sealActive(false), m_totalSize(0), m_rewrittenSize(0)
+{
+}
+
+QString SegmentStore::pathFor(quint64 sequence) const
+{
+    return m_folder + "/" + QString("%1.seg").arg(sequence, 16, 10, QChar('0'));
+}
+
+bool SegmentStore::load(const std::function<void(const Block &)> &visitor, const std::function<void()> &onLoaded)
+{
+    m_segments.clear();
+    QDir dir(m_folder);
+    if (!dir.exists())
+    {
+        if (onLoaded)
+        {
+            onLoaded();
+        }
+        return true;
+    }
+
+    // kept open so the mapped payloads handed to the visitor outlive the scan
+    std::vector<std::unique_ptr<QFile>> files;
+    std::deque<QByteArray> buffers;
+    bool ok = true;
+    for (const QString &fileName : dir.entryList(QStringList() << "*.seg", QDir::Files, QDir::Name))
+    {
+        bool isNumber = false;
+        const quint64 sequence = QFileInfo(fileName).baseName().toULongLong(&isNumber);
+        if (!isNumber)
+        {
+            continue;
+        }
+        Segment segment;
+        segment.sequence = sequence;
+        files.push_back(std::make_unique<QFile>(pathFor(sequence)));
+        buffers.emplace_back();
+        // never append to a segment that could not be read back
+        m_sealActive = !loadSegment(segment, *files.back(), buffers.back(), visitor);
+        ok = ok && !m_sealActive;
+        m_segments.push_back(std::move(segment));
+    }
+    updateTotalSize();
+    m_rewrittenSize = m_totalSize.load();
+    if (onLoaded)
+    {
+        onLoaded();
+    }
+    return ok;
+}
+
+bool SegmentStore::loadSegment(Segment &segment, QFile &file, QByteArray &buffer, const std::function<void(const Block &)> &visitor)
+{
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Failed to open segment" << file.fileName() << ":" << file.errorString();
+        return false;
+    }
+
+    const qint64 size = file.size();
+    segment.size = size;
+    if (size < HeaderSize)
+    {
+        qWarning() << "Segment too short" << file.fileName();
+        return false;
+    }
+
+    const char *data = reinterpret_cast<const char *>(file.map(0, size));
+    if (data == nullptr)
+    {
+        buffer = file.readAll();
+        data = buffer.constData();
+    }
+
+    if (std::memcmp(data, SegmentMagic, sizeof(SegmentMagic)) != 0 ||
+        BinaryCodec::readFixed32(data + sizeof(SegmentMagic)) > FormatVersion)
+    {
+        qWarning() << "Unsupported segment format" << file.fileName();
+        return false;
+    }
+
+    // a valid footer marks where the blocks end; without one, scan until the first torn block
+    qint64 limit = size;
+    if (size >= HeaderSize + TrailerSize &&
+        std::memcmp(data + size - sizeof(FooterMagic), FooterMagic, sizeof(FooterMagic)) == 0)
+    {
+        const qint64 footerOffset = static_cast<qint64>(BinaryCodec::readFixed64(data + size - TrailerSize));
+        const quint32 footerCrc = BinaryCodec::readFixed32(data + size - TrailerSize + 8);
+        if (footerOffset >= HeaderSize && footerOffset <= size - TrailerSize &&
+            BinaryCodec::crc32(data + footerOffset, size - TrailerSize - footerOffset) == footerCrc)
+        {
+            limit = footerOffset;
+        }
+    }
+
+    qint64 pos = HeaderSize;
+    while (pos + BlockHeaderSize <= limit)
+    {
+        const quint32 length = BinaryCodec::readFixed32(data + pos);
+        const quint32 crc = BinaryCodec::readFixed32(data + pos + 4);
+        if (length > limit - pos - BlockHeaderSize)
+        {
+            break;
+        }
+        const char *body = data + pos + BlockHeaderSize;
+        Block block;
+        if (BinaryCodec::crc32(body, length) != crc || !decodeBlock(body, length, &block))
+        {
+            break;
+        }
+
+        visitor(block);
+        pos += BlockHeaderSize + length;
+    }
+
+    if (pos != limit)
+    {
+        qWarning() << "Segment" << file.fileName() << "has a torn tail of" << limit - pos << "bytes";
+    }
+    segment.dataEnd = pos;
+    return true;
+}
+
+void SegmentStore::appendRecords(const QString &doc, const std::vector<DataRecord> &records)
+{
+    for (size_t first = 0; first < records.size(); first += MaxRecordsPerBlock)
+    {
+        const size_t last = std::min(records.size(), first + static_cast<size_t>(MaxRecordsPerBlock));
+        QByteArray body;
+        body.append(static_cast<char>(BlockType::Records));
+        BinaryCodec::appendString(body, doc);
+        BinaryCodec::appendVarint(body, last - first);
+        qint64 previous = 0;
+        for (size_t i = first; i < last; ++i)
+        {
+            BinaryCodec::appendSignedVarint(body, records[i].timestamp - previous);
+            BinaryCodec::appendString(body, records[i].data);
+            previous = records[i].timestamp;
+        }
+        appendBlock(body);
+    }
+}
+
+void SegmentStore::appendDeleteRange(const QString &doc, qint64 fromTs, qint64 toTs)
+{
+    QByteArray body;
+    body.append(static_cast<char>(BlockType::DeleteRange));
+    BinaryCodec::appendString(body, doc);
+    BinaryCodec::appendSignedVarint(body, fromTs);
+    BinaryCodec::appendSignedVarint(body, toTs);
+    appendBlock(body);
+}
+
+void SegmentStore::appendClearDocument(const QString &doc)
+{
+    QByteArray body;
+    body.append(static_cast<char>(BlockType::ClearDocument));
+    BinaryCodec::appendString(body, doc);
+    appendBlock(body);
+}
+
+void SegmentStore::appendBlock(const QByteArray &body)
+{
+    BinaryCodec::appendFixed32(m_pending, static_cast<quint32>(body.size()));
+    BinaryCodec::appendFixed32(m_pending, BinaryCodec::crc32(body.constData(), body.size()));
+    m_pending.append(body);
+}
+
+bool SegmentStore::commit()
+{
+    if (m_pending.isEmpty())
+    {
+        return true;
+    }
+
+    if (m_segments.empty() || m_sealActive || m_segments.back().dataEnd >= TargetSegmentSize)
+    {
+        Segment next;
+        next.sequence = m_segments.empty() ? 1 : m_segments.back().sequence + 1;
+        m_segments.push_back(std::move(next));
+        m_sealActive = false;
+    }
+    Segment &active = m_segments.back();
+
+    QDir().mkpath(m_folder);
+    QFile file(pathFor(active.sequence));
+    if (!file.open(QIODevice::ReadWrite))
+    {
+        qWarning() << "Failed to open segment" << file.fileName() << ":" << file.errorString();
+        return false;
+    }
+
+    // append after the last intact block, cutting off a torn tail or a footer written by earlier versions
+    QByteArray out;
+    qint64 base = active.dataEnd;
+    if (base < HeaderSize)
+    {
+        base = 0;
+        out.append(SegmentMagic, sizeof(SegmentMagic));
+        BinaryCodec::appendFixed32(out, FormatVersion);
+    }
+    out.append(m_pending);
+    const qint64 blocksEnd = base + out.size();
+    if (blocksEnd >= TargetSegmentSize)
+    {
+        out.append(encodeFooter(blocksEnd));
+    }
+
+    const bool positioned = file.resize(base) && file.seek(base);
+    const qint64 written = positioned ? file.write(out) : -1;
+    const bool ok = written == out.size() && file.flush() && syncFile(file);
+    if (!ok)
+    {
+        qWarning() << "Failed to append to segment" << file.fileName() << ":" << file.errorString();
+    }
+    file.close();
+    if (!ok)
+    {
+        // later blocks go to a new segment; this one is read up to its first torn block
+        m_sealActive = true;
+        return false;
+    }
+
+    active.dataEnd = blocksEnd;
+    active.size = base + out.size();
+    m_pending.clear();
+    updateTotalSize();
+    return true;
+}
+
+QByteArray SegmentStore::encodeFooter(qint64 footerOffset)
+{
+    // nothing but the end of the blocks: loading reads every block anyway
+    QByteArray footer;
+    BinaryCodec::appendFixed64(footer, static_cast<quint64>(footerOffset));
+    BinaryCodec::appendFixed32(footer, BinaryCodec::crc32(footer.constData(), 0));
+    footer.append(FooterMagic, sizeof(FooterMagic));
+    return footer;
+}
+
+void SegmentStore::beginRewrite()
+{
+    m_retiring.clear();
+    for (const Segment &segment : m_segments)
+    {
+        m_retiring.push_back(segment.sequence);
+    }
+    m_sealActive = true;
+}
+
+bool SegmentStore::finishRewrite()
+{
+    if (!m_pending.isEmpty())
+    {
+        // the rewrite did not fully commit: keep the old segments and drop
+        // what it wrote, or the next commit would append the rest of it
+        m_pending.clear();
+        const quint64 lastRetiring = m_retiring.empty() ? 0 : m_retiring.back();
+        for (const Segment &segment : m_segments)
+        {
+            if (segment.sequence > lastRetiring)
+            {
+                QFile::remove(pathFor(segment.sequence));
+            }
+        }
+        m_segments.erase(std::remove_if(m_segments.begin(), m_segments.end(),
+                                        [lastRetiring](const Segment &segment) { return segment.sequence > lastRetiring; }),
+                         m_segments.end());
+        m_retiring.clear();
+        updateTotalSize();
+        return false;
+    }
+
+    for (const quint64 sequence : m_retiring)
+    {
+        QFile::remove(pathFor(sequence));
+    }
+    m_segments.erase(std::remove_if(m_segments.begin(), m_segments.end(),
+                                    [this](const Segment &segment)
+                                    {
+                                        return std::find(m_retiring.begin(), m_retiring.end(), segment.sequence) != m_retiring.end();
+                                    }),
+                     m_segments.end());
+    m_retiring.clear();
+    updateTotalSize();
+    m_rewrittenSize = m_totalSize.load();
+    return true;
+}
+
+void SegmentStore::updateTotalSize()
+{
+    qint64 total = 0;
+    for (const Segment &segment : m_segments)
+    {
+        total += segment.size;
+    }
+    m_totalSize = total;
+}
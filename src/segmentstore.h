@@ -0,0 +1,102 @@
+#ifndef SEGMENTSTORE_H
+#define SEGMENTSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <atomic>
+#include <functional>
+#include <string_view>
+#include <vector>
+#include "datarecord.h"
+
+class QFile;
+
+// Persistent storage of one collection as a sequence of binary segment files
+// (<collection>/<sequence>.seg). Each flush appends blocks to the newest
+// segment; once it outgrows TargetSegmentSize the segment is sealed with a
+// footer and the next flush starts a new one. Segments are read block by
+// block up to their footer or, before they are sealed, their first torn
+// block. A store is used by one thread at a time; only the size accessors
+// may be read concurrently.
+//
+// Segment layout (integers little-endian, varints LEB128, signed ones zigzag):
+//   header   "FXDBSEG\0" magic, u32 format version
+//   blocks   u32 body length, u32 crc32(body), body
+//            body = u8 type, doc name, then per type:
+//              Records        varint count, count x (signed varint ts delta, varint length, payload)
+//              DeleteRange    signed varint from, signed varint to
+//              ClearDocument  nothing
+//   footer   (sealed segments only) u64 footer offset, u32 crc32 of the footer bytes before it, "FXDBIDX\0";
+//            segments written by earlier versions have a per-document block index there, which is skipped
+class SegmentStore {
+public:
+    static constexpr quint32 FormatVersion = 1;
+    static constexpr qint64 TargetSegmentSize = 64 * 1024 * 1024;
+    static constexpr qsizetype MaxRecordsPerBlock = 4096;
+
+    enum class BlockType : quint8 {
+        Records = 1,
+        DeleteRange = 2,
+        ClearDocument = 3
+    };
+
+    struct Block {
+        BlockType type;
+        QString doc;
+        qint64 fromTs = 0;
+        qint64 toTs = 0;
+        quint64 recordCount = 0;
+        // encoded records of a Records block
+        std::string_view records;
+
+        // Decodes the records in timestamp order; false if the block is malformed.
+        bool forEachRecord(const std::function<void(qint64, std::string_view)>& fn) const;
+    };
+
+    explicit SegmentStore(const QString& folder);
+
+    // Streams every intact block of every segment, oldest first. The segments
+    // stay mapped, and record payloads valid, until onLoaded has returned.
+    bool load(const std::function<void(const Block&)>& visitor, const std::function<void()>& onLoaded = nullptr);
+
+    void appendRecords(const QString& doc, const std::vector<DataRecord>& records);
+    void appendDeleteRange(const QString& doc, qint64 fromTs, qint64 toTs);
+    void appendClearDocument(const QString& doc);
+    bool hasPending() const { return !m_pending.isEmpty(); }
+    qsizetype pendingSize() const { return m_pending.size(); }
+    bool commit();
+
+    // Rewrites the whole collection: blocks committed between beginRewrite()
+    // and finishRewrite() go to fresh segments, then every older segment is
+    // removed. A rewrite that did not fully commit is dropped instead, and
+    // the older segments are kept.
+    void beginRewrite();
+    bool finishRewrite();
+
+    qint64 totalSize() const { return m_totalSize.load(); }
+    // total size right after the last load or rewrite
+    qint64 rewrittenSize() const { return m_rewrittenSize.load(); }
+
+private:
+    struct Segment {
+        quint64 sequence = 0;
+        qint64 dataEnd = 0;
+        qint64 size = 0;
+    };
+
+    QString pathFor(quint64 sequence) const;
+    bool loadSegment(Segment& segment, QFile& file, QByteArray& buffer, const std::function<void(const Block&)>& visitor);
+    void appendBlock(const QByteArray& body);
+    static QByteArray encodeFooter(qint64 footerOffset);
+    void updateTotalSize();
+
+    QString m_folder;
+    std::vector<Segment> m_segments;
+    std::vector<quint64> m_retiring;
+    bool m_sealActive;
+    QByteArray m_pending;
+    std::atomic<qint64> m_totalSize;
+    std::atomic<qint64> m_rewrittenSize;
+};
+
+#endif // SEGMENTSTORE_H
@@ -0,0 +1,347 @@
+#include "seriesqueries.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+struct SamplePoint {
+    DataRecord record;
+    double value;
+};
+
+// Splits [from, to] into at most count buckets of equal width. Offsets are
+// unsigned so that the widest range, from the lowest to the highest timestamp,
+// neither overflows the width nor a record's offset.
+class TimeBuckets
+{
+public:
+    TimeBuckets(qint64 from, qint64 to, qint64 count)
+        : m_from(from), m_count(static_cast<quint64>(count))
+    {
+        // ceil((span + 1) / count) is span / count + 1 unless that wraps
+        const quint64 span = static_cast<quint64>(to) - static_cast<quint64>(from);
+        m_width = span / m_count == std::numeric_limits<quint64>::max() ? span : span / m_count + 1;
+    }
+
+    quint64 indexOf(qint64 timestamp) const
+    {
+        return std::min((static_cast<quint64>(timestamp) - static_cast<quint64>(m_from)) / m_width, m_count - 1);
+    }
+
+private:
+    qint64 m_from;
+    quint64 m_count;
+    quint64 m_width;
+};
+
+// Whether the record matches the filter and, with a field, has a number there.
+bool sampleOf(const DataRecord &record, const PayloadPath &field, const PayloadFilter *filter, double *value)
+{
+    if (filter != nullptr && !filter->isEmpty() && !filter->matches(record.data))
+    {
+        return false;
+    }
+    *value = 0;
+    return field.isEmpty() || field.findNumber(record.data, value);
+}
+
+// Distance in time from origin, exact for the widest ranges.
+double offsetFrom(qint64 origin, qint64 timestamp)
+{
+    return static_cast<double>(static_cast<quint64>(timestamp) - static_cast<quint64>(origin));
+}
+
+// Largest-Triangle-Three-Buckets (Steinarsson, 2013): keeps the first and the
+// last sample in [from, to] and splits the time between them into points - 2
+// buckets. From each bucket it keeps the sample spanning the largest triangle
+// with the sample kept before it and the average of the next bucket, which
+// preserves peaks and dips. One pass sums the buckets and a second picks from
+// them, so only the averages of the non-empty buckets are held, never the
+// samples of the range.
+QList<DataRecord> largestTriangleThreeBuckets(const DocumentSeries &records, qint64 from, qint64 to, qint64 points,
+                                              const PayloadPath &field, const PayloadFilter *filter)
+{
+    QList<DataRecord> result;
+    SamplePoint first{DataRecord(), 0};
+    SamplePoint last{DataRecord(), 0};
+    bool found = false;
+    records.forEachInRange(from, to, false, [&](const DataRecord &record)
+                           {
+                               found = sampleOf(record, field, filter, &first.value);
+                               first.record = record;
+                               return !found;
+                           });
+    if (!found)
+    {
+        return result;
+    }
+    result.append(first.record);
+    records.forEachInRange(first.record.timestamp, to, true, [&](const DataRecord &record)
+                           {
+                               last.record = record;
+                               return !sampleOf(record, field, filter, &last.value);
+                           });
+    if (last.record.timestamp == first.record.timestamp || points < 2)
+    {
+        return result;
+    }
+    if (points == 2)
+    {
+        result.append(last.record);
+        return result;
+    }
+
+    struct Bucket {
+        quint64 index;
+        qint64 count;
+        double averageX;
+        double averageY;
+    };
+    // timestamps relative to the first sample keep the areas precise
+    const qint64 origin = first.record.timestamp;
+    const qint64 innerFrom = first.record.timestamp + 1;
+    const qint64 innerTo = last.record.timestamp - 1;
+    std::vector<Bucket> buckets;
+    qint64 samples = 2;
+    if (innerFrom <= innerTo)
+    {
+        const TimeBuckets bounds(innerFrom, innerTo, points - 2);
+        records.forEachInRange(innerFrom, innerTo, false, [&](const DataRecord &record)
+                               {
+                                   double value = 0;
+                                   if (sampleOf(record, field, filter, &value))
+                                   {
+                                       const quint64 index = bounds.indexOf(record.timestamp);
+                                       if (buckets.empty() || buckets.back().index != index)
+                                       {
+                                           buckets.push_back(Bucket{index, 0, 0, 0});
+                                       }
+                                       Bucket &bucket = buckets.back();
+                                       ++bucket.count;
+                                       bucket.averageX += offsetFrom(origin, record.timestamp);
+                                       bucket.averageY += value;
+                                       ++samples;
+                                   }
+                                   return true;
+                               });
+        for (Bucket &bucket : buckets)
+        {
+            bucket.averageX /= static_cast<double>(bucket.count);
+            bucket.averageY /= static_cast<double>(bucket.count);
+        }
+
+        const bool keepAll = samples <= points;
+        result.reserve(static_cast<qsizetype>(keepAll ? samples : buckets.size() + 2));
+        size_t current = 0;
+        double keptX = 0;
+        double keptY = first.value;
+        double largestArea = -1;
+        DataRecord chosen;
+        double chosenY = 0;
+        records.forEachInRange(innerFrom, innerTo, false, [&](const DataRecord &record)
+                               {
+                                   double value = 0;
+                                   if (!sampleOf(record, field, filter, &value))
+                                   {
+                                       return true;
+                                   }
+                                   if (keepAll)
+                                   {
+                                       result.append(record);
+                                       return true;
+                                   }
+                                   const quint64 index = bounds.indexOf(record.timestamp);
+                                   if (index != buckets[current].index)
+                                   {
+                                       // the pick of a bucket is the kept sample of the next one
+                                       result.append(chosen);
+                                       keptX = offsetFrom(origin, chosen.timestamp);
+                                       keptY = chosenY;
+                                       largestArea = -1;
+                                       ++current;
+                                   }
+                                   const bool lastBucket = current + 1 == buckets.size();
+                                   const double nextX = lastBucket ? offsetFrom(origin, last.record.timestamp) : buckets[current + 1].averageX;
+                                   const double nextY = lastBucket ? last.value : buckets[current + 1].averageY;
+                                   const double x = offsetFrom(origin, record.timestamp);
+                                   const double area = std::abs((keptX - nextX) * (value - keptY) - (keptX - x) * (nextY - keptY));
+                                   if (largestArea < 0 || area > largestArea)
+                                   {
+                                       largestArea = area;
+                                       chosen = record;
+                                       chosenY = value;
+                                   }
+                                   return true;
+                               });
+        if (!keepAll && !buckets.empty())
+        {
+            result.append(chosen);
+        }
+    }
+    result.append(last.record);
+    return result;
+}
+
+void reverseAndLimit(QList<DataRecord> &records, bool reverse, qint64 limit)
+{
+    if (reverse)
+    {
+        std::reverse(records.begin(), records.end());
+    }
+
+    if (limit > 0 && records.size() > limit)
+    {
+        records.resize(limit);
+    }
+}
+
+} // namespace
+
+bool downsampleMethodFromName(const QString &name, DownsampleMethod *method)
+{
+    if (name == QLatin1String("lttb")) *method = DownsampleMethod::Lttb;
+    else if (name == QLatin1String("first")) *method = DownsampleMethod::First;
+    else if (name == QLatin1String("last")) *method = DownsampleMethod::Last;
+    else if (name == QLatin1String("min")) *method = DownsampleMethod::Min;
+    else if (name == QLatin1String("max")) *method = DownsampleMethod::Max;
+    else return false;
+    return true;
+}
+
+bool latestRecordOf(const DocumentSeries &records, qint64 timestamp, qint64 from, const PayloadFilter *filter, DataRecord *recordOut)
+{
+    const auto pos = records.latestPosition(timestamp);
+    if (!pos.isValid())
+    {
+        return false;
+    }
+    const DataRecord record = records.recordAt(pos);
+    if ((from != 0 && record.timestamp < from) || (filter != nullptr && !filter->isEmpty() && !filter->matches(record.data)))
+    {
+        return false;
+    }
+    *recordOut = record;
+    return true;
+}
+
+QList<DataRecord> recordsInRange(const DocumentSeries &records, qint64 from, qint64 to, bool reverse, qint64 limit,
+                                 const PayloadFilter *filter)
+{
+    QList<DataRecord> result;
+    if (from > to)
+    {
+        return result;
+    }
+
+    const bool hasFilter = filter != nullptr && !filter->isEmpty();
+    if (limit > 0)
+    {
+        result.reserve(static_cast<qsizetype>(std::min<qint64>(limit, records.size())));
+    }
+    // walks from the requested end and stops at the limit, so "latest N"
+    // costs N records however long the history is
+    records.forEachInRange(from, to, reverse, [&](const DataRecord &record)
+                           {
+                               if (!hasFilter || filter->matches(record.data))
+                               {
+                                   result.append(record);
+                               }
+                               return limit <= 0 || result.size() < limit;
+                           });
+    return result;
+}
+
+QList<DataRecord> downsampleSeries(const DocumentSeries &records, qint64 from, qint64 to, qint64 points, DownsampleMethod method,
+                                   const PayloadPath &field, bool reverse, qint64 limit, const PayloadFilter *filter)
+{
+    QList<DataRecord> result;
+    if (from > to || points <= 0)
+    {
+        return result;
+    }
+    if (method == DownsampleMethod::Lttb)
+    {
+        result = largestTriangleThreeBuckets(records, from, to, points, field, filter);
+        reverseAndLimit(result, reverse, limit);
+        return result;
+    }
+
+    // only the record kept for the current bucket is held on to
+    const TimeBuckets bounds(from, to, points);
+    quint64 currentBucket = 0;
+    SamplePoint sample{DataRecord(), 0};
+    bool hasSample = false;
+    records.forEachInRange(from, to, false, [&](const DataRecord &record)
+                           {
+                               double value = 0;
+                               if (!sampleOf(record, field, filter, &value))
+                               {
+                                   return true;
+                               }
+                               const quint64 bucket = bounds.indexOf(record.timestamp);
+                               if (!hasSample || bucket != currentBucket)
+                               {
+                                   if (hasSample)
+                                   {
+                                       result.append(sample.record);
+                                   }
+                                   sample = SamplePoint{record, value};
+                                   currentBucket = bucket;
+                                   hasSample = true;
+                               }
+                               else if (method == DownsampleMethod::Last || (method == DownsampleMethod::Min && value < sample.value) ||
+                                        (method == DownsampleMethod::Max && value > sample.value))
+                               {
+                                   sample = SamplePoint{record, value};
+                               }
+                               return true;
+                           });
+    if (hasSample)
+    {
+        result.append(sample.record);
+    }
+
+    reverseAndLimit(result, reverse, limit);
+    return result;
+}
+
+std::vector<AggregateBucket> aggregateSeries(const DocumentSeries &records, qint64 from, qint64 to, qint64 bucketWidth,
+                                             const PayloadPath &field)
+{
+    std::vector<AggregateBucket> buckets;
+    auto pos = records.earliestPosition(from);
+    while (pos.isValid())
+    {
+        const DataRecord record = records.recordAt(pos);
+        if (record.timestamp > to)
+        {
+            break;
+        }
+        records.next(pos);
+
+        double value = 0;
+        if (!field.isEmpty() && !field.findNumber(record.data, &value))
+        {
+            continue;
+        }
+
+        // records come in time order, so a record either extends the last bucket or opens the next one
+        qint64 start = from;
+        if (bucketWidth > 0)
+        {
+            start = record.timestamp - ((record.timestamp % bucketWidth) + bucketWidth) % bucketWidth;
+        }
+        if (buckets.empty() || buckets.back().start != start)
+        {
+            buckets.push_back(AggregateBucket{start, 0, value, value, 0, value, value});
+        }
+        AggregateBucket &bucket = buckets.back();
+        ++bucket.count;
+        bucket.min = std::min(bucket.min, value);
+        bucket.max = std::max(bucket.max, value);
+        bucket.sum += value;
+        bucket.last = value;
+    }
+    return buckets;
+}
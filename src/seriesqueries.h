@@ -0,0 +1,52 @@
+#ifndef SERIESQUERIES_H
+#define SERIESQUERIES_H
+
+#include <QList>
+#include <QString>
+#include <vector>
+#include "datarecord.h"
+#include "documentseries.h"
+#include "payloadpath.h"
+#include "payloadfilter.h"
+
+// Queries over the records of one document, shared by Collection and
+// CollectionView.
+
+struct AggregateBucket {
+    // bucket start, a multiple of the bucket width
+    qint64 start;
+    qint64 count;
+    double min;
+    double max;
+    double sum;
+    double first;
+    double last;
+};
+
+enum class DownsampleMethod {
+    // Largest-Triangle-Three-Buckets over a numeric field
+    Lttb,
+    // one record per time bucket: the first, last, lowest or highest one
+    First,
+    Last,
+    Min,
+    Max
+};
+
+// "lttb", "first", "last", "min" or "max"
+bool downsampleMethodFromName(const QString& name, DownsampleMethod* method);
+
+// The last record at or before timestamp, provided it is at or after from
+// (any record for 0) and matches the filter.
+bool latestRecordOf(const DocumentSeries& records, qint64 timestamp, qint64 from, const PayloadFilter* filter, DataRecord* recordOut);
+// See Collection::getAllRecordsForDocument().
+QList<DataRecord> recordsInRange(const DocumentSeries& records, qint64 from, qint64 to, bool reverse, qint64 limit,
+                                 const PayloadFilter* filter);
+// See Collection::downsampleDocument().
+QList<DataRecord> downsampleSeries(const DocumentSeries& records, qint64 from, qint64 to, qint64 points, DownsampleMethod method,
+                                   const PayloadPath& field, bool reverse, qint64 limit, const PayloadFilter* filter);
+// See Collection::aggregate().
+std::vector<AggregateBucket> aggregateSeries(const DocumentSeries& records, qint64 from, qint64 to, qint64 bucketWidth,
+                                             const PayloadPath& field);
+
+#endif // SERIESQUERIES_H
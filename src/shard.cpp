@@ -0,0 +1,247 @@
+#include "shard.h"
+#include <QMutexLocker>
+#include <QTimer>
+#include <climits>
+
+Shard::Shard(int index, bool threaded, const QString &dataFolder, PersistenceWriter *writer)
+    : m_index(index), m_threaded(threaded), m_dataFolder(dataFolder), m_writer(writer), m_jobsQueued(0), m_jobsDone(0),
+      m_publishedAt(0), m_publishScheduled(false), m_stopping(false)
+{
+    setObjectName(QStringLiteral("Shard %1").arg(index));
+    m_clock.start();
+}
+
+Shard::~Shard()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wake.wakeAll();
+    }
+    wait();
+    m_collections.clear();
+}
+
+void Shard::post(std::function<void(Shard &)> job)
+{
+    if (!m_threaded)
+    {
+        ++m_jobsQueued;
+        job(*this);
+        finishInlineJob();
+        return;
+    }
+    enqueue([this, job]() { job(*this); });
+}
+
+std::shared_ptr<const CollectionView> Shard::readView(const QString &name, quint64 minJobs, bool *current) const
+{
+    *current = false;
+    const std::shared_ptr<const ReadView> view = std::atomic_load(&m_readView);
+    if (view == nullptr || view->jobs < minJobs)
+    {
+        return nullptr;
+    }
+    auto it = view->collections.find(name);
+    if (it == view->collections.end())
+    {
+        *current = true;
+        return nullptr;
+    }
+    *current = it->second != nullptr;
+    return it->second;
+}
+
+bool Shard::collectionNames(quint64 minJobs, QStringList *names) const
+{
+    const std::shared_ptr<const ReadView> view = std::atomic_load(&m_readView);
+    if (view == nullptr || view->jobs < minJobs)
+    {
+        return false;
+    }
+    for (const auto &[name, collection] : view->collections)
+    {
+        names->append(name);
+    }
+    return true;
+}
+
+Collection *Shard::collection(const QString &name) const
+{
+    auto it = m_collections.find(name);
+    return it != m_collections.end() ? it->second.get() : nullptr;
+}
+
+Collection *Shard::createCollection(const QString &name)
+{
+    auto &collection = m_collections[name];
+    if (collection == nullptr)
+    {
+        collection = std::make_unique<Collection>(name, m_dataFolder, m_writer);
+    }
+    return collection.get();
+}
+
+void Shard::eraseCollection(const QString &name)
+{
+    m_collections.erase(name);
+}
+
+void Shard::applyLogEntry(const WriteAheadLog::Entry &entry)
+{
+    Collection *database = collection(entry.col);
+    switch (entry.op)
+    {
+    case WriteAheadLog::Operation::Insert:
+        createCollection(entry.col)->insert(entry.ts, entry.doc, entry.data);
+        break;
+    case WriteAheadLog::Operation::SetValue:
+        createCollection(entry.col)->setValueForKey(entry.doc, QString::fromStdString(entry.data));
+        break;
+    case WriteAheadLog::Operation::DeleteRecord:
+        if (database != nullptr)
+        {
+            database->deleteRecord(entry.doc, entry.ts);
+        }
+        break;
+    case WriteAheadLog::Operation::DeleteRange:
+        if (database != nullptr)
+        {
+            database->deleteRecordsInRange(entry.doc, entry.ts, entry.toTs);
+        }
+        break;
+    case WriteAheadLog::Operation::ClearDocument:
+        if (database != nullptr)
+        {
+            database->clearDocument(entry.doc);
+            if (database->isEmpty())
+            {
+                eraseCollection(entry.col);
+            }
+        }
+        break;
+    case WriteAheadLog::Operation::DeleteCollection:
+        eraseCollection(entry.col);
+        break;
+    case WriteAheadLog::Operation::RemoveValue:
+        if (database != nullptr)
+        {
+            database->removeValueForKey(entry.doc);
+        }
+        break;
+    }
+
+}
+
+void Shard::setLoading(const QString &name, bool loading)
+{
+    if (loading)
+    {
+        m_loading.insert(name);
+    }
+    else
+    {
+        m_loading.erase(name);
+    }
+}
+
+void Shard::enqueue(std::function<void()> job)
+{
+    QMutexLocker locker(&m_mutex);
+    ++m_jobsQueued;
+    m_jobs.push_back(std::move(job));
+    m_wake.wakeOne();
+}
+
+void Shard::finishInlineJob()
+{
+    ++m_jobsDone;
+    const qint64 dueMs = publishWhenDue();
+    if (dueMs > 0 && !m_publishScheduled)
+    {
+        // no thread waits for the views to come due, so a timer does
+        m_publishScheduled = true;
+        QTimer::singleShot(dueMs, this, [this]()
+                           {
+                               m_publishScheduled = false;
+                               publishWhenDue();
+                           });
+    }
+}
+
+qint64 Shard::publishWhenDue()
+{
+    const std::shared_ptr<const ReadView> previous = std::atomic_load(&m_readView);
+    if (previous != nullptr && previous->jobs == m_jobsDone)
+    {
+        return -1;
+    }
+    const qint64 dueMs = m_publishedAt + ReadViewIntervalMs - m_clock.elapsed();
+    if (previous != nullptr && dueMs > 0)
+    {
+        return dueMs;
+    }
+    publish();
+    return -1;
+}
+
+void Shard::publish()
+{
+    const std::shared_ptr<const ReadView> previous = std::atomic_load(&m_readView);
+    auto view = std::make_shared<ReadView>();
+    view->jobs = m_jobsDone;
+    for (const auto &[name, collection] : m_collections)
+    {
+        if (m_loading.count(name) > 0)
+        {
+            view->collections.emplace(name, nullptr);
+            continue;
+        }
+        // stamps are unique, so equal ones mean nothing changed since the last view
+        if (previous != nullptr)
+        {
+            auto it = previous->collections.find(name);
+            if (it != previous->collections.end() && it->second != nullptr && it->second->version() == collection->version() &&
+                it->second->valuesVersion() == collection->valuesVersion())
+            {
+                view->collections.emplace(name, it->second);
+                continue;
+            }
+        }
+        view->collections.emplace(name, collection->publish());
+    }
+    m_publishedAt = m_clock.elapsed();
+    std::atomic_store(&m_readView, std::shared_ptr<const ReadView>(std::move(view)));
+}
+
+void Shard::run()
+{
+    qint64 dueMs = -1;
+    for (;;)
+    {
+        std::function<void()> job;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_jobs.empty() && !m_stopping)
+            {
+                // until a job comes in or the views left behind are due
+                m_wake.wait(&m_mutex, dueMs < 0 ? ULONG_MAX : static_cast<unsigned long>(dueMs));
+            }
+            if (m_jobs.empty() && m_stopping)
+            {
+                return;
+            }
+            if (!m_jobs.empty())
+            {
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+        }
+        if (job)
+        {
+            job();
+            ++m_jobsDone;
+        }
+        dueMs = publishWhenDue();
+    }
+}
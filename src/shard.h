@@ -0,0 +1,138 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "collection.h"
+#include "collectionview.h"
+#include "keypattern.h"
+#include "responsecache.h"
+#include "writeaheadlog.h"
+
+class PersistenceWriter;
+
+// One partition of the collections, hashed by name (see WebSocket::shardFor()).
+// A shard owns its collections and its caches, and all work on them runs as
+// jobs on its own thread, one at a time in the order they were queued, so
+// shards share no mutable state and scale with cores. A shard without a
+// thread runs its jobs right away on the caller's thread.
+//
+// After the jobs that changed something, a shard publishes views of its
+// collections (see Collection::publish()), so reads run on other threads
+// against them while the shard goes on writing: readers never wait for the
+// writer and the writer never waits for readers. A view only copies the
+// documents changed since the last one, and views are published at most
+// every ReadViewIntervalMs, so under a steady write load they trail the
+// shard by about that much.
+class Shard : public QThread {
+public:
+    Shard(int index, bool threaded, const QString& dataFolder, PersistenceWriter* writer);
+    // Runs every job still queued, then stops the thread and drops the collections.
+    ~Shard();
+
+    // Runs job(shard) on the shard's thread, then done(result) on the thread
+    // of receiver, through its event loop.
+    template <typename Job, typename Done>
+    void call(Job job, QObject* receiver, Done done)
+    {
+        if (!m_threaded)
+        {
+            ++m_jobsQueued;
+            auto result = job(*this);
+            finishInlineJob();
+            done(result);
+            return;
+        }
+        enqueue([this, job, receiver, done]() mutable
+                {
+                    auto result = job(*this);
+                    QMetaObject::invokeMethod(receiver, [done, result]() { done(result); }, Qt::QueuedConnection);
+                });
+    }
+    // Runs job(shard) without waiting for it.
+    void post(std::function<void(Shard&)> job);
+
+    int index() const { return m_index; }
+    bool isThreaded() const { return m_threaded; }
+
+    // Number of the last job queued: a job queued by the caller has this
+    // number or a lower one.
+    quint64 jobsQueued() const { return m_jobsQueued; }
+    // The last published view of a collection, for a read on another thread,
+    // if it holds the jobs up to and including minJobs. *current is false
+    // when the read has to run as a job instead: the view is older than
+    // minJobs, or the collection was being loaded. A current null view means
+    // there is no such collection.
+    std::shared_ptr<const CollectionView> readView(const QString& name, quint64 minJobs, bool* current) const;
+    // The names of the collections if the published views hold minJobs.
+    bool collectionNames(quint64 minJobs, QStringList* names) const;
+
+    // Only to be used from jobs, or before the thread is started.
+    Collection* collection(const QString& name) const;
+    // The collection, created when it does not exist yet.
+    Collection* createCollection(const QString& name);
+    void eraseCollection(const QString& name);
+    // Redoes a logged mutation of one of the shard's collections, on top of
+    // what the collection loaded from disk.
+    void applyLogEntry(const WriteAheadLog::Entry& entry);
+    // A collection being filled on a loader thread is not published.
+    void setLoading(const QString& name, bool loading);
+    std::unordered_map<QString, std::unique_ptr<Collection>>& collections() { return m_collections; }
+    // the caches may also be used from reads on other threads
+    KeyPatternCache& keyPatterns() { return m_keyPatterns; }
+    ResponseCache& responseCache() { return m_responseCache; }
+
+protected:
+    void run() override;
+
+private:
+    static constexpr qint64 ReadViewIntervalMs = 10;
+
+    struct ReadView {
+        // jobs done when it was published
+        quint64 jobs;
+        // null for a collection being loaded
+        std::unordered_map<QString, std::shared_ptr<const CollectionView>> collections;
+    };
+
+    void enqueue(std::function<void()> job);
+    void finishInlineJob();
+    // Publishes new views if jobs ran since the last ones and they are due.
+    // Returns the ms until they are due, or -1 when none are needed.
+    qint64 publishWhenDue();
+    void publish();
+
+    int m_index;
+    bool m_threaded;
+    QString m_dataFolder;
+    PersistenceWriter* m_writer;
+    std::unordered_map<QString, std::unique_ptr<Collection>> m_collections;
+    KeyPatternCache m_keyPatterns;
+    ResponseCache m_responseCache;
+
+    // read and replaced with std::atomic_load() and std::atomic_store()
+    std::shared_ptr<const ReadView> m_readView;
+    std::atomic<quint64> m_jobsQueued;
+    std::atomic<quint64> m_jobsDone;
+    std::unordered_set<QString> m_loading;
+    qint64 m_publishedAt;
+    // an inline shard's timer for views left due is running
+    bool m_publishScheduled;
+    QElapsedTimer m_clock;
+
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    std::deque<std::function<void()>> m_jobs;
+    bool m_stopping;
+};
+
+#endif // SHARD_H
@@ -0,0 +1,59 @@
+#include "subscriptionrequest.h"
+#include <QCborStreamReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QDebug>
+#include "cborcodec.h"
+
+SubscriptionRequest SubscriptionRequest::fromJson(const QString& jsonString, bool* ok)
+{
+    SubscriptionRequest request;
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(jsonString.toUtf8(), &error);
+
+    if (error.error != QJsonParseError::NoError) {
+        qWarning() << "JSON parse error:" << error.errorString();
+        if (ok) *ok = false;
+        return request;
+    }
+
+    if (!doc.isObject()) {
+        qWarning() << "JSON is not an object";
+        if (ok) *ok = false;
+        return request;
+    }
+
+    QJsonObject obj = doc.object();
+    request.col = obj["col"].toString();
+    request.doc = obj["doc"].toString();
+    request.sub = obj["sub"].toString();
+
+    if (ok) *ok = true;
+    return request;
+}
+
+SubscriptionRequest SubscriptionRequest::fromCbor(const QByteArray& cbor, bool* ok)
+{
+    SubscriptionRequest request;
+    QCborStreamReader reader(cbor);
+    const bool parsed = CborCodec::readMap(reader, [&request](const QString& key, QCborStreamReader& value) {
+        if (key == QLatin1String("col")) return CborCodec::readString(value, &request.col);
+        if (key == QLatin1String("doc")) return CborCodec::readString(value, &request.doc);
+        if (key == QLatin1String("sub")) return CborCodec::readString(value, &request.sub);
+        return CborCodec::skip(value);
+    });
+    if (!parsed) {
+        qWarning() << "CBOR payload is not a valid map";
+        if (ok) *ok = false;
+        return request;
+    }
+
+    if (ok) *ok = true;
+    return request;
+}
+
+bool SubscriptionRequest::isValid() const
+{
+    return !col.isEmpty();
+}
@@ -0,0 +1,19 @@
+#ifndef SUBSCRIPTIONREQUEST_H
+#define SUBSCRIPTIONREQUEST_H
+
+#include <QString>
+#include <QByteArray>
+
+// Payload of sub (col plus an optional literal or /regex/ doc) and unsub
+// (the id of the sub message, or none for every subscription).
+struct SubscriptionRequest {
+    QString col;
+    QString doc;
+    QString sub;
+
+    static SubscriptionRequest fromJson(const QString& jsonString, bool* ok = nullptr);
+    static SubscriptionRequest fromCbor(const QByteArray& cbor, bool* ok = nullptr);
+    bool isValid() const;
+};
+
+#endif // SUBSCRIPTIONREQUEST_H
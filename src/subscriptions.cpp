@@ -0,0 +1,208 @@
+#include "subscriptions.h"
+#include <algorithm>
+#include "responsewriter.h"
+
+bool Subscriptions::Subscription::matches(const QString &document) const
+{
+    if (docPattern != nullptr)
+    {
+        return docPattern->matches(document);
+    }
+    return doc.isEmpty() || doc == document;
+}
+
+void Subscriptions::subscribe(QWebSocket *client, bool binary, const QString &id, const QString &col,
+                              const QString &doc, std::shared_ptr<const KeyPattern> docPattern)
+{
+    unsubscribe(client, id);
+
+    auto subscription = std::make_shared<Subscription>();
+    subscription->client = client;
+    subscription->binary = binary;
+    subscription->id = id;
+    subscription->col = col;
+    subscription->doc = doc;
+    subscription->docPattern = std::move(docPattern);
+    subscription->coalesced = 0;
+
+    Subscriber &subscriber = m_subscribers[client];
+    subscriber.socket = client;
+    subscriber.subscriptions.push_back(subscription);
+    m_byCollection[col].push_back(subscription);
+}
+
+int Subscriptions::unsubscribe(QWebSocket *client, const QString &id)
+{
+    auto it = m_subscribers.find(client);
+    if (it == m_subscribers.end())
+    {
+        return 0;
+    }
+
+    auto &subscriptions = it->second.subscriptions;
+    int removed = 0;
+    for (auto sub = subscriptions.begin(); sub != subscriptions.end();)
+    {
+        if (id.isEmpty() || (*sub)->id == id)
+        {
+            removeFromCollection(*sub);
+            sub = subscriptions.erase(sub);
+            ++removed;
+        }
+        else
+        {
+            ++sub;
+        }
+    }
+
+    if (subscriptions.empty())
+    {
+        m_subscribers.erase(it);
+        m_pending.erase(client);
+    }
+    return removed;
+}
+
+void Subscriptions::removeClient(QWebSocket *client)
+{
+    unsubscribe(client, QString());
+}
+
+bool Subscriptions::publish(const QString &col, const QString &doc, qint64 ts, const QString &data)
+{
+    auto it = m_byCollection.find(col);
+    if (it == m_byCollection.end())
+    {
+        return false;
+    }
+
+    bool queued = false;
+    for (const auto &subscription : it->second)
+    {
+        if (!subscription->matches(doc))
+        {
+            continue;
+        }
+
+        auto docIt = subscription->queuedDocs.find(doc);
+        if (docIt != subscription->queuedDocs.end() && isBehind(subscription->client))
+        {
+            // the client is not keeping up: it only gets the latest record per document
+            Record &record = subscription->queue[docIt->second];
+            if (ts >= record.ts)
+            {
+                record.ts = ts;
+                record.data = data;
+            }
+            ++subscription->coalesced;
+            continue;
+        }
+
+        subscription->queuedDocs[doc] = subscription->queue.size();
+        subscription->queue.push_back(Record{doc, ts, data});
+        m_pending.insert(subscription->client);
+        queued = true;
+    }
+    return queued;
+}
+
+bool Subscriptions::hasPending(QWebSocket *client) const
+{
+    return m_pending.count(client) > 0;
+}
+
+void Subscriptions::push()
+{
+    for (auto it = m_pending.begin(); it != m_pending.end();)
+    {
+        auto subscriberIt = m_subscribers.find(*it);
+        if (subscriberIt == m_subscribers.end() || subscriberIt->second.socket.isNull())
+        {
+            it = m_pending.erase(it);
+            continue;
+        }
+        QWebSocket *socket = subscriberIt->second.socket;
+        if (isBehind(socket))
+        {
+            // retried once the socket has written enough
+            ++it;
+            continue;
+        }
+
+        for (const auto &subscription : subscriberIt->second.subscriptions)
+        {
+            if (!subscription->queue.empty())
+            {
+                send(socket, *subscription);
+            }
+        }
+        it = m_pending.erase(it);
+    }
+}
+
+bool Subscriptions::isBehind(QWebSocket *socket)
+{
+    return socket->bytesToWrite() > MaxUnwrittenBytes;
+}
+
+void Subscriptions::send(QWebSocket *socket, Subscription &subscription)
+{
+    ResponseWriter writer(subscription.binary);
+    writer.startMap();
+    writer.key("type");
+    writer.string("push");
+    writer.key("sub");
+    writer.string(subscription.id);
+    writer.key("records");
+    writer.startArray();
+    for (const Record &record : subscription.queue)
+    {
+        writer.startMap();
+        writer.key("doc");
+        writer.string(record.doc);
+        writer.key("ts");
+        writer.integer(record.ts);
+        writer.key("data");
+        writer.string(record.data);
+        writer.endMap();
+    }
+    writer.endArray();
+    if (subscription.coalesced > 0)
+    {
+        writer.key("coalesced");
+        writer.integer(subscription.coalesced);
+    }
+    writer.endMap();
+
+    subscription.queue.clear();
+    subscription.queuedDocs.clear();
+    subscription.coalesced = 0;
+
+    if (socket->state() != QAbstractSocket::ConnectedState)
+    {
+        return;
+    }
+    if (subscription.binary)
+    {
+        socket->sendBinaryMessage(writer.take());
+    }
+    else
+    {
+        socket->sendTextMessage(QString::fromUtf8(writer.take()));
+    }
+}
+
+void Subscriptions::removeFromCollection(const std::shared_ptr<Subscription> &subscription)
+{
+    auto it = m_byCollection.find(subscription->col);
+    if (it == m_byCollection.end())
+    {
+        return;
+    }
+    auto &subscriptions = it->second;
+    subscriptions.erase(std::remove(subscriptions.begin(), subscriptions.end(), subscription), subscriptions.end());
+    if (subscriptions.empty())
+    {
+        m_byCollection.erase(it);
+    }
+}
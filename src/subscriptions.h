@@ -0,0 +1,76 @@
+#ifndef SUBSCRIPTIONS_H
+#define SUBSCRIPTIONS_H
+
+#include <QString>
+#include <QPointer>
+#include <QWebSocket>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "keypattern.h"
+
+// Live subscriptions: a client registers a collection and a literal or regex
+// document pattern, and inserts matching it are queued for that client as
+// they are applied. Queues are pushed once per event loop turn. While a
+// client's socket still has more than MaxUnwrittenBytes to write, its queues
+// keep only the latest record of each document and count the ones dropped.
+class Subscriptions
+{
+public:
+    static constexpr qint64 MaxUnwrittenBytes = 1024 * 1024;
+
+    // Registers the subscription, replacing one of the client with the same id.
+    // A null docPattern with an empty doc matches every document.
+    void subscribe(QWebSocket* client, bool binary, const QString& id, const QString& col,
+                   const QString& doc, std::shared_ptr<const KeyPattern> docPattern);
+    // Removes the client's subscription with this id, or all of them for an
+    // empty id, and returns how many were removed.
+    int unsubscribe(QWebSocket* client, const QString& id);
+    void removeClient(QWebSocket* client);
+
+    // Queues an applied insert for every matching subscription and returns
+    // whether anything was queued.
+    bool publish(const QString& col, const QString& doc, qint64 ts, const QString& data);
+    bool hasPending(QWebSocket* client) const;
+    // Sends the queued records of every client that is keeping up.
+    void push();
+
+private:
+    struct Record {
+        QString doc;
+        qint64 ts;
+        QString data;
+    };
+
+    struct Subscription {
+        QWebSocket* client;
+        bool binary;
+        QString id;
+        QString col;
+        QString doc;
+        std::shared_ptr<const KeyPattern> docPattern;
+
+        std::vector<Record> queue;
+        // position of each document's last record in the queue, for coalescing
+        std::unordered_map<QString, size_t> queuedDocs;
+        qint64 coalesced;
+
+        bool matches(const QString& document) const;
+    };
+
+    struct Subscriber {
+        QPointer<QWebSocket> socket;
+        std::vector<std::shared_ptr<Subscription>> subscriptions;
+    };
+
+    static bool isBehind(QWebSocket* socket);
+    static void send(QWebSocket* socket, Subscription& subscription);
+    void removeFromCollection(const std::shared_ptr<Subscription>& subscription);
+
+    std::unordered_map<QWebSocket*, Subscriber> m_subscribers;
+    std::unordered_map<QString, std::vector<std::shared_ptr<Subscription>>> m_byCollection;
+    std::unordered_set<QWebSocket*> m_pending;
+};
+
+#endif // SUBSCRIPTIONS_H
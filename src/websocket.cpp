@@ -13,7 +13,15 @@
 #include <QUrl>
 #include <QUrlQuery>
 #include <QWebSocketProtocol>
-#include <QRegularExpression>
+#include <QThreadPool>
+#include <QMutexLocker>
+#include <QFileInfo>
+#include <QCborValue>
+#include <QCborMap>
+#include <QCborArray>
+#include <limits>
+#include <algorithm>
+#include <atomic>
 #include "insertrequest.h"
 #include "querysessions.h"
 #include "querydocument.h"
@@ -23,83 +31,320 @@
 #include "deleterecord.h"
 #include "deletemultiplerecords.h"
 #include "deleterecordsrange.h"
+#include "responsewriter.h"
+#include "subscriptionrequest.h"
+#include "aggregaterequest.h"
+#include "querydocumentnames.h"
+#include "payloadfilter.h"
 
 namespace {
 
-bool tryParseRegexPattern(const QString &candidate, QRegularExpression *regexOut)
+// qdoc streams: records and bytes per frame, and how much a client may have
+// unread before the next frame waits for it
+constexpr qint64 StreamFrameRecords = 1024;
+constexpr qint64 StreamFrameBytes = 256 * 1024;
+constexpr qint64 StreamUnwrittenBytes = 1024 * 1024;
+
+// frames at least this large are decoded on the parser pool
+constexpr qsizetype ParseOffThreadBytes = 16 * 1024;
+
+// binary requests decode straight from their CBOR payload, text ones from the
+// JSON string, unless decodePayload() did so already
+template <typename Request>
+auto parseRequest(const MessageRequest &message, bool *ok)
 {
-    if (candidate.size() < 2 || !candidate.startsWith('/'))
+    using Decoded = decltype(Request::fromJson(QString(), ok));
+    if (const Decoded *decoded = std::any_cast<Decoded>(&message.decoded))
     {
-        return false;
+        *ok = message.decodedOk;
+        return *decoded;
     }
+    return message.binary ? Request::fromCbor(message.payload, ok) : Request::fromJson(message.data, ok);
+}
 
-    int closingSlashIndex = -1;
-    bool escaping = false;
-    for (int i = 1; i < candidate.size(); ++i)
+QString messageTypeForOpcode(quint64 opcode)
+{
+    if (opcode > std::numeric_limits<quint8>::max())
+    {
+        return QString();
+    }
+    switch (static_cast<Opcode>(opcode))
+    {
+    case Opcode::Insert: return MessageType::Insert;
+    case Opcode::QuerySessions: return MessageType::QuerySessions;
+    case Opcode::QueryCollections: return MessageType::QueryCollections;
+    case Opcode::QueryDocument: return MessageType::QueryDocument;
+    case Opcode::DeleteDocument: return MessageType::DeleteDocument;
+    case Opcode::DeleteCollection: return MessageType::DeleteCollection;
+    case Opcode::DeleteRecord: return MessageType::DeleteRecord;
+    case Opcode::DeleteMultipleRecords: return MessageType::DeleteMultipleRecords;
+    case Opcode::DeleteRecordsRange: return MessageType::DeleteRecordsRange;
+    case Opcode::SetValue: return MessageType::SetValue;
+    case Opcode::GetValue: return MessageType::GetValue;
+    case Opcode::GetValues: return MessageType::GetValues;
+    case Opcode::RemoveValue: return MessageType::RemoveValue;
+    case Opcode::GetAllValues: return MessageType::GetAllValues;
+    case Opcode::GetAllKeys: return MessageType::GetAllKeys;
+    case Opcode::ManageApiKey: return MessageType::ManageApiKey;
+    case Opcode::Connections: return MessageType::Connections;
+    case Opcode::Subscribe: return MessageType::Subscribe;
+    case Opcode::Unsubscribe: return MessageType::Unsubscribe;
+    case Opcode::Aggregate: return MessageType::Aggregate;
+    case Opcode::QueryDocumentNames: return MessageType::QueryDocumentNames;
+    }
+    return QString();
+}
+
+template <typename Request>
+void decodePayload(MessageRequest &message)
+{
+    bool ok = false;
+    message.decoded = message.binary ? Request::fromCbor(message.payload, &ok) : Request::fromJson(message.data, &ok);
+    message.decodedOk = ok;
+}
+
+// Decodes the payload into the request struct its handler reads through
+// parseRequest(). Types with no payload, or one the handler reads itself,
+// are left alone.
+void decodePayload(MessageRequest &message)
+{
+    const QString &type = message.type;
+    if (type == MessageType::Insert) decodePayload<InsertRequest>(message);
+    else if (type == MessageType::QuerySessions) decodePayload<QuerySessions>(message);
+    else if (type == MessageType::QueryDocument) decodePayload<QueryDocument>(message);
+    else if (type == MessageType::QueryDocumentNames) decodePayload<QueryDocumentNames>(message);
+    else if (type == MessageType::Aggregate) decodePayload<AggregateRequest>(message);
+    else if (type == MessageType::DeleteDocument) decodePayload<DeleteDocument>(message);
+    else if (type == MessageType::DeleteCollection) decodePayload<DeleteCollection>(message);
+    else if (type == MessageType::DeleteRecord) decodePayload<DeleteRecord>(message);
+    else if (type == MessageType::DeleteMultipleRecords) decodePayload<DeleteMultipleRecords>(message);
+    else if (type == MessageType::DeleteRecordsRange) decodePayload<DeleteRecordsRange>(message);
+    else if (type == MessageType::SetValue || type == MessageType::GetValue || type == MessageType::GetValues ||
+             type == MessageType::RemoveValue || type == MessageType::GetAllValues || type == MessageType::GetAllKeys)
+        decodePayload<KeyValue>(message);
+    else if (type == MessageType::Subscribe || type == MessageType::Unsubscribe) decodePayload<SubscriptionRequest>(message);
+}
+
+// Appends the collection a request names; an empty one means every collection.
+template <typename Request>
+bool appendCollection(const MessageRequest &message, QStringList *collections)
+{
+    bool ok = false;
+    collections->append(parseRequest<Request>(message, &ok).col);
+    return ok;
+}
+
+// Collections a request touches, read from the payload decodePayload()
+// decoded; false for a malformed payload or a type naming no collection.
+bool requestCollections(const MessageRequest &message, QStringList *collections)
+{
+    const QString &type = message.type;
+    bool ok = false;
+    if (type == MessageType::Insert)
     {
-        const QChar ch = candidate.at(i);
-        if (!escaping && ch == '/')
+        for (const InsertRequest &request : parseRequest<InsertRequest>(message, &ok))
         {
-            closingSlashIndex = i;
-            break;
+            collections->append(request.col);
         }
-
-        if (!escaping && ch == '\\')
+        return ok;
+    }
+    if (type == MessageType::DeleteMultipleRecords)
+    {
+        for (const DeleteRecord &record : parseRequest<DeleteMultipleRecords>(message, &ok).records)
         {
-            escaping = true;
-            continue;
+            collections->append(record.col);
         }
+        return ok;
+    }
+    if (type == MessageType::QuerySessions) return appendCollection<QuerySessions>(message, collections);
+    if (type == MessageType::QueryDocument) return appendCollection<QueryDocument>(message, collections);
+    if (type == MessageType::QueryDocumentNames) return appendCollection<QueryDocumentNames>(message, collections);
+    if (type == MessageType::Aggregate) return appendCollection<AggregateRequest>(message, collections);
+    if (type == MessageType::DeleteDocument) return appendCollection<DeleteDocument>(message, collections);
+    if (type == MessageType::DeleteCollection) return appendCollection<DeleteCollection>(message, collections);
+    if (type == MessageType::DeleteRecord) return appendCollection<DeleteRecord>(message, collections);
+    if (type == MessageType::DeleteRecordsRange) return appendCollection<DeleteRecordsRange>(message, collections);
+    if (type == MessageType::SetValue || type == MessageType::GetValue || type == MessageType::GetValues ||
+        type == MessageType::RemoveValue || type == MessageType::GetAllValues || type == MessageType::GetAllKeys)
+        return appendCollection<KeyValue>(message, collections);
+    if (type == MessageType::Subscribe) return appendCollection<SubscriptionRequest>(message, collections);
+    return false;
+}
 
-        escaping = false;
+// Decodes a text or binary frame into its request, payload included; false
+// when the frame is not a valid request.
+bool parseFrame(const QString &text, const QByteArray &frame, bool binary, MessageRequest *message)
+{
+    bool ok = false;
+    if (binary)
+    {
+        *message = MessageRequest::fromCbor(frame, &ok);
+        if (ok)
+        {
+            message->type = messageTypeForOpcode(message->opcode);
+            ok = !message->type.isEmpty();
+        }
     }
-
-    if (closingSlashIndex == -1)
+    else
     {
-        return false;
+        *message = MessageRequest::fromJson(text, &ok);
+    }
+    if (ok)
+    {
+        decodePayload(*message);
     }
+    return ok;
+}
+
+// Opens the response map of a request, starting with its id.
+void startResponse(ResponseWriter &writer, const QString &id)
+{
+    writer.startMap();
+    writer.key("id");
+    writer.string(id);
+}
 
-    const QString pattern = candidate.mid(1, closingSlashIndex - 1);
-    const QString flags = candidate.mid(closingSlashIndex + 1);
+void startResponse(ResponseWriter &writer, const MessageRequest &message)
+{
+    startResponse(writer, message.id);
+}
+
+// Key of a cacheable response: the request type, the encoding and the request
+// parameters the response depends on, normalized by the caller.
+QByteArray responseCacheKey(const char *type, const MessageRequest &message, const QJsonArray &parameters)
+{
+    QByteArray key(type);
+    key += message.binary ? ":cbor:" : ":json:";
+    key += QJsonDocument(parameters).toJson(QJsonDocument::Compact);
+    return key;
+}
 
-    QRegularExpression::PatternOptions options = QRegularExpression::NoPatternOption;
-    for (const QChar flag : flags)
+QByteArray acknowledge(const MessageRequest &message)
+{
+    ResponseWriter writer(message.binary);
+    startResponse(writer, message);
+    writer.endMap();
+    return writer.take();
+}
+
+// Answers a well-formed request that cannot be served, e.g. an invalid filter.
+QByteArray errorResponse(const QString &id, bool binary, const QString &error)
+{
+    ResponseWriter writer(binary);
+    startResponse(writer, id);
+    writer.key("error");
+    writer.string(error);
+    writer.endMap();
+    return writer.take();
+}
+
+QByteArray errorResponse(const MessageRequest &message, const QString &error)
+{
+    return errorResponse(message.id, message.binary, error);
+}
+
+// Returns a function that calls done on its count-th call, to join the jobs
+// of several shards. Only called on the event loop thread.
+std::function<void()> countdown(size_t count, std::function<void()> done)
+{
+    auto remaining = std::make_shared<size_t>(count);
+    return [remaining, done]()
+    {
+        if (--*remaining == 0)
+        {
+            done();
+        }
+    };
+}
+
+// Applies a batch of inserts on a shard. The records are grouped by
+// collection and document first, so each document takes its records in one
+// sorted merge (see Collection::insert()) instead of one point insert each.
+void applyInserts(Shard &shard, const QList<InsertRequest> &batch)
+{
+    if (batch.size() == 1)
+    {
+        const InsertRequest &payload = batch.front();
+        shard.createCollection(payload.col)->insert(payload.ts, payload.doc, payload.data);
+        return;
+    }
+    // the records point into these
+    std::vector<QByteArray> payloads;
+    payloads.reserve(batch.size());
+    std::unordered_map<QString, std::unordered_map<QString, std::vector<DataRecord>>> groups;
+    for (const InsertRequest &payload : batch)
+    {
+        payloads.push_back(payload.data.toUtf8());
+        const QByteArray &data = payloads.back();
+        groups[payload.col][payload.doc].push_back(DataRecord{payload.ts, std::string_view(data.constData(), data.size())});
+    }
+    for (auto &[col, documents] : groups)
     {
-        if (flag == 'i')
+        Collection *database = shard.createCollection(col);
+        for (auto &[doc, records] : documents)
         {
-            options |= QRegularExpression::CaseInsensitiveOption;
+            database->insert(doc, records);
         }
-        else if (flag == 'm')
+    }
+}
+
+// Clears the document in every collection of the shard but the skipped ones,
+// dropping the collections it leaves empty.
+void clearDocumentEverywhere(Shard &shard, const QString &doc, const std::unordered_set<QString> &skipped)
+{
+    QVector<QString> toErase;
+    for (auto &[key, value] : shard.collections())
+    {
+        if (skipped.count(key) > 0)
         {
-            options |= QRegularExpression::MultilineOption;
+            continue;
         }
-        else if (flag == 's')
+        value->clearDocument(doc);
+        if (value->isEmpty())
         {
-            options |= QRegularExpression::DotMatchesEverythingOption;
+            toErase.append(key);
         }
     }
-
-    QRegularExpression regex(pattern, options);
-    if (!regex.isValid())
+    foreach (const QString &key, toErase)
     {
-        qWarning() << "Invalid regex pattern" << candidate << ":" << regex.errorString();
-        return false;
+        qInfo() << "Deleting collection (1) since there are no more documents:" << key;
+        shard.eraseCollection(key);
     }
+}
 
-    if (regexOut != nullptr)
+void writeRecord(ResponseWriter &writer, const DataRecord &record, const PayloadProjection &projection = PayloadProjection())
+{
+    writer.startMap();
+    writer.key("ts");
+    writer.integer(record.timestamp);
+    writer.key("data");
+    if (projection.isEmpty())
     {
-        *regexOut = regex;
+        writer.string(record.data);
     }
-
-    return true;
+    else
+    {
+        const QByteArray projected = projection.apply(record.data);
+        writer.string(std::string_view(projected.constData(), static_cast<size_t>(projected.size())));
+    }
+    writer.endMap();
 }
 
 } // namespace
 
 
-WebSocket::WebSocket(const QString &masterKey, const QString &dataFolder, int flushIntervalSeconds, QObject *parent) : QObject(parent)
+WebSocket::WebSocket(const QString &masterKey, const QString &dataFolder, int flushIntervalSeconds,
+                     WriteAheadLog::SyncPolicy walSyncPolicy, int walSyncIntervalMs, bool lazyLoad, int shards, QObject *parent) : QObject(parent)
 {
     m_masterKey = masterKey;
     m_dataFolder = dataFolder;
+    m_walCommitScheduled = false;
+    m_pushScheduled = false;
+    m_streamsScheduled = false;
+    m_lastStreamSerial = 0;
+    m_lastFrameSerial = 0;
+    m_flushInProgress = false;
+    m_loadedRecords = 0;
     m_server = new QWebSocketServer(QStringLiteral("WebSocket Server"), QWebSocketServer::NonSecureMode, this);
 
     QString errorMessage;
@@ -107,6 +352,20 @@ WebSocket::WebSocket(const QString &masterKey, const QString &dataFolder, int fl
         qWarning() << "Failed to register master API key:" << errorMessage;
     }
     
+    if (!m_dataFolder.isEmpty()) {
+        m_writer = std::make_unique<PersistenceWriter>();
+        m_writer->start();
+    }
+    // without shard threads one shard runs everything on the event loop thread
+    for (int i = 0; i < std::max(shards, 1); ++i)
+    {
+        m_shards.push_back(std::make_unique<Shard>(i, shards > 0, m_dataFolder, m_writer.get()));
+    }
+    if (shards > 0)
+    {
+        qInfo() << "Collections sharded across" << shards << "threads";
+    }
+
     if (m_dataFolder.isEmpty()) {
         qInfo() << "Running in non-persistent mode (no data folder specified)";
         return;
@@ -119,22 +378,66 @@ WebSocket::WebSocket(const QString &masterKey, const QString &dataFolder, int fl
     // Load API keys from disk
     loadApiKeysFromDisk();
 
-    // get collections from data folder
+    // get collections from data folder; they load in parallel, each building
+    // its documents on the global thread pool
     QDir dir(m_dataFolder);
     if (dir.exists())
     {
-        foreach (const QString &collection, dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+        m_loadTimer.start();
+        const QStringList collections = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        foreach (const QString &collection, collections)
+        {
+            shardFor(collection)->createCollection(collection);
+        }
+
+        if (lazyLoad)
         {
-            m_databases[collection] = std::make_unique<Collection>(collection, m_dataFolder);
-            m_databases[collection]->loadFromDisk();
+            startLazyLoad(collections);
+        }
+        else
+        {
+            std::atomic<qsizetype> records(0);
+            foreach (const QString &collection, collections)
+            {
+                Collection *database = shardFor(collection)->collection(collection);
+                m_loaders.start([database, &records]() { records += database->loadFromDisk(); });
+            }
+            m_loaders.waitForDone();
+            qInfo() << "Loaded" << collections.size() << "collections with" << records.load() << "records in"
+                    << m_loadTimer.elapsed() << "ms using" << m_loaders.maxThreadCount() << "threads";
         }
     }
+
+    // replay mutations acknowledged after the last flush on top of the flushed state
+    dir.mkpath(m_dataFolder);
+    m_wal = std::make_unique<WriteAheadLog>(m_dataFolder, walSyncPolicy);
+    if (!m_wal->open([this](const WriteAheadLog::Entry &entry) { applyLogEntry(entry); }))
+    {
+        qWarning() << "Write-ahead log disabled, durability limited to the flush interval";
+        m_wal.reset();
+        return;
+    }
+    if (walSyncPolicy == WriteAheadLog::SyncPolicy::Interval)
+    {
+        qInfo() << "Write-ahead log sync interval set to" << walSyncIntervalMs << "ms";
+        m_walSyncTimer.start(walSyncIntervalMs);
+        connect(&m_walSyncTimer, &QTimer::timeout, this, [this]() { m_wal->sync(); });
+    }
 }
 
 WebSocket::~WebSocket()
 {
+    {
+        QMutexLocker locker(&m_loadQueueMutex);
+        m_loadQueue.clear();
+    }
+    m_loaders.waitForDone();
+    m_parsers.waitForDone();
+    m_readers.waitForDone();
     m_server->close();
     qDeleteAll(m_clients.begin(), m_clients.end());
+    // runs the jobs still queued on the shards before their collections go
+    m_shards.clear();
 }
 
 void WebSocket::flushToDisk()
@@ -143,17 +446,389 @@ void WebSocket::flushToDisk()
         return; // Skip persistence if no data folder specified
     }
     
-    for (auto &[key, value] : m_databases)
+    if (m_flushInProgress) {
+        qDebug() << "Previous flush still being written, skipping";
+        return;
+    }
+    if (!m_loadingCollections.empty()) {
+        // the log generations still hold mutations of collections being loaded
+        qDebug() << "Collections still loading, skipping flush";
+        return;
+    }
+
+    // mutations logged from here on belong to the next flush; the ones
+    // logged before were queued on their shards ahead of the capture
+    const quint64 walGeneration = m_wal ? m_wal->rotate() : 0;
+    m_flushInProgress = true;
+
+    // capture the changes on the shards, serialize and write them on the persistence thread
+    auto jobs = std::make_shared<std::vector<std::function<bool()>>>();
+    const auto captured = countdown(m_shards.size(), [this, jobs, walGeneration]()
+    {
+        m_writer->enqueue([this, jobs, walGeneration]()
+        {
+            bool flushed = true;
+            for (const auto &job : *jobs)
+            {
+                flushed = job() && flushed;
+            }
+            QMetaObject::invokeMethod(this, [this, flushed, walGeneration]() { flushFinished(flushed, walGeneration); },
+                                      Qt::QueuedConnection);
+        });
+    });
+    for (const auto &shard : m_shards)
+    {
+        shard->call([](Shard &shard)
+                    {
+                        std::vector<std::function<bool()>> shardJobs;
+                        for (auto &[key, value] : shard.collections())
+                        {
+                            if (auto job = value->takeFlushJob()) {
+                                shardJobs.push_back(std::move(job));
+                            }
+                        }
+                        return shardJobs;
+                    },
+                    this, [jobs, captured](const std::vector<std::function<bool()>> &shardJobs)
+                    {
+                        jobs->insert(jobs->end(), shardJobs.begin(), shardJobs.end());
+                        captured();
+                    });
+    }
+}
+
+void WebSocket::flushFinished(bool flushed, quint64 walGeneration)
+{
+    // queued ahead of the next flush's capture, so a failed flush's changes
+    // are captured again before anything is checkpointed past them
+    for (const auto &shard : m_shards)
+    {
+        shard->post([flushed](Shard &shard)
+                    {
+                        for (auto &[key, value] : shard.collections())
+                        {
+                            value->finishFlush(flushed);
+                        }
+                    });
+    }
+    m_flushInProgress = false;
+    // everything logged before the flush is now on disk, unless a segment
+    // write failed and the log is still needed to recover it
+    if (m_wal && flushed) {
+        m_wal->checkpoint(walGeneration);
+    } else if (!flushed) {
+        qWarning() << "Flush failed, its changes are kept in the write-ahead log and written with the next flush";
+    }
+}
+
+void WebSocket::commitWriteAheadLog()
+{
+    m_walCommitScheduled = false;
+    const bool committed = !m_wal || m_wal->commit();
+    if (!committed)
+    {
+        // the entries stay buffered for the next commit, but none of these writes is durable yet
+        qWarning() << "Write-ahead log commit failed, failing" << m_pendingResponses.size() << "held responses' writes";
+    }
+
+    const QList<PendingResponse> responses = m_pendingResponses;
+    m_pendingResponses.clear();
+    for (const PendingResponse &pending : responses)
+    {
+        if (pending.client.isNull())
+        {
+            continue;
+        }
+        if (!committed && !pending.writeId.isEmpty())
+        {
+            sendResponse(pending.client, errorResponse(pending.writeId, pending.binary, "Write-ahead log commit failed"), pending.binary);
+        }
+        else
+        {
+            sendResponse(pending.client, pending.response, pending.binary);
+        }
+    }
+}
+
+void WebSocket::schedulePush()
+{
+    if (!m_pushScheduled)
+    {
+        m_pushScheduled = true;
+        QTimer::singleShot(0, this, &WebSocket::pushSubscriptions);
+    }
+}
+
+void WebSocket::pushSubscriptions()
+{
+    m_pushScheduled = false;
+    if (m_walCommitScheduled)
+    {
+        // subscribers never see records before they are durable
+        commitWriteAheadLog();
+    }
+    m_subscriptions.push();
+}
+
+void WebSocket::scheduleDocumentStreams()
+{
+    if (!m_streamsScheduled)
+    {
+        m_streamsScheduled = true;
+        QTimer::singleShot(0, this, &WebSocket::pumpDocumentStreams);
+    }
+}
+
+void WebSocket::pumpDocumentStreams()
+{
+    m_streamsScheduled = false;
+    if (m_walCommitScheduled)
+    {
+        // the first frame of a stream may still wait for the group commit
+        commitWriteAheadLog();
+    }
+
+    // one frame per stream at a time, so other requests are served in between
+    std::vector<std::pair<quint64, DocumentScan>> ready;
+    for (auto it = m_documentStreams.begin(); it != m_documentStreams.end();)
+    {
+        if (it->client.isNull())
+        {
+            it = m_documentStreams.erase(it);
+            continue;
+        }
+        // the others resume when their frame is done, or from bytesWritten
+        if (!it->pending && it->client->bytesToWrite() <= StreamUnwrittenBytes)
+        {
+            it->pending = true;
+            ready.emplace_back(it->serial, it->scan);
+        }
+        ++it;
+    }
+    for (const auto &[serial, scan] : ready)
+    {
+        shardFor(scan.query.col)->call([scan = scan](Shard &shard) mutable
+                                       {
+                                           bool finished = false;
+                                           const QByteArray frame = nextDocumentPage(shard.collection(scan.query.col), scan,
+                                                                                     StreamFrameRecords, StreamFrameBytes, &finished);
+                                           return std::make_tuple(frame, scan, finished);
+                                       },
+                                       this, [this, serial = serial](const std::tuple<QByteArray, DocumentScan, bool> &page)
+                                       {
+                                           documentFrameReady(serial, std::get<0>(page), std::get<1>(page), std::get<2>(page));
+                                       });
+    }
+}
+
+void WebSocket::documentFrameReady(quint64 serial, const QByteArray &frame, const DocumentScan &scan, bool finished)
+{
+    auto it = std::find_if(m_documentStreams.begin(), m_documentStreams.end(),
+                           [serial](const DocumentStream &stream) { return stream.serial == serial; });
+    if (it == m_documentStreams.end() || it->client.isNull())
     {
-        value->flushToDisk();
+        // the client went away in the meantime
+        return;
+    }
+    respond(it->client, frame, scan.binary);
+    if (finished)
+    {
+        m_documentStreams.erase(it);
+        return;
     }
+    it->scan = scan;
+    it->pending = false;
+    scheduleDocumentStreams();
+}
+
+void WebSocket::applyLogEntry(const WriteAheadLog::Entry &entry)
+{
+    // collections still loading in the background get their entries once loaded
+    if (!m_loadingCollections.empty())
+    {
+        if (entry.col.isEmpty())
+        {
+            for (const QString &name : m_loadingCollections)
+            {
+                WriteAheadLog::Entry scoped = entry;
+                scoped.col = name;
+                m_deferredLogEntries[name].push_back(scoped);
+            }
+        }
+        else if (m_loadingCollections.count(entry.col) > 0)
+        {
+            m_deferredLogEntries[entry.col].push_back(entry);
+            return;
+        }
+    }
+
+    if (entry.op == WriteAheadLog::Operation::ClearDocument && entry.col.isEmpty())
+    {
+        // an empty collection clears the document across all collections
+        for (const auto &shard : m_shards)
+        {
+            shard->post([doc = entry.doc, loading = m_loadingCollections](Shard &shard) { clearDocumentEverywhere(shard, doc, loading); });
+        }
+        return;
+    }
+    shardFor(entry.col)->post([entry](Shard &shard) { shard.applyLogEntry(entry); });
+}
+
+void WebSocket::startLazyLoad(const QStringList &collections)
+{
+    // most recently written collections first, they are the likeliest to be queried
+    std::vector<std::pair<qint64, QString>> byRecency;
+    foreach (const QString &collection, collections)
+    {
+        const QFileInfoList segments = QDir(m_dataFolder + "/" + collection).entryInfoList(QStringList() << "*.seg", QDir::Files, QDir::Time);
+        byRecency.emplace_back(segments.isEmpty() ? 0 : segments.first().lastModified().toMSecsSinceEpoch(), collection);
+    }
+    std::stable_sort(byRecency.begin(), byRecency.end(),
+                     [](const std::pair<qint64, QString> &a, const std::pair<qint64, QString> &b) { return a.first > b.first; });
+
+    for (const auto &entry : byRecency)
+    {
+        shardFor(entry.second)->post([name = entry.second](Shard &shard) { shard.setLoading(name, true); });
+    }
+    {
+        QMutexLocker locker(&m_loadQueueMutex);
+        for (const auto &entry : byRecency)
+        {
+            m_loadingCollections.insert(entry.second);
+            m_loadQueue.append(PendingLoad{entry.second, shardFor(entry.second)->collection(entry.second)});
+        }
+    }
+    if (m_loadingCollections.empty())
+    {
+        return;
+    }
+
+    qInfo() << "Serving while loading" << collections.size() << "collections in the background";
+    const int workers = std::min(m_loaders.maxThreadCount(), static_cast<int>(collections.size()));
+    for (int i = 0; i < workers; ++i)
+    {
+        m_loaders.start([this]() { loadQueuedCollections(); });
+    }
+}
+
+void WebSocket::loadQueuedCollections()
+{
+    // runs on the loader threads
+    for (;;)
+    {
+        PendingLoad next;
+        {
+            QMutexLocker locker(&m_loadQueueMutex);
+            if (m_loadQueue.isEmpty())
+            {
+                return;
+            }
+            next = m_loadQueue.takeFirst();
+        }
+        const qsizetype records = next.collection->loadFromDisk();
+        const QString name = next.name;
+        QMetaObject::invokeMethod(this, [this, name, records]() { collectionLoaded(name, records); }, Qt::QueuedConnection);
+    }
+}
+
+void WebSocket::prioritizeLoad(const QString &collection)
+{
+    QMutexLocker locker(&m_loadQueueMutex);
+    for (int i = 1; i < m_loadQueue.size(); ++i)
+    {
+        if (m_loadQueue.at(i).name == collection)
+        {
+            qDebug() << "Loading collection on demand" << collection;
+            m_loadQueue.move(i, 0);
+            return;
+        }
+    }
+}
+
+void WebSocket::collectionLoaded(const QString &collection, qsizetype records)
+{
+    m_loadingCollections.erase(collection);
+    m_loadedRecords += records;
+    shardFor(collection)->post([collection](Shard &shard) { shard.setLoading(collection, false); });
+
+    // mutations logged after the last flush were held back until the flushed state was in
+    auto deferred = m_deferredLogEntries.find(collection);
+    if (deferred != m_deferredLogEntries.end())
+    {
+        const std::vector<WriteAheadLog::Entry> entries = std::move(deferred->second);
+        m_deferredLogEntries.erase(deferred);
+        for (const WriteAheadLog::Entry &entry : entries)
+        {
+            applyLogEntry(entry);
+        }
+    }
+
+    if (m_loadingCollections.empty())
+    {
+        qInfo() << "Loaded all collections with" << m_loadedRecords << "records in" << m_loadTimer.elapsed() << "ms";
+    }
+
+    const QList<ParkedMessage> parked = m_parkedMessages;
+    m_parkedMessages.clear();
+    for (const ParkedMessage &message : parked)
+    {
+        if (message.client.isNull())
+        {
+            continue;
+        }
+        if (waitsForLoading(message.message))
+        {
+            m_parkedMessages.append(message);
+            continue;
+        }
+        handleMessage(message.client, message.message);
+    }
+}
+
+bool WebSocket::waitsForLoading(const MessageRequest &message)
+{
+    if (m_loadingCollections.empty() || message.type == MessageType::QueryCollections ||
+        message.type == MessageType::Connections || message.type == MessageType::ManageApiKey ||
+        message.type == MessageType::Unsubscribe)
+    {
+        return false;
+    }
+
+    QStringList collections;
+    if (!requestCollections(message, &collections))
+    {
+        return false; // malformed, let the handler reject it
+    }
+    if (collections.contains(QString()))
+    {
+        // a missing collection means every collection
+        return true;
+    }
+
+    bool waiting = false;
+    for (const QString &collection : collections)
+    {
+        if (m_loadingCollections.count(collection) > 0)
+        {
+            prioritizeLoad(collection);
+            waiting = true;
+        }
+    }
+    return waiting;
 }
 
 void WebSocket::start(quint16 port)
 {
+    for (const auto &shard : m_shards)
+    {
+        if (shard->isThreaded())
+        {
+            shard->start();
+        }
+    }
     if (m_server->listen(QHostAddress::Any, port))
     {
-        qInfo() << QTime::currentTime().toString() << "WebSocket server listening on port" << port;
+        qInfo() << QTime::currentTime().toString() << "WebSocket server listening on port" << m_server->serverPort();
         connect(m_server, &QWebSocketServer::newConnection, this, &WebSocket::onNewConnection);
     }
     else
@@ -162,6 +837,11 @@ void WebSocket::start(quint16 port)
     }
 }
 
+quint16 WebSocket::serverPort() const
+{
+    return m_server->serverPort();
+}
+
 void WebSocket::onNewConnection()
 {
     QWebSocket *socket = m_server->nextPendingConnection();
@@ -178,6 +858,7 @@ void WebSocket::onNewConnection()
     const QUrlQuery query(requestUrl);
     const QString apiKey = query.queryItemValue("api-key");
     const QString clientName = query.queryItemValue("name");
+    const QString protocol = query.queryItemValue("protocol");
 
     if (apiKey.isEmpty())
     {
@@ -194,50 +875,169 @@ void WebSocket::onNewConnection()
         return;
     }
 
+    // binary clients are answered in CBOR, which also applies to binary frames from any client
+    const bool binary = protocol == QLatin1String("cbor");
+    if (!binary && !protocol.isEmpty() && protocol != QLatin1String("json"))
+    {
+        qWarning() << QTime::currentTime().toString() << "Unsupported protocol" << protocol << "from" << socket->peerAddress().toString();
+        rejectClient(socket, QStringLiteral("Unsupported protocol"));
+        return;
+    }
+
     m_clientScopes[socket->objectName()] = entry->scope;
     m_clientKeys[socket->objectName()] = apiKey;
     m_clientNames[socket->objectName()] = clientName;
 
     qInfo() << QTime::currentTime().toString() << "New client connected:" << socket->peerAddress().toString()
-            << "ID" << socket->objectName() << "Scope" << scopeToString(entry->scope);
+            << "ID" << socket->objectName() << "Scope" << scopeToString(entry->scope)
+            << "Protocol" << (binary ? "cbor" : "json");
     connect(socket, &QWebSocket::textMessageReceived, this, &WebSocket::processMessage);
+    connect(socket, &QWebSocket::binaryMessageReceived, this, &WebSocket::processBinaryMessage);
+    connect(socket, &QWebSocket::bytesWritten, this, [this, socket]()
+            {
+                // a subscriber that fell behind gets its coalesced records once it catches up
+                if (m_subscriptions.hasPending(socket))
+                {
+                    schedulePush();
+                }
+                if (!m_documentStreams.empty())
+                {
+                    scheduleDocumentStreams();
+                }
+            });
     connect(socket, &QWebSocket::disconnected, this, &WebSocket::socketDisconnected);
     m_clients << socket;
     m_connectionTimes[socket->objectName()] = QDateTime::currentMSecsSinceEpoch();
 
     // Send authentication success message
-    QJsonObject readyMessage;
-    readyMessage["type"] = "ready";
-    readyMessage["message"] = "Authentication successful";
-    QJsonDocument doc(readyMessage);
-    socket->sendTextMessage(doc.toJson(QJsonDocument::Compact));
+    ResponseWriter readyMessage(binary);
+    readyMessage.startMap();
+    readyMessage.key("type");
+    readyMessage.string("ready");
+    readyMessage.key("message");
+    readyMessage.string("Authentication successful");
+    readyMessage.endMap();
+    sendResponse(socket, readyMessage.take(), binary);
 }
 
 void WebSocket::processMessage(const QString &message)
 {
     QWebSocket *client = qobject_cast<QWebSocket *>(sender());
     if (!client) { return; }
-        
-    bool ok;
-    MessageRequest msg = MessageRequest::fromJson(message, &ok);
+    receiveFrame(client, message, QByteArray(), false);
+}
 
-    if (!ok)
+void WebSocket::processBinaryMessage(const QByteArray &message)
+{
+    QWebSocket *client = qobject_cast<QWebSocket *>(sender());
+    if (!client) { return; }
+    receiveFrame(client, QString(), message, true);
+}
+
+// Large frames are decoded on the parser pool. A client's frames are still
+// handled in the order they arrived: each one waits in m_incoming until the
+// ones before it are decoded and handled.
+void WebSocket::receiveFrame(QWebSocket *client, const QString &text, const QByteArray &frame, bool binary)
+{
+    auto &incoming = m_incoming[client];
+    const quint64 serial = ++m_lastFrameSerial;
+    const qsizetype size = binary ? frame.size() : text.size();
+    incoming.push_back(IncomingFrame{serial, false, false, binary, size, MessageRequest(), QString()});
+
+    if (size < ParseOffThreadBytes)
+    {
+        MessageRequest message;
+        const bool ok = parseFrame(text, frame, binary, &message);
+        frameParsed(client, serial, ok, message, ok || binary ? QString() : text);
+        return;
+    }
+    m_parsers.start([this, client, serial, text, frame, binary]()
+    {
+        MessageRequest message;
+        const bool ok = parseFrame(text, frame, binary, &message);
+        const QString invalidText = ok || binary ? QString() : text;
+        // client is only a key here; the serial tells a reused address apart
+        QMetaObject::invokeMethod(this, [this, client, serial, ok, message, invalidText]()
+                                  { frameParsed(client, serial, ok, message, invalidText); },
+                                  Qt::QueuedConnection);
+    });
+}
+
+void WebSocket::frameParsed(QWebSocket *client, quint64 serial, bool ok, const MessageRequest &message, const QString &invalidText)
+{
+    auto incoming = m_incoming.find(client);
+    if (incoming == m_incoming.end())
+    {
+        return; // disconnected in the meantime
+    }
+    auto frame = std::find_if(incoming->second.begin(), incoming->second.end(),
+                              [serial](const IncomingFrame &frame) { return frame.serial == serial; });
+    if (frame == incoming->second.end())
+    {
+        return;
+    }
+    frame->parsed = true;
+    frame->ok = ok;
+    frame->message = message;
+    frame->invalidText = invalidText;
+
+    // a handler may close the client, so look it up again for every frame
+    for (;;)
+    {
+        incoming = m_incoming.find(client);
+        if (incoming == m_incoming.end())
+        {
+            return;
+        }
+        if (incoming->second.empty())
+        {
+            m_incoming.erase(incoming);
+            return;
+        }
+        if (!incoming->second.front().parsed)
+        {
+            return;
+        }
+        const IncomingFrame next = std::move(incoming->second.front());
+        incoming->second.pop_front();
+        handleFrame(client, next);
+    }
+}
+
+void WebSocket::handleFrame(QWebSocket *client, const IncomingFrame &frame)
+{
+    if (!frame.ok)
     {
-        qWarning() << QTime::currentTime().toString() << "Invalid message" << message;
-        client->sendTextMessage("");
+        if (frame.binary)
+        {
+            qWarning() << QTime::currentTime().toString() << "Invalid binary message of" << frame.size << "bytes, opcode" << frame.message.opcode;
+            client->sendBinaryMessage(QByteArray());
+        }
+        else
+        {
+            qWarning() << QTime::currentTime().toString() << "Invalid message" << frame.invalidText;
+            client->sendTextMessage("");
+        }
         client->close();
         return;
     }
 
-    if (msg.type == MessageType::Auth)
+    if (!frame.binary && frame.message.type == MessageType::Auth)
     {
-        QJsonObject obj;
-        obj["id"] = msg.id;
-        obj["error"] = "auth messages are not supported; use the x-api-key header";
-        client->sendTextMessage(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+        ResponseWriter writer(false);
+        startResponse(writer, frame.message);
+        writer.key("error");
+        writer.string("auth messages are not supported; use the x-api-key header");
+        writer.endMap();
+        sendResponse(client, writer.take(), false);
         return;
     }
 
+    processRequest(client, frame.message);
+}
+
+void WebSocket::processRequest(QWebSocket *client, const MessageRequest &msg)
+{
     auto scopeIt = m_clientScopes.find(client->objectName());
     if (scopeIt == m_clientScopes.end())
     {
@@ -251,10 +1051,19 @@ void WebSocket::processMessage(const QString &message)
     {
         qWarning() << QTime::currentTime().toString() << "Permission denied for client" << client->peerAddress().toString()
                    << "ID" << client->objectName() << "Type" << msg.type;
-        QJsonObject obj;
-        obj["id"] = msg.id;
-        obj["error"] = "permission denied";
-        client->sendTextMessage(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+        ResponseWriter writer(msg.binary);
+        startResponse(writer, msg);
+        writer.key("error");
+        writer.string("permission denied");
+        writer.endMap();
+        sendResponse(client, writer.take(), msg.binary);
+        return;
+    }
+
+    if (waitsForLoading(msg))
+    {
+        // handled once the collections it touches have been loaded
+        m_parkedMessages.append(ParkedMessage{client, msg});
         return;
     }
 
@@ -263,8 +1072,8 @@ void WebSocket::processMessage(const QString &message)
 
 void WebSocket::handleMessage(QWebSocket *client, const MessageRequest &message)
 {
-    QString response;
-       
+    QByteArray response;
+
     if (message.type == MessageType::Insert)
     {
         response = handleInsert(client, message);
@@ -279,7 +1088,15 @@ void WebSocket::handleMessage(QWebSocket *client, const MessageRequest &message)
     }
     else if (message.type == MessageType::QueryDocument)
     {
-        response = handleQueryDocument(client, message);
+        response = handleQueryDocument(client, message);
+    }
+    else if (message.type == MessageType::Aggregate)
+    {
+        response = handleAggregate(client, message);
+    }
+    else if (message.type == MessageType::QueryDocumentNames)
+    {
+        response = handleQueryDocumentNames(client, message);
     }
     else if (message.type == MessageType::DeleteDocument)
     {
@@ -333,27 +1150,188 @@ void WebSocket::handleMessage(QWebSocket *client, const MessageRequest &message)
     {
         response = handleConnections(client, message);
     }
+    else if (message.type == MessageType::Subscribe)
+    {
+        response = handleSubscribe(client, message);
+    }
+    else if (message.type == MessageType::Unsubscribe)
+    {
+        response = handleUnsubscribe(client, message);
+    }
     else
     {
         qWarning() << "Unknown message type:" << message.type;
-        client->sendTextMessage("{\"error\": \"Unknown message type\"}");
+        ResponseWriter writer(message.binary);
+        writer.startMap();
+        writer.key("error");
+        writer.string("Unknown message type");
+        writer.endMap();
+        sendResponse(client, writer.take(), message.binary);
         client->close();
         return;
     }
+    // handlers answering from a shard return nothing and respond once it is done
     if (!response.isEmpty()) {
-        if (client->state() != QAbstractSocket::ConnectedState)
+        respond(client, response, message.binary);
+    }
+    if (m_wal && m_wal->hasPending())
+    {
+        // mutations are logged before the shards apply them; commit meanwhile
+        scheduleCommit();
+    }
+}
+
+void WebSocket::respond(QWebSocket *client, const QByteArray &response, bool binary, const QString &writeId)
+{
+    if (m_wal && (m_wal->hasPending() || !m_pendingResponses.isEmpty()))
+    {
+        // group commit: everything answered in this event loop turn is acknowledged together
+        m_pendingResponses.append(PendingResponse{client, response, binary, writeId});
+        scheduleCommit();
+        return;
+    }
+    sendResponse(client, response, binary);
+}
+
+void WebSocket::scheduleCommit()
+{
+    if (!m_walCommitScheduled)
+    {
+        m_walCommitScheduled = true;
+        QTimer::singleShot(0, this, &WebSocket::commitWriteAheadLog);
+    }
+}
+
+Shard *WebSocket::shardFor(const QString &collection) const
+{
+    return m_shards[qHash(collection) % m_shards.size()].get();
+}
+
+void WebSocket::answerFromShard(QWebSocket *client, const MessageRequest &message, const QString &collection,
+                                std::function<QByteArray(Shard &)> job)
+{
+    QPointer<QWebSocket> target(client);
+    const bool binary = message.binary;
+    shardFor(collection)->call(std::move(job), this, [this, target, binary](const QByteArray &response)
+    {
+        if (!target.isNull() && !response.isEmpty())
         {
-            qWarning() << QTime::currentTime().toString() << "Client disconnected:" << client->peerAddress().toString() << "ID" << client->objectName();
-            return;
+            respond(target, response, binary);
+        }
+    });
+}
+
+void WebSocket::answerWrite(QWebSocket *client, const MessageRequest &message, const QString &collection,
+                            std::function<QByteArray(Shard &)> job)
+{
+    QPointer<QWebSocket> target(client);
+    const bool binary = message.binary;
+    const QString id = message.id;
+    shardFor(collection)->call(std::move(job), this, [this, target, binary, id](const QByteArray &response)
+    {
+        if (!target.isNull() && !response.isEmpty())
+        {
+            respond(target, response, binary, id);
         }
-        client->sendTextMessage(response);
+    });
+    noteWrite(client, shardFor(collection));
+}
+
+void WebSocket::noteWrite(QWebSocket *client, Shard *shard)
+{
+    std::vector<quint64> &writes = m_clientWrites[client];
+    writes.resize(m_shards.size());
+    writes[shard->index()] = shard->jobsQueued();
+}
+
+quint64 WebSocket::lastWrite(QWebSocket *client, const Shard *shard) const
+{
+    auto it = m_clientWrites.find(client);
+    return it != m_clientWrites.end() ? it->second[shard->index()] : 0;
+}
+
+template <typename Read>
+void WebSocket::answerRead(QWebSocket *client, const MessageRequest &message, const QString &collection, Read read)
+{
+    Shard *shard = shardFor(collection);
+    bool current = false;
+    std::shared_ptr<const CollectionView> view = shard->readView(collection, lastWrite(client, shard), &current);
+    if (!current)
+    {
+        answerFromShard(client, message, collection, [collection, read](Shard &shard)
+                        {
+                            return read(shard, static_cast<const Collection *>(shard.collection(collection)));
+                        });
+        return;
+    }
+
+    QPointer<QWebSocket> target(client);
+    const bool binary = message.binary;
+    m_readers.start([this, shard, view, read, target, binary]()
+    {
+        const QByteArray response = read(*shard, view.get());
+        QMetaObject::invokeMethod(this, [this, target, binary, response]()
+                                  {
+                                      if (!target.isNull() && !response.isEmpty())
+                                      {
+                                          respond(target, response, binary);
+                                      }
+                                  },
+                                  Qt::QueuedConnection);
+    });
+}
+
+QByteArray WebSocket::cachedRead(Shard &shard, QPointer<QWebSocket> target, const MessageRequest &message, const QByteArray &cacheKey,
+                                 quint64 version, const std::function<QByteArray()> &compute)
+{
+    const auto waiter = [this, target, id = message.id, binary = message.binary](const QByteArray &computed)
+    {
+        const QByteArray response = ResponseWriter::withId(computed, id, binary);
+        QMetaObject::invokeMethod(this, [this, target, response, binary]()
+                                  {
+                                      if (!target.isNull())
+                                      {
+                                          respond(target, response, binary);
+                                      }
+                                  },
+                                  Qt::QueuedConnection);
+    };
+    QByteArray response;
+    switch (shard.responseCache().lookup(cacheKey, version, &response, waiter))
+    {
+    case ResponseCache::Lookup::Hit:
+        break;
+    case ResponseCache::Lookup::Pending:
+        return QByteArray();
+    case ResponseCache::Lookup::Miss:
+        response = compute();
+        shard.responseCache().insert(cacheKey, version, response);
+        break;
+    }
+    return ResponseWriter::withId(response, message.id, message.binary);
+}
+
+void WebSocket::sendResponse(QWebSocket *client, const QByteArray &response, bool binary)
+{
+    if (client->state() != QAbstractSocket::ConnectedState)
+    {
+        qWarning() << QTime::currentTime().toString() << "Client disconnected:" << client->peerAddress().toString() << "ID" << client->objectName();
+        return;
+    }
+    if (binary)
+    {
+        client->sendBinaryMessage(response);
+    }
+    else
+    {
+        client->sendTextMessage(QString::fromUtf8(response));
     }
 }
 
-QString WebSocket::handleInsert(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleInsert(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    QList<InsertRequest> payloads = InsertRequest::fromJson(message.data, &ok);
+    QList<InsertRequest> payloads = parseRequest<InsertRequest>(message, &ok);
     if (!ok)
     {
         qWarning() << "Invalid insert message format from" << client->peerAddress().toString();
@@ -361,214 +1339,569 @@ QString WebSocket::handleInsert(QWebSocket *client, const MessageRequest &messag
         return "";
     }
 
-    foreach (InsertRequest payload, payloads)
+    // logged here, in arrival order, and applied by the shards owning the collections
+    std::vector<QList<InsertRequest>> groups(m_shards.size());
+    foreach (const InsertRequest &payload, payloads)
     {
-        auto database = m_databases[payload.col].get();
-        if (database == nullptr)
+        if (m_wal)
         {
-            m_databases[payload.col] = std::make_unique<Collection>(payload.col, m_dataFolder);
-            database = m_databases[payload.col].get();
+            m_wal->appendInsert(payload.col, payload.doc, payload.ts, payload.data);
         }
-        database->insert(payload.ts, payload.doc, payload.data);
+        groups[shardFor(payload.col)->index()].append(payload);
     }
 
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+    QPointer<QWebSocket> target(client);
+    const auto applied = [this, target, payloads, message]()
+    {
+        bool published = false;
+        foreach (const InsertRequest &payload, payloads)
+        {
+            published = m_subscriptions.publish(payload.col, payload.doc, payload.ts, payload.data) || published;
+        }
+        if (published)
+        {
+            schedulePush();
+        }
+        if (!target.isNull())
+        {
+            respond(target, acknowledge(message), message.binary, message.id);
+        }
+    };
+    const size_t shards = std::count_if(groups.begin(), groups.end(), [](const QList<InsertRequest> &group) { return !group.isEmpty(); });
+    if (shards == 0)
+    {
+        applied();
+        return "";
+    }
+    const auto finished = countdown(shards, applied);
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        if (groups[i].isEmpty())
+        {
+            continue;
+        }
+        m_shards[i]->call([group = groups[i]](Shard &shard)
+                          {
+                              applyInserts(shard, group);
+                              return true;
+                          },
+                          this, [finished](bool) { finished(); });
+        noteWrite(client, m_shards[i].get());
+    }
+    return "";
 }
 
-QString WebSocket::handleQuerySessions(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleQuerySessions(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    QuerySessions query = QuerySessions::fromJson(message.data, &ok);
+    QuerySessions query = parseRequest<QuerySessions>(message, &ok);
     if (!ok)
     {
         qWarning() << "Invalid query sessions message format from" << client->peerAddress().toString();
         client->close();
         return "";
     }
-    auto database = m_databases[query.col].get();
-    QJsonObject dataObj;
-    QJsonObject obj;
-    obj["id"] = message.id;
-    if (database == nullptr)
+    PayloadFilter filter;
+    QString filterError;
+    if (!PayloadFilter::compile(query.filter, &filter, &filterError))
     {
-        m_databases.erase(query.col);   
-        obj["records"] = QJsonObject();
-        QJsonDocument doc(obj);
-        return doc.toJson(QJsonDocument::Compact);
+        return errorResponse(message, QStringLiteral("invalid filter: ") + filterError);
     }
-    QRegularExpression docRegex;
-    const bool useRegex = tryParseRegexPattern(query.doc, &docRegex);
-    auto records = database->getAllRecords(query.ts, useRegex ? QString() : query.doc, query.from, useRegex ? &docRegex : nullptr);
 
-    foreach (const QString &key, records.keys())
+    QPointer<QWebSocket> target(client);
+    answerRead(client, message, query.col, [this, target, query, filter, message](Shard &shard, const auto *database)
     {
-        dataObj[key] = records[key]->toJson();
-    }
-
-    obj["records"] = dataObj;
+        if (database == nullptr)
+        {
+            ResponseWriter writer(message.binary);
+            startResponse(writer, message);
+            writer.key("records");
+            writer.startMap();
+            writer.endMap();
+            writer.endMap();
+            return writer.take();
+        }
 
-    QJsonDocument doc(obj);
-    auto resp = doc.toJson(QJsonDocument::Compact);
-    return resp;
+        const auto docPattern = shard.keyPatterns().lookup(query.doc);
+        const bool singleDocument = !docPattern && !query.doc.isEmpty();
+        const quint64 version = singleDocument ? database->documentVersion(query.doc) : database->version();
+        // every timestamp at or after the newest record reads the same records
+        const QString at = query.ts >= database->latestHighWater() ? QStringLiteral("now") : QString::number(query.ts);
+        const QByteArray cacheKey = responseCacheKey("qry", message, QJsonArray{query.col, query.doc, at, QString::number(query.from),
+                                                                                 QJsonArray::fromStringList(query.fields), query.filter});
+        return cachedRead(shard, target, message, cacheKey, version, [&]()
+        {
+            ResponseWriter writer(message.binary);
+            startResponse(writer, QString());
+            writer.key("records");
+            writer.startMap();
+            auto records = database->getAllRecords(query.ts, docPattern ? QString() : query.doc, query.from, docPattern.get(), &filter);
+            const PayloadProjection projection(query.fields);
+            for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+            {
+                writer.key(it.key());
+                writeRecord(writer, it.value(), projection);
+            }
+            writer.endMap();
+            writer.endMap();
+            return writer.take();
+        });
+    });
+    return "";
 }
 
-QString WebSocket::handleQueryCollections(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleQueryCollections(QWebSocket *client, const MessageRequest &message)
 {
-    QJsonObject obj;
-    obj["id"] = message.id;
-
-    QJsonArray recordsArray;
-    for( auto &[key, value] : m_databases)
-    {
-        recordsArray.append(key);
+    // answered right away when every shard's published views hold the client's writes
+    QStringList published;
+    if (std::all_of(m_shards.begin(), m_shards.end(), [this, client, &published](const std::unique_ptr<Shard> &shard)
+                    { return shard->collectionNames(lastWrite(client, shard.get()), &published); }))
+    {
+        ResponseWriter writer(message.binary);
+        startResponse(writer, message);
+        writer.key("collections");
+        writer.startArray();
+        for (const QString &name : published)
+        {
+            writer.string(name);
+        }
+        writer.endArray();
+        writer.endMap();
+        return writer.take();
     }
-    obj["collections"] = recordsArray;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
 
+    QPointer<QWebSocket> target(client);
+    auto names = std::make_shared<QStringList>();
+    const auto listed = countdown(m_shards.size(), [this, target, names, message]()
+    {
+        ResponseWriter writer(message.binary);
+        startResponse(writer, message);
+        writer.key("collections");
+        writer.startArray();
+        for (const QString &name : *names)
+        {
+            writer.string(name);
+        }
+        writer.endArray();
+        writer.endMap();
+        if (!target.isNull())
+        {
+            respond(target, writer.take(), message.binary);
+        }
+    });
+    for (const auto &shard : m_shards)
+    {
+        shard->call([](Shard &shard)
+                    {
+                        QStringList names;
+                        for (const auto &[key, value] : shard.collections())
+                        {
+                            names.append(key);
+                        }
+                        return names;
+                    },
+                    this, [names, listed](const QStringList &shardNames)
+                    {
+                        names->append(shardNames);
+                        listed();
+                    });
+    }
+    return "";
 }
 
-QString WebSocket::handleQueryDocument(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleQueryDocument(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    QueryDocument queryDocument = QueryDocument::fromJson(message.data, &ok);
+    QueryDocument queryDocument = parseRequest<QueryDocument>(message, &ok);
     if (!ok)
     {
         qWarning() << "Invalid query document message format from" << client->peerAddress().toString();
         client->close();
         return "";
     }
+    PayloadFilter filter;
+    QString filterError;
+    if (!PayloadFilter::compile(queryDocument.filter, &filter, &filterError))
+    {
+        return errorResponse(message, QStringLiteral("invalid filter: ") + filterError);
+    }
+
+    DocumentScan scan{message.id, message.binary, queryDocument, filter, PayloadProjection(queryDocument.fields), queryDocument.limit};
+    if (!queryDocument.cursor.isEmpty())
+    {
+        // resume right after the last record of the previous page
+        qint64 last = 0;
+        if (!queryDocument.decodeCursor(&last) || !scan.query.resumeAfter(last))
+        {
+            return errorResponse(message, QStringLiteral("invalid cursor"));
+        }
+    }
+
+    if (queryDocument.stream)
+    {
+        // the first frame is answered right away, the others from pumpDocumentStreams()
+        QPointer<QWebSocket> target(client);
+        shardFor(queryDocument.col)->call([scan](Shard &shard) mutable
+                                          {
+                                              bool finished = false;
+                                              const QByteArray frame = nextDocumentPage(shard.collection(scan.query.col), scan,
+                                                                                        StreamFrameRecords, StreamFrameBytes, &finished);
+                                              return std::make_tuple(frame, scan, finished);
+                                          },
+                                          this, [this, target](const std::tuple<QByteArray, DocumentScan, bool> &page)
+                                          {
+                                              if (target.isNull())
+                                              {
+                                                  return;
+                                              }
+                                              respond(target, std::get<0>(page), std::get<1>(page).binary);
+                                              if (!std::get<2>(page))
+                                              {
+                                                  m_documentStreams.push_back(DocumentStream{target, ++m_lastStreamSerial, false, std::get<1>(page)});
+                                                  scheduleDocumentStreams();
+                                              }
+                                          });
+        return "";
+    }
 
-    QJsonObject dataObj;
-    auto database = m_databases[queryDocument.col].get();
-    QJsonArray recordsArray;
+    QPointer<QWebSocket> target(client);
+    answerRead(client, message, queryDocument.col, [this, target, scan, message](Shard &shard, const auto *database)
+    {
+        const QueryDocument &queryDocument = scan.query;
+        const auto compute = [&]()
+        {
+            if (queryDocument.downsample == 0)
+            {
+                bool finished = false;
+                DocumentScan page = scan;
+                page.id.clear();
+                return nextDocumentPage(database, page, queryDocument.limit, 0, &finished);
+            }
+            ResponseWriter writer(message.binary);
+            startResponse(writer, QString());
+            writer.key("records");
+            writer.startArray();
+            if (database != nullptr)
+            {
+                DownsampleMethod method;
+                downsampleMethodFromName(queryDocument.downsampleMethod, &method);
+                const QList<DataRecord> records = database->downsampleDocument(queryDocument.doc, queryDocument.from, queryDocument.to,
+                                                                               queryDocument.downsample, method,
+                                                                               PayloadPath(queryDocument.downsampleField),
+                                                                               queryDocument.reverse, queryDocument.limit, &scan.filter);
+                foreach (const DataRecord &record, records)
+                {
+                    writeRecord(writer, record, scan.projection);
+                }
+            }
+            writer.endArray();
+            writer.endMap();
+            return writer.take();
+        };
+        if (database == nullptr)
+        {
+            return ResponseWriter::withId(compute(), message.id, message.binary);
+        }
+        const QByteArray cacheKey = responseCacheKey(
+            "qdoc", message, QJsonArray{queryDocument.col, queryDocument.doc, QString::number(queryDocument.from),
+                                        QString::number(queryDocument.to), QString::number(queryDocument.limit), queryDocument.reverse,
+                                        QJsonArray::fromStringList(queryDocument.fields), queryDocument.filter,
+                                        QString::number(queryDocument.downsample), queryDocument.downsampleMethod,
+                                        queryDocument.downsampleField});
+        return cachedRead(shard, target, message, cacheKey, database->documentVersion(queryDocument.doc), compute);
+    });
+    return "";
+}
 
-    dataObj["id"] = message.id;
-    if (database == nullptr)
+// Writes the next page of a document query: at most maxRecords records (0 for
+// all) and, with maxBytes, about that many bytes. The query's range is then
+// narrowed past the last record written. A page that is not the last frame of
+// a stream carries "more"; the last one carries a cursor when the limit cut
+// the result short. Runs on the shard owning the collection, or on a reader
+// against its view.
+template <typename Database>
+QByteArray WebSocket::nextDocumentPage(const Database *database, DocumentScan &scan, qint64 maxRecords, qint64 maxBytes, bool *finished)
+{
+    QueryDocument &query = scan.query;
+    if (query.limit > 0 && (maxRecords == 0 || maxRecords > scan.remaining))
     {
-        m_databases.erase(queryDocument.col);   
-        dataObj["records"] = recordsArray;
-        QJsonDocument doc(dataObj);
-        return doc.toJson(QJsonDocument::Compact);
+        maxRecords = scan.remaining;
     }
-    auto records = database->getAllRecordsForDocument(queryDocument.doc, queryDocument.from, queryDocument.to, queryDocument.reverse, queryDocument.limit);
 
-    foreach (const DataRecord *record, records)
+    ResponseWriter writer(scan.binary);
+    startResponse(writer, scan.id);
+    writer.key("records");
+    writer.startArray();
+
+    bool more = false;
+    if (database != nullptr)
     {
-        recordsArray.append(record->toJson());
+        // one record past the page tells whether another one follows
+        const QList<DataRecord> records = database->getAllRecordsForDocument(query.doc, query.from, query.to, query.reverse,
+                                                                             maxRecords > 0 ? maxRecords + 1 : 0, &scan.filter);
+        qsizetype written = 0;
+        while (written < records.size() && (maxRecords == 0 || written < maxRecords) && (maxBytes == 0 || writer.size() < maxBytes))
+        {
+            writeRecord(writer, records.at(written), scan.projection);
+            ++written;
+        }
+        more = written < records.size();
+        if (written > 0)
+        {
+            // a record at the last timestamp of the direction ends the scan
+            more = query.resumeAfter(records.at(written - 1).timestamp) && more;
+            scan.remaining -= written;
+        }
     }
-    dataObj["records"] = recordsArray;
+    writer.endArray();
 
-    QJsonDocument doc(dataObj);
-    return doc.toJson(QJsonDocument::Compact);
+    const bool limitReached = query.limit > 0 && scan.remaining <= 0;
+    *finished = !more || limitReached || !query.stream;
+    if (!*finished)
+    {
+        writer.key("more");
+        writer.boolean(true);
+    }
+    else if (more)
+    {
+        const qint64 last = query.reverse ? query.to + 1 : query.from - 1;
+        writer.key("cursor");
+        writer.string(QueryDocument::encodeCursor(query.doc, last, query.reverse));
+    }
+    writer.endMap();
+    return writer.take();
 }
 
-QString WebSocket::handleDeleteDocument(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleQueryDocumentNames(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    DeleteDocument query = DeleteDocument::fromJson(message.data  , &ok);
+    QueryDocumentNames query = parseRequest<QueryDocumentNames>(message, &ok);
     if (!ok)
     {
-        qWarning() << "Invalid delete document message format from" << client->peerAddress().toString();
+        qWarning() << "Invalid document names message format from" << client->peerAddress().toString();
         client->close();
         return "";
     }
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonDocument doc(obj);
 
-    if (query.col.isEmpty())
+    answerRead(client, message, query.col, [query, message](Shard &, const auto *database)
     {
-        // Hidden capability: empty collection deletes this document across all collections; SDKs keep this private.
-        QVector<QString> toErase;
-        
-        for (auto &[key, value] : m_databases)
+        ResponseWriter writer(message.binary);
+        startResponse(writer, message);
+        writer.key("docs");
+        writer.startArray();
+        bool more = false;
+        if (database != nullptr)
         {
-            value->clearDocument(query.doc);
-            if (value->isEmpty())
+            for (const QString &name : database->getDocumentNames(query.prefix, query.after, query.limit, &more))
             {
-                toErase.append(key);
+                writer.string(name);
             }
         }
-        
-        // Now erase the empty collections
-        foreach (const QString &key, toErase)
-        {            
-            qInfo() << "Deleting collection (1) since there are no more documents:" << key;
-            m_databases.erase(key);
+        writer.endArray();
+        if (more)
+        {
+            writer.key("more");
+            writer.boolean(true);
         }
+        writer.endMap();
+        return writer.take();
+    });
+    return "";
+}
+
+QByteArray WebSocket::handleAggregate(QWebSocket *client, const MessageRequest &message)
+{
+    bool ok;
+    AggregateRequest request = parseRequest<AggregateRequest>(message, &ok);
+    if (!ok)
+    {
+        qWarning() << "Invalid aggregate message format from" << client->peerAddress().toString();
+        client->close();
+        return "";
     }
-    else
+
+    answerRead(client, message, request.col, [request, message](Shard &shard, const auto *database)
     {
-        auto database = m_databases[query.col].get();
-        if (database == nullptr)
+        ResponseWriter writer(message.binary);
+        startResponse(writer, message);
+        writer.key("docs");
+        writer.startMap();
+        if (database != nullptr)
         {
-            m_databases.erase(query.col);   
-            qWarning() << "Collection not found for collection:" << query.col;
-            return doc.toJson(QJsonDocument::Compact);
+            const auto docPattern = shard.keyPatterns().lookup(request.doc);
+            const PayloadPath field(request.field);
+            const auto documents = database->aggregate(docPattern ? QString() : request.doc, docPattern.get(),
+                                                       request.from, request.to, request.bucket, field);
+            for (auto it = documents.constBegin(); it != documents.constEnd(); ++it)
+            {
+                writer.key(it.key());
+                writer.startArray();
+                for (const AggregateBucket &bucket : it.value())
+                {
+                    writer.startMap();
+                    writer.key("ts");
+                    writer.integer(bucket.start);
+                    if (request.functions & AggregateRequest::Count)
+                    {
+                        writer.key("count");
+                        writer.integer(bucket.count);
+                    }
+                    if (!request.field.isEmpty())
+                    {
+                        if (request.functions & AggregateRequest::Min)
+                        {
+                            writer.key("min");
+                            writer.number(bucket.min);
+                        }
+                        if (request.functions & AggregateRequest::Max)
+                        {
+                            writer.key("max");
+                            writer.number(bucket.max);
+                        }
+                        if (request.functions & AggregateRequest::Sum)
+                        {
+                            writer.key("sum");
+                            writer.number(bucket.sum);
+                        }
+                        if (request.functions & AggregateRequest::Avg)
+                        {
+                            writer.key("avg");
+                            writer.number(bucket.sum / bucket.count);
+                        }
+                        if (request.functions & AggregateRequest::First)
+                        {
+                            writer.key("first");
+                            writer.number(bucket.first);
+                        }
+                        if (request.functions & AggregateRequest::Last)
+                        {
+                            writer.key("last");
+                            writer.number(bucket.last);
+                        }
+                    }
+                    writer.endMap();
+                }
+                writer.endArray();
+            }
         }
-        database->clearDocument(query.doc);
-        
-        if (database->isEmpty())
+        writer.endMap();
+        writer.endMap();
+        return writer.take();
+    });
+    return "";
+}
+
+QByteArray WebSocket::handleDeleteDocument(QWebSocket *client, const MessageRequest &message)
+{
+    bool ok;
+    DeleteDocument query = parseRequest<DeleteDocument>(message, &ok);
+    if (!ok)
+    {
+        qWarning() << "Invalid delete document message format from" << client->peerAddress().toString();
+        client->close();
+        return "";
+    }
+
+    if (m_wal)
+    {
+        m_wal->appendClearDocument(query.col, query.doc);
+    }
+    if (!query.col.isEmpty())
+    {
+        answerWrite(client, message, query.col, [query, message](Shard &shard)
         {
-            qInfo() << "Deleting collection (2) since there are no more documents:" << query.col;
-            m_databases.erase(query.col);
-        }
+            Collection *database = shard.collection(query.col);
+            if (database == nullptr)
+            {
+                qWarning() << "Collection not found for collection:" << query.col;
+                return acknowledge(message);
+            }
+            database->clearDocument(query.doc);
+            if (database->isEmpty())
+            {
+                qInfo() << "Deleting collection (2) since there are no more documents:" << query.col;
+                shard.eraseCollection(query.col);
+            }
+            return acknowledge(message);
+        });
+        return "";
     }
-    return doc.toJson(QJsonDocument::Compact);
+
+    // Hidden capability: empty collection deletes this document across all collections; SDKs keep this private.
+    QPointer<QWebSocket> target(client);
+    const auto cleared = countdown(m_shards.size(), [this, target, message]()
+    {
+        if (!target.isNull())
+        {
+            respond(target, acknowledge(message), message.binary, message.id);
+        }
+    });
+    for (const auto &shard : m_shards)
+    {
+        shard->call([doc = query.doc](Shard &shard)
+                    {
+                        clearDocumentEverywhere(shard, doc, std::unordered_set<QString>());
+                        return true;
+                    },
+                    this, [cleared](bool) { cleared(); });
+        noteWrite(client, shard.get());
+    }
+    return "";
 }
 
-QString WebSocket::handleDeleteCollection(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleDeleteCollection(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    DeleteCollection query = DeleteCollection::fromJson(message.data, &ok);
+    DeleteCollection query = parseRequest<DeleteCollection>(message, &ok);
     if (!ok)
     {
         qWarning() << "Invalid delete collection message format from" << client->peerAddress().toString();
         client->close();
         return "";
     }
-    if (m_databases.find(query.col) != m_databases.end())
+
+    if (m_wal)
     {
-        m_databases.erase(query.col);
+        m_wal->appendDeleteCollection(query.col);
     }
-
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+    answerWrite(client, message, query.col, [query, message](Shard &shard)
+    {
+        shard.eraseCollection(query.col);
+        return acknowledge(message);
+    });
+    return "";
 }
 
-QString WebSocket::handleDeleteRecord(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleDeleteRecord(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    DeleteRecord query = DeleteRecord::fromJson(message.data, &ok);
+    DeleteRecord query = parseRequest<DeleteRecord>(message, &ok);
     if (!ok)
     {
         qWarning() << "Invalid delete record message format from" << client->peerAddress().toString();
         client->close();
         return "";
     }
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonDocument doc(obj);
 
-    auto database = m_databases[query.col].get();
-    if (database == nullptr)
-    {        m_databases.erase(query.col);
-        return doc.toJson(QJsonDocument::Compact);
+    if (m_wal)
+    {
+        m_wal->appendDeleteRecord(query.col, query.doc, query.ts);
     }
-    database->deleteRecord(query.doc, query.ts);    
-    return doc.toJson(QJsonDocument::Compact);
+    answerWrite(client, message, query.col, [query, message](Shard &shard)
+    {
+        if (Collection *database = shard.collection(query.col))
+        {
+            database->deleteRecord(query.doc, query.ts);
+        }
+        return acknowledge(message);
+    });
+    return "";
 }
 
-QString WebSocket::handleDeleteMultipleRecords(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleDeleteMultipleRecords(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    DeleteMultipleRecords query = DeleteMultipleRecords::fromJson(message.data, &ok);
+    DeleteMultipleRecords query = parseRequest<DeleteMultipleRecords>(message, &ok);
     if (!ok)
     {
         qWarning() << "Invalid delete multiple records message format from" << client->peerAddress().toString();
@@ -576,51 +1909,84 @@ QString WebSocket::handleDeleteMultipleRecords(QWebSocket *client, const Message
         return "";
     }
 
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonDocument doc(obj);
+    std::vector<QList<DeleteRecord>> groups(m_shards.size());
     foreach (const DeleteRecord &record, query.records)
     {
-        auto database = m_databases[record.col].get();
-        if (database == nullptr)
+        if (m_wal)
         {
-            m_databases.erase(record.col);   
-        } else {
-            database->deleteRecord(record.doc, record.ts);
+            m_wal->appendDeleteRecord(record.col, record.doc, record.ts);
         }
+        groups[shardFor(record.col)->index()].append(record);
     }
-    return doc.toJson(QJsonDocument::Compact);
+
+    QPointer<QWebSocket> target(client);
+    const auto deleted = [this, target, message]()
+    {
+        if (!target.isNull())
+        {
+            respond(target, acknowledge(message), message.binary, message.id);
+        }
+    };
+    const size_t shards = std::count_if(groups.begin(), groups.end(), [](const QList<DeleteRecord> &group) { return !group.isEmpty(); });
+    if (shards == 0)
+    {
+        deleted();
+        return "";
+    }
+    const auto finished = countdown(shards, deleted);
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        if (groups[i].isEmpty())
+        {
+            continue;
+        }
+        m_shards[i]->call([group = groups[i]](Shard &shard)
+                          {
+                              foreach (const DeleteRecord &record, group)
+                              {
+                                  if (Collection *database = shard.collection(record.col))
+                                  {
+                                      database->deleteRecord(record.doc, record.ts);
+                                  }
+                              }
+                              return true;
+                          },
+                          this, [finished](bool) { finished(); });
+        noteWrite(client, m_shards[i].get());
+    }
+    return "";
 }
 
-QString WebSocket::handleDeleteRecordsRange(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleDeleteRecordsRange(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    DeleteRecordsRange query = DeleteRecordsRange::fromJson(message.data, &ok);
+    DeleteRecordsRange query = parseRequest<DeleteRecordsRange>(message, &ok);
     if (!ok || !query.isValid())
     {
         qWarning() << "Invalid delete records range message format from" << client->peerAddress().toString();
         client->close();
         return "";
     }
-    
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonDocument doc(obj);
 
-    auto database = m_databases[query.col].get();
-    if (database == nullptr)
+    if (m_wal)
     {
-        m_databases.erase(query.col);
-        return doc.toJson(QJsonDocument::Compact);
+        m_wal->appendDeleteRange(query.col, query.doc, query.fromTs, query.toTs);
     }
-    database->deleteRecordsInRange(query.doc, query.fromTs, query.toTs);
-    return doc.toJson(QJsonDocument::Compact);
+    answerWrite(client, message, query.col, [query, message](Shard &shard)
+    {
+        if (Collection *database = shard.collection(query.col))
+        {
+            database->deleteRecordsInRange(query.doc, query.fromTs, query.toTs);
+        }
+        return acknowledge(message);
+    });
+    return "";
 }
 
-QString WebSocket::handleSetValue(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleSetValue(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    KeyValue kv = KeyValue::fromJson(message.data, &ok);
+    KeyValue kv = parseRequest<KeyValue>(message, &ok);
     if (!ok || !kv.isValid() || !kv.hasKey() || !kv.hasValue())
     {
         qWarning() << "Invalid set value message format from" << client->peerAddress().toString();
@@ -628,26 +1994,22 @@ QString WebSocket::handleSetValue(QWebSocket *client, const MessageRequest &mess
         return "";
     }
 
-    auto collection = kv.col;
-    auto database = m_databases[collection].get();
-    if (database == nullptr)
+    if (m_wal)
     {
-        m_databases[collection] = std::make_unique<Collection>(collection, m_dataFolder);
-        database = m_databases[collection].get();
+        m_wal->appendSetValue(kv.col, kv.key, kv.value);
     }
-    
-    database->setValueForKey(kv.key, kv.value);
-
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+    answerWrite(client, message, kv.col, [kv, message](Shard &shard)
+    {
+        shard.createCollection(kv.col)->setValueForKey(kv.key, kv.value);
+        return acknowledge(message);
+    });
+    return "";
 }
 
-QString WebSocket::handleGetValue(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleGetValue(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    KeyValue kv = KeyValue::fromJson(message.data, &ok);
+    KeyValue kv = parseRequest<KeyValue>(message, &ok);
     if (!ok || !kv.isValid() || !kv.hasKey())
     {
         qWarning() << "Invalid get value message format from" << client->peerAddress().toString();
@@ -655,26 +2017,28 @@ QString WebSocket::handleGetValue(QWebSocket *client, const MessageRequest &mess
         return "";
     }
 
-    QJsonObject obj;
-    obj["id"] = message.id;
-    obj["value"] = "";
+    answerRead(client, message, kv.col, [kv, message](Shard &, const auto *database)
+    {
+        QString value;
+        if (database != nullptr)
+        {
+            value = database->getValueForKey(kv.key);
+        }
 
-    auto collection = kv.col;
-    auto database = m_databases[collection].get();
-    
-    if (database == nullptr) {
-        m_databases.erase(collection);
-    } else {
-        obj["value"] = database->getValueForKey(kv.key);
-    }
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+        ResponseWriter writer(message.binary);
+        startResponse(writer, message);
+        writer.key("value");
+        writer.string(value);
+        writer.endMap();
+        return writer.take();
+    });
+    return "";
 }
 
-QString WebSocket::handleGetValues(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleGetValues(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    KeyValue kv = KeyValue::fromJson(message.data, &ok);
+    KeyValue kv = parseRequest<KeyValue>(message, &ok);
     if (!ok || !kv.isValid() || !kv.hasKey())
     {
         qWarning() << "Invalid get values message format from" << client->peerAddress().toString();
@@ -682,44 +2046,43 @@ QString WebSocket::handleGetValues(QWebSocket *client, const MessageRequest &mes
         return "";
     }
 
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonObject valuesObj;
-
-    auto collection = kv.col;
-    auto database = m_databases[collection].get();
-
-    if (database == nullptr)
-    {
-        m_databases.erase(collection);
-    }
-    else
+    answerRead(client, message, kv.col, [kv, message](Shard &shard, const auto *database)
     {
-        QRegularExpression keyRegex;
-        const bool useRegex = tryParseRegexPattern(kv.key, &keyRegex);
-        if (useRegex)
+        ResponseWriter writer(message.binary);
+        startResponse(writer, message);
+        writer.key("values");
+        writer.startMap();
+
+        if (database != nullptr)
         {
-            auto values = database->getAllValues(&keyRegex);
-            for (auto it = values.constBegin(); it != values.constEnd(); ++it)
+            const auto keyPattern = shard.keyPatterns().lookup(kv.key);
+            if (keyPattern)
             {
-                valuesObj[it.key()] = it.value();
+                auto values = database->getAllValues(keyPattern.get());
+                for (auto it = values.constBegin(); it != values.constEnd(); ++it)
+                {
+                    writer.key(it.key());
+                    writer.string(it.value());
+                }
+            }
+            else
+            {
+                writer.key(kv.key);
+                writer.string(database->getValueForKey(kv.key));
             }
         }
-        else
-        {
-            valuesObj[kv.key] = database->getValueForKey(kv.key);
-        }
-    }
 
-    obj["values"] = valuesObj;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+        writer.endMap();
+        writer.endMap();
+        return writer.take();
+    });
+    return "";
 }
 
-QString WebSocket::handleRemoveValue(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleRemoveValue(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    KeyValue kv = KeyValue::fromJson(message.data, &ok);
+    KeyValue kv = parseRequest<KeyValue>(message, &ok);
     if (!ok || !kv.isValid() || !kv.hasKey())
     {
         qWarning() << "Invalid remove value message format from" << client->peerAddress().toString();
@@ -727,24 +2090,25 @@ QString WebSocket::handleRemoveValue(QWebSocket *client, const MessageRequest &m
         return "";
     }
 
-    auto collection = kv.col;
-    auto database = m_databases[collection].get();
-    if (database == nullptr) {
-        m_databases.erase(collection);        
-    } else {
-        database->removeValueForKey(kv.key);
+    if (m_wal)
+    {
+        m_wal->appendRemoveValue(kv.col, kv.key);
     }
-
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+    answerWrite(client, message, kv.col, [kv, message](Shard &shard)
+    {
+        if (Collection *database = shard.collection(kv.col))
+        {
+            database->removeValueForKey(kv.key);
+        }
+        return acknowledge(message);
+    });
+    return "";
 }
 
-QString WebSocket::handleGetAllValues(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleGetAllValues(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    KeyValue kv = KeyValue::fromJson(message.data, &ok);
+    KeyValue kv = parseRequest<KeyValue>(message, &ok);
     if (!ok || !kv.isValid())
     {
         qWarning() << "Invalid get all values message format from" << client->peerAddress().toString();
@@ -752,31 +2116,42 @@ QString WebSocket::handleGetAllValues(QWebSocket *client, const MessageRequest &
         return "";
     }
 
-    auto collection = kv.col;
-    auto database = m_databases[collection].get();
-    QJsonObject valuesObj;
-    
-    if (database == nullptr) {
-        m_databases.erase(collection);
-    } else {
-        auto values = database->getAllValues();
-        for (auto it = values.begin(); it != values.end(); ++it)
+    QPointer<QWebSocket> target(client);
+    answerRead(client, message, kv.col, [this, target, kv, message](Shard &shard, const auto *database)
+    {
+        const auto compute = [&]()
+        {
+            ResponseWriter writer(message.binary);
+            startResponse(writer, QString());
+            writer.key("values");
+            writer.startMap();
+            if (database != nullptr)
+            {
+                auto values = database->getAllValues();
+                for (auto it = values.begin(); it != values.end(); ++it)
+                {
+                    writer.key(it.key());
+                    writer.string(it.value());
+                }
+            }
+            writer.endMap();
+            writer.endMap();
+            return writer.take();
+        };
+        if (database == nullptr)
         {
-            valuesObj[it.key()] = it.value();
+            return ResponseWriter::withId(compute(), message.id, message.binary);
         }
-    }
-
-    QJsonObject obj;
-    obj["id"] = message.id;
-    obj["values"] = valuesObj;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+        const QByteArray cacheKey = responseCacheKey("gvals", message, QJsonArray{kv.col});
+        return cachedRead(shard, target, message, cacheKey, database->valuesVersion(), compute);
+    });
+    return "";
 }
 
-QString WebSocket::handleGetAllKeys(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleGetAllKeys(QWebSocket *client, const MessageRequest &message)
 {
     bool ok;
-    KeyValue kv = KeyValue::fromJson(message.data, &ok);
+    KeyValue kv = parseRequest<KeyValue>(message, &ok);
     if (!ok || !kv.isValid())
     {
         qWarning() << "Invalid get all keys message format from" << client->peerAddress().toString();
@@ -784,32 +2159,32 @@ QString WebSocket::handleGetAllKeys(QWebSocket *client, const MessageRequest &me
         return "";
     }
 
-    auto collection = kv.col;
-    auto database = m_databases[collection].get();
-    QJsonArray keysArray;
-    
-    if (database == nullptr) {
-        m_databases.erase(collection);
-    } else {
-        auto keys = database->getAllKeys();
-        foreach (const QString &key, keys)
+    answerRead(client, message, kv.col, [kv, message](Shard &, const auto *database)
+    {
+        ResponseWriter writer(message.binary);
+        startResponse(writer, message);
+        writer.key("keys");
+        writer.startArray();
+        if (database != nullptr)
         {
-            keysArray.append(key);
+            foreach (const QString &key, database->getAllKeys())
+            {
+                writer.string(key);
+            }
         }
-    }
-
-    QJsonObject obj;
-    obj["id"] = message.id;
-    obj["keys"] = keysArray;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+        writer.endArray();
+        writer.endMap();
+        return writer.take();
+    });
+    return "";
 }
 
-QString WebSocket::handleConnections(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleConnections(QWebSocket *client, const MessageRequest &message)
 {
-    QJsonObject obj;
-    obj["id"] = message.id;
-    QJsonArray connectionsArray;
+    ResponseWriter writer(message.binary);
+    startResponse(writer, message);
+    writer.key("connections");
+    writer.startArray();
     const qint64 now = QDateTime::currentMSecsSinceEpoch();
 
     for (QWebSocket *socket : m_clients)
@@ -818,8 +2193,9 @@ QString WebSocket::handleConnections(QWebSocket *client, const MessageRequest &m
         {
             continue;
         }
-        QJsonObject connectionObj;
-        connectionObj["ip"] = socket->peerAddress().toString();
+        writer.startMap();
+        writer.key("ip");
+        writer.string(socket->peerAddress().toString());
         QString connectionName;
         auto nameIt = m_clientNames.find(socket->objectName());
         if (nameIt != m_clientNames.end())
@@ -832,51 +2208,105 @@ QString WebSocket::handleConnections(QWebSocket *client, const MessageRequest &m
         {
             connectedAt = it->second;
         }
-        connectionObj["since"] = now - connectedAt;
+        writer.key("since");
+        writer.integer(now - connectedAt);
+        writer.key("name");
         if (connectionName.isEmpty())
         {
-            connectionObj["name"] = QJsonValue();
+            writer.null();
         }
         else
         {
-            connectionObj["name"] = connectionName;
+            writer.string(connectionName);
         }
-        connectionObj["self"] = (socket == client);
-        connectionsArray.append(connectionObj);
+        writer.key("self");
+        writer.boolean(socket == client);
+        writer.endMap();
+    }
+
+    writer.endArray();
+    writer.endMap();
+    return writer.take();
+}
+
+QByteArray WebSocket::handleSubscribe(QWebSocket *client, const MessageRequest &message)
+{
+    bool ok;
+    SubscriptionRequest request = parseRequest<SubscriptionRequest>(message, &ok);
+    if (!ok || !request.isValid())
+    {
+        qWarning() << "Invalid subscribe message format from" << client->peerAddress().toString();
+        client->close();
+        return "";
+    }
+
+    m_subscriptions.subscribe(client, message.binary, message.id, request.col, request.doc, m_keyPatterns.lookup(request.doc));
+    qInfo() << "Client" << client->objectName() << "subscribed to" << request.col << request.doc;
+
+    return acknowledge(message);
+}
+
+QByteArray WebSocket::handleUnsubscribe(QWebSocket *client, const MessageRequest &message)
+{
+    bool ok;
+    SubscriptionRequest request = parseRequest<SubscriptionRequest>(message, &ok);
+    if (!ok)
+    {
+        qWarning() << "Invalid unsubscribe message format from" << client->peerAddress().toString();
+        client->close();
+        return "";
     }
 
-    obj["connections"] = connectionsArray;
-    QJsonDocument doc(obj);
-    return doc.toJson(QJsonDocument::Compact);
+    const int removed = m_subscriptions.unsubscribe(client, request.sub);
+
+    ResponseWriter writer(message.binary);
+    startResponse(writer, message);
+    writer.key("removed");
+    writer.integer(removed);
+    writer.endMap();
+    return writer.take();
 }
 
-QString WebSocket::handleManageApiKey(QWebSocket *client, const MessageRequest &message)
+QByteArray WebSocket::handleManageApiKey(QWebSocket *client, const MessageRequest &message)
 {
+    ResponseWriter writer(message.binary);
+    startResponse(writer, message);
+
     auto clientKeyIt = m_clientKeys.find(client->objectName());
     if (clientKeyIt == m_clientKeys.end() || clientKeyIt->second != m_masterKey)
     {
-        QJsonObject response;
-        response["id"] = message.id;
-        response["error"] = "only the master key may manage API keys";
-        QJsonDocument responseDoc(response);
-        return responseDoc.toJson(QJsonDocument::Compact);
+        writer.key("error");
+        writer.string("only the master key may manage API keys");
+        writer.endMap();
+        return writer.take();
     }
 
-    QJsonParseError error;
-    QJsonDocument doc = QJsonDocument::fromJson(message.data.toUtf8(), &error);
-    if (error.error != QJsonParseError::NoError || !doc.isObject())
+    // rare enough that both encodings go through a document
+    bool parsed = false;
+    QJsonObject payload;
+    if (message.binary)
+    {
+        QCborParserError error;
+        const QCborValue value = QCborValue::fromCbor(message.payload, &error);
+        parsed = error.error == QCborError::NoError && value.isMap();
+        payload = value.toMap().toJsonObject();
+    }
+    else
+    {
+        QJsonParseError error;
+        QJsonDocument doc = QJsonDocument::fromJson(message.data.toUtf8(), &error);
+        parsed = error.error == QJsonParseError::NoError && doc.isObject();
+        payload = doc.object();
+    }
+    if (!parsed)
     {
         qWarning() << "Invalid manage api key message format from" << client->peerAddress().toString();
         rejectClient(client, QStringLiteral("Invalid manage api key message"));
         return "";
     }
 
-    QJsonObject payload = doc.object();
     QString action = payload.value("action").toString().trimmed().toLower();
 
-    QJsonObject response;
-    response["id"] = message.id;
-
     if (action == "add")
     {
         const QString key = payload.value("key").toString();
@@ -884,19 +2314,23 @@ QString WebSocket::handleManageApiKey(QWebSocket *client, const MessageRequest &
         ApiKeyScope scopeValue;
         if (!parseScope(scopeString, &scopeValue))
         {
-            response["error"] = "invalid scope";
+            writer.key("error");
+            writer.string("invalid scope");
         }
         else
         {
             QString errorMessage;
             if (registerApiKey(key, scopeValue, true, &errorMessage))
             {
-                response["status"] = "ok";
-                response["scope"] = scopeToString(scopeValue);
+                writer.key("status");
+                writer.string("ok");
+                writer.key("scope");
+                writer.string(scopeToString(scopeValue));
             }
             else
             {
-                response["error"] = errorMessage;
+                writer.key("error");
+                writer.string(errorMessage);
             }
         }
     }
@@ -906,20 +2340,23 @@ QString WebSocket::handleManageApiKey(QWebSocket *client, const MessageRequest &
         QString errorMessage;
         if (removeApiKey(key, &errorMessage))
         {
-            response["status"] = "ok";
+            writer.key("status");
+            writer.string("ok");
         }
         else
         {
-            response["error"] = errorMessage;
+            writer.key("error");
+            writer.string(errorMessage);
         }
     }
     else
     {
-        response["error"] = "unknown action";
+        writer.key("error");
+        writer.string("unknown action");
     }
 
-    QJsonDocument responseDoc(response);
-    return responseDoc.toJson(QJsonDocument::Compact);
+    writer.endMap();
+    return writer.take();
 }
 
 bool WebSocket::hasPermission(ApiKeyScope scope, RequiredPermission required) const
@@ -951,7 +2388,9 @@ WebSocket::RequiredPermission WebSocket::permissionForType(const QString &type)
     if (type == MessageType::QuerySessions || type == MessageType::QueryCollections ||
         type == MessageType::QueryDocument || type == MessageType::GetValue ||
         type == MessageType::GetValues || type == MessageType::Connections ||
-        type == MessageType::GetAllValues || type == MessageType::GetAllKeys)
+        type == MessageType::GetAllValues || type == MessageType::GetAllKeys ||
+        type == MessageType::Subscribe || type == MessageType::Unsubscribe ||
+        type == MessageType::Aggregate || type == MessageType::QueryDocumentNames)
     {
         return RequiredPermission::Read;
     }
@@ -1247,6 +2686,8 @@ void WebSocket::rejectClient(QWebSocket *socket, const QString &reason)
     m_clientKeys.erase(socket->objectName());
     m_clientNames.erase(socket->objectName());
     m_connectionTimes.erase(socket->objectName());
+    m_subscriptions.removeClient(socket);
+    m_clientWrites.erase(socket);
     m_clients.removeAll(socket);
     socket->close(QWebSocketProtocol::CloseCodePolicyViolated, reason.left(120));
     socket->deleteLater();
@@ -1263,6 +2704,12 @@ void WebSocket::socketDisconnected()
         m_clientKeys.erase(client->objectName());
         m_clientNames.erase(client->objectName());
         m_connectionTimes.erase(client->objectName());
+        m_subscriptions.removeClient(client);
+        m_incoming.erase(client);
+        m_clientWrites.erase(client);
+        m_documentStreams.erase(std::remove_if(m_documentStreams.begin(), m_documentStreams.end(),
+                                               [client](const DocumentStream &stream) { return stream.client == client; }),
+                                m_documentStreams.end());
         m_clients.removeAll(client);
         client->deleteLater();
     }
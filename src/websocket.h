@@ -7,13 +7,27 @@
 #include <QWebSocketServer>
 #include <QWebSocket>
 #include <QTimer>
+#include <QPointer>
 #include <QStringList>
+#include <QThreadPool>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <memory>
 #include <QDateTime>
 
 #include "messagerequest.h"
 #include "collection.h"
+#include "writeaheadlog.h"
+#include "persistencewriter.h"
+#include "subscriptions.h"
+#include "querydocument.h"
+#include "payloadfilter.h"
+#include "keypattern.h"
+#include "shard.h"
 
 namespace MessageType {
     inline const QString Auth = QStringLiteral("auth");
@@ -34,8 +48,37 @@ namespace MessageType {
     inline const QString GetAllKeys = QStringLiteral("gkeys");
     inline const QString ManageApiKey = QStringLiteral("keys");
     inline const QString Connections = QStringLiteral("conn");
+    inline const QString Subscribe = QStringLiteral("sub");
+    inline const QString Unsubscribe = QStringLiteral("unsub");
+    inline const QString Aggregate = QStringLiteral("agg");
+    inline const QString QueryDocumentNames = QStringLiteral("docs");
 }
 
+// Numeric message types of the binary (CBOR) protocol, one per MessageType.
+enum class Opcode : quint8 {
+    Insert = 1,
+    QuerySessions = 2,
+    QueryCollections = 3,
+    QueryDocument = 4,
+    DeleteDocument = 5,
+    DeleteCollection = 6,
+    DeleteRecord = 7,
+    DeleteMultipleRecords = 8,
+    DeleteRecordsRange = 9,
+    SetValue = 10,
+    GetValue = 11,
+    GetValues = 12,
+    RemoveValue = 13,
+    GetAllValues = 14,
+    GetAllKeys = 15,
+    ManageApiKey = 16,
+    Connections = 17,
+    Subscribe = 18,
+    Unsubscribe = 19,
+    Aggregate = 20,
+    QueryDocumentNames = 21
+};
+
 // comment
 class WebSocket : public QObject
 {
@@ -55,39 +98,105 @@ public:
         ManageKeys
     };
 
-    explicit WebSocket(const QString& masterKey, const QString& dataFolder, int flushIntervalSeconds = 15, QObject *parent = nullptr);
+    explicit WebSocket(const QString& masterKey, const QString& dataFolder, int flushIntervalSeconds = 15,
+                       WriteAheadLog::SyncPolicy walSyncPolicy = WriteAheadLog::SyncPolicy::Batch, int walSyncIntervalMs = 100,
+                       bool lazyLoad = false, int shards = 0, QObject *parent = nullptr);
     ~WebSocket();
 
     void start(quint16 port = 8080);
+    // the port listened on; start(0) picks a free one
+    quint16 serverPort() const;
 
 private slots:
     void onNewConnection();
     void processMessage(const QString &message);
+    void processBinaryMessage(const QByteArray &message);
     void socketDisconnected();
     void flushToDisk();
+    void commitWriteAheadLog();
+    void pushSubscriptions();
+    void pumpDocumentStreams();
 
 private:
+    struct IncomingFrame;
+    void receiveFrame(QWebSocket* client, const QString& text, const QByteArray& frame, bool binary);
+    void frameParsed(QWebSocket* client, quint64 serial, bool ok, const MessageRequest& message, const QString& invalidText);
+    void handleFrame(QWebSocket* client, const IncomingFrame& frame);
+    void processRequest(QWebSocket* client, const MessageRequest& message);
     void handleMessage(QWebSocket* client, const MessageRequest& message);
+    void sendResponse(QWebSocket* client, const QByteArray& response, bool binary);
+    // Sends a response, or holds it for the group commit while the write-ahead log has pending entries.
+    // The acknowledgement of a write passes the request id and becomes an error if that commit fails.
+    void respond(QWebSocket* client, const QByteArray& response, bool binary, const QString& writeId = QString());
+    void scheduleCommit();
+    void flushFinished(bool flushed, quint64 walGeneration);
+    void applyLogEntry(const WriteAheadLog::Entry& entry);
+    void schedulePush();
+    void scheduleDocumentStreams();
+
+    // sharding: collection data is only touched by jobs on the owning shard
+    Shard* shardFor(const QString& collection) const;
+    // Runs job on the shard owning collection and answers the client with
+    // the response it returns.
+    void answerFromShard(QWebSocket* client, const MessageRequest& message, const QString& collection,
+                         std::function<QByteArray(Shard&)> job);
+    // Same for a write, noting it for the client's later reads.
+    void answerWrite(QWebSocket* client, const MessageRequest& message, const QString& collection,
+                     std::function<QByteArray(Shard&)> job);
+    // Same for a read: read(shard, database) runs on the reader pool against
+    // the collection's last published view, which may trail the writes of
+    // other clients by a few ms, unless it misses a write of this client;
+    // then it runs as a job. database is a const CollectionView* or a const
+    // Collection*, null when the collection does not exist.
+    template <typename Read>
+    void answerRead(QWebSocket* client, const MessageRequest& message, const QString& collection, Read read);
+    // Answers a read through the shard's response cache: a cached response
+    // is sent as is, otherwise compute() builds it, without an id. While an
+    // identical read is computing it this one waits instead, answered from
+    // that read's result, and an empty response is returned. Safe to call
+    // from the reader threads.
+    QByteArray cachedRead(Shard& shard, QPointer<QWebSocket> target, const MessageRequest& message, const QByteArray& cacheKey,
+                          quint64 version, const std::function<QByteArray()>& compute);
+    // A write of the client was queued on the shard; its reads now wait for
+    // views holding it, so a client always reads its own writes.
+    void noteWrite(QWebSocket* client, Shard* shard);
+    quint64 lastWrite(QWebSocket* client, const Shard* shard) const;
+
+    // lazy loading: collections load in the background while requests for
+    // the ones not loaded yet are parked
+    void startLazyLoad(const QStringList& collections);
+    void loadQueuedCollections();
+    void prioritizeLoad(const QString& collection);
+    void collectionLoaded(const QString& collection, qsizetype records);
+    bool waitsForLoading(const MessageRequest& message);
     
-    QString handleQueryDocument(QWebSocket* client, const MessageRequest& message);
-    QString handleQuerySessions(QWebSocket* client, const MessageRequest& message);
-    QString handleQueryCollections(QWebSocket* client, const MessageRequest& message);
-    QString handleDeleteDocument(QWebSocket* client, const MessageRequest& message);
-    QString handleDeleteCollection(QWebSocket* client, const MessageRequest& message);
-    QString handleDeleteRecord(QWebSocket* client, const MessageRequest& message);
-    QString handleDeleteMultipleRecords(QWebSocket* client, const MessageRequest& message);
-    QString handleDeleteRecordsRange(QWebSocket* client, const MessageRequest& message);
-    QString handleInsert(QWebSocket* client, const MessageRequest& message);
-    QString handleConnections(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleQueryDocument(QWebSocket* client, const MessageRequest& message);
+    struct DocumentScan;
+    template <typename Database>
+    static QByteArray nextDocumentPage(const Database* database, DocumentScan& scan, qint64 maxRecords, qint64 maxBytes, bool* finished);
+    void documentFrameReady(quint64 serial, const QByteArray& frame, const DocumentScan& scan, bool finished);
+    QByteArray handleQuerySessions(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleQueryCollections(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleAggregate(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleQueryDocumentNames(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleDeleteDocument(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleDeleteCollection(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleDeleteRecord(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleDeleteMultipleRecords(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleDeleteRecordsRange(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleInsert(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleConnections(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleSubscribe(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleUnsubscribe(QWebSocket* client, const MessageRequest& message);
 
     // key value
-    QString handleSetValue(QWebSocket* client, const MessageRequest& message);
-    QString handleGetValue(QWebSocket* client, const MessageRequest& message);
-    QString handleGetValues(QWebSocket* client, const MessageRequest& message);
-    QString handleRemoveValue(QWebSocket* client, const MessageRequest& message);
-    QString handleGetAllValues(QWebSocket* client, const MessageRequest& message);
-    QString handleGetAllKeys(QWebSocket* client, const MessageRequest& message);
-    QString handleManageApiKey(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleSetValue(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleGetValue(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleGetValues(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleRemoveValue(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleGetAllValues(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleGetAllKeys(QWebSocket* client, const MessageRequest& message);
+    QByteArray handleManageApiKey(QWebSocket* client, const MessageRequest& message);
 
     bool hasPermission(ApiKeyScope scope, RequiredPermission required) const;
     RequiredPermission permissionForType(const QString& type) const;
@@ -114,16 +223,100 @@ private:
     QString m_masterKey;
     QString m_dataFolder;
 
-    // In-memory databases
-    std::unordered_map<QString, std::unique_ptr<Collection>> m_databases;
+    // persistence thread; declared before the shards so it outlives their collections
+    std::unique_ptr<PersistenceWriter> m_writer;
+
+    // In-memory databases, hash-partitioned by collection name
+    std::vector<std::unique_ptr<Shard>> m_shards;
     std::unordered_map<QString, ApiKeyScope> m_clientScopes;
     std::unordered_map<QString, ApiKeyEntry> m_apiKeys;
     std::unordered_map<QString, QString> m_clientKeys;
     std::unordered_map<QString, QString> m_clientNames;
     std::unordered_map<QString, qint64> m_connectionTimes;
+    // compiled /pattern/ doc selectors of subscriptions; the shards cache their own
+    KeyPatternCache m_keyPatterns;
+
+    // frames of each client in arrival order; large ones are decoded on the
+    // parser pool and wait here until the frames before them are handled
+    struct IncomingFrame {
+        quint64 serial;
+        bool parsed;
+        bool ok;
+        bool binary;
+        qsizetype size;
+        MessageRequest message;
+        // logged when a text frame is not a valid request
+        QString invalidText;
+    };
+    std::unordered_map<QWebSocket*, std::deque<IncomingFrame>> m_incoming;
+    quint64 m_lastFrameSerial;
+    QThreadPool m_parsers;
+    // reads against the published collection views, see answerRead()
+    QThreadPool m_readers;
+    // Shard::jobsQueued() after each client's last write, by shard index
+    std::unordered_map<QWebSocket*, std::vector<quint64>> m_clientWrites;
+
+    // startup loading; the queue is shared with the loader threads
+    struct PendingLoad {
+        QString name;
+        Collection* collection;
+    };
+    struct ParkedMessage {
+        QPointer<QWebSocket> client;
+        MessageRequest message;
+    };
+    QThreadPool m_loaders;
+    QMutex m_loadQueueMutex;
+    QList<PendingLoad> m_loadQueue;
+    std::unordered_set<QString> m_loadingCollections;
+    std::unordered_map<QString, std::vector<WriteAheadLog::Entry>> m_deferredLogEntries;
+    QList<ParkedMessage> m_parkedMessages;
+    QElapsedTimer m_loadTimer;
+    qsizetype m_loadedRecords;
 
     // flush timer
     QTimer m_flushTimer;
+    bool m_flushInProgress;
+
+    // write-ahead log; responses wait for the group commit of the current event loop turn
+    struct PendingResponse {
+        QPointer<QWebSocket> client;
+        QByteArray response;
+        bool binary;
+        // id of the write the response acknowledges, empty for other responses
+        QString writeId;
+    };
+    std::unique_ptr<WriteAheadLog> m_wal;
+    QList<PendingResponse> m_pendingResponses;
+    bool m_walCommitScheduled;
+    QTimer m_walSyncTimer;
+
+    // live subscriptions, pushed at the end of the event loop turn after the group commit
+    Subscriptions m_subscriptions;
+    bool m_pushScheduled;
+
+    // qdoc results sent as a series of bounded frames; the query's range is
+    // narrowed past each frame and the next one waits until the client has
+    // drained the previous ones
+    struct DocumentScan {
+        QString id;
+        bool binary;
+        QueryDocument query;
+        PayloadFilter filter;
+        PayloadProjection projection;
+        // records left to send when the query has a limit
+        qint64 remaining;
+    };
+    struct DocumentStream {
+        QPointer<QWebSocket> client;
+        quint64 serial;
+        // a frame is being written on the shard
+        bool pending;
+        DocumentScan scan;
+    };
+    std::vector<DocumentStream> m_documentStreams;
+    quint64 m_lastStreamSerial;
+    bool m_streamsScheduled;
 };
 
 #endif // WEBSOCKET_H 
@@ -0,0 +1,320 @@
+#include "writeaheadlog.h"
+#include <QDebug>
+#include <QDir>
+#include "binarycodec.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool syncFile(QFileDevice &file)
+{
+#ifdef __linux__
+    return ::fdatasync(file.handle()) == 0;
+#else
+    Q_UNUSED(file);
+    return true;
+#endif
+}
+
+bool decodeEntry(const char *data, qsizetype size, WriteAheadLog::Entry *entry)
+{
+    BinaryCodec::Reader reader(data, size);
+    quint8 op = 0;
+    std::string_view payload;
+    if (!reader.readByte(&op) || op < static_cast<quint8>(WriteAheadLog::Operation::Insert) ||
+        op > static_cast<quint8>(WriteAheadLog::Operation::RemoveValue))
+    {
+        return false;
+    }
+    if (!reader.readString(&entry->col) || !reader.readString(&entry->doc) ||
+        !reader.readSignedVarint(&entry->ts) || !reader.readSignedVarint(&entry->toTs) ||
+        !reader.readBytes(&payload))
+    {
+        return false;
+    }
+    entry->op = static_cast<WriteAheadLog::Operation>(op);
+    entry->data.assign(payload.data(), payload.size());
+    return reader.atEnd();
+}
+
+int replayFile(const QString &path, const std::function<void(const WriteAheadLog::Entry &)> &replay)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Failed to open write-ahead log" << path << ":" << file.errorString();
+        return 0;
+    }
+    const QByteArray bytes = file.readAll();
+    file.close();
+
+    int replayed = 0;
+    BinaryCodec::Reader reader(bytes.constData(), bytes.size());
+    while (!reader.atEnd())
+    {
+        quint32 size = 0;
+        quint32 crc = 0;
+        if (!reader.readFixed32(&size) || !reader.readFixed32(&crc) || size > reader.remaining())
+        {
+            break;
+        }
+        if (BinaryCodec::crc32(reader.position(), size) != crc)
+        {
+            break;
+        }
+        WriteAheadLog::Entry entry;
+        if (!decodeEntry(reader.position(), size, &entry))
+        {
+            break;
+        }
+        reader.skip(size);
+        replay(entry);
+        ++replayed;
+    }
+
+    if (!reader.atEnd())
+    {
+        qWarning() << "Discarding torn write-ahead log tail of" << path << ":" << reader.remaining() << "bytes";
+    }
+    return replayed;
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const QString &dataFolder, SyncPolicy policy)
+    : m_folder(dataFolder), m_generation(0), m_policy(policy), m_dirty(false)
+{
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    commit();
+    sync();
+    m_file.close();
+}
+
+QString WriteAheadLog::pathFor(quint64 generation) const
+{
+    return m_folder + "/" + QString("fluxiondb.%1.wal").arg(generation, 16, 10, QChar('0'));
+}
+
+std::vector<quint64> WriteAheadLog::generations() const
+{
+    std::vector<quint64> result;
+    for (const QString &name : QDir(m_folder).entryList(QStringList() << "fluxiondb.*.wal", QDir::Files, QDir::Name))
+    {
+        bool isNumber = false;
+        const quint64 generation = name.section('.', 1, 1).toULongLong(&isNumber);
+        if (isNumber)
+        {
+            result.push_back(generation);
+        }
+    }
+    return result;
+}
+
+bool WriteAheadLog::open(const std::function<void(const Entry &)> &replay)
+{
+    int replayed = 0;
+    for (const quint64 generation : generations())
+    {
+        replayed += replayFile(pathFor(generation), replay);
+        m_generation = generation;
+    }
+    if (replayed > 0)
+    {
+        qInfo() << "Replayed" << replayed << "write-ahead log entries";
+    }
+
+    // replayed generations stay on disk until the next checkpoint covers them
+    if (!openGeneration(m_generation + 1))
+    {
+        return false;
+    }
+    qInfo() << "Write-ahead log opened" << m_file.fileName() << "sync policy" << syncPolicyToString(m_policy);
+    return true;
+}
+
+bool WriteAheadLog::openGeneration(quint64 generation)
+{
+    m_file.close();
+    m_generation = generation;
+    m_file.setFileName(pathFor(generation));
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Unbuffered))
+    {
+        qWarning() << "Failed to open write-ahead log" << m_file.fileName() << ":" << m_file.errorString();
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
+
+void WriteAheadLog::appendInsert(const QString &col, const QString &doc, qint64 ts, const QString &data)
+{
+    const QByteArray payload = data.toUtf8();
+    append(Operation::Insert, col, doc, ts, 0, std::string_view(payload.constData(), payload.size()));
+}
+
+void WriteAheadLog::appendDeleteRecord(const QString &col, const QString &doc, qint64 ts)
+{
+    append(Operation::DeleteRecord, col, doc, ts, ts, std::string_view());
+}
+
+void WriteAheadLog::appendDeleteRange(const QString &col, const QString &doc, qint64 fromTs, qint64 toTs)
+{
+    append(Operation::DeleteRange, col, doc, fromTs, toTs, std::string_view());
+}
+
+void WriteAheadLog::appendClearDocument(const QString &col, const QString &doc)
+{
+    append(Operation::ClearDocument, col, doc, 0, 0, std::string_view());
+}
+
+void WriteAheadLog::appendDeleteCollection(const QString &col)
+{
+    append(Operation::DeleteCollection, col, QString(), 0, 0, std::string_view());
+}
+
+void WriteAheadLog::appendSetValue(const QString &col, const QString &key, const QString &value)
+{
+    const QByteArray payload = value.toUtf8();
+    append(Operation::SetValue, col, key, 0, 0, std::string_view(payload.constData(), payload.size()));
+}
+
+void WriteAheadLog::appendRemoveValue(const QString &col, const QString &key)
+{
+    append(Operation::RemoveValue, col, key, 0, 0, std::string_view());
+}
+
+void WriteAheadLog::append(Operation op, const QString &col, const QString &doc, qint64 ts, qint64 toTs, std::string_view data)
+{
+    QByteArray payload;
+    payload.append(static_cast<char>(op));
+    BinaryCodec::appendString(payload, col);
+    BinaryCodec::appendString(payload, doc);
+    BinaryCodec::appendSignedVarint(payload, ts);
+    BinaryCodec::appendSignedVarint(payload, toTs);
+    BinaryCodec::appendString(payload, data);
+
+    BinaryCodec::appendFixed32(m_pending, static_cast<quint32>(payload.size()));
+    BinaryCodec::appendFixed32(m_pending, BinaryCodec::crc32(payload.constData(), payload.size()));
+    m_pending.append(payload);
+}
+
+bool WriteAheadLog::commit()
+{
+    if (m_pending.isEmpty())
+    {
+        return true;
+    }
+    // a generation that failed to open is retried, nothing was written to it
+    if (!m_file.isOpen() && !openGeneration(m_generation))
+    {
+        return false;
+    }
+
+    const qint64 start = m_file.pos();
+    const qint64 written = m_file.write(m_pending);
+    if (written != m_pending.size())
+    {
+        qWarning() << "Failed to append to write-ahead log:" << m_file.errorString();
+        rollBack(start);
+        return false;
+    }
+    m_dirty = true;
+    if (m_policy == SyncPolicy::Batch && !sync())
+    {
+        // the kernel may have dropped the pages it failed to write, so the
+        // group is written again rather than trusting a later fdatasync
+        rollBack(start);
+        return false;
+    }
+    m_pending.clear();
+    return true;
+}
+
+void WriteAheadLog::rollBack(qint64 size)
+{
+    // a torn group would hide every group appended after it from replay; if
+    // it cannot be cut off, later groups go to the next generation instead
+    if (!m_file.resize(size) || !m_file.seek(size))
+    {
+        qWarning() << "Failed to truncate write-ahead log" << m_file.fileName() << ":" << m_file.errorString();
+        openGeneration(m_generation + 1);
+    }
+}
+
+bool WriteAheadLog::sync()
+{
+    if (!m_dirty || !m_file.isOpen())
+    {
+        return true;
+    }
+    if (!syncFile(m_file))
+    {
+        qWarning() << "Failed to sync write-ahead log" << m_file.fileName();
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
+
+quint64 WriteAheadLog::rotate()
+{
+    commit();
+    sync();
+    openGeneration(m_generation + 1);
+    return m_generation;
+}
+
+bool WriteAheadLog::checkpoint(quint64 generation)
+{
+    bool ok = true;
+    for (const quint64 older : generations())
+    {
+        if (older < generation && !QFile::remove(pathFor(older)))
+        {
+            qWarning() << "Failed to remove write-ahead log" << pathFor(older);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool WriteAheadLog::parseSyncPolicy(const QString &value, SyncPolicy *policyOut)
+{
+    const QString normalized = value.trimmed().toLower();
+    if (normalized == "batch")
+    {
+        *policyOut = SyncPolicy::Batch;
+        return true;
+    }
+    if (normalized == "interval")
+    {
+        *policyOut = SyncPolicy::Interval;
+        return true;
+    }
+    if (normalized == "os")
+    {
+        *policyOut = SyncPolicy::Os;
+        return true;
+    }
+    return false;
+}
+
+QString WriteAheadLog::syncPolicyToString(SyncPolicy policy)
+{
+    switch (policy)
+    {
+    case SyncPolicy::Batch:
+        return QStringLiteral("batch");
+    case SyncPolicy::Interval:
+        return QStringLiteral("interval");
+    case SyncPolicy::Os:
+        return QStringLiteral("os");
+    }
+    return QStringLiteral("unknown");
+}
@@ -0,0 +1,91 @@
+#ifndef WRITEAHEADLOG_H
+#define WRITEAHEADLOG_H
+
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Append-only binary journal of every mutation applied since the last flush.
+// Mutations are buffered and written as one group by commit(), which also
+// fsyncs when the sync policy is Batch. The log is split into generations,
+// <data>/fluxiondb.<generation>.wal, so a flush running in the background can
+// retire exactly the generations it covers.
+class WriteAheadLog {
+public:
+    enum class SyncPolicy {
+        Batch,     // fsync every committed group before acknowledging it
+        Interval,  // fsync from a timer, acknowledge after write()
+        Os         // leave syncing to the OS page cache
+    };
+
+    enum class Operation : quint8 {
+        Insert = 1,
+        DeleteRecord = 2,
+        DeleteRange = 3,
+        ClearDocument = 4,
+        DeleteCollection = 5,
+        SetValue = 6,
+        RemoveValue = 7
+    };
+
+    struct Entry {
+        Operation op;
+        QString col;
+        // document name, or the key for key-value operations
+        QString doc;
+        qint64 ts = 0;
+        qint64 toTs = 0;
+        // record payload, or the value for key-value operations
+        std::string data;
+    };
+
+    explicit WriteAheadLog(const QString& dataFolder, SyncPolicy policy);
+    ~WriteAheadLog();
+
+    // Replays every intact entry of every generation in order and starts a new generation.
+    bool open(const std::function<void(const Entry&)>& replay);
+
+    void appendInsert(const QString& col, const QString& doc, qint64 ts, const QString& data);
+    void appendDeleteRecord(const QString& col, const QString& doc, qint64 ts);
+    void appendDeleteRange(const QString& col, const QString& doc, qint64 fromTs, qint64 toTs);
+    void appendClearDocument(const QString& col, const QString& doc);
+    void appendDeleteCollection(const QString& col);
+    void appendSetValue(const QString& col, const QString& key, const QString& value);
+    void appendRemoveValue(const QString& col, const QString& key);
+
+    bool hasPending() const { return !m_pending.isEmpty(); }
+    SyncPolicy policy() const { return m_policy; }
+
+    // Writes the buffered entries as one group, synced under the Batch policy.
+    // A group that fails is truncated away and kept buffered for the next commit.
+    bool commit();
+    bool sync();
+    // Starts a new generation and returns it; everything logged before is in
+    // older generations. Called when a flush takes its snapshot.
+    quint64 rotate();
+    // Called once that flush is on disk: removes the generations older than the given one.
+    bool checkpoint(quint64 generation);
+
+    static bool parseSyncPolicy(const QString& value, SyncPolicy* policyOut);
+    static QString syncPolicyToString(SyncPolicy policy);
+
+private:
+    void append(Operation op, const QString& col, const QString& doc, qint64 ts, qint64 toTs, std::string_view data);
+    QString pathFor(quint64 generation) const;
+    std::vector<quint64> generations() const;
+    bool openGeneration(quint64 generation);
+    void rollBack(qint64 size);
+
+    QString m_folder;
+    quint64 m_generation;
+    SyncPolicy m_policy;
+    QFile m_file;
+    QByteArray m_pending;
+    bool m_dirty;
+};
+
+#endif // WRITEAHEADLOG_H
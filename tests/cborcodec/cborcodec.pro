@@ -0,0 +1,19 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_cborcodec
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_cborcodec.cpp \
+    ../../src/cborcodec.cpp \
+    ../../src/insertrequest.cpp \
+    ../../src/messagerequest.cpp
+
+HEADERS += \
+    ../../src/cborcodec.h \
+    ../../src/insertrequest.h \
+    ../../src/messagerequest.h
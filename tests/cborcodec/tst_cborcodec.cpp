@@ -0,0 +1,159 @@
+#include <QtTest>
+#include <QCborStreamReader>
+#include <QCborStreamWriter>
+#include "cborcodec.h"
+#include "insertrequest.h"
+#include "messagerequest.h"
+
+// Decoding of binary protocol frames and fields, well-formed or not. Frames
+// are given as hex so malformed ones can be spelled out byte by byte.
+class TestCborCodec : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void readsIntegers_data();
+    void readsIntegers();
+    void decodesRequestFrames();
+    void rejectsMalformedFrames_data();
+    void rejectsMalformedFrames();
+    void rejectsMalformedInserts_data();
+    void rejectsMalformedInserts();
+};
+
+void TestCborCodec::readsIntegers_data()
+{
+    QTest::addColumn<QByteArray>("cbor");
+    QTest::addColumn<bool>("accepted");
+    QTest::addColumn<qint64>("value");
+
+    QTest::newRow("small") << QByteArray("17") << true << qint64(23);
+    QTest::newRow("timestamp") << QByteArray("1b0000018bcfe56800") << true << qint64(1700000000000);
+    QTest::newRow("max") << QByteArray("1b7fffffffffffffff") << true << std::numeric_limits<qint64>::max();
+    QTest::newRow("past max") << QByteArray("1b8000000000000000") << false << qint64(0);
+    QTest::newRow("minus one") << QByteArray("20") << true << qint64(-1);
+    QTest::newRow("min") << QByteArray("3b7fffffffffffffff") << true << std::numeric_limits<qint64>::min();
+    QTest::newRow("past min") << QByteArray("3b8000000000000000") << false << qint64(0);
+    QTest::newRow("minus 2^64") << QByteArray("3bffffffffffffffff") << false << qint64(0);
+    QTest::newRow("whole double") << QByteArray("fb4278bcfe56800000") << true << qint64(1700000000000);
+    QTest::newRow("whole float") << QByteArray("fa40400000") << true << qint64(3);
+    QTest::newRow("negative double") << QByteArray("fbc000000000000000") << true << qint64(-2);
+    QTest::newRow("double min") << QByteArray("fbc3e0000000000000") << true << std::numeric_limits<qint64>::min();
+    QTest::newRow("double 2^63") << QByteArray("fb43e0000000000000") << false << qint64(0);
+    QTest::newRow("fraction") << QByteArray("fb3ff8000000000000") << false << qint64(0);
+    QTest::newRow("nan") << QByteArray("fb7ff8000000000000") << false << qint64(0);
+    QTest::newRow("infinity") << QByteArray("fb7ff0000000000000") << false << qint64(0);
+    QTest::newRow("minus infinity") << QByteArray("fbfff0000000000000") << false << qint64(0);
+    QTest::newRow("string") << QByteArray("6131") << false << qint64(0);
+    QTest::newRow("bool") << QByteArray("f5") << false << qint64(0);
+}
+
+void TestCborCodec::readsIntegers()
+{
+    QFETCH(QByteArray, cbor);
+    QFETCH(bool, accepted);
+    QFETCH(qint64, value);
+
+    QCborStreamReader reader(QByteArray::fromHex(cbor));
+    qint64 decoded = 0;
+    QCOMPARE(CborCodec::readInteger(reader, &decoded), accepted);
+    if (accepted)
+    {
+        QCOMPARE(decoded, value);
+    }
+}
+
+void TestCborCodec::decodesRequestFrames()
+{
+    QByteArray frame;
+    QCborStreamWriter writer(&frame);
+    writer.startArray(3);
+    writer.append(quint64(1));
+    writer.append(QString("req-1"));
+    writer.startArray(1);
+    writer.startMap(4);
+    writer.append(QString("col"));
+    writer.append(QString("metrics"));
+    writer.append(QString("doc"));
+    writer.append(QString("cpu"));
+    writer.append(QString("ts"));
+    writer.append(qint64(1700000000000));
+    writer.append(QString("data"));
+    writer.append(QString("{\"v\":1}"));
+    writer.endMap();
+    writer.endArray();
+    writer.endArray();
+
+    bool ok = false;
+    const MessageRequest message = MessageRequest::fromCbor(frame, &ok);
+    QVERIFY(ok);
+    QVERIFY(message.binary);
+    QCOMPARE(message.opcode, quint64(1));
+    QCOMPARE(message.id, QString("req-1"));
+
+    const QList<InsertRequest> inserts = InsertRequest::fromCbor(message.payload, &ok);
+    QVERIFY(ok);
+    QCOMPARE(inserts.size(), 1);
+    QCOMPARE(inserts.first().col, QString("metrics"));
+    QCOMPARE(inserts.first().doc, QString("cpu"));
+    QCOMPARE(inserts.first().ts, qint64(1700000000000));
+    QCOMPARE(inserts.first().data, QString("{\"v\":1}"));
+}
+
+void TestCborCodec::rejectsMalformedFrames_data()
+{
+    QTest::addColumn<QByteArray>("frame");
+
+    // [1, "a", {}] is 83 01 6161 a0
+    QTest::newRow("empty") << QByteArray("");
+    QTest::newRow("map") << QByteArray("a1616101");
+    QTest::newRow("empty array") << QByteArray("80");
+    QTest::newRow("text opcode") << QByteArray("83616161 61a0");
+    QTest::newRow("negative opcode") << QByteArray("83 20 6161 a0");
+    QTest::newRow("no id") << QByteArray("81 01");
+    QTest::newRow("integer id") << QByteArray("83 01 02 a0");
+    QTest::newRow("empty id") << QByteArray("83 01 60 a0");
+    QTest::newRow("no payload") << QByteArray("82 01 6161");
+    QTest::newRow("trailing item") << QByteArray("84 01 6161 a0 00");
+    QTest::newRow("truncated payload") << QByteArray("83 01 6161 a2 6161");
+    QTest::newRow("truncated string") << QByteArray("83 01 6561 a0");
+    QTest::newRow("unterminated array") << QByteArray("9f 01 6161 a0");
+}
+
+void TestCborCodec::rejectsMalformedFrames()
+{
+    QFETCH(QByteArray, frame);
+
+    bool ok = true;
+    MessageRequest::fromCbor(QByteArray::fromHex(frame), &ok);
+    QVERIFY(!ok);
+}
+
+void TestCborCodec::rejectsMalformedInserts_data()
+{
+    QTest::addColumn<QByteArray>("payload");
+
+    QTest::newRow("map") << QByteArray("a0");
+    QTest::newRow("element not a map") << QByteArray("81 01");
+    // [{"ts": 1.5}]
+    QTest::newRow("fractional ts") << QByteArray("81 a1 627473 fb3ff8000000000000");
+    // [{"ts": NaN}]
+    QTest::newRow("nan ts") << QByteArray("81 a1 627473 fb7ff8000000000000");
+    // [{"doc": 1}]
+    QTest::newRow("integer doc") << QByteArray("81 a1 63646f63 01");
+    // [{1: "a"}]
+    QTest::newRow("integer key") << QByteArray("81 a1 01 6161");
+    QTest::newRow("truncated map") << QByteArray("81 a2 627473 01");
+}
+
+void TestCborCodec::rejectsMalformedInserts()
+{
+    QFETCH(QByteArray, payload);
+
+    bool ok = true;
+    InsertRequest::fromCbor(QByteArray::fromHex(payload), &ok);
+    QVERIFY(!ok);
+}
+
+QTEST_GUILESS_MAIN(TestCborCodec)
+#include "tst_cborcodec.moc"
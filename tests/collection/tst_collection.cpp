@@ -0,0 +1,615 @@
+#include <QtTest>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include "collection.h"
+#include "collectionview.h"
+#include "keypattern.h"
+#include "parallelscan.h"
+#include "payloadfilter.h"
+
+// A collection's records and key-values across flushes and reloads.
+class TestCollection : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void reloadsFlushedCollection();
+    void backfillFlushesOnlyTheChangedRange();
+    void failedFlushIsWrittenByTheNext();
+    void pagesDocumentNamesInOrder();
+    void listsDocumentNamesUnderAPrefix_data();
+    void listsDocumentNamesUnderAPrefix();
+    void readsOnlyDocumentsActiveSince_data();
+    void readsOnlyDocumentsActiveSince();
+    void viewsKeepTheActivityTheyWerePublishedWith();
+    void readsTheLatestRecordsAtTheHighWaterMark();
+    void viewsKeepTheLatestRecordsTheyWerePublishedWith();
+    void viewsKeepWhatTheyWerePublishedWith();
+    void viewsCanBeReadWhileTheCollectionChanges();
+    void scansLargeCollectionsInParallel();
+
+private:
+    // Runs the collection's flush job and settles it with the given outcome.
+    static void flush(Collection& collection, bool succeeds = true);
+    static QList<qint64> timestamps(const Collection& collection, const QString& doc);
+    // total size of the collection's segment files
+    static qint64 segmentBytes(const QString& folder);
+    // all pages of names under the prefix, limit names at a time
+    static QStringList allDocumentNames(const Collection& collection, const QString& prefix, qint64 limit);
+    template <typename Value>
+    static QStringList sortedKeys(const QHash<QString, Value>& documents);
+    // "doc@ts:payload" for each record, sorted
+    static QStringList describe(const QHash<QString, DataRecord>& records);
+    // timestamp of each record, by document
+    static QHash<QString, qint64> timestamps(const QHash<QString, DataRecord>& records);
+};
+
+void TestCollection::flush(Collection &collection, bool succeeds)
+{
+    const std::function<bool()> job = collection.takeFlushJob();
+    QVERIFY(job != nullptr);
+    if (succeeds)
+    {
+        QVERIFY(job());
+    }
+    collection.finishFlush(succeeds);
+}
+
+QList<qint64> TestCollection::timestamps(const Collection &collection, const QString &doc)
+{
+    QList<qint64> result;
+    for (const DataRecord &record :
+         collection.getAllRecordsForDocument(doc, std::numeric_limits<qint64>::min(), std::numeric_limits<qint64>::max()))
+    {
+        result.append(record.timestamp);
+    }
+    return result;
+}
+
+qint64 TestCollection::segmentBytes(const QString &folder)
+{
+    qint64 bytes = 0;
+    for (const QFileInfo &info : QDir(folder).entryInfoList(QStringList() << "*.seg", QDir::Files))
+    {
+        bytes += info.size();
+    }
+    return bytes;
+}
+
+QStringList TestCollection::allDocumentNames(const Collection &collection, const QString &prefix, qint64 limit)
+{
+    QStringList names;
+    for (;;)
+    {
+        bool more = false;
+        const QStringList page = collection.getDocumentNames(prefix, names.isEmpty() ? QString() : names.last(), limit, &more);
+        if ((limit > 0 && page.size() > limit) || (more && page.size() != limit))
+        {
+            return QStringList() << "unexpected page size";
+        }
+        names += page;
+        if (!more)
+        {
+            return names;
+        }
+    }
+}
+
+template <typename Value>
+QStringList TestCollection::sortedKeys(const QHash<QString, Value> &documents)
+{
+    QStringList keys = documents.keys();
+    keys.sort();
+    return keys;
+}
+
+QStringList TestCollection::describe(const QHash<QString, DataRecord> &records)
+{
+    QStringList result;
+    for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+    {
+        const QString payload = QString::fromUtf8(it.value().data.data(), static_cast<qsizetype>(it.value().data.size()));
+        result.append(QString("%1@%2:%3").arg(it.key()).arg(it.value().timestamp).arg(payload));
+    }
+    result.sort();
+    return result;
+}
+
+QHash<QString, qint64> TestCollection::timestamps(const QHash<QString, DataRecord> &records)
+{
+    QHash<QString, qint64> result;
+    for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+    {
+        result.insert(it.key(), it.value().timestamp);
+    }
+    return result;
+}
+
+void TestCollection::reloadsFlushedCollection()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    Collection written("metrics", dir.path());
+    for (qint64 ts = 1; ts <= 100; ++ts)
+    {
+        written.insert(ts, "cpu", QString::number(ts));
+    }
+    written.insert(7, "memory", QString("7"));
+    written.deleteRecord("cpu", 50);
+    written.clearDocument("memory");
+    written.setValueForKey("unit", "percent");
+    flush(written);
+
+    Collection loaded("metrics", dir.path());
+    QCOMPARE(loaded.loadFromDisk(), qsizetype(99));
+    QCOMPARE(timestamps(loaded, "cpu"), timestamps(written, "cpu"));
+    QVERIFY(timestamps(loaded, "memory").isEmpty());
+    QCOMPARE(loaded.getValueForKey("unit"), QString("percent"));
+}
+
+void TestCollection::backfillFlushesOnlyTheChangedRange()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    Collection written("metrics", dir.path());
+    for (qint64 ts = 1000; ts < 11000; ++ts)
+    {
+        written.insert(ts, "cpu", QString::number(ts));
+    }
+    flush(written);
+    const qint64 before = segmentBytes(dir.path() + "/metrics");
+    QVERIFY(before > 0);
+
+    // one record far behind the newest and one past it: the flush writes
+    // those two, not the history between them
+    written.insert(5, "cpu", QString("late"));
+    written.insert(11000, "cpu", QString("next"));
+    flush(written);
+    const qint64 after = segmentBytes(dir.path() + "/metrics");
+    QVERIFY2(after - before < before / 100, qPrintable(QString("%1 -> %2 bytes").arg(before).arg(after)));
+
+    Collection loaded("metrics", dir.path());
+    QCOMPARE(loaded.loadFromDisk(), qsizetype(10002));
+    DataRecord earliest;
+    QVERIFY(loaded.getEarliestRecordForDocument("cpu", 0, &earliest));
+    QCOMPARE(earliest.timestamp, qint64(5));
+    QCOMPARE(timestamps(loaded, "cpu"), timestamps(written, "cpu"));
+}
+
+void TestCollection::failedFlushIsWrittenByTheNext()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    Collection written("metrics", dir.path());
+    for (qint64 ts = 1; ts <= 10; ++ts)
+    {
+        written.insert(ts, "cpu", QString::number(ts));
+    }
+    flush(written);
+
+    // the failed flush's record and deletion are written by the next one
+    written.insert(11, "cpu", QString("11"));
+    written.deleteRecord("cpu", 5);
+    flush(written, false);
+    written.insert(12, "cpu", QString("12"));
+    written.deleteRecord("cpu", 6);
+    flush(written);
+
+    Collection loaded("metrics", dir.path());
+    QCOMPARE(loaded.loadFromDisk(), qsizetype(10));
+    QCOMPARE(timestamps(loaded, "cpu"), QList<qint64>({1, 2, 3, 4, 7, 8, 9, 10, 11, 12}));
+}
+
+void TestCollection::pagesDocumentNamesInOrder()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    Collection written("metrics", dir.path());
+    const QStringList inserted = {"region-2/site-1/device-1", "region-1/site-2/device-1", "region-1/site-1/device-2",
+                                  "region-1/site-1/device-10", "region-1/site-1/device-1", "region-10/site-1/device-1"};
+    for (const QString &name : inserted)
+    {
+        written.insert(1, name, QString("{}"));
+    }
+    QStringList sorted = inserted;
+    std::sort(sorted.begin(), sorted.end());
+
+    QCOMPARE(allDocumentNames(written, QString(), 0), sorted);
+    for (const qint64 limit : {1, 2, 4, 6, 7})
+    {
+        QCOMPARE(allDocumentNames(written, QString(), limit), sorted);
+    }
+    // exactly filling the last page still tells there is no more
+    bool more = true;
+    QCOMPARE(written.getDocumentNames(QString(), sorted.at(3), 2, &more), sorted.mid(4));
+    QVERIFY(!more);
+
+    // cleared documents leave the index, written ones come back
+    written.clearDocument("region-1/site-1/device-2");
+    written.insert(2, "region-1/site-1/device-3", QString("{}"));
+    sorted.removeOne("region-1/site-1/device-2");
+    sorted.append("region-1/site-1/device-3");
+    std::sort(sorted.begin(), sorted.end());
+    QCOMPARE(allDocumentNames(written, QString(), 2), sorted);
+
+    flush(written);
+    Collection loaded("metrics", dir.path());
+    loaded.loadFromDisk();
+    QCOMPARE(allDocumentNames(loaded, QString(), 3), sorted);
+}
+
+void TestCollection::listsDocumentNamesUnderAPrefix_data()
+{
+    QTest::addColumn<QString>("prefix");
+    QTest::addColumn<QString>("after");
+    QTest::addColumn<QStringList>("expected");
+
+    QTest::newRow("region") << QString("region-1/") << QString()
+                            << QStringList({"region-1/site-1/device-1", "region-1/site-1/device-2", "region-1/site-2/device-1"});
+    QTest::newRow("site") << QString("region-1/site-1/") << QString()
+                          << QStringList({"region-1/site-1/device-1", "region-1/site-1/device-2"});
+    QTest::newRow("partial name") << QString("region-1") << QString()
+                                  << QStringList({"region-1/site-1/device-1", "region-1/site-1/device-2", "region-1/site-2/device-1",
+                                                  "region-10/site-1/device-1"});
+    QTest::newRow("after a name") << QString("region-1/") << QString("region-1/site-1/device-1")
+                                  << QStringList({"region-1/site-1/device-2", "region-1/site-2/device-1"});
+    QTest::newRow("after a missing name") << QString("region-1/") << QString("region-1/site-1/zzz")
+                                          << QStringList({"region-1/site-2/device-1"});
+    QTest::newRow("after before the prefix") << QString("region-1/site-2/") << QString("a")
+                                             << QStringList({"region-1/site-2/device-1"});
+    QTest::newRow("after past the prefix") << QString("region-1/") << QString("region-2") << QStringList();
+    QTest::newRow("no match") << QString("region-3/") << QString() << QStringList();
+}
+
+void TestCollection::listsDocumentNamesUnderAPrefix()
+{
+    QFETCH(QString, prefix);
+    QFETCH(QString, after);
+    QFETCH(QStringList, expected);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    Collection collection("metrics", dir.path());
+    for (const QString &name : {"region-2/site-1/device-1", "region-1/site-2/device-1", "region-1/site-1/device-2",
+                                "region-10/site-1/device-1", "region-1/site-1/device-1"})
+    {
+        collection.insert(1, name, QString("{}"));
+    }
+    bool more = true;
+    QCOMPARE(collection.getDocumentNames(prefix, after, 0, &more), expected);
+    QVERIFY(!more);
+}
+
+void TestCollection::readsOnlyDocumentsActiveSince_data()
+{
+    QTest::addColumn<qint64>("from");
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<QStringList>("latest");
+    QTest::addColumn<QStringList>("aggregated");
+
+    // "moved" had a record at 10000000 that was deleted again
+    QTest::newRow("everything") << qint64(0) << QString() << QStringList({"cpu-new", "mid", "moved", "new", "old"})
+                                << QStringList({"cpu-new", "mid", "moved", "new", "old"});
+    QTest::newRow("bucket start") << qint64(5000000) << QString() << QStringList({"cpu-new", "mid", "new"})
+                                  << QStringList({"cpu-new", "mid", "new"});
+    QTest::newRow("within a bucket") << qint64(5000001) << QString() << QStringList({"cpu-new", "new"})
+                                     << QStringList({"cpu-new", "new"});
+    QTest::newRow("pattern") << qint64(5000000) << QString("/new$/") << QStringList({"cpu-new", "new"})
+                             << QStringList({"cpu-new", "new"});
+    QTest::newRow("prefix") << qint64(5000000) << QString("/^cpu/") << QStringList({"cpu-new"}) << QStringList({"cpu-new"});
+    QTest::newRow("past everything") << qint64(20000000) << QString() << QStringList() << QStringList();
+}
+
+void TestCollection::readsOnlyDocumentsActiveSince()
+{
+    QFETCH(qint64, from);
+    QFETCH(QString, pattern);
+    QFETCH(QStringList, latest);
+    QFETCH(QStringList, aggregated);
+
+    Collection collection("metrics", QString());
+    collection.insert(1000, "old", QString("{\"v\":1}"));
+    collection.insert(5000000, "mid", QString("{\"v\":1}"));
+    collection.insert(1000, "new", QString("{\"v\":1}"));
+    collection.insert(10000000, "new", QString("{\"v\":1}"));
+    collection.insert(10000000, "cpu-new", QString("{\"v\":1}"));
+    collection.insert(2000, "moved", QString("{\"v\":1}"));
+    collection.insert(10000000, "moved", QString("{\"v\":1}"));
+    collection.deleteRecord("moved", 10000000);
+    const std::shared_ptr<const CollectionView> view = collection.publish();
+
+    const std::shared_ptr<const KeyPattern> keyPattern = pattern.isEmpty() ? nullptr : KeyPattern::parse(pattern);
+    const qint64 now = std::numeric_limits<qint64>::max();
+    // a timestamp before the newest record goes past the latest-record table
+    for (const qint64 timestamp : {now, qint64(15000000)})
+    {
+        QCOMPARE(sortedKeys(collection.getAllRecords(timestamp, QString(), from, keyPattern.get())), latest);
+        QCOMPARE(sortedKeys(view->getAllRecords(timestamp, QString(), from, keyPattern.get())), latest);
+    }
+    QCOMPARE(sortedKeys(collection.aggregate(QString(), keyPattern.get(), from, now, 0, PayloadPath("v"))), aggregated);
+    QCOMPARE(sortedKeys(view->aggregate(QString(), keyPattern.get(), from, now, 0, PayloadPath("v"))), aggregated);
+}
+
+void TestCollection::viewsKeepTheActivityTheyWerePublishedWith()
+{
+    Collection collection("metrics", QString());
+    collection.insert(1000, "a", QString("{\"v\":1}"));
+    collection.insert(1000, "b", QString("{\"v\":1}"));
+    collection.insert(9000000, "b", QString("{\"v\":1}"));
+    const std::shared_ptr<const CollectionView> before = collection.publish();
+
+    // moves both documents between buckets, and removes one
+    collection.insert(9000000, "a", QString("{\"v\":1}"));
+    collection.deleteRecord("b", 9000000);
+    collection.insert(1000, "c", QString("{\"v\":1}"));
+    collection.insert(9500000, "c", QString("{\"v\":1}"));
+    collection.clearDocument("c");
+    const std::shared_ptr<const CollectionView> after = collection.publish();
+
+    const qint64 now = std::numeric_limits<qint64>::max();
+    QCOMPARE(sortedKeys(before->getAllRecords(now, QString(), 5000000)), QStringList({"b"}));
+    QCOMPARE(sortedKeys(after->getAllRecords(now, QString(), 5000000)), QStringList({"a"}));
+    QCOMPARE(sortedKeys(after->getAllRecords(now, QString(), 500)), QStringList({"a", "b"}));
+    QCOMPARE(sortedKeys(collection.getAllRecords(now, QString(), 5000000)), QStringList({"a"}));
+}
+
+void TestCollection::readsTheLatestRecordsAtTheHighWaterMark()
+{
+    Collection collection("metrics", QString());
+    collection.insert(100, "cpu", QString("{\"v\":1}"));
+    collection.insert(300, "cpu", QString("{\"v\":3}"));
+    collection.insert(200, "memory", QString("{\"v\":2}"));
+    collection.insert(400, "disk", QString("{\"v\":4}"));
+    // backfilled, older than the latest record
+    collection.insert(50, "disk", QString("{\"v\":0}"));
+    QCOMPARE(collection.latestHighWater(), qint64(400));
+
+    PayloadFilter filter;
+    QString errorMessage;
+    QVERIFY(PayloadFilter::compile(QJsonObject{{"gt", QJsonArray{"v", 2}}}, &filter, &errorMessage));
+    const std::shared_ptr<const KeyPattern> pattern = KeyPattern::parse("/^(cpu|disk)$/");
+
+    const auto check = [&](const std::shared_ptr<const CollectionView> &view)
+    {
+        // at the mark and past it, from the table; before it, from the series
+        for (const qint64 timestamp : {collection.latestHighWater(), std::numeric_limits<qint64>::max(), collection.latestHighWater() - 1})
+        {
+            for (const qint64 from : {qint64(0), qint64(250)})
+            {
+                QCOMPARE(describe(view->getAllRecords(timestamp, QString(), from)),
+                         describe(collection.getAllRecords(timestamp, QString(), from)));
+                QCOMPARE(describe(view->getAllRecords(timestamp, QString(), from, pattern.get())),
+                         describe(collection.getAllRecords(timestamp, QString(), from, pattern.get())));
+                QCOMPARE(describe(view->getAllRecords(timestamp, QString(), from, nullptr, &filter)),
+                         describe(collection.getAllRecords(timestamp, QString(), from, nullptr, &filter)));
+                QCOMPARE(describe(view->getAllRecords(timestamp, "cpu", from)), describe(collection.getAllRecords(timestamp, "cpu", from)));
+            }
+        }
+    };
+
+    std::shared_ptr<const CollectionView> view = collection.publish();
+    QCOMPARE(view->latestHighWater(), qint64(400));
+    QCOMPARE(describe(view->getAllRecords(400, QString())), QStringList({"cpu@300:{\"v\":3}", "disk@400:{\"v\":4}", "memory@200:{\"v\":2}"}));
+    QCOMPARE(describe(view->getAllRecords(400, QString(), 250, nullptr, &filter)), QStringList({"cpu@300:{\"v\":3}", "disk@400:{\"v\":4}"}));
+    check(view);
+
+    // deleting the newest record lowers the mark
+    collection.deleteRecord("disk", 400);
+    view = collection.publish();
+    QCOMPARE(view->latestHighWater(), qint64(300));
+    QCOMPARE(describe(view->getAllRecords(300, QString())), QStringList({"cpu@300:{\"v\":3}", "disk@50:{\"v\":0}", "memory@200:{\"v\":2}"}));
+    check(view);
+
+    collection.insert(500, "memory", QString("{\"v\":5}"));
+    collection.clearDocument("cpu");
+    view = collection.publish();
+    QCOMPARE(describe(view->getAllRecords(500, QString())), QStringList({"disk@50:{\"v\":0}", "memory@500:{\"v\":5}"}));
+    check(view);
+}
+
+void TestCollection::viewsKeepTheLatestRecordsTheyWerePublishedWith()
+{
+    Collection collection("metrics", QString());
+    for (qint64 ts = 1; ts <= 3 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        collection.insert(ts, "cpu", QString("{\"v\":%1}").arg(ts));
+    }
+    const qint64 last = 3 * DocumentSeries::ChunkCapacity;
+    const std::shared_ptr<const CollectionView> before = collection.publish();
+
+    // rewrites the chunk the published latest record lies in, then drops it
+    collection.insert(last, "cpu", QString("{\"v\":\"replaced\"}"));
+    collection.deleteRecordsInRange("cpu", last - 10, last);
+    collection.insert(last + 1, "memory", QString("{}"));
+    const std::shared_ptr<const CollectionView> after = collection.publish();
+
+    const qint64 now = std::numeric_limits<qint64>::max();
+    QCOMPARE(describe(before->getAllRecords(now, QString())), QStringList({QString("cpu@%1:{\"v\":%1}").arg(last)}));
+    QCOMPARE(describe(after->getAllRecords(now, "cpu")), QStringList({QString("cpu@%1:{\"v\":%1}").arg(last - 11)}));
+}
+
+void TestCollection::viewsKeepWhatTheyWerePublishedWith()
+{
+    Collection collection("metrics", QString());
+    collection.insert(100, "cpu", QString("{\"v\":1}"));
+    collection.insert(200, "cpu", QString("{\"v\":2}"));
+    collection.insert(100, "disk", QString("{\"v\":3}"));
+    collection.setValueForKey("owner", "ops");
+    collection.setValueForKey("region", "eu");
+    const std::shared_ptr<const CollectionView> before = collection.publish();
+    const quint64 cpuVersion = collection.documentVersion("cpu");
+
+    // every kind of change, then a second view
+    collection.insert(300, "cpu", QString("{\"v\":4}"));
+    collection.clearDocument("disk");
+    collection.insert(100, "memory", QString("{\"v\":5}"));
+    collection.setValueForKey("owner", "dev");
+    collection.removeValueForKey("region");
+    const std::shared_ptr<const CollectionView> after = collection.publish();
+    // and changes no view has seen
+    collection.insert(400, "cpu", QString("{\"v\":6}"));
+    collection.setValueForKey("zone", "a");
+
+    const qint64 now = std::numeric_limits<qint64>::max();
+    bool more = false;
+    QCOMPARE(describe(before->getAllRecords(now, QString())), QStringList({"cpu@200:{\"v\":2}", "disk@100:{\"v\":3}"}));
+    QCOMPARE(before->getAllRecordsForDocument("cpu", 0, now).size(), 2);
+    QCOMPARE(before->getDocumentNames(QString(), QString(), 0, &more), QStringList({"cpu", "disk"}));
+    QCOMPARE(before->getValueForKey("owner"), QString("ops"));
+    QCOMPARE(sortedKeys(before->getAllValues()), QStringList({"owner", "region"}));
+    QCOMPARE(before->documentVersion("cpu"), cpuVersion);
+    QCOMPARE(before->documentVersion("memory"), quint64(0));
+    QCOMPARE(before->latestHighWater(), qint64(200));
+
+    QCOMPARE(describe(after->getAllRecords(now, QString())), QStringList({"cpu@300:{\"v\":4}", "memory@100:{\"v\":5}"}));
+    QCOMPARE(after->getAllRecordsForDocument("cpu", 0, now).size(), 3);
+    QCOMPARE(after->getAllRecordsForDocument("disk", 0, now).size(), 0);
+    QCOMPARE(after->getDocumentNames(QString(), QString(), 0, &more), QStringList({"cpu", "memory"}));
+    QCOMPARE(after->getValueForKey("owner"), QString("dev"));
+    QCOMPARE(sortedKeys(after->getAllValues()), QStringList({"owner"}));
+    QVERIFY(after->documentVersion("cpu") != cpuVersion);
+    QVERIFY(after->valuesVersion() != before->valuesVersion());
+
+    // a view published without changes answers as the last one did
+    const std::shared_ptr<const CollectionView> latest = collection.publish();
+    QCOMPARE(describe(latest->getAllRecords(now, QString())), describe(collection.getAllRecords(now, QString())));
+    QCOMPARE(latest->getAllValues(), collection.getAllValues());
+    QCOMPARE(latest->documentVersion("cpu"), collection.documentVersion("cpu"));
+    QCOMPARE(latest->version(), collection.version());
+    QCOMPARE(collection.publish()->version(), latest->version());
+}
+
+void TestCollection::viewsCanBeReadWhileTheCollectionChanges()
+{
+    // Each batch adds a record to every document and counts itself in a
+    // key-value, so any view has as many records in each document as the
+    // count says, the newest at the high-water mark.
+    const int documents = 8;
+    const int batches = 3 * DocumentSeries::ChunkCapacity;
+    Collection collection("metrics", QString());
+    std::mutex mutex;
+    std::shared_ptr<const CollectionView> current = collection.publish();
+    std::atomic<bool> done{false};
+    std::atomic<int> mismatches{0};
+    std::atomic<int> reads{0};
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]()
+        {
+            while (!done)
+            {
+                std::shared_ptr<const CollectionView> view;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    view = current;
+                }
+                const qint64 count = view->getValueForKey("batches").toLongLong();
+                const QHash<QString, DataRecord> latest = view->getAllRecords(std::numeric_limits<qint64>::max(), QString());
+                bool consistent = latest.size() == (count == 0 ? 0 : documents) && (count == 0 || view->latestHighWater() == count);
+                for (auto it = latest.constBegin(); it != latest.constEnd(); ++it)
+                {
+                    consistent = consistent && it.value().timestamp == count
+                                 && view->getAllRecordsForDocument(it.key(), 0, count).size() == count;
+                }
+                if (!consistent)
+                {
+                    ++mismatches;
+                }
+                ++reads;
+            }
+        });
+    }
+    for (int batch = 1; batch <= batches; ++batch)
+    {
+        for (int doc = 0; doc < documents; ++doc)
+        {
+            collection.insert(batch, QString("doc%1").arg(doc), QString("{\"v\":%1}").arg(batch));
+        }
+        collection.setValueForKey("batches", QString::number(batch));
+        const std::shared_ptr<const CollectionView> view = collection.publish();
+        std::lock_guard<std::mutex> lock(mutex);
+        current = view;
+    }
+    // the readers get to the last view too
+    const int seen = reads;
+    while (reads < seen + 4 * 4)
+    {
+        std::this_thread::yield();
+    }
+    done = true;
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+    QCOMPARE(mismatches.load(), 0);
+    QCOMPARE(current->getAllRecordsForDocument("doc0", 0, batches).size(), batches);
+}
+
+void TestCollection::scansLargeCollectionsInParallel()
+{
+    // enough documents and keys for scans of every one to be split, each
+    // document with a shared first record and one of its own
+    const int count = int(ParallelScanEntries) + 1000;
+    QVERIFY(scanPartitions(count) > 1);
+    Collection collection("metrics", QString());
+    QHash<QString, qint64> latest;
+    QHash<QString, qint64> first;
+    QHash<QString, qint64> latestMatching;
+    QHash<QString, QString> values;
+    QHash<QString, QString> valuesMatching;
+    const std::shared_ptr<const KeyPattern> pattern = KeyPattern::parse("/7$/");
+    for (int i = 0; i < count; ++i)
+    {
+        const QString doc = QString("doc%1").arg(i);
+        collection.insert(1000, doc, QString("{\"v\":0}"));
+        collection.insert(2000 + i, doc, QString("{\"v\":%1}").arg(i));
+        collection.setValueForKey(QString("key%1").arg(i), QString::number(i));
+        latest.insert(doc, 2000 + i);
+        first.insert(doc, 1000);
+        values.insert(QString("key%1").arg(i), QString::number(i));
+        if (i % 10 == 7)
+        {
+            latestMatching.insert(doc, 2000 + i);
+            valuesMatching.insert(QString("key%1").arg(i), QString::number(i));
+        }
+    }
+    const std::shared_ptr<const CollectionView> view = collection.publish();
+
+    // at the high-water mark from the latest records, before it from the series
+    const qint64 now = std::numeric_limits<qint64>::max();
+    QCOMPARE(timestamps(collection.getAllRecords(now, QString())), latest);
+    QCOMPARE(timestamps(view->getAllRecords(now, QString())), latest);
+    QCOMPARE(timestamps(collection.getAllRecords(1500, QString())), first);
+    QCOMPARE(timestamps(view->getAllRecords(1500, QString())), first);
+    QCOMPARE(timestamps(collection.getAllRecords(now, QString(), 0, pattern.get())), latestMatching);
+    QCOMPARE(timestamps(view->getAllRecords(now, QString(), 0, pattern.get())), latestMatching);
+    QCOMPARE(collection.getAllRecords(1500, QString(), 0, pattern.get()).size(), latestMatching.size());
+    QCOMPARE(view->getAllRecords(1500, QString(), 0, pattern.get()).size(), latestMatching.size());
+
+    const QHash<QString, QList<DataRecord>> session = collection.getSessionData(1000, 2000 + count);
+    QCOMPARE(session.size(), count);
+    for (auto it = session.constBegin(); it != session.constEnd(); ++it)
+    {
+        QCOMPARE(it.value().size(), 2);
+        QCOMPARE(it.value().last().timestamp, latest.value(it.key()));
+    }
+
+    QCOMPARE(collection.getAllValues(), values);
+    QCOMPARE(view->getAllValues(), values);
+    QCOMPARE(collection.getAllValues(pattern.get()), valuesMatching);
+    QCOMPARE(view->getAllValues(pattern.get()), valuesMatching);
+}
+
+QTEST_GUILESS_MAIN(TestCollection)
+#include "tst_collection.moc"
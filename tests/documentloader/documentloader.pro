@@ -0,0 +1,19 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_documentloader
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_documentloader.cpp \
+    ../../src/datarecord.cpp \
+    ../../src/documentloader.cpp \
+    ../../src/documentseries.cpp
+
+HEADERS += \
+    ../../src/datarecord.h \
+    ../../src/documentloader.h \
+    ../../src/documentseries.h
@@ -0,0 +1,147 @@
+#include <QtTest>
+#include <QThreadPool>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "documentloader.h"
+
+// How DocumentLoader resolves a persisted history of records, deletions and
+// clears, given in write order, into the series a live collection would hold.
+class TestDocumentLoader : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void sortsRecordsWrittenOutOfOrder();
+    void keepsTheLatestWriteOfATimestamp();
+    void deletesOnlyEarlierWrites();
+    void dropsRecordsBeforeAClear();
+    void buildsManyDocumentsInParallel();
+
+private:
+    using Records = std::vector<std::pair<qint64, std::string>>;
+    using Series = std::unordered_map<QString, DocumentSeries>;
+
+    static Records records(const Series& series, const QString& doc);
+};
+
+TestDocumentLoader::Records TestDocumentLoader::records(const Series &series, const QString &doc)
+{
+    Records result;
+    auto it = series.find(doc);
+    if (it == series.end())
+    {
+        return result;
+    }
+    it->second.forEachInRange(std::numeric_limits<qint64>::min(), std::numeric_limits<qint64>::max(), false,
+                              [&result](const DataRecord &record)
+                              {
+                                  result.emplace_back(record.timestamp, std::string(record.data));
+                                  return true;
+                              });
+    return result;
+}
+
+void TestDocumentLoader::sortsRecordsWrittenOutOfOrder()
+{
+    DocumentLoader loader;
+    loader.addRecord("cpu", 1, 30, "c");
+    loader.addRecord("cpu", 2, 10, "a");
+    loader.addRecord("cpu", 3, 20, "b");
+
+    Series series;
+    QThreadPool pool;
+    QCOMPARE(loader.build(series, &pool), qsizetype(3));
+    QVERIFY(records(series, "cpu") == Records({{10, "a"}, {20, "b"}, {30, "c"}}));
+    QCOMPARE(series.at("cpu").firstTimestamp(), qint64(10));
+    QCOMPARE(series.at("cpu").lastTimestamp(), qint64(30));
+}
+
+void TestDocumentLoader::keepsTheLatestWriteOfATimestamp()
+{
+    DocumentLoader loader;
+    // a rewritten segment may replay an older write after a newer one
+    loader.addRecord("cpu", 5, 10, "newer");
+    loader.addRecord("cpu", 2, 10, "older");
+    loader.addRecord("cpu", 3, 20, "only");
+
+    Series series;
+    QThreadPool pool;
+    QCOMPARE(loader.build(series, &pool), qsizetype(2));
+    QVERIFY(records(series, "cpu") == Records({{10, "newer"}, {20, "only"}}));
+}
+
+void TestDocumentLoader::deletesOnlyEarlierWrites()
+{
+    DocumentLoader loader;
+    loader.addRecord("cpu", 1, 10, "a");
+    loader.addRecord("cpu", 2, 20, "b");
+    loader.addRecord("cpu", 3, 30, "c");
+    loader.addDeletion("cpu", 4, 10, 20);
+    // written again after the deletion
+    loader.addRecord("cpu", 5, 20, "b2");
+    // a single-timestamp deletion of the newest write
+    loader.addDeletion("cpu", 6, 30, 30);
+
+    loader.addRecord("memory", 7, 10, "gone");
+    loader.addDeletion("memory", 8, 0, 100);
+
+    Series series;
+    QThreadPool pool;
+    QCOMPARE(loader.build(series, &pool), qsizetype(1));
+    QVERIFY(records(series, "cpu") == Records({{20, "b2"}}));
+    // a document with every record deleted is left out
+    QVERIFY(series.find("memory") == series.end());
+}
+
+void TestDocumentLoader::dropsRecordsBeforeAClear()
+{
+    DocumentLoader loader;
+    loader.addRecord("cpu", 1, 10, "a");
+    loader.addRecord("cpu", 2, 20, "b");
+    loader.addClear("cpu", 3);
+    loader.addRecord("cpu", 4, 5, "c");
+    // an older clear replayed later does not undo the newer one
+    loader.addClear("cpu", 2);
+
+    Series series;
+    QThreadPool pool;
+    QCOMPARE(loader.build(series, &pool), qsizetype(1));
+    QVERIFY(records(series, "cpu") == Records({{5, "c"}}));
+}
+
+void TestDocumentLoader::buildsManyDocumentsInParallel()
+{
+    // more documents than batches, with payloads whose source is gone
+    DocumentLoader loader;
+    quint64 sequence = 0;
+    for (int doc = 0; doc < 100; ++doc)
+    {
+        for (qint64 ts = 2 * DocumentSeries::ChunkCapacity; ts > 0; --ts)
+        {
+            loader.addRecord(QString("doc%1").arg(doc), ++sequence, ts, loader.keep(std::to_string(doc * ts)));
+        }
+    }
+
+    Series series;
+    QThreadPool pool;
+    pool.setMaxThreadCount(3);
+    QCOMPARE(loader.build(series, &pool), qsizetype(100 * 2 * DocumentSeries::ChunkCapacity));
+    QCOMPARE(series.size(), size_t(100));
+    for (int doc = 0; doc < 100; ++doc)
+    {
+        const Records loaded = records(series, QString("doc%1").arg(doc));
+        QCOMPARE(loaded.size(), size_t(2 * DocumentSeries::ChunkCapacity));
+        for (size_t i = 0; i < loaded.size(); ++i)
+        {
+            const qint64 ts = static_cast<qint64>(i) + 1;
+            QCOMPARE(loaded[i].first, ts);
+            QCOMPARE(loaded[i].second, std::to_string(doc * ts));
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(TestDocumentLoader)
+#include "tst_documentloader.moc"
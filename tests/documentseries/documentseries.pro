@@ -0,0 +1,17 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_documentseries
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_documentseries.cpp \
+    ../../src/datarecord.cpp \
+    ../../src/documentseries.cpp
+
+HEADERS += \
+    ../../src/datarecord.h \
+    ../../src/documentseries.h
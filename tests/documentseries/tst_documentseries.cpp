@@ -0,0 +1,279 @@
+#include <QtTest>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "documentseries.h"
+
+// DocumentSeries::insertSorted() against a std::map holding what one
+// insert() per record would leave behind.
+class TestDocumentSeries : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void appendsPastTheNewestRecord();
+    void rebuildsTheChunksItReaches();
+    void insertsFewRecordsDeepInTheHistory();
+    void leavesSnapshotsUntouched();
+    void snapshotsOnlyTheGivenRanges();
+    void walksRangesFromEitherEnd();
+    void stopsWalkingWhenTold();
+
+private:
+    using Reference = std::map<qint64, std::string>;
+
+    // Records for the timestamps, each with a payload naming the batch.
+    std::vector<DataRecord> batch(const std::vector<qint64>& timestamps, const std::string& tag);
+    void insertSorted(DocumentSeries& series, Reference& reference, const std::vector<DataRecord>& records);
+    void compare(const DocumentSeries& series, const Reference& reference);
+
+    // payloads outlive the series they are inserted into
+    std::vector<std::unique_ptr<std::string>> m_payloads;
+};
+
+std::vector<DataRecord> TestDocumentSeries::batch(const std::vector<qint64> &timestamps, const std::string &tag)
+{
+    std::vector<DataRecord> records;
+    records.reserve(timestamps.size());
+    for (const qint64 timestamp : timestamps)
+    {
+        m_payloads.push_back(std::make_unique<std::string>(tag + ":" + std::to_string(timestamp)));
+        records.push_back(DataRecord{timestamp, *m_payloads.back()});
+    }
+    return records;
+}
+
+void TestDocumentSeries::insertSorted(DocumentSeries &series, Reference &reference, const std::vector<DataRecord> &records)
+{
+    series.insertSorted(records);
+    for (const DataRecord &record : records)
+    {
+        reference[record.timestamp] = std::string(record.data);
+    }
+}
+
+void TestDocumentSeries::compare(const DocumentSeries &series, const Reference &reference)
+{
+    QCOMPARE(series.size(), static_cast<qsizetype>(reference.size()));
+    QCOMPARE(series.firstTimestamp(), reference.begin()->first);
+    QCOMPARE(series.lastTimestamp(), reference.rbegin()->first);
+    auto expected = reference.begin();
+    series.forEachInRange(std::numeric_limits<qint64>::min(), std::numeric_limits<qint64>::max(), false,
+                          [&](const DataRecord &record)
+                          {
+                              if (expected == reference.end() || expected->first != record.timestamp ||
+                                  expected->second != record.data)
+                              {
+                                  return false;
+                              }
+                              ++expected;
+                              return true;
+                          });
+    QVERIFY(expected == reference.end());
+}
+
+void TestDocumentSeries::appendsPastTheNewestRecord()
+{
+    DocumentSeries series;
+    Reference reference;
+    std::vector<qint64> timestamps;
+    for (qint64 ts = 0; ts < 3 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        timestamps.push_back(ts * 10);
+    }
+    insertSorted(series, reference, batch(timestamps, "first"));
+    insertSorted(series, reference, batch({30000, 30010, 30020}, "tail"));
+    compare(series, reference);
+}
+
+void TestDocumentSeries::rebuildsTheChunksItReaches()
+{
+    DocumentSeries series;
+    Reference reference;
+    std::vector<qint64> timestamps;
+    for (qint64 ts = 0; ts < 4 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        timestamps.push_back(ts * 10);
+    }
+    insertSorted(series, reference, batch(timestamps, "first"));
+
+    // a backfill as large as the history after it: new timestamps between
+    // the existing ones, replacements of existing ones and a few past the end
+    std::vector<qint64> backfill;
+    for (qint64 ts = 2 * DocumentSeries::ChunkCapacity * 10; ts < 5 * DocumentSeries::ChunkCapacity * 10; ts += 5)
+    {
+        backfill.push_back(ts);
+    }
+    insertSorted(series, reference, batch(backfill, "backfill"));
+    compare(series, reference);
+
+    // replacing only existing timestamps keeps the size
+    const qsizetype size = series.size();
+    insertSorted(series, reference, batch({0, 10, 20, 25590}, "replaced"));
+    QCOMPARE(series.size(), size);
+    compare(series, reference);
+}
+
+void TestDocumentSeries::insertsFewRecordsDeepInTheHistory()
+{
+    DocumentSeries series;
+    Reference reference;
+    std::vector<qint64> timestamps;
+    for (qint64 ts = 0; ts < 8 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        timestamps.push_back(ts * 10);
+    }
+    insertSorted(series, reference, batch(timestamps, "first"));
+
+    // few records against a long history take the point-insert path
+    insertSorted(series, reference, batch({5, 100, 115}, "late"));
+    compare(series, reference);
+}
+
+void TestDocumentSeries::leavesSnapshotsUntouched()
+{
+    DocumentSeries series;
+    Reference reference;
+    std::vector<qint64> timestamps;
+    for (qint64 ts = 0; ts < 2 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        timestamps.push_back(ts * 10);
+    }
+    insertSorted(series, reference, batch(timestamps, "first"));
+    const Reference before = reference;
+    const DocumentSeries::Snapshot snapshot = series.snapshot();
+
+    std::vector<qint64> backfill;
+    for (qint64 ts = 5; ts < 2 * DocumentSeries::ChunkCapacity * 10; ts += 10)
+    {
+        backfill.push_back(ts);
+    }
+    insertSorted(series, reference, batch(backfill, "backfill"));
+    insertSorted(series, reference, batch({0, 10}, "replaced"));
+    compare(series, reference);
+
+    auto expected = before.begin();
+    bool same = true;
+    snapshot.forEach([&](const DataRecord &record)
+                     {
+                         same = same && expected != before.end() && expected->first == record.timestamp && expected->second == record.data;
+                         ++expected;
+                     });
+    QVERIFY(same);
+    QVERIFY(expected == before.end());
+}
+
+void TestDocumentSeries::snapshotsOnlyTheGivenRanges()
+{
+    DocumentSeries series;
+    Reference reference;
+    std::vector<qint64> timestamps;
+    for (qint64 ts = 0; ts < 4 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        timestamps.push_back(ts);
+    }
+    insertSorted(series, reference, batch(timestamps, "first"));
+
+    // ranges starting before the first record, inside a chunk, a single
+    // timestamp and one running past the newest record
+    const DocumentSeries::Snapshot snapshot = series.snapshot({{-10, 3}, {600, 601}, {1500, 1500}, {2040, 5000}});
+    std::vector<qint64> expected = {0, 1, 2, 3, 600, 601, 1500};
+    for (qint64 ts = 2040; ts < 4 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        expected.push_back(ts);
+    }
+    std::vector<qint64> visited;
+    bool payloads = true;
+    snapshot.forEach([&](const DataRecord &record)
+                     {
+                         visited.push_back(record.timestamp);
+                         payloads = payloads && reference[record.timestamp] == record.data;
+                     });
+    QVERIFY(visited == expected);
+    QVERIFY(payloads);
+
+    QVERIFY(series.snapshot({{5000, 6000}}).isEmpty());
+}
+
+void TestDocumentSeries::walksRangesFromEitherEnd()
+{
+    DocumentSeries series;
+    Reference reference;
+    std::vector<qint64> timestamps;
+    for (qint64 ts = 0; ts < 3 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        timestamps.push_back(ts * 10);
+    }
+    insertSorted(series, reference, batch(timestamps, "first"));
+
+    const qint64 last = timestamps.back();
+    const qint64 min = std::numeric_limits<qint64>::min();
+    const qint64 max = std::numeric_limits<qint64>::max();
+    // ends on and between records, across chunk boundaries, and past both
+    // ends of the series
+    const std::vector<std::pair<qint64, qint64>> ranges = {
+        {0, last}, {min, max}, {5, 15}, {10, 10}, {11, 19}, {-100, -1}, {last + 1, max},
+        {(DocumentSeries::ChunkCapacity - 2) * 10, (DocumentSeries::ChunkCapacity + 2) * 10 + 5}, {20, 10}};
+    for (const auto &range : ranges)
+    {
+        std::vector<qint64> expected;
+        for (auto it = reference.lower_bound(range.first); range.first <= range.second && it != reference.end() && it->first <= range.second; ++it)
+        {
+            expected.push_back(it->first);
+        }
+
+        std::vector<qint64> forward;
+        series.forEachInRange(range.first, range.second, false, [&](const DataRecord &record)
+                              {
+                                  forward.push_back(record.timestamp);
+                                  return true;
+                              });
+        QCOMPARE(forward, expected);
+
+        std::vector<qint64> reverse;
+        series.forEachInRange(range.first, range.second, true, [&](const DataRecord &record)
+                              {
+                                  reverse.push_back(record.timestamp);
+                                  return true;
+                              });
+        std::reverse(expected.begin(), expected.end());
+        QCOMPARE(reverse, expected);
+    }
+}
+
+void TestDocumentSeries::stopsWalkingWhenTold()
+{
+    DocumentSeries series;
+    Reference reference;
+    std::vector<qint64> timestamps;
+    for (qint64 ts = 1; ts <= 4 * DocumentSeries::ChunkCapacity; ++ts)
+    {
+        timestamps.push_back(ts);
+    }
+    insertSorted(series, reference, batch(timestamps, "first"));
+
+    // the newest few are reached without visiting anything older
+    std::vector<qint64> visited;
+    series.forEachInRange(std::numeric_limits<qint64>::min(), std::numeric_limits<qint64>::max(), true,
+                          [&](const DataRecord &record)
+                          {
+                              visited.push_back(record.timestamp);
+                              return visited.size() < 3;
+                          });
+    const qint64 last = timestamps.back();
+    QCOMPARE(visited, std::vector<qint64>({last, last - 1, last - 2}));
+
+    visited.clear();
+    series.forEachInRange(100, last, false, [&](const DataRecord &record)
+                          {
+                              visited.push_back(record.timestamp);
+                              return visited.size() < 2;
+                          });
+    QCOMPARE(visited, std::vector<qint64>({100, 101}));
+}
+
+QTEST_GUILESS_MAIN(TestDocumentSeries)
+#include "tst_documentseries.moc"
@@ -0,0 +1,15 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_keypattern
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_keypattern.cpp \
+    ../../src/keypattern.cpp
+
+HEADERS += \
+    ../../src/keypattern.h
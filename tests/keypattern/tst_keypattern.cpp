@@ -0,0 +1,174 @@
+#include <QtTest>
+#include "keypattern.h"
+
+// /pattern/ keys: the literals pulled out to pre-filter keys may only ever
+// reject keys the regex would reject too.
+class TestKeyPattern : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parsesPatterns_data();
+    void parsesPatterns();
+    void extractsLiterals_data();
+    void extractsLiterals();
+    void agreesWithTheRegex_data();
+    void agreesWithTheRegex();
+    void neverRejectsAMatchingKey();
+    void cachesCompiledPatterns();
+
+private:
+    static QStringList patterns();
+    static QStringList keys();
+};
+
+QStringList TestKeyPattern::patterns()
+{
+    return {
+        "/^site-7\\/.*\\/cpu$/", "/cpu/", "/^cpu/", "/^cpu/i", "/^cpu/m", "/cpu|mem/", "/^(cpu|mem)-1/", "/^cpu-(1|2)$/",
+        "/ab?c/", "/ab*c/", "/ab+c/", "/a{0}bc/", "/a{00}bc/", "/a{0,2}bc/", "/a{,2}bc/", "/a{ 0 }bc/", "/a{2}bc/",
+        "/a{2,}bc/", "/a{x}/", "/a??bc/", "/a*?bc/", "/ab++c/", "/(?i)CPU/", "/x(?i)CPU/", "/(?i:CPU)-1/", "/\\Qa.b\\E/",
+        "/\\Qa|b/", "/a\\.b/", "/a\\x2eb/", "/\\d+-cpu/", "/\\bcpu\\b/", "/(?=cpu)c/", "/(?!cpu)\\w+/", "/(?<=-)cpu/",
+        "/[cm]pu/", "/[^]]pu/", "/[[:alpha:]]pu/", "/.pu/", "/^.{3}-1/", "/cpu$/m", "/^mem/m", "/k/i", "/s$/i",
+        "/café/i", "/Été/i", "/^disk-1/i", "/-desk$/i", "/a\U0001F600?b/", "/a\\\U0001F600?b/", "/\U0001F600+x/", "/(a)\\1/", "/a\\Kb/",
+        "/(*UTF)cpu/", "/(?|a)b/", "/^\\/x/",
+    };
+}
+
+QStringList TestKeyPattern::keys()
+{
+    return {
+        "", "cpu", "CPU", "Cpu", "cpu-1", "cpu-2", "cpu-3", "mem-1", "mem", "site-7/host/cpu", "site-7/cpu", "site-8/host/cpu",
+        "x/site-7/a/cpu", "abc", "ac", "bc", "aabc", "aaabc", "abbc", "xCPU", "xcpu", "a.b", "a|b", "axb", "12-cpu", "-cpu",
+        "my cpu", "mpu", "]pu", "upu", "123-1", "disk\ncpu", "disk\nmem", "cpu\nmem", "\u212A", "\u017F", "k", "S",
+        "cafÉ", "café", "DI\u017FK-1", "disk-1", "my-DESK", "my-de\u212Ak", "été", "ab", "a\U0001F600b", "a\U0001F600\U0001F600b", "\U0001F600x", "x",
+        "aa", "a{x}", "/x", "ax",
+    };
+}
+
+void TestKeyPattern::parsesPatterns_data()
+{
+    QTest::addColumn<QString>("candidate");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("pattern") << QString("/cpu/") << true;
+    QTest::newRow("flags") << QString("/cpu/im") << true;
+    QTest::newRow("escaped slash") << QString("/a\\/b/") << true;
+    QTest::newRow("plain key") << QString("cpu") << false;
+    QTest::newRow("no closing slash") << QString("/cpu") << false;
+    QTest::newRow("slash only") << QString("/") << false;
+    QTest::newRow("invalid regex") << QString("/cpu(/") << false;
+}
+
+void TestKeyPattern::parsesPatterns()
+{
+    QFETCH(QString, candidate);
+    QFETCH(bool, valid);
+
+    QCOMPARE(KeyPattern::parse(candidate) != nullptr, valid);
+}
+
+void TestKeyPattern::extractsLiterals_data()
+{
+    QTest::addColumn<QString>("candidate");
+    QTest::addColumn<QString>("prefix");
+
+    QTest::newRow("anchored") << QString("/^site-7\\/.*\\/cpu$/") << QString("site-7/");
+    QTest::newRow("escaped") << QString("/^a\\.b/") << QString("a.b");
+    QTest::newRow("repeated last") << QString("/^ab+/") << QString("ab");
+    QTest::newRow("optional last") << QString("/^ab?/") << QString("a");
+    QTest::newRow("case insensitive") << QString("/^cpu/i") << QString("cpu");
+    QTest::newRow("case insensitive s") << QString("/^disk/i") << QString("di");
+    QTest::newRow("not anchored") << QString("/cpu/") << QString();
+    QTest::newRow("multiline") << QString("/^cpu/m") << QString();
+    QTest::newRow("alternation") << QString("/^cpu|mem/") << QString();
+    QTest::newRow("zero repeats") << QString("/^a{0}b/") << QString();
+    QTest::newRow("inline option") << QString("/^(?i)cpu/") << QString();
+    QTest::newRow("quoted") << QString("/^\\Qa.b\\E/") << QString();
+}
+
+void TestKeyPattern::extractsLiterals()
+{
+    QFETCH(QString, candidate);
+    QFETCH(QString, prefix);
+
+    const std::shared_ptr<const KeyPattern> pattern = KeyPattern::parse(candidate);
+    QVERIFY(pattern != nullptr);
+    QCOMPARE(pattern->prefix(), prefix);
+}
+
+void TestKeyPattern::agreesWithTheRegex_data()
+{
+    QTest::addColumn<QString>("candidate");
+    QTest::addColumn<QString>("key");
+    QTest::addColumn<bool>("matches");
+
+    QTest::newRow("prefix") << QString("/^site-7\\/.*\\/cpu$/") << QString("site-7/host/cpu") << true;
+    QTest::newRow("other prefix") << QString("/^site-7\\/.*\\/cpu$/") << QString("site-8/host/cpu") << false;
+    QTest::newRow("missing literal") << QString("/^site-7\\/.*\\/cpu$/") << QString("site-7/host/mem") << false;
+    QTest::newRow("alternation") << QString("/cpu|mem/") << QString("mem-1") << true;
+    QTest::newRow("grouped alternation") << QString("/^(cpu|mem)-1/") << QString("mem-1") << true;
+    QTest::newRow("optional") << QString("/ab?c/") << QString("ac") << true;
+    QTest::newRow("zero repeats") << QString("/a{0}bc/") << QString("bc") << true;
+    QTest::newRow("padded zero repeats") << QString("/a{00}bc/") << QString("bc") << true;
+    QTest::newRow("inline case") << QString("/(?i)CPU/") << QString("cpu") << true;
+    QTest::newRow("flag case") << QString("/^cpu/i") << QString("CPU-1") << true;
+    QTest::newRow("quoted") << QString("/\\Qa.b\\E/") << QString("a.b") << true;
+    QTest::newRow("quoted dot") << QString("/\\Qa.b\\E/") << QString("axb") << false;
+    QTest::newRow("multiline") << QString("/^cpu/m") << QString("disk\ncpu") << true;
+    QTest::newRow("kelvin sign") << QString("/^disk-1/i") << QString("DIS\u212A-1") << true;
+    QTest::newRow("optional emoji") << QString("/a\U0001F600?b/") << QString("ab") << true;
+}
+
+void TestKeyPattern::agreesWithTheRegex()
+{
+    QFETCH(QString, candidate);
+    QFETCH(QString, key);
+    QFETCH(bool, matches);
+
+    const std::shared_ptr<const KeyPattern> pattern = KeyPattern::parse(candidate);
+    QVERIFY(pattern != nullptr);
+    QCOMPARE(pattern->regex().match(key).hasMatch(), matches);
+    QCOMPARE(pattern->matches(key), matches);
+}
+
+void TestKeyPattern::neverRejectsAMatchingKey()
+{
+    for (const QString &candidate : patterns())
+    {
+        const std::shared_ptr<const KeyPattern> pattern = KeyPattern::parse(candidate);
+        if (pattern == nullptr)
+        {
+            // left to the regex engine in use
+            continue;
+        }
+        for (const QString &key : keys())
+        {
+            const bool expected = pattern->regex().match(key).hasMatch();
+            if (pattern->matches(key) != expected)
+            {
+                QFAIL(qPrintable(QString("%1 on \"%2\": expected %3").arg(candidate, key).arg(expected)));
+            }
+        }
+    }
+}
+
+void TestKeyPattern::cachesCompiledPatterns()
+{
+    KeyPatternCache cache(2);
+    const std::shared_ptr<const KeyPattern> cpu = cache.lookup("/^cpu/");
+    QVERIFY(cpu != nullptr);
+    QCOMPARE(cache.lookup("/^cpu/"), cpu);
+    QVERIFY(cache.lookup("/cpu(/") == nullptr);
+    QVERIFY(cache.lookup("cpu") == nullptr);
+
+    // the least recently used one goes first
+    const std::shared_ptr<const KeyPattern> mem = cache.lookup("/^mem/");
+    QCOMPARE(cache.lookup("/^cpu/"), cpu);
+    cache.lookup("/^disk/");
+    QCOMPARE(cache.lookup("/^cpu/"), cpu);
+    QVERIFY(cache.lookup("/^mem/") != mem);
+}
+
+QTEST_GUILESS_MAIN(TestKeyPattern)
+#include "tst_keypattern.moc"
@@ -0,0 +1,15 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_parallelscan
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_parallelscan.cpp \
+    ../../src/parallelscan.cpp
+
+HEADERS += \
+    ../../src/parallelscan.h
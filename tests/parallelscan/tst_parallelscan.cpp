@@ -0,0 +1,153 @@
+#include <QtTest>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "parallelscan.h"
+
+// Scans split into partitions on the global pool, and their results joined.
+class TestParallelScan : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void splitsOnlyLargeScans();
+    void runsEveryPartitionOnce_data();
+    void runsEveryPartitionOnce();
+    void runsASinglePartitionOnTheCaller();
+    void sharesPartitionsWithThePool();
+    void finishesWhileThePoolIsBusy();
+    void mergesPartitions();
+};
+
+void TestParallelScan::splitsOnlyLargeScans()
+{
+    const int threads = QThreadPool::globalInstance()->maxThreadCount();
+    QCOMPARE(scanPartitions(0), 1);
+    QCOMPARE(scanPartitions(ParallelScanEntries - 1), 1);
+    QCOMPARE(scanPartitions(ParallelScanEntries), threads * 4);
+    QCOMPARE(scanPartitions(100 * ParallelScanEntries), threads * 4);
+}
+
+void TestParallelScan::runsEveryPartitionOnce_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("one") << 1;
+    QTest::newRow("two") << 2;
+    QTest::newRow("fewer than the threads") << 3;
+    QTest::newRow("many") << 1000;
+}
+
+void TestParallelScan::runsEveryPartitionOnce()
+{
+    QFETCH(int, count);
+
+    std::vector<std::atomic<int>> runs(count);
+    runPartitions(count, [&](int partition) { ++runs[partition]; });
+    for (int partition = 0; partition < count; ++partition)
+    {
+        QCOMPARE(runs[partition].load(), 1);
+    }
+}
+
+void TestParallelScan::runsASinglePartitionOnTheCaller()
+{
+    std::thread::id thread;
+    runPartitions(1, [&](int) { thread = std::this_thread::get_id(); });
+    QCOMPARE(thread, std::this_thread::get_id());
+}
+
+void TestParallelScan::sharesPartitionsWithThePool()
+{
+    if (QThreadPool::globalInstance()->maxThreadCount() < 2)
+    {
+        QSKIP("the pool has a single thread");
+    }
+    // the first partition waits for a second one to start on another thread
+    std::atomic<int> started{0};
+    std::atomic<bool> overlapped{false};
+    const std::thread::id caller = std::this_thread::get_id();
+    std::vector<std::thread::id> threads(2);
+    runPartitions(2, [&](int partition)
+    {
+        threads[partition] = std::this_thread::get_id();
+        ++started;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (started < 2 && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::yield();
+        }
+        if (started == 2)
+        {
+            overlapped = true;
+        }
+    });
+    QVERIFY(overlapped);
+    QVERIFY(threads[0] != threads[1]);
+    QVERIFY(threads[0] == caller || threads[1] == caller);
+}
+
+void TestParallelScan::finishesWhileThePoolIsBusy()
+{
+    // every pool thread blocked, so only the caller is left to scan
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int threads = pool->maxThreadCount();
+    auto blocked = std::make_shared<QSemaphore>();
+    auto release = std::make_shared<QSemaphore>();
+    for (int i = 0; i < threads; ++i)
+    {
+        pool->start([blocked, release]()
+        {
+            blocked->release();
+            release->acquire();
+        });
+    }
+    blocked->acquire(threads);
+
+    const std::thread::id caller = std::this_thread::get_id();
+    std::atomic<int> elsewhere{0};
+    std::atomic<int> runs{0};
+    runPartitions(16, [&](int)
+    {
+        if (std::this_thread::get_id() != caller)
+        {
+            ++elsewhere;
+        }
+        ++runs;
+    });
+    QCOMPARE(runs.load(), 16);
+    QCOMPARE(elsewhere.load(), 0);
+
+    // the helpers queued behind the blocked tasks find nothing left to run
+    release->release(threads);
+    QVERIFY(pool->waitForDone(5000));
+    QCOMPARE(runs.load(), 16);
+}
+
+void TestParallelScan::mergesPartitions()
+{
+    std::vector<QHash<QString, int>> partial(3);
+    partial[0].insert("a", 1);
+    partial[0].insert("b", 2);
+    partial[2].insert("c", 3);
+    const QHash<QString, int> merged = mergePartitions(partial);
+    QCOMPARE(merged, (QHash<QString, int>{{"a", 1}, {"b", 2}, {"c", 3}}));
+    for (const QHash<QString, int> &part : partial)
+    {
+        QVERIFY(part.isEmpty());
+    }
+
+    std::vector<QHash<QString, int>> single(1);
+    single[0].insert("a", 1);
+    QCOMPARE(mergePartitions(single), (QHash<QString, int>{{"a", 1}}));
+
+    std::vector<QHash<QString, int>> empty(4);
+    QVERIFY(mergePartitions(empty).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TestParallelScan)
+#include "tst_parallelscan.moc"
@@ -0,0 +1,19 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_payloadfilter
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_payloadfilter.cpp \
+    ../../src/payloadfilter.cpp \
+    ../../src/payloadpath.cpp \
+    ../../src/responsewriter.cpp
+
+HEADERS += \
+    ../../src/payloadfilter.h \
+    ../../src/payloadpath.h \
+    ../../src/responsewriter.h
@@ -0,0 +1,125 @@
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <string>
+#include "payloadfilter.h"
+
+// Filter expressions as sent in qry and qdoc: which ones compile, and which
+// payloads the compiled ones match.
+class TestPayloadFilter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void compilesExpressions_data();
+    void compilesExpressions();
+    void matchesPayloads_data();
+    void matchesPayloads();
+    void matchesEverythingWithoutAnExpression();
+
+private:
+    // The "filter" member of a JSON object, so any value can be written inline.
+    static QJsonValue expression(const QString& json);
+};
+
+QJsonValue TestPayloadFilter::expression(const QString &json)
+{
+    return QJsonDocument::fromJson(QString("{\"filter\":%1}").arg(json).toUtf8()).object().value("filter");
+}
+
+void TestPayloadFilter::compilesExpressions_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("comparison") << QString(R"({"gt":["speed",80]})") << true;
+    QTest::newRow("nested") << QString(R"({"and":[{"gte":["a",1]},{"or":[{"eq":["b","x"]},{"not":{"exists":"c"}}]}]})") << true;
+    QTest::newRow("bool eq") << QString(R"({"eq":["on",true]})") << true;
+    QTest::newRow("null ne") << QString(R"({"ne":["v",null]})") << true;
+    QTest::newRow("not an object") << QString(R"([{"eq":["a",1]}])") << false;
+    QTest::newRow("two operators") << QString(R"({"eq":["a",1],"ne":["b",2]})") << false;
+    QTest::newRow("empty object") << QString("{}") << false;
+    QTest::newRow("unknown operator") << QString(R"({"like":["a","x%"]})") << false;
+    QTest::newRow("empty and") << QString(R"({"and":[]})") << false;
+    QTest::newRow("or of a filter") << QString(R"({"or":{"eq":["a",1]}})") << false;
+    QTest::newRow("bad operand deep down") << QString(R"({"and":[{"eq":["a",1]},{"not":{"gt":["b"]}}]})") << false;
+    QTest::newRow("one argument") << QString(R"({"eq":["a"]})") << false;
+    QTest::newRow("path not a string") << QString(R"({"eq":[1,1]})") << false;
+    QTest::newRow("empty path") << QString(R"({"eq":["",1]})") << false;
+    QTest::newRow("array value") << QString(R"({"eq":["a",[1]]})") << false;
+    QTest::newRow("ordered bool") << QString(R"({"gt":["a",true]})") << false;
+    QTest::newRow("ordered null") << QString(R"({"lte":["a",null]})") << false;
+    QTest::newRow("exists without path") << QString(R"({"exists":1})") << false;
+}
+
+void TestPayloadFilter::compilesExpressions()
+{
+    QFETCH(QString, filter);
+    QFETCH(bool, valid);
+
+    PayloadFilter compiled;
+    QString errorMessage;
+    QCOMPARE(PayloadFilter::compile(expression(filter), &compiled, &errorMessage), valid);
+    QCOMPARE(errorMessage.isEmpty(), valid);
+    if (!valid)
+    {
+        // a rejected expression leaves a filter matching everything
+        QVERIFY(compiled.isEmpty());
+    }
+}
+
+void TestPayloadFilter::matchesPayloads_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QString>("payload");
+    QTest::addColumn<bool>("matched");
+
+    const QString vehicle(R"({"speed":92.5,"state":"moving","on":true,"pos":{"lat":52.1},"tags":["a","b"],"note":null})");
+    QTest::newRow("gt number") << QString(R"({"gt":["speed",80]})") << vehicle << true;
+    QTest::newRow("lte number") << QString(R"({"lte":["speed",92.5]})") << vehicle << true;
+    QTest::newRow("lt number") << QString(R"({"lt":["speed",92.5]})") << vehicle << false;
+    QTest::newRow("nested path") << QString(R"({"gte":["pos.lat",52]})") << vehicle << true;
+    QTest::newRow("array element") << QString(R"({"eq":["tags.1","b"]})") << vehicle << true;
+    QTest::newRow("string order") << QString(R"({"lt":["state","parked"]})") << vehicle << true;
+    QTest::newRow("bool") << QString(R"({"eq":["on",true]})") << vehicle << true;
+    QTest::newRow("bool ne") << QString(R"({"ne":["on",true]})") << vehicle << false;
+    QTest::newRow("null") << QString(R"({"eq":["note",null]})") << vehicle << true;
+    QTest::newRow("number against string") << QString(R"({"eq":["state",1]})") << vehicle << false;
+    QTest::newRow("string against number") << QString(R"({"gt":["speed","1"]})") << vehicle << false;
+    QTest::newRow("ne on a missing path") << QString(R"({"ne":["missing",1]})") << vehicle << false;
+    QTest::newRow("ne on another type") << QString(R"({"ne":["state",1]})") << vehicle << false;
+    QTest::newRow("exists") << QString(R"({"exists":"pos.lat"})") << vehicle << true;
+    QTest::newRow("exists null") << QString(R"({"exists":"note"})") << vehicle << true;
+    QTest::newRow("not exists") << QString(R"({"not":{"exists":"pos.lon"}})") << vehicle << true;
+    QTest::newRow("and") << QString(R"({"and":[{"gt":["speed",80]},{"not":{"eq":["state","parked"]}}]})") << vehicle << true;
+    QTest::newRow("and short") << QString(R"({"and":[{"gt":["speed",80]},{"eq":["state","parked"]}]})") << vehicle << false;
+    QTest::newRow("or") << QString(R"({"or":[{"eq":["state","parked"]},{"eq":["on",true]}]})") << vehicle << true;
+    QTest::newRow("escaped string") << QString(R"({"eq":["s","a\"é"]})") << QString(R"({"s":"a\"é"})") << true;
+    QTest::newRow("not json") << QString(R"({"exists":"a"})") << QString("plain text") << false;
+}
+
+void TestPayloadFilter::matchesPayloads()
+{
+    QFETCH(QString, filter);
+    QFETCH(QString, payload);
+    QFETCH(bool, matched);
+
+    PayloadFilter compiled;
+    QString errorMessage;
+    QVERIFY2(PayloadFilter::compile(expression(filter), &compiled, &errorMessage), qPrintable(errorMessage));
+    QCOMPARE(compiled.matches(payload.toStdString()), matched);
+}
+
+void TestPayloadFilter::matchesEverythingWithoutAnExpression()
+{
+    PayloadFilter compiled;
+    QString errorMessage;
+    QVERIFY(PayloadFilter::compile(QJsonValue(QJsonValue::Undefined), &compiled, &errorMessage));
+    QVERIFY(compiled.isEmpty());
+    QVERIFY(compiled.matches("anything"));
+    QVERIFY(PayloadFilter::compile(QJsonValue(QJsonValue::Null), &compiled, &errorMessage));
+    QVERIFY(compiled.matches(""));
+}
+
+QTEST_GUILESS_MAIN(TestPayloadFilter)
+#include "tst_payloadfilter.moc"
@@ -0,0 +1,17 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_payloadpath
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_payloadpath.cpp \
+    ../../src/payloadpath.cpp \
+    ../../src/responsewriter.cpp
+
+HEADERS += \
+    ../../src/payloadpath.h \
+    ../../src/responsewriter.h
@@ -0,0 +1,95 @@
+#include <QtTest>
+#include <string>
+#include <string_view>
+#include "payloadpath.h"
+
+// Dotted paths resolved against payload text, and the projections built
+// from them.
+class TestPayloadPath : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void findsTheValueAtThePath_data();
+    void findsTheValueAtThePath();
+    void convertsScalars();
+    void projectsTheGivenFields();
+};
+
+void TestPayloadPath::findsTheValueAtThePath_data()
+{
+    QTest::addColumn<QString>("payload");
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<bool>("exists");
+    // JSON text of the value
+    QTest::addColumn<QString>("value");
+
+    QTest::newRow("top level") << QString(R"({"a":1,"b":2})") << QString("b") << true << QString("2");
+    QTest::newRow("nested") << QString(R"({"pos":{"lat":52.1,"lon":4.3}})") << QString("pos.lon") << true << QString("4.3");
+    QTest::newRow("object value") << QString(R"({"pos":{"lat":52.1}})") << QString("pos") << true << QString(R"({"lat":52.1})");
+    QTest::newRow("array index") << QString(R"({"cores":[{"load":1},{"load":2}]})") << QString("cores.1.load") << true << QString("2");
+    QTest::newRow("whitespace") << QString(" {\n \"a\" : { \"b\" :\t[ 1 , \"x\" ] } }") << QString("a.b.1") << true << QString(R"("x")");
+    QTest::newRow("skips nested values") << QString(R"({"a":{"v":[1,{"v":2}],"s":"}]\"v"},"v":3})") << QString("v") << true << QString("3");
+    QTest::newRow("escaped key") << QString(R"({"a\"b":1,"c":2})") << QString("c") << true << QString("2");
+    QTest::newRow("string") << QString(R"({"s":"a\"b"})") << QString("s") << true << QString(R"("a\"b")");
+    QTest::newRow("negative number") << QString(R"({"n":-1.5e3})") << QString("n") << true << QString("-1.5e3");
+    QTest::newRow("null") << QString(R"({"n":null})") << QString("n") << true << QString("null");
+    QTest::newRow("missing key") << QString(R"({"a":1})") << QString("b") << false << QString();
+    QTest::newRow("index past the end") << QString(R"({"a":[1,2]})") << QString("a.2") << false << QString();
+    QTest::newRow("index into an object") << QString(R"({"a":{"0":1}})") << QString("a.0") << true << QString("1");
+    QTest::newRow("key into an array") << QString(R"({"a":[1]})") << QString("a.x") << false << QString();
+    QTest::newRow("through a scalar") << QString(R"({"a":1})") << QString("a.b") << false << QString();
+    QTest::newRow("not json") << QString("plain text") << QString("a") << false << QString();
+    QTest::newRow("truncated") << QString(R"({"a":{"b":)") << QString("a.b") << false << QString();
+    QTest::newRow("unterminated string") << QString(R"({"a":"b)") << QString("a") << false << QString();
+}
+
+void TestPayloadPath::findsTheValueAtThePath()
+{
+    QFETCH(QString, payload);
+    QFETCH(QString, path);
+    QFETCH(bool, exists);
+    QFETCH(QString, value);
+
+    const std::string text = payload.toStdString();
+    std::string_view found;
+    QCOMPARE(PayloadPath(path).find(text, &found), exists);
+    if (exists)
+    {
+        QCOMPARE(QString::fromStdString(std::string(found)), value);
+    }
+}
+
+void TestPayloadPath::convertsScalars()
+{
+    double number = 0;
+    QVERIFY(PayloadPath::toNumber("-2.5e2", &number));
+    QCOMPARE(number, -250.0);
+    QVERIFY(!PayloadPath::toNumber("\"1\"", &number));
+    QVERIFY(!PayloadPath::toNumber("true", &number));
+    QVERIFY(!PayloadPath::toNumber("1x", &number));
+
+    std::string text;
+    QVERIFY(PayloadPath::toString(R"("a\"b\\c\né😀")", &text));
+    QCOMPARE(QString::fromStdString(text), QString::fromUtf8("a\"b\\c\n\xc3\xa9\xf0\x9f\x98\x80"));
+    QVERIFY(!PayloadPath::toString("1", &text));
+    QVERIFY(!PayloadPath::toString(R"("\x")", &text));
+
+    QVERIFY(PayloadPath("a.b").findNumber(R"({"a":{"b":7}})", &number));
+    QCOMPARE(number, 7.0);
+    QVERIFY(!PayloadPath("a").findNumber(R"({"a":"7"})", &number));
+}
+
+void TestPayloadPath::projectsTheGivenFields()
+{
+    const PayloadProjection projection(QStringList({"speed", "pos.lat", "missing", "tags.1", "a\"b"}));
+    const std::string payload = R"({"pos":{"lat":52.1,"lon":4.3},"speed":12,"tags":["x",{"y":1}],"a\"b":true})";
+    QCOMPARE(projection.apply(payload), QByteArray(R"({"speed":12,"pos.lat":52.1,"tags.1":{"y":1},"a\"b":true})"));
+
+    // nothing on the paths leaves an empty object
+    QCOMPARE(projection.apply(R"({"other":1})"), QByteArray("{}"));
+    QCOMPARE(projection.apply("not json"), QByteArray("{}"));
+}
+
+QTEST_GUILESS_MAIN(TestPayloadPath)
+#include "tst_payloadpath.moc"
@@ -0,0 +1,14 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_persistentmap
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_persistentmap.cpp
+
+HEADERS += \
+    ../../src/persistentmap.h
@@ -0,0 +1,380 @@
+#include <QtTest>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+#include "persistentmap.h"
+
+// Entries of a persistent map through inserts, erases and copies, checked
+// against a std::map given the same changes.
+class TestPersistentMap : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void keepsEntriesInOrder_data();
+    void keepsEntriesInOrder();
+    void mergesNodesAsEntriesAreErased_data();
+    void mergesNodesAsEntriesAreErased();
+    void copiesKeepTheirEntries();
+    void walksFromAKey_data();
+    void walksFromAKey();
+    void stopsWalkingWhenTold();
+    void copiesCanBeReadOnOtherThreads();
+
+private:
+    using Map = PersistentMap<int, QString>;
+
+    // a node splits past this many entries
+    static constexpr size_t NodeEntries = 64;
+
+    // 0..count-1 in the given order: "ascending", "descending" or "shuffled"
+    static std::vector<int> keys(const QString& order, int count);
+    // "key=value" for each entry, in the order visited
+    static QStringList describe(const Map& map);
+    static QStringList describe(const std::map<int, QString>& map);
+    // Checks the leaves hold the entries in order, none empty or overfull.
+    static void checkLeaves(const Map& map);
+};
+
+std::vector<int> TestPersistentMap::keys(const QString &order, int count)
+{
+    std::vector<int> result(count);
+    for (int i = 0; i < count; ++i)
+    {
+        result[i] = i;
+    }
+    if (order == "descending")
+    {
+        std::reverse(result.begin(), result.end());
+    }
+    else if (order == "shuffled")
+    {
+        std::shuffle(result.begin(), result.end(), std::mt19937(count));
+    }
+    return result;
+}
+
+QStringList TestPersistentMap::describe(const Map &map)
+{
+    QStringList result;
+    map.forEach([&](int key, const QString &value)
+    {
+        result.append(QString("%1=%2").arg(key).arg(value));
+        return true;
+    });
+    return result;
+}
+
+QStringList TestPersistentMap::describe(const std::map<int, QString> &map)
+{
+    QStringList result;
+    for (const auto &[key, value] : map)
+    {
+        result.append(QString("%1=%2").arg(key).arg(value));
+    }
+    return result;
+}
+
+void TestPersistentMap::checkLeaves(const Map &map)
+{
+    QStringList entries;
+    for (const Map::Leaf &leaf : map.leaves())
+    {
+        QVERIFY(!leaf.keys->empty());
+        QVERIFY(leaf.keys->size() <= NodeEntries);
+        QCOMPARE(leaf.values->size(), leaf.keys->size());
+        for (size_t i = 0; i < leaf.keys->size(); ++i)
+        {
+            entries.append(QString("%1=%2").arg((*leaf.keys)[i]).arg((*leaf.values)[i]));
+        }
+    }
+    QCOMPARE(entries, describe(map));
+}
+
+void TestPersistentMap::keepsEntriesInOrder_data()
+{
+    QTest::addColumn<QString>("order");
+    QTest::addColumn<int>("count");
+
+    for (const QString order : {"ascending", "descending", "shuffled"})
+    {
+        // empty, one leaf, a leaf just split, and a few levels of branches
+        for (const int count : {0, 1, int(NodeEntries), int(NodeEntries) + 1, 20000})
+        {
+            QTest::newRow(qPrintable(QString("%1 %2").arg(order).arg(count))) << order << count;
+        }
+    }
+}
+
+void TestPersistentMap::keepsEntriesInOrder()
+{
+    QFETCH(QString, order);
+    QFETCH(int, count);
+
+    Map map;
+    std::map<int, QString> expected;
+    for (const int key : keys(order, count))
+    {
+        map.insert(key, QString::number(key));
+        expected[key] = QString::number(key);
+    }
+    // replacing values adds no entries
+    for (int key = 0; key < count; key += 3)
+    {
+        map.insert(key, "replaced");
+        expected[key] = "replaced";
+    }
+
+    QCOMPARE(map.size(), expected.size());
+    QCOMPARE(map.isEmpty(), count == 0);
+    QCOMPARE(describe(map), describe(expected));
+    checkLeaves(map);
+    for (int key = -1; key <= count; ++key)
+    {
+        const QString *value = map.find(key);
+        const auto it = expected.find(key);
+        QCOMPARE(value != nullptr, it != expected.end());
+        if (value != nullptr)
+        {
+            QCOMPARE(*value, it->second);
+        }
+    }
+}
+
+void TestPersistentMap::mergesNodesAsEntriesAreErased_data()
+{
+    QTest::addColumn<QString>("order");
+
+    QTest::newRow("ascending") << QString("ascending");
+    QTest::newRow("descending") << QString("descending");
+    QTest::newRow("shuffled") << QString("shuffled");
+}
+
+void TestPersistentMap::mergesNodesAsEntriesAreErased()
+{
+    QFETCH(QString, order);
+
+    const int count = 20000;
+    Map map;
+    std::map<int, QString> expected;
+    for (const int key : keys("shuffled", count))
+    {
+        map.insert(key, QString::number(key));
+        expected[key] = QString::number(key);
+    }
+    const size_t fullLeaves = map.leaves().size();
+
+    // keeps one entry in ten, spread over every leaf
+    for (const int key : keys(order, count))
+    {
+        if (key % 10 != 0)
+        {
+            QVERIFY(map.erase(key));
+            expected.erase(key);
+        }
+    }
+    QVERIFY(!map.erase(1));
+    QVERIFY(!map.erase(count));
+    QCOMPARE(map.size(), expected.size());
+    QCOMPARE(describe(map), describe(expected));
+    checkLeaves(map);
+    // without merging, every leaf would be left holding a few entries
+    QVERIFY2(map.leaves().size() * 2 < fullLeaves, qPrintable(QString("%1 of %2 leaves").arg(map.leaves().size()).arg(fullLeaves)));
+
+    for (const int key : keys(order, count))
+    {
+        if (key % 10 == 0)
+        {
+            QVERIFY(map.erase(key));
+        }
+    }
+    QVERIFY(map.isEmpty());
+    QCOMPARE(map.size(), size_t(0));
+    QVERIFY(map.leaves().empty());
+    QCOMPARE(map.find(0), nullptr);
+
+    // and is usable again
+    map.insert(7, "seven");
+    QCOMPARE(describe(map), QStringList({"7=seven"}));
+}
+
+void TestPersistentMap::copiesKeepTheirEntries()
+{
+    Map map;
+    std::map<int, QString> expected;
+    std::vector<std::pair<Map, std::map<int, QString>>> copies;
+    std::mt19937 random(1);
+    // batches of inserts, replacements and erases, copied after each
+    for (int batch = 0; batch < 50; ++batch)
+    {
+        for (int i = 0; i < 200; ++i)
+        {
+            const int key = int(random() % 5000);
+            if (random() % 3 == 0)
+            {
+                QCOMPARE(map.erase(key), expected.erase(key) == 1);
+            }
+            else
+            {
+                const QString value = QString("%1/%2").arg(key).arg(batch);
+                map.insert(key, value);
+                expected[key] = value;
+            }
+        }
+        copies.emplace_back(map, expected);
+    }
+
+    // changing a copy leaves the map and the other copies alone
+    Map changed = copies[10].first;
+    changed.insert(-1, "new");
+    changed.erase(changed.leaves().front().keys->front());
+    changed.clear();
+    QVERIFY(changed.isEmpty());
+
+    map.clear();
+    QVERIFY(map.isEmpty());
+    for (const auto &[copy, entries] : copies)
+    {
+        QCOMPARE(copy.size(), entries.size());
+        QCOMPARE(describe(copy), describe(entries));
+        checkLeaves(copy);
+    }
+}
+
+void TestPersistentMap::walksFromAKey_data()
+{
+    QTest::addColumn<int>("from");
+
+    // the keys are the even numbers in [0, 1000)
+    QTest::newRow("before the first") << -5;
+    QTest::newRow("first") << 0;
+    QTest::newRow("present") << 500;
+    QTest::newRow("absent") << 501;
+    QTest::newRow("first of a leaf") << -1;
+    QTest::newRow("past a leaf") << -2;
+    QTest::newRow("last") << 998;
+    QTest::newRow("past the last") << 999;
+}
+
+void TestPersistentMap::walksFromAKey()
+{
+    QFETCH(int, from);
+
+    Map map;
+    std::map<int, QString> expected;
+    for (int key = 0; key < 1000; key += 2)
+    {
+        map.insert(key, QString::number(key));
+        expected[key] = QString::number(key);
+    }
+    // the first key of the second leaf, and the one after the first's last
+    const std::vector<Map::Leaf> leaves = map.leaves();
+    QVERIFY(leaves.size() > 2);
+    if (from == -1)
+    {
+        from = leaves[1].keys->front();
+    }
+    else if (from == -2)
+    {
+        from = leaves[0].keys->back() + 1;
+    }
+
+    QStringList walked;
+    map.forEachFrom(from, [&](int key, const QString &value)
+    {
+        walked.append(QString("%1=%2").arg(key).arg(value));
+        return true;
+    });
+    QStringList rest;
+    for (auto it = expected.lower_bound(from); it != expected.end(); ++it)
+    {
+        rest.append(QString("%1=%2").arg(it->first).arg(it->second));
+    }
+    QCOMPARE(walked, rest);
+}
+
+void TestPersistentMap::stopsWalkingWhenTold()
+{
+    Map map;
+    for (int key = 0; key < 1000; ++key)
+    {
+        map.insert(key, QString::number(key));
+    }
+    // past a leaf boundary, so the stop has to leave the branches too
+    QList<int> walked;
+    map.forEachFrom(50, [&](int key, const QString &)
+    {
+        walked.append(key);
+        return key < 149;
+    });
+    QCOMPARE(walked.size(), 100);
+    QCOMPARE(walked.front(), 50);
+    QCOMPARE(walked.back(), 149);
+
+    walked.clear();
+    map.forEach([&](int key, const QString &)
+    {
+        walked.append(key);
+        return false;
+    });
+    QCOMPARE(walked, QList<int>({0}));
+}
+
+void TestPersistentMap::copiesCanBeReadOnOtherThreads()
+{
+    Map map;
+    for (int key = 0; key < 10000; ++key)
+    {
+        map.insert(key, QString::number(key));
+    }
+    // each reader walks its copy while the map keeps changing underneath
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> readers;
+    for (int round = 0; round < 8; ++round)
+    {
+        const Map copy = map;
+        const size_t size = copy.size();
+        readers.emplace_back([copy, size, &mismatches]()
+        {
+            for (int pass = 0; pass < 5; ++pass)
+            {
+                size_t seen = 0;
+                int previous = -1;
+                copy.forEach([&](int key, const QString &value)
+                {
+                    if (key <= previous || value != QString::number(key))
+                    {
+                        ++mismatches;
+                    }
+                    previous = key;
+                    ++seen;
+                    return true;
+                });
+                if (seen != size)
+                {
+                    ++mismatches;
+                }
+            }
+        });
+        for (int key = round; key < 10000; key += 8)
+        {
+            map.erase(key);
+        }
+        for (int key = 10000 + round * 1000; key < 10000 + (round + 1) * 1000; ++key)
+        {
+            map.insert(key, QString::number(key));
+        }
+    }
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+    QCOMPARE(mismatches.load(), 0);
+    QCOMPARE(map.size(), size_t(8000));
+}
+
+QTEST_GUILESS_MAIN(TestPersistentMap)
+#include "tst_persistentmap.moc"
@@ -0,0 +1,29 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_querydocument
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_querydocument.cpp \
+    ../../src/cborcodec.cpp \
+    ../../src/datarecord.cpp \
+    ../../src/documentseries.cpp \
+    ../../src/payloadfilter.cpp \
+    ../../src/payloadpath.cpp \
+    ../../src/querydocument.cpp \
+    ../../src/responsewriter.cpp \
+    ../../src/seriesqueries.cpp
+
+HEADERS += \
+    ../../src/cborcodec.h \
+    ../../src/datarecord.h \
+    ../../src/documentseries.h \
+    ../../src/payloadfilter.h \
+    ../../src/payloadpath.h \
+    ../../src/querydocument.h \
+    ../../src/responsewriter.h \
+    ../../src/seriesqueries.h
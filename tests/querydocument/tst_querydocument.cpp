@@ -0,0 +1,119 @@
+#include <QtTest>
+#include <limits>
+#include "querydocument.h"
+
+// qdoc requests: which option combinations are accepted, and the cursors
+// that resume a paged scan.
+class TestQueryDocument : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void acceptsOptionCombinations_data();
+    void acceptsOptionCombinations();
+    void decodesTheCursorItEncoded();
+    void rejectsForeignCursors_data();
+    void rejectsForeignCursors();
+    void resumesAfterTheLastRecord();
+
+private:
+    static QueryDocument query(const QString& doc, bool reverse, const QString& cursor = QString());
+};
+
+QueryDocument TestQueryDocument::query(const QString &doc, bool reverse, const QString &cursor)
+{
+    bool ok = false;
+    QueryDocument query = QueryDocument::fromJson(
+        QString(R"({"col":"metrics","doc":"%1","from":0,"to":1000,"limit":10,"reverse":%2,"cursor":"%3"})")
+            .arg(doc, reverse ? "true" : "false", cursor),
+        &ok);
+    return query;
+}
+
+void TestQueryDocument::acceptsOptionCombinations_data()
+{
+    QTest::addColumn<QString>("json");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("plain") << QString(R"({"col":"m","doc":"d","from":0,"to":10})") << true;
+    QTest::newRow("cursor") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"limit":5,"cursor":"x"})") << true;
+    QTest::newRow("stream") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"stream":true})") << true;
+    QTest::newRow("downsample") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"downsample":{"points":5,"field":"v"}})") << true;
+    QTest::newRow("downsample first") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"downsample":{"points":5,"method":"first"}})") << true;
+    QTest::newRow("lttb without field") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"downsample":{"points":5}})") << false;
+    QTest::newRow("unknown method") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"downsample":{"points":5,"method":"avg","field":"v"}})") << false;
+    QTest::newRow("downsample cursor") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"cursor":"x","downsample":{"points":5,"field":"v"}})") << false;
+    QTest::newRow("downsample stream") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"stream":true,"downsample":{"points":5,"field":"v"}})") << false;
+    QTest::newRow("negative points") << QString(R"({"col":"m","doc":"d","from":0,"to":10,"downsample":{"points":-1,"field":"v"}})") << false;
+    QTest::newRow("from after to") << QString(R"({"col":"m","doc":"d","from":20,"to":10})") << false;
+    QTest::newRow("no document") << QString(R"({"col":"m","from":0,"to":10})") << false;
+}
+
+void TestQueryDocument::acceptsOptionCombinations()
+{
+    QFETCH(QString, json);
+    QFETCH(bool, valid);
+
+    bool ok = !valid;
+    QueryDocument::fromJson(json, &ok);
+    QCOMPARE(ok, valid);
+}
+
+void TestQueryDocument::decodesTheCursorItEncoded()
+{
+    const qint64 min = std::numeric_limits<qint64>::min();
+    const qint64 max = std::numeric_limits<qint64>::max();
+    for (const qint64 ts : {qint64(0), qint64(1700000000000), qint64(-5), min + 1, max - 1})
+    {
+        for (const bool reverse : {false, true})
+        {
+            const QString doc = QString::fromUtf8("region-1/caf\xc3\xa9:cpu");
+            qint64 decoded = 0;
+            QVERIFY(query(doc, reverse, QueryDocument::encodeCursor(doc, ts, reverse)).decodeCursor(&decoded));
+            QCOMPARE(decoded, ts);
+        }
+    }
+}
+
+void TestQueryDocument::rejectsForeignCursors_data()
+{
+    QTest::addColumn<QString>("cursor");
+    QTest::addColumn<bool>("reverse");
+
+    QTest::newRow("other document") << QueryDocument::encodeCursor("memory", 10, false) << false;
+    QTest::newRow("document prefix") << QueryDocument::encodeCursor("cp", 10, false) << false;
+    QTest::newRow("other direction") << QueryDocument::encodeCursor("cpu", 10, true) << false;
+    QTest::newRow("not base64") << QString("!!!") << false;
+    QTest::newRow("no separator") << QString::fromLatin1(QByteArray("f:10").toBase64(QByteArray::Base64UrlEncoding)) << false;
+    QTest::newRow("not a number") << QString::fromLatin1(QByteArray("f:1x:cpu").toBase64(QByteArray::Base64UrlEncoding)) << false;
+    // nothing follows these, and resuming past them would overflow
+    QTest::newRow("last forward") << QueryDocument::encodeCursor("cpu", std::numeric_limits<qint64>::max(), false) << false;
+    QTest::newRow("last reverse") << QueryDocument::encodeCursor("cpu", std::numeric_limits<qint64>::min(), true) << true;
+}
+
+void TestQueryDocument::rejectsForeignCursors()
+{
+    QFETCH(QString, cursor);
+    QFETCH(bool, reverse);
+
+    qint64 ts = 0;
+    QVERIFY(!query("cpu", reverse, cursor).decodeCursor(&ts));
+}
+
+void TestQueryDocument::resumesAfterTheLastRecord()
+{
+    QueryDocument forward = query("cpu", false);
+    QVERIFY(forward.resumeAfter(500));
+    QCOMPARE(forward.from, qint64(501));
+    QCOMPARE(forward.to, qint64(1000));
+    QVERIFY(!forward.resumeAfter(std::numeric_limits<qint64>::max()));
+
+    QueryDocument reverse = query("cpu", true);
+    QVERIFY(reverse.resumeAfter(500));
+    QCOMPARE(reverse.from, qint64(0));
+    QCOMPARE(reverse.to, qint64(499));
+    QVERIFY(!reverse.resumeAfter(std::numeric_limits<qint64>::min()));
+}
+
+QTEST_GUILESS_MAIN(TestQueryDocument)
+#include "tst_querydocument.moc"
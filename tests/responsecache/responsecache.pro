@@ -0,0 +1,15 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_responsecache
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_responsecache.cpp \
+    ../../src/responsecache.cpp
+
+HEADERS += \
+    ../../src/responsecache.h
@@ -0,0 +1,186 @@
+#include <QtTest>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "responsecache.h"
+
+// Cached responses by request key and change stamp, and reads of the same
+// key computed once.
+class TestResponseCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void hitsOnlyTheVersionItWasStoredWith();
+    void keepsNewerEntriesFromOlderReads();
+    void computesConcurrentMissesOnce();
+    void answersWaitersAcrossThreads();
+    void doesNotWaitOnAnotherVersion();
+    void evictsTheLeastRecentlyUsed();
+
+private:
+    // a waiter that should never be called
+    static ResponseCache::Waiter unexpected();
+};
+
+ResponseCache::Waiter TestResponseCache::unexpected()
+{
+    return [](const QByteArray &) { QFAIL("waiter called"); };
+}
+
+void TestResponseCache::hitsOnlyTheVersionItWasStoredWith()
+{
+    ResponseCache cache;
+    QByteArray response;
+    QCOMPARE(cache.lookup("qry", 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+    cache.insert("qry", 1, "one");
+
+    QCOMPARE(cache.lookup("qry", 1, &response, unexpected()), ResponseCache::Lookup::Hit);
+    QCOMPARE(response, QByteArray("one"));
+    QCOMPARE(cache.lookup("other", 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+
+    // a write moved the stamp on
+    QCOMPARE(cache.lookup("qry", 2, &response, unexpected()), ResponseCache::Lookup::Miss);
+    cache.insert("qry", 2, "two");
+    QCOMPARE(cache.lookup("qry", 2, &response, unexpected()), ResponseCache::Lookup::Hit);
+    QCOMPARE(response, QByteArray("two"));
+}
+
+void TestResponseCache::keepsNewerEntriesFromOlderReads()
+{
+    ResponseCache cache;
+    QByteArray response;
+    QCOMPARE(cache.lookup("qry", 5, &response, unexpected()), ResponseCache::Lookup::Miss);
+    cache.insert("qry", 5, "five");
+
+    // a reader on an older view neither gets nor replaces the newer response
+    QCOMPARE(cache.lookup("qry", 4, &response, unexpected()), ResponseCache::Lookup::Miss);
+    cache.insert("qry", 4, "four");
+    QCOMPARE(cache.lookup("qry", 5, &response, unexpected()), ResponseCache::Lookup::Hit);
+    QCOMPARE(response, QByteArray("five"));
+}
+
+void TestResponseCache::computesConcurrentMissesOnce()
+{
+    ResponseCache cache;
+    QByteArray response;
+    QList<QByteArray> answered;
+    const auto waiter = [&answered](const QByteArray &computed) { answered.append(computed); };
+
+    QCOMPARE(cache.lookup("qry", 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+    QCOMPARE(cache.lookup("qry", 1, &response, waiter), ResponseCache::Lookup::Pending);
+    QCOMPARE(cache.lookup("qry", 1, &response, waiter), ResponseCache::Lookup::Pending);
+    QVERIFY(answered.isEmpty());
+
+    cache.insert("qry", 1, "computed");
+    QCOMPARE(answered, QList<QByteArray>({"computed", "computed"}));
+    QCOMPARE(cache.lookup("qry", 1, &response, unexpected()), ResponseCache::Lookup::Hit);
+
+    // the waiters get a response too large to keep all the same
+    ResponseCache small(1600);
+    answered.clear();
+    QCOMPARE(small.lookup("large", 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+    QCOMPARE(small.lookup("large", 1, &response, waiter), ResponseCache::Lookup::Pending);
+    small.insert("large", 1, QByteArray(1000, 'x'));
+    QCOMPARE(answered, QList<QByteArray>({QByteArray(1000, 'x')}));
+    QCOMPARE(small.lookup("large", 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+}
+
+void TestResponseCache::answersWaitersAcrossThreads()
+{
+    ResponseCache cache;
+    const int readers = 8;
+    std::atomic<int> computed(0);
+    std::atomic<int> answered(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; ++i)
+    {
+        threads.emplace_back([&]()
+                             {
+                                 while (!go.load())
+                                 {
+                                     std::this_thread::yield();
+                                 }
+                                 QByteArray response;
+                                 const auto waiter = [&answered](const QByteArray &result)
+                                 {
+                                     if (result == "computed")
+                                     {
+                                         ++answered;
+                                     }
+                                 };
+                                 switch (cache.lookup("qry", 1, &response, waiter))
+                                 {
+                                 case ResponseCache::Lookup::Hit:
+                                     if (response == "computed")
+                                     {
+                                         ++answered;
+                                     }
+                                     break;
+                                 case ResponseCache::Lookup::Pending:
+                                     break;
+                                 case ResponseCache::Lookup::Miss:
+                                     ++computed;
+                                     // long enough for the others to pile up
+                                     std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                                     cache.insert("qry", 1, "computed");
+                                     ++answered;
+                                     break;
+                                 }
+                             });
+    }
+    go = true;
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    QCOMPARE(computed.load(), 1);
+    QCOMPARE(answered.load(), readers);
+}
+
+void TestResponseCache::doesNotWaitOnAnotherVersion()
+{
+    ResponseCache cache;
+    QByteArray response;
+    QList<QByteArray> answered;
+    const auto waiter = [&answered](const QByteArray &computed) { answered.append(computed); };
+
+    QCOMPARE(cache.lookup("qry", 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+    QCOMPARE(cache.lookup("qry", 1, &response, waiter), ResponseCache::Lookup::Pending);
+    // a newer read computes its own response instead of taking the older one
+    QCOMPARE(cache.lookup("qry", 2, &response, unexpected()), ResponseCache::Lookup::Miss);
+    cache.insert("qry", 2, "two");
+    QVERIFY(answered.isEmpty());
+
+    // the older one still answers its waiters, but does not replace the newer
+    cache.insert("qry", 1, "one");
+    QCOMPARE(answered, QList<QByteArray>({"one"}));
+    QCOMPARE(cache.lookup("qry", 2, &response, unexpected()), ResponseCache::Lookup::Hit);
+    QCOMPARE(response, QByteArray("two"));
+}
+
+void TestResponseCache::evictsTheLeastRecentlyUsed()
+{
+    // room for sixteen entries of a 5 byte key and 95 bytes, the largest kept
+    ResponseCache cache(16 * 100);
+    const QByteArray payload(95, 'x');
+    QByteArray response;
+    for (int i = 10; i < 26; ++i)
+    {
+        const QByteArray key = "key" + QByteArray::number(i);
+        QCOMPARE(cache.lookup(key, 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+        cache.insert(key, 1, payload);
+    }
+    QCOMPARE(cache.lookup("key10", 1, &response, unexpected()), ResponseCache::Lookup::Hit);
+
+    QCOMPARE(cache.lookup("key26", 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+    cache.insert("key26", 1, payload);
+    QCOMPARE(cache.lookup("key10", 1, &response, unexpected()), ResponseCache::Lookup::Hit);
+    QCOMPARE(cache.lookup("key12", 1, &response, unexpected()), ResponseCache::Lookup::Hit);
+    QCOMPARE(cache.lookup("key26", 1, &response, unexpected()), ResponseCache::Lookup::Hit);
+    QCOMPARE(cache.lookup("key11", 1, &response, unexpected()), ResponseCache::Lookup::Miss);
+}
+
+QTEST_GUILESS_MAIN(TestResponseCache)
+#include "tst_responsecache.moc"
@@ -0,0 +1,19 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_segmentstore
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_segmentstore.cpp \
+    ../../src/binarycodec.cpp \
+    ../../src/datarecord.cpp \
+    ../../src/segmentstore.cpp
+
+HEADERS += \
+    ../../src/binarycodec.h \
+    ../../src/datarecord.h \
+    ../../src/segmentstore.h
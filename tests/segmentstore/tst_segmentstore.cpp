@@ -0,0 +1,129 @@
+#include <QtTest>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <string>
+#include <utility>
+#include <vector>
+#include "segmentstore.h"
+
+// What a collection's segment files hold after commits, crashes mid-write
+// and rewrites.
+class TestSegmentStore : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void loadsCommittedSegmentBlocks();
+    void appendsAfterATornSegmentTail();
+    void failedRewriteKeepsTheOldSegments();
+
+private:
+    using Records = std::vector<std::pair<qint64, std::string>>;
+
+    static Records loadRecords(const QString& folder);
+    static QStringList segmentFiles(const QString& folder);
+};
+
+TestSegmentStore::Records TestSegmentStore::loadRecords(const QString &folder)
+{
+    Records records;
+    SegmentStore store(folder);
+    store.load([&records](const SegmentStore::Block &block)
+               {
+                   block.forEachRecord([&records](qint64 timestamp, std::string_view payload)
+                                       {
+                                           records.emplace_back(timestamp, std::string(payload));
+                                       });
+               });
+    return records;
+}
+
+QStringList TestSegmentStore::segmentFiles(const QString &folder)
+{
+    return QDir(folder).entryList(QStringList() << "*.seg", QDir::Files, QDir::Name);
+}
+
+void TestSegmentStore::loadsCommittedSegmentBlocks()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const std::string first = "first";
+    const std::string second = "second";
+    {
+        SegmentStore store(dir.path());
+        store.appendRecords("cpu", {DataRecord{10, first}, DataRecord{20, second}});
+        store.appendDeleteRange("cpu", 10, 10);
+        store.appendClearDocument("memory");
+        QVERIFY(store.commit());
+        QVERIFY(!store.hasPending());
+    }
+
+    SegmentStore store(dir.path());
+    std::vector<SegmentStore::BlockType> types;
+    QVERIFY(store.load([&types](const SegmentStore::Block &block) { types.push_back(block.type); }));
+    QVERIFY(types == std::vector<SegmentStore::BlockType>({SegmentStore::BlockType::Records, SegmentStore::BlockType::DeleteRange,
+                                                           SegmentStore::BlockType::ClearDocument}));
+    QVERIFY(loadRecords(dir.path()) == Records({{10, "first"}, {20, "second"}}));
+}
+
+void TestSegmentStore::appendsAfterATornSegmentTail()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const std::string payload = "payload";
+    {
+        SegmentStore store(dir.path());
+        store.appendRecords("cpu", {DataRecord{10, payload}});
+        QVERIFY(store.commit());
+    }
+    QFile file(dir.path() + "/" + segmentFiles(dir.path()).last());
+    QVERIFY(file.open(QIODevice::Append));
+    // the length of a block that never got written
+    file.write(QByteArray("\x40\x00\x00\x00torn", 8));
+    file.close();
+
+    // the next commit cuts the torn tail off instead of appending after it
+    {
+        SegmentStore store(dir.path());
+        QVERIFY(store.load([](const SegmentStore::Block &) {}));
+        store.appendRecords("cpu", {DataRecord{20, payload}});
+        QVERIFY(store.commit());
+    }
+
+    QVERIFY(loadRecords(dir.path()) == Records({{10, "payload"}, {20, "payload"}}));
+    QCOMPARE(segmentFiles(dir.path()).size(), 1);
+}
+
+void TestSegmentStore::failedRewriteKeepsTheOldSegments()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const std::string flushed = "flushed";
+    const std::string rewritten = "rewritten";
+    const std::string next = "next";
+    SegmentStore store(dir.path());
+    store.appendRecords("cpu", {DataRecord{10, flushed}});
+    QVERIFY(store.commit());
+    const QStringList before = segmentFiles(dir.path());
+    QCOMPARE(before.size(), 1);
+
+    // a directory where the rewrite's segment goes makes its commit fail
+    const QString blocked = QString("%1.seg").arg(before.last().section('.', 0, 0).toULongLong() + 1, 16, 10, QChar('0'));
+    QVERIFY(QDir(dir.path()).mkdir(blocked));
+    store.beginRewrite();
+    store.appendRecords("cpu", {DataRecord{10, rewritten}});
+    QVERIFY(!store.commit());
+    QVERIFY(!store.finishRewrite());
+    QVERIFY(!store.hasPending());
+    QVERIFY(QDir(dir.path()).rmdir(blocked));
+
+    // the next commit holds its own blocks only, not the rest of the rewrite
+    store.appendRecords("cpu", {DataRecord{20, next}});
+    QVERIFY(store.commit());
+    QVERIFY(loadRecords(dir.path()) == Records({{10, "flushed"}, {20, "next"}}));
+    QVERIFY(segmentFiles(dir.path()).contains(before.last()));
+}
+
+QTEST_GUILESS_MAIN(TestSegmentStore)
+#include "tst_segmentstore.moc"
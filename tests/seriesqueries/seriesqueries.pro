@@ -0,0 +1,29 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_seriesqueries
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_seriesqueries.cpp \
+    ../../src/aggregaterequest.cpp \
+    ../../src/cborcodec.cpp \
+    ../../src/datarecord.cpp \
+    ../../src/documentseries.cpp \
+    ../../src/payloadfilter.cpp \
+    ../../src/payloadpath.cpp \
+    ../../src/responsewriter.cpp \
+    ../../src/seriesqueries.cpp
+
+HEADERS += \
+    ../../src/aggregaterequest.h \
+    ../../src/cborcodec.h \
+    ../../src/datarecord.h \
+    ../../src/documentseries.h \
+    ../../src/payloadfilter.h \
+    ../../src/payloadpath.h \
+    ../../src/responsewriter.h \
+    ../../src/seriesqueries.h
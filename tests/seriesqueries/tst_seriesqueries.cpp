@@ -0,0 +1,327 @@
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include "aggregaterequest.h"
+#include "seriesqueries.h"
+
+// The per-document queries behind agg, qdoc and qry, run on small series
+// whose expected results can be worked out by hand.
+class TestSeriesQueries : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void limitsScansFromEitherEnd_data();
+    void limitsScansFromEitherEnd();
+    void filtersBeforeTheLimit();
+    void bucketsStartAtMultiplesOfTheWidth();
+    void bucketsNegativeTimestampsDown();
+    void aggregatesTheRangeIntoOneBucketForWidthZero();
+    void aggregatesOnlyRecordsHoldingTheField();
+    void parsesAggregateRequests_data();
+    void parsesAggregateRequests();
+    void bucketMethodsKeepOneRecordPerBucket();
+    void lttbKeepsTheEndsAndTheExtremes();
+    void lttbKeepsEverythingBelowThePointCount();
+    void downsamplesTheWidestRange();
+    void downsamplesOnlyMatchingRecords();
+
+private:
+    // A series with a {"v": value} payload at each timestamp.
+    static DocumentSeries numbers(const std::vector<std::pair<qint64, double>>& records);
+    static DocumentSeries payloads(const std::vector<std::pair<qint64, std::string>>& records);
+    static QList<qint64> timestamps(const QList<DataRecord>& records);
+    static void compareBucket(const AggregateBucket& bucket, qint64 start, qint64 count, double min, double max, double sum,
+                              double first, double last);
+};
+
+DocumentSeries TestSeriesQueries::numbers(const std::vector<std::pair<qint64, double>> &records)
+{
+    DocumentSeries series;
+    for (const auto &record : records)
+    {
+        series.insert(record.first, "{\"v\":" + std::to_string(record.second) + "}");
+    }
+    return series;
+}
+
+DocumentSeries TestSeriesQueries::payloads(const std::vector<std::pair<qint64, std::string>> &records)
+{
+    DocumentSeries series;
+    for (const auto &record : records)
+    {
+        series.insert(record.first, record.second);
+    }
+    return series;
+}
+
+QList<qint64> TestSeriesQueries::timestamps(const QList<DataRecord> &records)
+{
+    QList<qint64> result;
+    for (const DataRecord &record : records)
+    {
+        result.append(record.timestamp);
+    }
+    return result;
+}
+
+void TestSeriesQueries::compareBucket(const AggregateBucket &bucket, qint64 start, qint64 count, double min, double max,
+                                      double sum, double first, double last)
+{
+    QCOMPARE(bucket.start, start);
+    QCOMPARE(bucket.count, count);
+    QCOMPARE(bucket.min, min);
+    QCOMPARE(bucket.max, max);
+    QCOMPARE(bucket.sum, sum);
+    QCOMPARE(bucket.first, first);
+    QCOMPARE(bucket.last, last);
+}
+
+void TestSeriesQueries::limitsScansFromEitherEnd_data()
+{
+    QTest::addColumn<qint64>("from");
+    QTest::addColumn<qint64>("to");
+    QTest::addColumn<bool>("reverse");
+    QTest::addColumn<qint64>("limit");
+    QTest::addColumn<QList<qint64>>("expected");
+
+    QTest::newRow("latest") << qint64(0) << qint64(1000) << true << qint64(3) << QList<qint64>({50, 40, 30});
+    QTest::newRow("earliest") << qint64(0) << qint64(1000) << false << qint64(2) << QList<qint64>({10, 20});
+    QTest::newRow("latest before") << qint64(0) << qint64(35) << true << qint64(2) << QList<qint64>({30, 20});
+    QTest::newRow("earliest after") << qint64(25) << qint64(1000) << false << qint64(2) << QList<qint64>({30, 40});
+    QTest::newRow("limit past the range") << qint64(15) << qint64(45) << true << qint64(10) << QList<qint64>({40, 30, 20});
+    QTest::newRow("no limit") << qint64(0) << qint64(1000) << true << qint64(0) << QList<qint64>({50, 40, 30, 20, 10});
+    QTest::newRow("whole range") << std::numeric_limits<qint64>::min() << std::numeric_limits<qint64>::max() << true << qint64(1)
+                                 << QList<qint64>({50});
+    QTest::newRow("empty range") << qint64(41) << qint64(49) << true << qint64(3) << QList<qint64>();
+    QTest::newRow("inverted range") << qint64(40) << qint64(20) << false << qint64(3) << QList<qint64>();
+}
+
+void TestSeriesQueries::limitsScansFromEitherEnd()
+{
+    QFETCH(qint64, from);
+    QFETCH(qint64, to);
+    QFETCH(bool, reverse);
+    QFETCH(qint64, limit);
+    QFETCH(QList<qint64>, expected);
+
+    const DocumentSeries series = numbers({{10, 1}, {20, 2}, {30, 3}, {40, 4}, {50, 5}});
+    QCOMPARE(timestamps(recordsInRange(series, from, to, reverse, limit, nullptr)), expected);
+}
+
+void TestSeriesQueries::filtersBeforeTheLimit()
+{
+    std::vector<std::pair<qint64, double>> records;
+    for (qint64 ts = 1; ts <= 5000; ++ts)
+    {
+        records.push_back({ts, double(ts % 100)});
+    }
+    const DocumentSeries series = numbers(records);
+
+    // the limit counts matching records, not the ones scanned past
+    PayloadFilter filter;
+    QString errorMessage;
+    QVERIFY(PayloadFilter::compile(QJsonObject{{"eq", QJsonArray{"v", 7}}}, &filter, &errorMessage));
+    QCOMPARE(timestamps(recordsInRange(series, 0, 5000, true, 3, &filter)), QList<qint64>({4907, 4807, 4707}));
+    QCOMPARE(timestamps(recordsInRange(series, 0, 5000, false, 2, &filter)), QList<qint64>({7, 107}));
+}
+
+void TestSeriesQueries::bucketsStartAtMultiplesOfTheWidth()
+{
+    const DocumentSeries series = numbers({{5, 4}, {30, 1}, {59, 7}, {60, 2}, {119, 3}, {250, 9}, {400, 5}});
+
+    // the buckets start at multiples of the width, not at from, and the
+    // empty one between 120 and 240 is left out
+    const std::vector<AggregateBucket> buckets = aggregateSeries(series, 5, 399, 60, PayloadPath("v"));
+    QCOMPARE(buckets.size(), size_t(3));
+    compareBucket(buckets[0], 0, 3, 1, 7, 12, 4, 7);
+    compareBucket(buckets[1], 60, 2, 2, 3, 5, 2, 3);
+    compareBucket(buckets[2], 240, 1, 9, 9, 9, 9, 9);
+}
+
+void TestSeriesQueries::bucketsNegativeTimestampsDown()
+{
+    const DocumentSeries series = numbers({{-61, 1}, {-60, 2}, {-1, 3}, {0, 4}});
+
+    const std::vector<AggregateBucket> buckets = aggregateSeries(series, -100, 100, 60, PayloadPath("v"));
+    QCOMPARE(buckets.size(), size_t(3));
+    compareBucket(buckets[0], -120, 1, 1, 1, 1, 1, 1);
+    compareBucket(buckets[1], -60, 2, 2, 3, 5, 2, 3);
+    compareBucket(buckets[2], 0, 1, 4, 4, 4, 4, 4);
+}
+
+void TestSeriesQueries::aggregatesTheRangeIntoOneBucketForWidthZero()
+{
+    const DocumentSeries series = numbers({{5, 100}, {10, 1}, {50, 3}, {100, 2}, {101, 100}});
+
+    // both ends of the range are included
+    const std::vector<AggregateBucket> buckets = aggregateSeries(series, 10, 100, 0, PayloadPath("v"));
+    QCOMPARE(buckets.size(), size_t(1));
+    compareBucket(buckets[0], 10, 3, 1, 3, 6, 1, 2);
+
+    QVERIFY(aggregateSeries(series, 200, 300, 0, PayloadPath("v")).empty());
+}
+
+void TestSeriesQueries::aggregatesOnlyRecordsHoldingTheField()
+{
+    const DocumentSeries series = payloads({{10, "{\"v\":1}"},
+                                            {20, "{\"w\":2}"},
+                                            {30, "{\"v\":\"3\"}"},
+                                            {40, "{\"v\":null}"},
+                                            {50, "not json"},
+                                            {60, "{\"v\":-2.5}"}});
+
+    const std::vector<AggregateBucket> numeric = aggregateSeries(series, 0, 100, 0, PayloadPath("v"));
+    QCOMPARE(numeric.size(), size_t(1));
+    compareBucket(numeric[0], 0, 2, -2.5, 1, -1.5, 1, -2.5);
+
+    // without a field every record counts
+    const std::vector<AggregateBucket> counted = aggregateSeries(series, 0, 100, 30, PayloadPath());
+    QCOMPARE(counted.size(), size_t(3));
+    QCOMPARE(counted[0].count, qint64(2));
+    QCOMPARE(counted[1].count, qint64(3));
+    QCOMPARE(counted[2].count, qint64(1));
+}
+
+void TestSeriesQueries::parsesAggregateRequests_data()
+{
+    QTest::addColumn<QString>("json");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("full") << QString(R"({"col":"m","doc":"/cpu-.*/","from":0,"to":100,"bucket":10,"field":"v","fns":["avg","max","count"]})") << true;
+    QTest::newRow("count without field") << QString(R"({"col":"m","from":0,"to":100,"fns":["count"]})") << true;
+    QTest::newRow("min without field") << QString(R"({"col":"m","from":0,"to":100,"fns":["count","min"]})") << false;
+    QTest::newRow("unknown function") << QString(R"({"col":"m","from":0,"to":100,"field":"v","fns":["median"]})") << false;
+    QTest::newRow("no functions") << QString(R"({"col":"m","from":0,"to":100,"field":"v"})") << false;
+    QTest::newRow("negative bucket") << QString(R"({"col":"m","from":0,"to":100,"bucket":-1,"fns":["count"]})") << false;
+    QTest::newRow("from after to") << QString(R"({"col":"m","from":200,"to":100,"fns":["count"]})") << false;
+    QTest::newRow("no collection") << QString(R"({"from":0,"to":100,"fns":["count"]})") << false;
+}
+
+void TestSeriesQueries::parsesAggregateRequests()
+{
+    QFETCH(QString, json);
+    QFETCH(bool, valid);
+
+    bool ok = !valid;
+    const AggregateRequest request = AggregateRequest::fromJson(json, &ok);
+    QCOMPARE(ok, valid);
+    if (valid && request.field == "v")
+    {
+        QCOMPARE(request.functions, AggregateRequest::Avg | AggregateRequest::Max | AggregateRequest::Count);
+        QCOMPARE(request.bucket, qint64(10));
+    }
+}
+
+void TestSeriesQueries::bucketMethodsKeepOneRecordPerBucket()
+{
+    // four buckets of 25 ms, each with a peak at offset 10 and a dip at 20
+    std::vector<std::pair<qint64, double>> records;
+    for (qint64 ts = 0; ts < 100; ++ts)
+    {
+        records.emplace_back(ts, ts % 25 == 10 ? 100 + ts : (ts % 25 == 20 ? -100 - ts : 0));
+    }
+    const DocumentSeries series = numbers(records);
+    const PayloadPath v("v");
+
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 99, 4, DownsampleMethod::First, v, false, 0, nullptr)),
+             QList<qint64>({0, 25, 50, 75}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 99, 4, DownsampleMethod::Last, v, false, 0, nullptr)),
+             QList<qint64>({24, 49, 74, 99}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 99, 4, DownsampleMethod::Max, v, false, 0, nullptr)),
+             QList<qint64>({10, 35, 60, 85}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 99, 4, DownsampleMethod::Min, v, false, 0, nullptr)),
+             QList<qint64>({20, 45, 70, 95}));
+    // reverse and limit apply to the kept records
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 99, 4, DownsampleMethod::Max, v, true, 3, nullptr)),
+             QList<qint64>({85, 60, 35}));
+    // empty buckets are left out, and the range is split, not the records
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 399, 4, DownsampleMethod::First, v, false, 0, nullptr)),
+             QList<qint64>({0}));
+}
+
+void TestSeriesQueries::lttbKeepsTheEndsAndTheExtremes()
+{
+    std::vector<std::pair<qint64, double>> records;
+    for (qint64 ts = 0; ts < 1000; ++ts)
+    {
+        records.emplace_back(ts * 10, ts == 500 ? 100 : (ts == 700 ? -100 : 0));
+    }
+    const DocumentSeries series = numbers(records);
+
+    const QList<qint64> kept = timestamps(downsampleSeries(series, 0, 9990, 10, DownsampleMethod::Lttb, PayloadPath("v"), false, 0, nullptr));
+    QVERIFY(kept.size() <= 10);
+    QCOMPARE(kept.first(), qint64(0));
+    QCOMPARE(kept.last(), qint64(9990));
+    QVERIFY(std::is_sorted(kept.begin(), kept.end()));
+    QVERIFY(std::adjacent_find(kept.begin(), kept.end()) == kept.end());
+    QVERIFY(kept.contains(5000));
+    QVERIFY(kept.contains(7000));
+
+    // the ends are the first and last samples inside the range
+    const QList<qint64> inner = timestamps(downsampleSeries(series, 15, 9975, 10, DownsampleMethod::Lttb, PayloadPath("v"), false, 0, nullptr));
+    QCOMPARE(inner.first(), qint64(20));
+    QCOMPARE(inner.last(), qint64(9970));
+}
+
+void TestSeriesQueries::lttbKeepsEverythingBelowThePointCount()
+{
+    const DocumentSeries series = numbers({{10, 1}, {20, 5}, {30, 2}, {40, 8}, {50, 3}});
+    const PayloadPath v("v");
+
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 100, 10, DownsampleMethod::Lttb, v, false, 0, nullptr)),
+             QList<qint64>({10, 20, 30, 40, 50}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 100, 2, DownsampleMethod::Lttb, v, false, 0, nullptr)),
+             QList<qint64>({10, 50}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 100, 1, DownsampleMethod::Lttb, v, false, 0, nullptr)),
+             QList<qint64>({10}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 100, 10, DownsampleMethod::Lttb, v, true, 2, nullptr)),
+             QList<qint64>({50, 40}));
+    QVERIFY(downsampleSeries(series, 60, 100, 10, DownsampleMethod::Lttb, v, false, 0, nullptr).isEmpty());
+}
+
+void TestSeriesQueries::downsamplesTheWidestRange()
+{
+    const qint64 min = std::numeric_limits<qint64>::min();
+    const qint64 max = std::numeric_limits<qint64>::max();
+    const DocumentSeries series = numbers({{min, 1}, {min + 1, 9}, {-1, 2}, {0, 3}, {max - 1, 7}, {max, 4}});
+    const PayloadPath v("v");
+
+    // bucket arithmetic over the whole timestamp range must not overflow
+    QCOMPARE(timestamps(downsampleSeries(series, min, max, 2, DownsampleMethod::First, v, false, 0, nullptr)),
+             QList<qint64>({min, 0}));
+    QCOMPARE(timestamps(downsampleSeries(series, min, max, 1, DownsampleMethod::Max, v, false, 0, nullptr)),
+             QList<qint64>({min + 1}));
+    QCOMPARE(timestamps(downsampleSeries(series, min, max, 3, DownsampleMethod::Lttb, v, false, 0, nullptr)),
+             QList<qint64>({min, min + 1, max}));
+    QCOMPARE(timestamps(downsampleSeries(series, min, max, 100, DownsampleMethod::Lttb, v, false, 0, nullptr)).size(), 6);
+}
+
+void TestSeriesQueries::downsamplesOnlyMatchingRecords()
+{
+    const DocumentSeries series = payloads({{10, "{\"v\":1,\"ok\":true}"},
+                                            {20, "{\"v\":50,\"ok\":false}"},
+                                            {30, "{\"w\":60,\"ok\":true}"},
+                                            {40, "{\"v\":2,\"ok\":true}"}});
+    PayloadFilter filter;
+    QString errorMessage;
+    QVERIFY(PayloadFilter::compile(QJsonObject{{"eq", QJsonArray{"ok", true}}}, &filter, &errorMessage));
+
+    // the first and last methods need no field, the others skip records without one
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 100, 1, DownsampleMethod::Last, PayloadPath(), false, 0, &filter)),
+             QList<qint64>({40}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 100, 1, DownsampleMethod::Max, PayloadPath("v"), false, 0, &filter)),
+             QList<qint64>({40}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 100, 1, DownsampleMethod::Max, PayloadPath("v"), false, 0, nullptr)),
+             QList<qint64>({20}));
+    QCOMPARE(timestamps(downsampleSeries(series, 0, 100, 10, DownsampleMethod::Lttb, PayloadPath("v"), false, 0, &filter)),
+             QList<qint64>({10, 40}));
+}
+
+QTEST_GUILESS_MAIN(TestSeriesQueries)
+#include "tst_seriesqueries.moc"
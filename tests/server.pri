@@ -0,0 +1,80 @@
+# The server sources but main.cpp, for suites that need most of them.
+QT += websockets
+
+INCLUDEPATH += $$PWD/../src
+
+SOURCES += \
+    $$PWD/../src/insertrequest.cpp \
+    $$PWD/../src/datarecord.cpp \
+    $$PWD/../src/messagerequest.cpp \
+    $$PWD/../src/responsewriter.cpp \
+    $$PWD/../src/cborcodec.cpp \
+    $$PWD/../src/subscriptions.cpp \
+    $$PWD/../src/subscriptionrequest.cpp \
+    $$PWD/../src/aggregaterequest.cpp \
+    $$PWD/../src/querydocumentnames.cpp \
+    $$PWD/../src/payloadpath.cpp \
+    $$PWD/../src/payloadfilter.cpp \
+    $$PWD/../src/keypattern.cpp \
+    $$PWD/../src/responsecache.cpp \
+    $$PWD/../src/shard.cpp \
+    $$PWD/../src/documentindex.cpp \
+    $$PWD/../src/deletecollection.cpp \
+    $$PWD/../src/querysessions.cpp \
+    $$PWD/../src/querydocument.cpp \
+    $$PWD/../src/websocket.cpp \
+    $$PWD/../src/collection.cpp \
+    $$PWD/../src/collectionview.cpp \
+    $$PWD/../src/seriesqueries.cpp \
+    $$PWD/../src/parallelscan.cpp \
+    $$PWD/../src/documentseries.cpp \
+    $$PWD/../src/binarycodec.cpp \
+    $$PWD/../src/writeaheadlog.cpp \
+    $$PWD/../src/segmentstore.cpp \
+    $$PWD/../src/persistencewriter.cpp \
+    $$PWD/../src/documentloader.cpp \
+    $$PWD/../src/deletedocument.cpp \
+    $$PWD/../src/keyvalue.cpp \
+    $$PWD/../src/deleterecord.cpp \
+    $$PWD/../src/deletemultiplerecords.cpp \
+    $$PWD/../src/deleterecordsrange.cpp
+
+HEADERS += \
+    $$PWD/../src/insertrequest.h \
+    $$PWD/../src/datarecord.h \
+    $$PWD/../src/datarecordheader.h \
+    $$PWD/../src/message.h \
+    $$PWD/../src/messagerequest.h \
+    $$PWD/../src/responsewriter.h \
+    $$PWD/../src/cborcodec.h \
+    $$PWD/../src/subscriptions.h \
+    $$PWD/../src/subscriptionrequest.h \
+    $$PWD/../src/aggregaterequest.h \
+    $$PWD/../src/querydocumentnames.h \
+    $$PWD/../src/payloadpath.h \
+    $$PWD/../src/payloadfilter.h \
+    $$PWD/../src/keypattern.h \
+    $$PWD/../src/responsecache.h \
+    $$PWD/../src/shard.h \
+    $$PWD/../src/documentindex.h \
+    $$PWD/../src/deletecollection.h \
+    $$PWD/../src/querysessions.h \
+    $$PWD/../src/querydocument.h \
+    $$PWD/../src/websocket.h \
+    $$PWD/../src/collection.h \
+    $$PWD/../src/collectionview.h \
+    $$PWD/../src/persistentmap.h \
+    $$PWD/../src/seriesqueries.h \
+    $$PWD/../src/parallelscan.h \
+    $$PWD/../src/documentseries.h \
+    $$PWD/../src/binarycodec.h \
+    $$PWD/../src/writeaheadlog.h \
+    $$PWD/../src/segmentstore.h \
+    $$PWD/../src/persistencewriter.h \
+    $$PWD/../src/documentloader.h \
+    $$PWD/../src/deletedocument.h \
+    $$PWD/../src/keyvalue.h \
+    $$PWD/../src/deleterecord.h \
+    $$PWD/../src/deletemultiplerecords.h \
+    $$PWD/../src/deleterecordsrange.h \
+    $$PWD/../src/json/json.hpp
@@ -0,0 +1,142 @@
+#include <QtTest>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "shard.h"
+
+// A shard's jobs, and the views it publishes for reads on other threads.
+class TestShard : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void runsJobsInOrderOnItsThread();
+    void runsJobsRightAwayWithoutAThread();
+    void finishesQueuedJobsWhenDestroyed();
+    void publishesViewsHoldingTheJobsQueued();
+    void keepsLoadingCollectionsOnTheShard();
+};
+
+void TestShard::runsJobsInOrderOnItsThread()
+{
+    Shard shard(0, true, QString(), nullptr);
+    shard.start();
+
+    // only touched on the shard's thread
+    auto order = std::make_shared<std::vector<int>>();
+    auto threads = std::make_shared<std::vector<std::thread::id>>();
+    for (int i = 0; i < 100; ++i)
+    {
+        shard.post([order, threads, i](Shard &)
+                   {
+                       order->push_back(i);
+                       threads->push_back(std::this_thread::get_id());
+                   });
+    }
+    bool done = false;
+    std::thread::id doneThread;
+    shard.call([order](Shard &) { return static_cast<int>(order->size()); }, this, [&](int count)
+               {
+                   QCOMPARE(count, 100);
+                   doneThread = std::this_thread::get_id();
+                   done = true;
+               });
+    QTRY_VERIFY(done);
+    QVERIFY(doneThread == std::this_thread::get_id());
+    for (int i = 0; i < 100; ++i)
+    {
+        QCOMPARE(order->at(static_cast<size_t>(i)), i);
+        QVERIFY(threads->at(static_cast<size_t>(i)) == threads->front());
+    }
+    QVERIFY(threads->front() != std::this_thread::get_id());
+    QCOMPARE(shard.jobsQueued(), quint64(101));
+}
+
+void TestShard::runsJobsRightAwayWithoutAThread()
+{
+    Shard shard(0, false, QString(), nullptr);
+    int ran = 0;
+    shard.post([&ran](Shard &) { ++ran; });
+    QCOMPARE(ran, 1);
+    bool done = false;
+    shard.call([](Shard &) { return std::this_thread::get_id(); }, this, [&](std::thread::id thread)
+               {
+                   QVERIFY(thread == std::this_thread::get_id());
+                   done = true;
+               });
+    QVERIFY(done);
+    QCOMPARE(shard.jobsQueued(), quint64(2));
+}
+
+void TestShard::finishesQueuedJobsWhenDestroyed()
+{
+    std::atomic<int> ran(0);
+    {
+        Shard shard(0, true, QString(), nullptr);
+        shard.start();
+        for (int i = 0; i < 1000; ++i)
+        {
+            shard.post([&ran](Shard &) { ++ran; });
+        }
+    }
+    QCOMPARE(ran.load(), 1000);
+}
+
+void TestShard::publishesViewsHoldingTheJobsQueued()
+{
+    Shard shard(0, true, QString(), nullptr);
+    shard.post([](Shard &shard) { shard.createCollection("metrics")->insert(10, "cpu", QString("{\"v\":1}")); });
+
+    // queued before the thread runs, so no view holds it yet
+    bool current = true;
+    QVERIFY(shard.readView("metrics", shard.jobsQueued(), &current) == nullptr);
+    QVERIFY(!current);
+    QStringList names;
+    QVERIFY(!shard.collectionNames(shard.jobsQueued(), &names));
+
+    shard.start();
+    const quint64 written = shard.jobsQueued();
+    QTRY_VERIFY((shard.readView("metrics", written, &current), current));
+    const std::shared_ptr<const CollectionView> view = shard.readView("metrics", written, &current);
+    QVERIFY(view != nullptr);
+    QCOMPARE(view->getAllRecordsForDocument("cpu", 0, 100).size(), qsizetype(1));
+    QVERIFY(shard.collectionNames(written, &names));
+    QCOMPARE(names, QStringList({"metrics"}));
+
+    // a current view without the collection means there is none
+    QVERIFY(shard.readView("logs", written, &current) == nullptr);
+    QVERIFY(current);
+
+    // later views share what did not change
+    shard.post([](Shard &shard) { shard.createCollection("logs")->insert(10, "app", QString("{}")); });
+    const quint64 logged = shard.jobsQueued();
+    QTRY_VERIFY((shard.readView("logs", logged, &current), current));
+    QCOMPARE(shard.readView("metrics", logged, &current), view);
+}
+
+void TestShard::keepsLoadingCollectionsOnTheShard()
+{
+    Shard shard(0, true, QString(), nullptr);
+    shard.start();
+    shard.post([](Shard &shard)
+               {
+                   shard.createCollection("metrics")->insert(10, "cpu", QString("{}"));
+                   shard.setLoading("metrics", true);
+               });
+    const quint64 loading = shard.jobsQueued();
+    QStringList names;
+    QTRY_VERIFY((names.clear(), shard.collectionNames(loading, &names)));
+    QCOMPARE(names, QStringList({"metrics"}));
+    bool current = true;
+    QVERIFY(shard.readView("metrics", loading, &current) == nullptr);
+    QVERIFY(!current);
+
+    shard.post([](Shard &shard) { shard.setLoading("metrics", false); });
+    const quint64 loaded = shard.jobsQueued();
+    QTRY_VERIFY((shard.readView("metrics", loaded, &current), current));
+    QVERIFY(shard.readView("metrics", loaded, &current) != nullptr);
+}
+
+QTEST_GUILESS_MAIN(TestShard)
+#include "tst_shard.moc"
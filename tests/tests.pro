@@ -0,0 +1,19 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    documentseries \
+    writeaheadlog \
+    segmentstore \
+    collection \
+    documentloader \
+    websocket \
+    cborcodec \
+    seriesqueries \
+    payloadpath \
+    payloadfilter \
+    querydocument \
+    keypattern \
+    responsecache \
+    shard \
+    persistentmap \
+    parallelscan
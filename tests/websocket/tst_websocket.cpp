@@ -0,0 +1,526 @@
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QWebSocket>
+#include <functional>
+#include <limits>
+#include <memory>
+#include "collection.h"
+#include "websocket.h"
+
+// Requests sent to a running server over a WebSocket connection, and what
+// comes back.
+class TestWebSocket : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parksRequestsUntilTheirCollectionLoads();
+    void pushesInsertsToMatchingSubscriptions();
+    void stopsPushingAfterUnsubscribe();
+    void pagesWithCursors();
+    void streamsLargeReadsInFrames();
+    void pagesDocumentNames();
+    void readsSeeEarlierWritesThroughTheCache();
+    void routesCollectionsAcrossShards();
+    void keepsTheOrderOfFramesParsedAside();
+
+private:
+    // A connection collecting the text frames the server sends.
+    struct Client {
+        QWebSocket socket;
+        QList<QJsonObject> received;
+    };
+
+    static std::unique_ptr<Client> connectTo(WebSocket& server, const QString& apiKey = "master");
+    static void send(Client& client, const QString& id, const QString& type, const QJsonValue& data);
+    // Waits for the first frame with the id and takes it, or returns an
+    // empty object after a few seconds.
+    static QJsonObject response(Client& client, const QString& id);
+    static QList<qint64> timestamps(const QJsonObject& response);
+    // Takes the records pushed for the subscription as "doc@ts" strings, in
+    // order, once there are at least count of them or after a few seconds.
+    static QStringList pushed(Client& client, const QString& sub, int count);
+    static QJsonObject insertRecord(const QString& col, const QString& doc, qint64 ts);
+    // Runs the collection's flush job.
+    static void flush(Collection& collection);
+};
+
+std::unique_ptr<TestWebSocket::Client> TestWebSocket::connectTo(WebSocket &server, const QString &apiKey)
+{
+    auto client = std::make_unique<Client>();
+    Client *target = client.get();
+    QObject::connect(&client->socket, &QWebSocket::textMessageReceived, &client->socket, [target](const QString &message)
+                     {
+                         target->received.append(QJsonDocument::fromJson(message.toUtf8()).object());
+                     });
+    client->socket.open(QUrl(QString("ws://127.0.0.1:%1/?api-key=%2").arg(server.serverPort()).arg(apiKey)));
+    QElapsedTimer timer;
+    timer.start();
+    while (client->socket.state() != QAbstractSocket::ConnectedState && timer.elapsed() < 5000)
+    {
+        QTest::qWait(5);
+    }
+    return client;
+}
+
+void TestWebSocket::send(Client &client, const QString &id, const QString &type, const QJsonValue &data)
+{
+    const QJsonDocument payload = data.isArray() ? QJsonDocument(data.toArray()) : QJsonDocument(data.toObject());
+    QJsonObject message;
+    message["id"] = id;
+    message["type"] = type;
+    message["data"] = QString::fromUtf8(payload.toJson(QJsonDocument::Compact));
+    client.socket.sendTextMessage(QString::fromUtf8(QJsonDocument(message).toJson(QJsonDocument::Compact)));
+}
+
+QJsonObject TestWebSocket::response(Client &client, const QString &id)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 5000)
+    {
+        for (int i = 0; i < client.received.size(); ++i)
+        {
+            if (client.received.at(i)["id"].toString() == id)
+            {
+                return client.received.takeAt(i);
+            }
+        }
+        QTest::qWait(5);
+    }
+    return QJsonObject();
+}
+
+QList<qint64> TestWebSocket::timestamps(const QJsonObject &response)
+{
+    QList<qint64> result;
+    for (const QJsonValue &record : response["records"].toArray())
+    {
+        result.append(record.toObject()["ts"].toVariant().toLongLong());
+    }
+    return result;
+}
+
+QStringList TestWebSocket::pushed(Client &client, const QString &sub, int count)
+{
+    QStringList records;
+    QElapsedTimer timer;
+    timer.start();
+    for (;;)
+    {
+        for (int i = 0; i < client.received.size();)
+        {
+            const QJsonObject frame = client.received.at(i);
+            if (frame["type"].toString() != "push" || frame["sub"].toString() != sub)
+            {
+                ++i;
+                continue;
+            }
+            for (const QJsonValue &record : frame["records"].toArray())
+            {
+                records.append(QString("%1@%2").arg(record.toObject()["doc"].toString()).arg(record.toObject()["ts"].toVariant().toLongLong()));
+            }
+            client.received.removeAt(i);
+        }
+        if (records.size() >= count || timer.elapsed() >= 5000)
+        {
+            return records;
+        }
+        QTest::qWait(5);
+    }
+}
+
+QJsonObject TestWebSocket::insertRecord(const QString &col, const QString &doc, qint64 ts)
+{
+    return QJsonObject{{"col", col}, {"doc", doc}, {"ts", ts}, {"data", QString("{\"v\":%1}").arg(ts)}};
+}
+
+void TestWebSocket::flush(Collection &collection)
+{
+    const std::function<bool()> job = collection.takeFlushJob();
+    QVERIFY(job != nullptr);
+    QVERIFY(job());
+    collection.finishFlush(true);
+}
+
+void TestWebSocket::parksRequestsUntilTheirCollectionLoads()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    // large enough that the requests below usually arrive while it loads
+    Collection written("metrics", dir.path());
+    for (qint64 ts = 1; ts <= 200000; ++ts)
+    {
+        written.insert(ts, "cpu", QString("{\"v\":%1}").arg(ts));
+    }
+    flush(written);
+
+    WebSocket server("master", dir.path(), 15, WriteAheadLog::SyncPolicy::Batch, 100, true);
+    server.start(0);
+    const std::unique_ptr<Client> client = connectTo(server);
+    QCOMPARE(client->socket.state(), QAbstractSocket::ConnectedState);
+
+    // handled in order once the collection is in, so the read sees the
+    // loaded history and the write made before it
+    QJsonArray records;
+    records.append(QJsonObject{{"ts", 200001}, {"doc", "cpu"}, {"col", "metrics"}, {"data", "{\"v\":0}"}});
+    send(*client, "insert", "ins", records);
+    send(*client, "read", "qdoc", QJsonObject{{"col", "metrics"}, {"doc", "cpu"}, {"from", 199990}, {"to", 300000}});
+
+    QVERIFY(!response(*client, "insert").contains("error"));
+    QCOMPARE(timestamps(response(*client, "read")),
+             QList<qint64>({199990, 199991, 199992, 199993, 199994, 199995, 199996, 199997, 199998, 199999, 200000, 200001}));
+}
+
+void TestWebSocket::pushesInsertsToMatchingSubscriptions()
+{
+    WebSocket server("master", QString());
+    server.start(0);
+    const std::unique_ptr<Client> pattern = connectTo(server);
+    const std::unique_ptr<Client> literal = connectTo(server);
+    const std::unique_ptr<Client> collection = connectTo(server);
+    const std::unique_ptr<Client> other = connectTo(server);
+    const std::unique_ptr<Client> writer = connectTo(server);
+
+    send(*pattern, "cpus", "sub", QJsonObject{{"col", "metrics"}, {"doc", "/^cpu-.*/"}});
+    send(*literal, "cpu-1", "sub", QJsonObject{{"col", "metrics"}, {"doc", "cpu-1"}});
+    send(*collection, "all", "sub", QJsonObject{{"col", "metrics"}});
+    send(*other, "logs", "sub", QJsonObject{{"col", "logs"}});
+    QVERIFY(!response(*pattern, "cpus").contains("error"));
+    QVERIFY(!response(*literal, "cpu-1").contains("error"));
+    QVERIFY(!response(*collection, "all").contains("error"));
+    QVERIFY(!response(*other, "logs").contains("error"));
+
+    QJsonArray records;
+    records.append(insertRecord("metrics", "cpu-1", 10));
+    records.append(insertRecord("metrics", "cpu-2", 10));
+    records.append(insertRecord("metrics", "mem-1", 10));
+    records.append(insertRecord("metrics", "cpu-1", 20));
+    send(*writer, "insert", "ins", records);
+    QVERIFY(!response(*writer, "insert").contains("error"));
+
+    // in the order the inserts were applied
+    QCOMPARE(pushed(*pattern, "cpus", 3), QStringList({"cpu-1@10", "cpu-2@10", "cpu-1@20"}));
+    QCOMPARE(pushed(*literal, "cpu-1", 2), QStringList({"cpu-1@10", "cpu-1@20"}));
+    QCOMPARE(pushed(*collection, "all", 4).size(), 4);
+    QTest::qWait(50);
+    QVERIFY(pushed(*other, "logs", 0).isEmpty());
+    QVERIFY(pushed(*writer, "insert", 0).isEmpty());
+}
+
+void TestWebSocket::stopsPushingAfterUnsubscribe()
+{
+    WebSocket server("master", QString());
+    server.start(0);
+    const std::unique_ptr<Client> client = connectTo(server);
+
+    send(*client, "first", "sub", QJsonObject{{"col", "metrics"}, {"doc", "cpu"}});
+    send(*client, "second", "sub", QJsonObject{{"col", "metrics"}, {"doc", "memory"}});
+    // the same id again replaces the subscription
+    send(*client, "second", "sub", QJsonObject{{"col", "metrics"}, {"doc", "cpu"}});
+    send(*client, "stop", "unsub", QJsonObject{{"sub", "first"}});
+    QCOMPARE(response(*client, "stop")["removed"].toInt(), 1);
+
+    QJsonArray records;
+    records.append(insertRecord("metrics", "cpu", 10));
+    records.append(insertRecord("metrics", "memory", 10));
+    send(*client, "insert", "ins", records);
+    QVERIFY(!response(*client, "insert").contains("error"));
+    QCOMPARE(pushed(*client, "second", 1), QStringList({"cpu@10"}));
+    QVERIFY(pushed(*client, "first", 0).isEmpty());
+
+    send(*client, "stop all", "unsub", QJsonObject());
+    QCOMPARE(response(*client, "stop all")["removed"].toInt(), 1);
+    send(*client, "insert again", "ins", records);
+    QVERIFY(!response(*client, "insert again").contains("error"));
+    QTest::qWait(50);
+    QVERIFY(pushed(*client, "second", 0).isEmpty());
+}
+
+void TestWebSocket::pagesWithCursors()
+{
+    WebSocket server("master", QString());
+    server.start(0);
+    const std::unique_ptr<Client> client = connectTo(server);
+
+    // ends at the last timestamp there is, where resuming must not overflow
+    const qint64 max = std::numeric_limits<qint64>::max();
+    QJsonArray records;
+    for (const qint64 ts : {qint64(10), qint64(20), qint64(30), max - 1, max})
+    {
+        records.append(insertRecord("metrics", "cpu", ts));
+    }
+    send(*client, "insert", "ins", records);
+    QVERIFY(!response(*client, "insert").contains("error"));
+
+    QList<qint64> forward;
+    QString cursor;
+    for (int page = 0; page < 10; ++page)
+    {
+        QJsonObject query{{"col", "metrics"}, {"doc", "cpu"}, {"from", 0}, {"to", max}, {"limit", 2}};
+        if (!cursor.isEmpty())
+        {
+            query["cursor"] = cursor;
+        }
+        send(*client, "forward", "qdoc", query);
+        const QJsonObject result = response(*client, "forward");
+        QVERIFY(!result.contains("error"));
+        forward += timestamps(result);
+        cursor = result["cursor"].toString();
+        if (cursor.isEmpty())
+        {
+            break;
+        }
+    }
+    QCOMPARE(forward, QList<qint64>({10, 20, 30, max - 1, max}));
+
+    QList<qint64> reverse;
+    cursor.clear();
+    for (int page = 0; page < 10; ++page)
+    {
+        QJsonObject query{{"col", "metrics"}, {"doc", "cpu"}, {"from", 0}, {"to", max}, {"limit", 3}, {"reverse", true}};
+        if (!cursor.isEmpty())
+        {
+            query["cursor"] = cursor;
+        }
+        send(*client, "reverse", "qdoc", query);
+        const QJsonObject result = response(*client, "reverse");
+        QVERIFY(!result.contains("error"));
+        reverse += timestamps(result);
+        cursor = result["cursor"].toString();
+        if (cursor.isEmpty())
+        {
+            break;
+        }
+    }
+    QCOMPARE(reverse, QList<qint64>({max, max - 1, 30, 20, 10}));
+
+    // a cursor is only good for the document and direction it came from
+    send(*client, "forward", "qdoc", QJsonObject{{"col", "metrics"}, {"doc", "cpu"}, {"from", 0}, {"to", max}, {"limit", 2}});
+    cursor = response(*client, "forward")["cursor"].toString();
+    QVERIFY(!cursor.isEmpty());
+    send(*client, "other", "qdoc", QJsonObject{{"col", "metrics"}, {"doc", "memory"}, {"from", 0}, {"to", max}, {"limit", 2}, {"cursor", cursor}});
+    QVERIFY(response(*client, "other").contains("error"));
+    send(*client, "backwards", "qdoc", QJsonObject{{"col", "metrics"}, {"doc", "cpu"}, {"from", 0}, {"to", max}, {"limit", 2}, {"reverse", true}, {"cursor", cursor}});
+    QVERIFY(response(*client, "backwards").contains("error"));
+}
+
+void TestWebSocket::streamsLargeReadsInFrames()
+{
+    WebSocket server("master", QString());
+    server.start(0);
+    const std::unique_ptr<Client> client = connectTo(server);
+
+    const qint64 count = 3000;
+    QJsonArray records;
+    for (qint64 ts = 1; ts <= count; ++ts)
+    {
+        records.append(insertRecord("metrics", "cpu", ts));
+    }
+    send(*client, "insert", "ins", records);
+    QVERIFY(!response(*client, "insert").contains("error"));
+
+    send(*client, "read", "qdoc", QJsonObject{{"col", "metrics"}, {"doc", "cpu"}, {"from", 0}, {"to", count}, {"stream", true}});
+    QList<qint64> streamed;
+    int frames = 0;
+    for (;;)
+    {
+        const QJsonObject frame = response(*client, "read");
+        QVERIFY(!frame.isEmpty());
+        QVERIFY(!frame.contains("error"));
+        ++frames;
+        streamed += timestamps(frame);
+        if (!frame["more"].toBool())
+        {
+            break;
+        }
+    }
+    QVERIFY(frames > 1);
+    QCOMPARE(streamed.size(), int(count));
+    for (int i = 0; i < streamed.size(); ++i)
+    {
+        QCOMPARE(streamed.at(i), qint64(i + 1));
+    }
+}
+
+void TestWebSocket::pagesDocumentNames()
+{
+    WebSocket server("master", QString());
+    server.start(0);
+    const std::unique_ptr<Client> client = connectTo(server);
+
+    QJsonArray records;
+    for (const QString &name : {"region-2/site-1/device-1", "region-1/site-2/device-1", "region-1/site-1/device-2",
+                                "region-1/site-1/device-1", "region-10/site-1/device-1"})
+    {
+        records.append(insertRecord("metrics", name, 10));
+    }
+    send(*client, "insert", "ins", records);
+    QVERIFY(!response(*client, "insert").contains("error"));
+
+    QStringList names;
+    for (int page = 0; page < 10; ++page)
+    {
+        QJsonObject query{{"col", "metrics"}, {"prefix", "region-1/"}, {"limit", 2}};
+        if (!names.isEmpty())
+        {
+            query["after"] = names.last();
+        }
+        send(*client, "names", "docs", query);
+        const QJsonObject result = response(*client, "names");
+        QVERIFY(!result.contains("error"));
+        for (const QJsonValue &name : result["docs"].toArray())
+        {
+            names.append(name.toString());
+        }
+        if (!result["more"].toBool())
+        {
+            break;
+        }
+    }
+    QCOMPARE(names, QStringList({"region-1/site-1/device-1", "region-1/site-1/device-2", "region-1/site-2/device-1"}));
+
+    send(*client, "missing", "docs", QJsonObject{{"col", "logs"}});
+    const QJsonObject missing = response(*client, "missing");
+    QVERIFY(missing.contains("docs"));
+    QVERIFY(missing["docs"].toArray().isEmpty());
+}
+
+void TestWebSocket::readsSeeEarlierWritesThroughTheCache()
+{
+    WebSocket server("master", QString());
+    server.start(0);
+    const std::unique_ptr<Client> client = connectTo(server);
+    const QJsonObject latest{{"col", "metrics"}, {"ts", 1000000}};
+    const auto latestTimestamp = [&](const QString &id, const QString &doc)
+    {
+        send(*client, id, "qry", latest);
+        return response(*client, id)["records"].toObject()[doc].toObject()["ts"].toVariant().toLongLong();
+    };
+
+    QJsonArray records;
+    records.append(insertRecord("metrics", "cpu", 10));
+    records.append(insertRecord("metrics", "memory", 10));
+    send(*client, "insert", "ins", records);
+    QVERIFY(!response(*client, "insert").contains("error"));
+    QCOMPARE(latestTimestamp("first", "cpu"), qint64(10));
+    // answered from the cache
+    QCOMPARE(latestTimestamp("again", "cpu"), qint64(10));
+
+    // each write moves the stamp on, so no read gets a response from before it
+    for (qint64 ts = 20; ts <= 100; ts += 10)
+    {
+        send(*client, QString("insert %1").arg(ts), "ins", QJsonArray{insertRecord("metrics", "cpu", ts)});
+        QCOMPARE(latestTimestamp(QString("read %1").arg(ts), "cpu"), ts);
+        QCOMPARE(latestTimestamp(QString("memory %1").arg(ts), "memory"), qint64(10));
+    }
+}
+
+void TestWebSocket::routesCollectionsAcrossShards()
+{
+    WebSocket server("master", QString(), 15, WriteAheadLog::SyncPolicy::Batch, 100, false, 4);
+    server.start(0);
+    const std::unique_ptr<Client> client = connectTo(server);
+
+    // one insert spanning collections on every shard, each with its own timestamps
+    const int collections = 12;
+    QJsonArray records;
+    QStringList names;
+    for (int i = 0; i < collections; ++i)
+    {
+        const QString col = QString("col-%1").arg(i);
+        names.append(col);
+        records.append(insertRecord(col, "cpu", 100 * i + 1));
+        records.append(insertRecord(col, "cpu", 100 * i + 2));
+        records.append(insertRecord(col, "shared", 100 * i + 1));
+    }
+    names.sort();
+    send(*client, "insert", "ins", records);
+
+    // sent without waiting, and still after the insert
+    for (int i = 0; i < collections; ++i)
+    {
+        send(*client, QString("read %1").arg(i), "qdoc",
+             QJsonObject{{"col", QString("col-%1").arg(i)}, {"doc", "cpu"}, {"from", 0}, {"to", 100000}});
+    }
+    send(*client, "cols", "cols", QJsonObject());
+    QVERIFY(!response(*client, "insert").contains("error"));
+    for (int i = 0; i < collections; ++i)
+    {
+        QCOMPARE(timestamps(response(*client, QString("read %1").arg(i))), QList<qint64>({100 * i + 1, 100 * i + 2}));
+    }
+    QStringList listed;
+    for (const QJsonValue &name : response(*client, "cols")["collections"].toArray())
+    {
+        listed.append(name.toString());
+    }
+    listed.sort();
+    QCOMPARE(listed, names);
+
+    // deletes that span collections reach every shard
+    send(*client, "ddoc", "ddoc", QJsonObject{{"doc", "shared"}});
+    QVERIFY(!response(*client, "ddoc").contains("error"));
+    QJsonArray deletes;
+    for (int i = 0; i < collections; ++i)
+    {
+        deletes.append(QJsonObject{{"col", QString("col-%1").arg(i)}, {"doc", "cpu"}, {"ts", 100 * i + 2}});
+    }
+    send(*client, "dmrec", "dmrec", deletes);
+    QVERIFY(!response(*client, "dmrec").contains("error"));
+    for (int i = 0; i < collections; ++i)
+    {
+        send(*client, QString("latest %1").arg(i), "qry", QJsonObject{{"col", QString("col-%1").arg(i)}, {"ts", 100000}});
+        const QJsonObject latest = response(*client, QString("latest %1").arg(i))["records"].toObject();
+        QCOMPARE(latest.keys(), QStringList({"cpu"}));
+        QCOMPARE(latest["cpu"].toObject()["ts"].toVariant().toLongLong(), qint64(100 * i + 1));
+    }
+}
+
+void TestWebSocket::keepsTheOrderOfFramesParsedAside()
+{
+    WebSocket server("master", QString());
+    server.start(0);
+    const std::unique_ptr<Client> client = connectTo(server);
+
+    // large frames are parsed on the pool, small ones right away; each is
+    // still handled after the frames sent before it
+    const auto batch = [](qint64 from, qint64 to)
+    {
+        QJsonArray records;
+        for (qint64 ts = from; ts <= to; ++ts)
+        {
+            records.append(insertRecord("metrics", "cpu", ts));
+        }
+        return records;
+    };
+    send(*client, "large 1", "ins", batch(1, 500));
+    send(*client, "small 1", "ins", batch(501, 501));
+    send(*client, "large 2", "ins", batch(502, 1000));
+    send(*client, "read", "qdoc", QJsonObject{{"col", "metrics"}, {"doc", "cpu"}, {"from", 0}, {"to", 100000}});
+    send(*client, "small 2", "ins", batch(1001, 1001));
+
+    QList<qint64> expected;
+    for (qint64 ts = 1; ts <= 1000; ++ts)
+    {
+        expected.append(ts);
+    }
+    QCOMPARE(timestamps(response(*client, "read")), expected);
+    QVERIFY(!response(*client, "small 2").contains("error"));
+    // the acknowledgements left, in the order the frames were sent
+    QStringList ids;
+    for (const QJsonObject &frame : client->received)
+    {
+        if (frame.contains("id"))
+        {
+            ids.append(frame["id"].toString());
+        }
+    }
+    QCOMPARE(ids, QStringList({"large 1", "small 1", "large 2"}));
+}
+
+QTEST_GUILESS_MAIN(TestWebSocket)
+#include "tst_websocket.moc"
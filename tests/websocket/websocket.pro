@@ -0,0 +1,12 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_websocket
+
+include(../server.pri)
+
+SOURCES += \
+    tst_websocket.cpp
@@ -0,0 +1,11 @@
+QT -= gui
+QT += core testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_writeaheadlog
+include(../server.pri)
+
+SOURCES += \
+    tst_writeaheadlog.cpp